@@ -0,0 +1,85 @@
+#include "memory/memory.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief A small dataset record, as loaded by the dataset readers.
+     */
+    struct Record
+    {
+        uint64_t key;
+        double value;
+        uint32_t flags;
+
+        explicit Record(uint64_t k) : key(k), value(static_cast<double>(k) * 0.5), flags(static_cast<uint32_t>(k & 0xff)) {}
+    };
+
+    /**
+     * @brief Runs one load strategy and reports load and teardown times.
+     * @tparam Load The callable producing the loaded vector of Refs.
+     * @param name The name of the strategy.
+     * @param count The number of records.
+     * @param load The load strategy.
+     */
+    template <typename Load>
+    void run(const char* name, size_t count, Load&& load)
+    {
+        auto start = Clock::now();
+        std::vector<Ref<Record>> records = load();
+        const double loadSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        uint64_t checksum = 0;
+        for (const auto& record : records)
+        {
+            checksum += record->key ^ record->flags;
+        }
+
+        start = Clock::now();
+        records.clear();
+        records.shrink_to_fit();
+        const double freeSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::cout << std::setw(12) << name
+                  << std::fixed << std::setprecision(3)
+                  << "  load " << std::setw(7) << loadSeconds << " s ("
+                  << std::setw(6) << static_cast<double>(count) / loadSeconds / 1e6 << " M/s)"
+                  << "  free " << std::setw(7) << freeSeconds << " s"
+                  << "  (checksum " << checksum << ")\n";
+    }
+}
+
+/**
+ * @brief Compares loading records with a makeRef loop against a single makeRefs call.
+ * Usage: mexMemory_bench_batchLoad [records = 10000000]
+ */
+int main(int argc, char** argv)
+{
+    const size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+    std::cout << "Loading " << count << " records of " << sizeof(Record) << " bytes\n";
+
+    run("makeRef loop", count, [count]() {
+        std::vector<Ref<Record>> records;
+        records.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            records.push_back(makeRef<Record>(i));
+        }
+        return records;
+    });
+
+    run("makeRefs", count, [count]() {
+        return makeRefs<Record>(count, [](size_t i) { return static_cast<uint64_t>(i); });
+    });
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "memory/memory.h"
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Link
+    {
+        Ref<Link> next;
+
+        void trace(RefVisitor& visit) const
+        {
+            visit(next);
+        }
+    };
+
+    /**
+     * @brief Prints the cost of one operation.
+     * @param name The name of the configuration being measured.
+     * @param start When the measurement started.
+     * @param operations The number of operations measured.
+     */
+    void report(const char* name, Clock::time_point start, size_t operations)
+    {
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << std::setw(24) << name
+                  << std::fixed << std::setprecision(2)
+                  << "  " << std::setw(10) << seconds * 1e9 / static_cast<double>(operations) << " ns/op\n";
+    }
+
+    /**
+     * @brief Copies and drops a Ref repeatedly; every drop is a decrement to a non-zero count.
+     * @param name The name of the configuration being measured.
+     * @param ref The Ref to copy.
+     * @param rounds The number of copies.
+     */
+    void copyAndDrop(const char* name, const Ref<Link>& ref, size_t rounds)
+    {
+        const auto start = Clock::now();
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            Ref<Link> copy = ref;
+        }
+        report(name, start, rounds);
+    }
+
+    /**
+     * @brief Drops one of two references to many distinct objects, so every decrement buffers a new root when
+     * collection is enabled.
+     * @param name The name of the configuration being measured.
+     * @param objects The number of objects.
+     */
+    void dropShared(const char* name, size_t objects)
+    {
+        std::vector<Ref<Link>> owners = makeRefBatch<Link>(objects);
+        std::vector<Ref<Link>> copies(owners.begin(), owners.end());
+        const auto start = Clock::now();
+        copies.clear();
+        report(name, start, objects);
+    }
+}
+
+/**
+ * @brief Measures what buffering possible roots adds to dropping a strong reference, what a collection costs, and
+ * the pauses of the background collector while cycles are created and dropped.
+ * Usage: mexMemory_bench_cycleCollector [rounds = 10000000] [cycles = 100000]
+ */
+int main(int argc, char** argv)
+{
+    const size_t rounds = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+    const size_t cycles = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100'000;
+
+    auto ref = makeRef<Link>();
+    copyAndDrop("copy/drop, off", ref, rounds);
+    CycleCollector::enable(true);
+    copyAndDrop("copy/drop, buffered", ref, rounds);
+    CycleCollector::enable(false);
+    CycleCollector::collectCycles();
+
+    dropShared("new root, off", cycles);
+    CycleCollector::enable(true);
+    dropShared("new root, buffered", cycles);
+    CycleCollector::collectCycles();
+
+    for (size_t i = 0; i < cycles; ++i)
+    {
+        auto a = makeRef<Link>();
+        auto b = makeRef<Link>();
+        a->next = b;
+        b->next = a;
+    }
+    const size_t buffered = CycleCollector::getBufferedRoots();
+    const auto start = Clock::now();
+    const auto stats = CycleCollector::collectCycles();
+    report("collect, per object", start, stats.objects_scanned);
+    std::cout << "                          (" << buffered << " roots, " << stats.objects_collected << " objects freed)\n";
+
+    CycleCollector::resetMetrics();
+    CycleCollector::startBackground();
+    const auto churn = Clock::now();
+    for (size_t i = 0; i < cycles; ++i)
+    {
+        auto a = makeRef<Link>();
+        auto b = makeRef<Link>();
+        a->next = b;
+        b->next = a;
+    }
+    report("cycle, background", churn, cycles);
+    CycleCollector::stopBackground();
+    CycleCollector::collectCycles();
+
+    const auto metrics = CycleCollector::getMetrics();
+    std::cout << "                          (" << metrics.collections << " collections, p50 "
+              << metrics.durations.percentile(50) << " ns, p99 " << metrics.durations.percentile(99) << " ns, max "
+              << metrics.max_duration_ns << " ns, handshake p99 " << metrics.handshakes.percentile(99) << " ns)\n";
+    CycleCollector::enable(false);
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include "memory/memory.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<int64_t> live{0};
+
+    /**
+     * @brief An object handed to both mexMemory and std::shared_ptr based modules.
+     */
+    struct Document
+    {
+        uint64_t id;
+        char payload[48];
+
+        explicit Document(uint64_t i) : id(i), payload{} { live.fetch_add(1, std::memory_order_relaxed); }
+        Document(const Document& other) : id(other.id), payload{} { live.fetch_add(1, std::memory_order_relaxed); }
+        ~Document() { live.fetch_sub(1, std::memory_order_relaxed); }
+    };
+
+    /**
+     * @brief Creates count objects with one strategy, takes both handles of each, drops everything, and reports
+     * the time, the heap allocations per object and the objects left alive.
+     * @tparam Create The callable creating an object and returning its handles.
+     * @param name The name of the strategy.
+     * @param count The number of objects.
+     * @param create The creation strategy.
+     */
+    template <typename Create>
+    void run(const char* name, size_t count, Create&& create)
+    {
+        live.store(0, std::memory_order_relaxed);
+        const uint64_t before = allocations.load(std::memory_order_relaxed);
+        const auto start = Clock::now();
+        {
+            std::vector<std::pair<std::shared_ptr<Document>, Ref<Document>>> handles;
+            handles.reserve(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                handles.push_back(create(i));
+            }
+        }
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        const uint64_t allocated = allocations.load(std::memory_order_relaxed) - before - 1;
+
+        std::cout << std::setw(16) << name
+                  << std::fixed << std::setprecision(3)
+                  << "  " << std::setw(7) << seconds << " s"
+                  << "  " << std::setw(5) << static_cast<double>(allocated) / static_cast<double>(count) << " allocations/object"
+                  << "  " << std::setw(9) << live.load(std::memory_order_relaxed) << " objects leaked\n";
+    }
+}
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* storage = std::malloc(size ? size : 1))
+    {
+        return storage;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* storage) noexcept
+{
+    std::free(storage);
+}
+
+void operator delete(void* storage, size_t) noexcept
+{
+    std::free(storage);
+}
+
+/**
+ * @brief Compares the copying DualRefObject that makeDualRef used to build with the current one, which hands out
+ * both kinds of handle to one object.
+ * Usage: mexMemory_bench_dualRef [objects = 1000000]
+ */
+int main(int argc, char** argv)
+{
+    const size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+    std::cout << "Creating " << count << " objects of " << sizeof(Document) << " bytes\n";
+
+    run("copy and leak", count, [](size_t i) {
+        auto* document = new Document(i);
+        std::shared_ptr<Document> shared(document, [](Document*) {});
+        return std::make_pair(shared, makeRef<Document>(*document));
+    });
+
+    run("makeDualRef", count, [](size_t i) {
+        auto dual = makeDualRef<Document>(i);
+        return std::make_pair(dual.getSharedPtr(), dual.getRef());
+    });
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "memory/memory.h"
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Node
+    {
+        Ref<Node> left;
+        Ref<Node> right;
+        WeakRef<Node> parent;
+
+        void trace(RefVisitor& visit) const
+        {
+            visit(left);
+            visit(right);
+            visit(parent);
+        }
+    };
+
+    /**
+     * @brief Gets the peak resident set size of the process.
+     * @return The peak in kilobytes.
+     */
+    long peakKilobytes()
+    {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    /**
+     * @brief Writes the tracked graph to /dev/null in one format and reports the cost per object.
+     * @param name The name of the format.
+     * @param format The format.
+     */
+    void measure(const char* name, GraphFormat format)
+    {
+        const int fd = ::open("/dev/null", O_WRONLY);
+        const long before = peakKilobytes();
+        const auto start = Clock::now();
+        const auto stats = HeapGraph::exportGraph(fd, format);
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        ::close(fd);
+        std::cout << std::setw(8) << name << std::setw(10) << stats.nodes << " objects"
+                  << std::fixed << std::setprecision(2)
+                  << "  " << std::setw(8) << seconds * 1e3 << " ms"
+                  << "  " << std::setw(7) << seconds * 1e9 / static_cast<double>(stats.nodes) << " ns/object"
+                  << "  " << std::setw(8) << static_cast<double>(stats.bytes) / (1 << 20) << " MiB"
+                  << "  peak RSS +" << peakKilobytes() - before << " KiB\n";
+    }
+}
+
+/**
+ * @brief Measures streaming the tracked object graph, a binary tree with a weak reference to each parent, in
+ * every format; the peak resident size should not grow with the graph.
+ * Usage: mexMemory_bench_heapGraph [objects = 1000000]
+ */
+int main(int argc, char** argv)
+{
+    const size_t objects = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+
+    enableAllocationTracking(true);
+    std::vector<Ref<Node>> nodes;
+    nodes.reserve(objects);
+    for (size_t i = 0; i < objects; ++i)
+    {
+        nodes.push_back(makeRef<Node>());
+        if (i > 0)
+        {
+            Node& parent = *nodes[(i - 1) / 2];
+            (i % 2 ? parent.left : parent.right) = nodes[i];
+            (*nodes[i]).parent = nodes[(i - 1) / 2].weak();
+        }
+    }
+
+    measure("binary", GraphFormat::Binary);
+    measure("dot", GraphFormat::Dot);
+    measure("graphml", GraphFormat::GraphML);
+
+    for (auto& node : nodes)
+    {
+        (*node).left.reset();
+        (*node).right.reset();
+    }
+    nodes.clear();
+    enableAllocationTracking(false);
+    return 0;
+}
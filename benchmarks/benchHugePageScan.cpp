@@ -0,0 +1,115 @@
+#include "memory/memory.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+using namespace memory;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Result of scanning one buffer.
+     */
+    struct ScanResult
+    {
+        double populateSeconds;
+        double sequentialSeconds;
+        double randomSeconds;
+        uint64_t checksum;
+    };
+
+    /**
+     * @brief Populates a buffer, then scans it sequentially and with random lookup-table style probes.
+     * @param data The buffer to scan.
+     * @param size The size of the buffer in bytes.
+     * @param probes The number of random probes to perform.
+     * @return The timings of the three phases.
+     */
+    ScanResult scan(std::byte* data, size_t size, size_t probes)
+    {
+        ScanResult result{};
+
+        auto start = Clock::now();
+        for (size_t i = 0; i < size; ++i)
+        {
+            data[i] = static_cast<std::byte>(i * 131);
+        }
+        result.populateSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        auto* words = reinterpret_cast<const uint64_t*>(data);
+        const size_t wordCount = size / sizeof(uint64_t);
+
+        start = Clock::now();
+        uint64_t sum = 0;
+        for (size_t i = 0; i < wordCount; ++i)
+        {
+            sum += words[i];
+        }
+        result.sequentialSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        start = Clock::now();
+        uint64_t state = 0x9e3779b97f4a7c15ull;
+        for (size_t i = 0; i < probes; ++i)
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            sum += words[state % wordCount];
+        }
+        result.randomSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        result.checksum = sum;
+        return result;
+    }
+
+    /**
+     * @brief Prints one result row.
+     * @param name The name of the allocation path.
+     * @param size The size of the buffer in bytes.
+     * @param probes The number of random probes performed.
+     * @param result The timings to print.
+     */
+    void report(const std::string& name, size_t size, size_t probes, const ScanResult& result)
+    {
+        const double gib = static_cast<double>(size) / (1024.0 * 1024.0 * 1024.0);
+        std::cout << std::setw(14) << name
+                  << std::fixed << std::setprecision(3)
+                  << "  populate " << std::setw(8) << result.populateSeconds << " s"
+                  << "  sequential " << std::setw(8) << gib / result.sequentialSeconds << " GiB/s"
+                  << "  random " << std::setw(8) << result.randomSeconds * 1e9 / static_cast<double>(probes) << " ns/probe"
+                  << "  (checksum " << result.checksum << ")\n";
+    }
+}
+
+/**
+ * @brief Compares scanning a Ref<std::byte[]> from the default allocator with one from HugePageAllocator.
+ * Usage: mexMemory_bench_hugePageScan [GiB = 1] [probes = 50000000]
+ */
+int main(int argc, char** argv)
+{
+    const size_t gib = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1;
+    const size_t probes = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 50'000'000;
+    const size_t size = gib * 1024 * 1024 * 1024;
+
+    enableAllocationTracking(true);
+
+    std::cout << "Scanning " << gib << " GiB buffers, " << probes << " random probes\n";
+    {
+        auto buffer = makeRef<std::byte[]>(size);
+        report("default", size, probes, scan(buffer.get(), size, probes));
+    }
+    {
+        auto buffer = makeRefWithAllocator<std::byte[], HugePageAllocator<std::byte[]>>(size);
+        report("huge pages", size, probes, scan(buffer.get(), size, probes));
+        AllocationTracker::printStatistics();
+    }
+
+    enableAllocationTracking(false);
+    return 0;
+}
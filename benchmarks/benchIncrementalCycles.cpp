@@ -0,0 +1,168 @@
+#include "memory/memory.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Node
+    {
+        std::array<Ref<Node>, 4> edges;
+
+        void trace(RefVisitor& visit) const
+        {
+            visit(edges);
+        }
+    };
+
+    /**
+     * @brief Prints the cost of one operation.
+     * @param name The name of the configuration being measured.
+     * @param start When the measurement started.
+     * @param operations The number of operations measured.
+     */
+    void report(const char* name, Clock::time_point start, size_t operations)
+    {
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << std::setw(28) << name
+                  << std::fixed << std::setprecision(2)
+                  << "  " << std::setw(10) << seconds * 1e9 / static_cast<double>(operations) << " ns/op\n";
+    }
+
+    /**
+     * @brief Copies and drops a Ref on the stack repeatedly.
+     * @param name The name of the configuration being measured.
+     * @param ref The Ref to copy.
+     * @param rounds The number of copies.
+     */
+    void copyAndDrop(const char* name, const Ref<Node>& ref, size_t rounds)
+    {
+        const auto start = Clock::now();
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            Ref<Node> copy = ref;
+        }
+        report(name, start, rounds);
+    }
+
+    /**
+     * @brief Drops the fields of every node, all Refs moved out before any is dropped.
+     * @param nodes The nodes.
+     */
+    void unlink(std::vector<Ref<Node>>& nodes)
+    {
+        std::vector<Ref<Node>> released;
+        for (auto& node : nodes)
+        {
+            for (auto& edge : node->edges)
+            {
+                released.push_back(std::move(edge));
+            }
+        }
+        nodes.clear();
+        released.clear();
+    }
+
+    /**
+     * @brief Builds a tree top-down, attaching every new object below a random earlier one.
+     * @param name The name of the configuration being measured.
+     * @param objects The number of objects.
+     */
+    void buildTree(const char* name, size_t objects)
+    {
+        std::mt19937_64 random(42);
+        std::vector<Ref<Node>> nodes{makeRef<Node>()};
+        std::vector<size_t> open{0};
+        const auto start = Clock::now();
+        for (size_t i = 1; i < objects; ++i)
+        {
+            const size_t slot = random() % open.size();
+            Node& parent = *nodes[open[slot]];
+            auto& field = parent.edges[parent.edges[0] ? parent.edges[1] ? parent.edges[2] ? 3 : 2 : 1 : 0];
+            field = makeRef<Node>();
+            nodes.push_back(field);
+            if (parent.edges[3])
+            {
+                open[slot] = open.back();
+                open.pop_back();
+            }
+            open.push_back(i);
+        }
+        report(name, start, objects - 1);
+        unlink(nodes);
+    }
+
+    /**
+     * @brief Assigns random references between existing objects, down a ranking that mostly follows creation order:
+     * the graph stays acyclic, and the assignments that disagree with the order kept reorder nearby objects.
+     * @param name The name of the configuration being measured.
+     * @param objects The number of objects.
+     */
+    void linkNearby(const char* name, size_t objects)
+    {
+        std::mt19937_64 random(42);
+        std::vector<Ref<Node>> nodes;
+        std::vector<size_t> rank(objects);
+        for (size_t i = 0; i < objects; ++i)
+        {
+            nodes.push_back(makeRef<Node>());
+            rank[i] = i + random() % 64;
+        }
+        const auto start = Clock::now();
+        size_t assignments = 0;
+        for (size_t field = 0; field < 4; ++field)
+        {
+            for (size_t i = 1; i < objects; ++i)
+            {
+                const size_t a = random() % (objects - 1) + 1;
+                const size_t b = a - 1 - random() % std::min<size_t>(a, 32);
+                if (rank[a] == rank[b]) continue;
+
+                const size_t from = rank[a] > rank[b] ? a : b;
+                nodes[from]->edges[field] = nodes[from == a ? b : a];
+                ++assignments;
+            }
+        }
+        report(name, start, assignments);
+        unlink(nodes);
+    }
+}
+
+/**
+ * @brief Measures what incremental cycle detection adds to copying a Ref on the stack and to assigning Refs inside
+ * objects, in an order that often disagrees with the topological order kept.
+ * Usage: mexMemory_bench_incrementalCycles [rounds = 10000000] [objects = 100000]
+ */
+int main(int argc, char** argv)
+{
+    const size_t rounds = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+    const size_t objects = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100'000;
+
+    auto ref = makeRef<Node>();
+    copyAndDrop("stack copy/drop, off", ref, rounds);
+    buildTree("tree, off", objects);
+    linkNearby("nearby links, off", objects);
+
+    CycleDetector::enableIncremental(true, CycleDetector::CycleAction::Report);
+    auto watched = makeRef<Node>();
+    copyAndDrop("stack copy/drop, on", watched, rounds);
+    buildTree("tree, on", objects);
+    linkNearby("nearby links, on", objects);
+
+    const auto stats = CycleDetector::getIncrementalStats();
+    std::cout << "                              (" << stats.insertions << " insertions, " << stats.reorders
+              << " reordered, " << std::setprecision(1)
+              << static_cast<double>(stats.reordered_objects) / static_cast<double>(stats.reorders ? stats.reorders : 1)
+              << " objects moved per reorder)\n";
+    CycleDetector::enableIncremental(false);
+    return 0;
+}
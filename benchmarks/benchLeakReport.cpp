@@ -0,0 +1,95 @@
+#include "memory/memory.h"
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Link
+    {
+        Ref<Link> next;
+
+        void trace(RefVisitor& visit) const
+        {
+            visit(next);
+        }
+    };
+
+    /**
+     * @brief Builds rings of objects, leaks every other one, analyzes the tracked graph and reports the cost per object.
+     * @param objects The number of objects.
+     * @param ringSize The number of objects per ring.
+     */
+    void run(size_t objects, size_t ringSize)
+    {
+        std::vector<Ref<Link>> live;
+        std::vector<Link*> leaked;
+        for (size_t ring = 0; ring * ringSize < objects; ++ring)
+        {
+            std::vector<Ref<Link>> links = makeRefs<Link>(ringSize, [](size_t) { return Link{}; });
+            for (size_t i = 0; i < ringSize; ++i)
+            {
+                links[i]->next = links[(i + 1) % ringSize];
+            }
+            if (ring % 2 == 0)
+            {
+                live.push_back(links.front());
+            }
+            else
+            {
+                leaked.push_back(links.front().get());
+            }
+        }
+
+        const auto start = Clock::now();
+        const auto report = CycleDetector::findLeaks();
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << std::setw(10) << report.objects_analyzed << " objects"
+                  << std::fixed << std::setprecision(2)
+                  << "  " << std::setw(8) << seconds * 1e3 << " ms"
+                  << "  " << std::setw(8) << seconds * 1e9 / static_cast<double>(report.objects_analyzed) << " ns/object"
+                  << "  (" << report.components.size() << " cycles)\n";
+
+        // Every link is moved out before any is dropped, so long rings are not destroyed recursively.
+        for (Ref<Link>& ring : live)
+        {
+            leaked.push_back(ring.get());
+        }
+        std::vector<Ref<Link>> released;
+        for (Link* link : leaked)
+        {
+            while (link->next)
+            {
+                Link* following = link->next.get();
+                released.push_back(std::move(link->next));
+                link = following;
+            }
+        }
+        released.clear();
+    }
+}
+
+/**
+ * @brief Measures the whole-graph leak analysis at growing sizes; the cost per object stays flat when it is linear.
+ * Usage: mexMemory_bench_leakReport [objects = 1000000] [ring size = 8]
+ */
+int main(int argc, char** argv)
+{
+    const size_t objects = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+    const size_t ringSize = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 8;
+
+    enableAllocationTracking(true);
+    for (size_t size = objects / 16; size <= objects; size *= 4)
+    {
+        run(size, ringSize);
+    }
+    enableAllocationTracking(false);
+    return 0;
+}
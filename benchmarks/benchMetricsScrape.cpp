@@ -0,0 +1,77 @@
+#include "memory/memory.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief A small tracked object.
+     */
+    struct Item
+    {
+        uint64_t id;
+
+        explicit Item(uint64_t i) : id(i) {}
+    };
+
+    /**
+     * @brief Times repeated scrapes and reports the cost per scrape.
+     * @tparam Scrape The callable performing one scrape and returning a value to keep it observable.
+     * @param name The name of the scrape method.
+     * @param rounds The number of scrapes.
+     * @param scrape The scrape.
+     */
+    template <typename Scrape>
+    void run(const char* name, size_t rounds, Scrape&& scrape)
+    {
+        size_t sink = 0;
+        const auto start = Clock::now();
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            sink += scrape();
+        }
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << std::setw(18) << name
+                  << std::fixed << std::setprecision(2)
+                  << "  " << std::setw(10) << seconds * 1e6 / static_cast<double>(rounds) << " us/scrape"
+                  << "  (sink " << sink << ")\n";
+    }
+}
+
+/**
+ * @brief Compares a metrics scrape through getStatistics, which walks every record, with getLiveMetrics.
+ * Usage: mexMemory_bench_metricsScrape [live objects = 1000000] [scrapes = 20]
+ */
+int main(int argc, char** argv)
+{
+    const size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+    const size_t rounds = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 20;
+
+    enableAllocationTracking(true);
+    std::vector<Ref<Item>> items;
+    items.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        items.push_back(makeRef<Item>(i));
+    }
+    std::cout << "Scraping with " << count << " live objects\n";
+
+    run("getStatistics", rounds, []() { return AllocationTracker::getStatistics().total_bytes; });
+    run("getLiveMetrics", rounds, []() { return AllocationTracker::getLiveMetrics().live_bytes; });
+
+    static char buffer[1 << 20];
+    run("exportOpenMetrics", rounds, []() { return AllocationTracker::exportOpenMetrics(buffer, sizeof(buffer)); });
+    run("exportJson", rounds, []() { return AllocationTracker::exportJson(buffer, sizeof(buffer)); });
+
+    items.clear();
+    enableAllocationTracking(false);
+    return 0;
+}
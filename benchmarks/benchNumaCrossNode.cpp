@@ -0,0 +1,132 @@
+#include "memory/memory.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+using namespace memory;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    volatile uint64_t sink = 0;
+
+    /**
+     * @brief Pins the calling thread to the CPUs of a NUMA node.
+     * @param node The node to pin to.
+     * @return True if the affinity was changed.
+     */
+    bool pinToNode(int node)
+    {
+#if defined(__linux__)
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!(file >> list))
+        {
+            return false;
+        }
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        size_t pos = 0;
+        while (pos < list.size())
+        {
+            const size_t end = list.find(',', pos);
+            const std::string range = list.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+            const size_t dash = range.find('-');
+            const int first = std::atoi(range.c_str());
+            const int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+            for (int cpu = first; cpu <= last; ++cpu)
+            {
+                CPU_SET(cpu, &set);
+            }
+            pos = end == std::string::npos ? list.size() : end + 1;
+        }
+        return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+        (void)node;
+        return false;
+#endif
+    }
+
+    /**
+     * @brief Allocates a buffer on one node and measures random reads from a thread on another node.
+     * @param allocNode The node to allocate on.
+     * @param workerNode The node the reading thread runs on.
+     * @param words The number of 64-bit words in the buffer.
+     * @param probes The number of random reads.
+     * @return The average time per read in nanoseconds.
+     */
+    double measure(int allocNode, int workerNode, size_t words, size_t probes)
+    {
+        Ref<uint64_t[], NumaAllocator<uint64_t[]>> buffer;
+        {
+            NumaNodeScope scope(allocNode);
+            buffer = makeRefWithAllocator<uint64_t[], NumaAllocator<uint64_t[]>>(words);
+        }
+        for (size_t i = 0; i < words; ++i)
+        {
+            buffer.get()[i] = i * 2654435761u;
+        }
+
+        double nanos = 0.0;
+        std::thread worker([&]() {
+            pinToNode(workerNode);
+            const uint64_t* data = buffer.get();
+            uint64_t state = 0x9e3779b97f4a7c15ull;
+            uint64_t sum = 0;
+            const auto start = Clock::now();
+            for (size_t i = 0; i < probes; ++i)
+            {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                sum += data[(state + sum) % words];
+            }
+            nanos = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / static_cast<double>(probes);
+            sink = sum;
+        });
+        worker.join();
+        return nanos;
+    }
+}
+
+/**
+ * @brief Measures random-read latency for every (allocation node, worker node) pair.
+ * On single-node machines only the local path is measured.
+ * Usage: mexMemory_bench_numaCrossNode [MiB = 512] [probes = 20000000]
+ */
+int main(int argc, char** argv)
+{
+    const size_t mib = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 512;
+    const size_t probes = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 20'000'000;
+    const size_t words = mib * 1024 * 1024 / sizeof(uint64_t);
+    const int nodes = refCounting::numa::nodeCount();
+
+    enableAllocationTracking(true);
+
+    std::cout << nodes << " NUMA node(s), " << mib << " MiB buffer, " << probes << " dependent random reads\n";
+    for (int allocNode = 0; allocNode < nodes; ++allocNode)
+    {
+        for (int workerNode = 0; workerNode < nodes; ++workerNode)
+        {
+            const double nanos = measure(allocNode, workerNode, words, probes);
+            std::cout << "  alloc node " << allocNode << " -> worker node " << workerNode
+                      << (allocNode == workerNode ? " (local) " : " (remote)")
+                      << std::fixed << std::setprecision(2) << std::setw(10) << nanos << " ns/read\n";
+        }
+    }
+
+    enableAllocationTracking(false);
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "memory/memory.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+using namespace memory;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Copies and drops a Ref repeatedly, two reference count events per round, and reports the cost per event.
+     * @param name The name of the configuration being measured.
+     * @param ref The Ref to copy.
+     * @param rounds The number of copies.
+     */
+    void run(const char* name, const Ref<uint64_t>& ref, size_t rounds)
+    {
+        const auto start = Clock::now();
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            Ref<uint64_t> copy = ref;
+            *copy += 1;
+        }
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << std::setw(14) << name
+                  << std::fixed << std::setprecision(2)
+                  << "  " << std::setw(10) << seconds * 1e9 / static_cast<double>(2 * rounds) << " ns/event\n";
+    }
+}
+
+/**
+ * @brief Compares the per-event cost of no instrumentation, binary tracing and text logging.
+ * Usage: mexMemory_bench_refTrace [rounds = 2000000] [trace file = mexMemory_bench.trace]
+ */
+int main(int argc, char** argv)
+{
+    const size_t rounds = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2'000'000;
+    const std::string path = argc > 2 ? argv[2] : "mexMemory_bench.trace";
+
+    auto ref = makeRef<uint64_t>(0);
+    run("off", ref, rounds);
+
+    if (!RefTrace::start(path, std::chrono::milliseconds(1)))
+    {
+        std::cerr << "Cannot write " << path << "\n";
+        return 1;
+    }
+    run("binary trace", ref, rounds);
+    RefTrace::stop();
+    const auto trace = TraceFile::load(path);
+    std::cout << "                (" << trace.records.size() << " events written, " << trace.header.dropped << " dropped)\n";
+    std::remove(path.c_str());
+
+    std::ofstream sink("/dev/null");
+    enableReferenceDebugging(true, &sink);
+    run("text logging", ref, rounds / 10);
+    enableReferenceDebugging(false);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "memory/memory.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+using namespace memory;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief A small object, typical of the hot allocation paths.
+     */
+    struct Node
+    {
+        uint64_t key;
+        uint64_t value;
+
+        explicit Node(uint64_t k) : key(k), value(k * 3) {}
+    };
+
+    /**
+     * @brief Creates and drops count Refs and reports the time per Ref.
+     * @param name The name of the tracking mode.
+     * @param count The number of Refs to create.
+     */
+    void run(const char* name, size_t count)
+    {
+        uint64_t checksum = 0;
+        const auto start = Clock::now();
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto node = makeRef<Node>(i);
+            checksum += node->value;
+        }
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        const auto stats = AllocationTracker::getStatistics();
+        std::cout << std::setw(22) << name
+                  << std::fixed << std::setprecision(1)
+                  << "  " << std::setw(7) << seconds * 1e9 / static_cast<double>(count) << " ns/Ref"
+                  << "  live samples " << stats.sampled_allocations
+                  << "  (checksum " << checksum << ")\n";
+    }
+}
+
+/**
+ * @brief Measures the cost of allocation tracking per makeRef with tracking off, exact and sampled.
+ * Usage: mexMemory_bench_samplingOverhead [refs = 5000000] [interval = 524288]
+ */
+int main(int argc, char** argv)
+{
+    const size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 5'000'000;
+    const size_t interval = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 512 * 1024;
+    std::cout << "Creating " << count << " Refs of " << sizeof(Node) << " bytes\n";
+
+    enableAllocationTracking(false);
+    run("tracking off", count);
+
+    enableAllocationTracking(true);
+    run("every allocation", count);
+
+    AllocationTracker::setSamplingInterval(interval);
+    run("sampled", count);
+
+    AllocationTracker::setSamplingInterval(0);
+    enableAllocationTracking(false);
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "memory/memory.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+
+using namespace memory;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::atomic<uint64_t> allocations{0};
+
+    /**
+     * @brief A handle passed to a third-party API.
+     */
+    struct Session
+    {
+        uint64_t id;
+
+        explicit Session(uint64_t i) : id(i) {}
+    };
+
+    /**
+     * @brief Stands in for the third-party API taking a std::shared_ptr.
+     */
+    [[gnu::noinline]] uint64_t consume(std::shared_ptr<Session> session)
+    {
+        return session->id;
+    }
+
+    /**
+     * @brief Runs one conversion strategy and reports conversions per second and heap allocations.
+     * @tparam Convert The callable converting the Ref.
+     * @param name The name of the strategy.
+     * @param count The number of conversions.
+     * @param ref The Ref to convert.
+     * @param convert The conversion strategy.
+     */
+    template <typename Convert>
+    void run(const char* name, size_t count, const Ref<Session>& ref, Convert&& convert)
+    {
+        uint64_t checksum = 0;
+        const uint64_t before = allocations.load(std::memory_order_relaxed);
+        const auto start = Clock::now();
+        for (size_t i = 0; i < count; ++i)
+        {
+            checksum += consume(convert(ref));
+        }
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        const uint64_t allocated = allocations.load(std::memory_order_relaxed) - before;
+
+        std::cout << std::setw(22) << name
+                  << std::fixed << std::setprecision(3)
+                  << "  " << std::setw(7) << seconds << " s ("
+                  << std::setw(7) << static_cast<double>(count) / seconds / 1e6 << " M/s)"
+                  << "  " << std::setw(10) << allocated << " allocations"
+                  << "  (checksum " << checksum << ")\n";
+    }
+}
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* storage = std::malloc(size ? size : 1))
+    {
+        return storage;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* storage) noexcept
+{
+    std::free(storage);
+}
+
+void operator delete(void* storage, size_t) noexcept
+{
+    std::free(storage);
+}
+
+/**
+ * @brief Compares converting a Ref to a std::shared_ptr through a deleter capturing the Ref, as to_shared_ptr
+ * used to, with to_shared_ptr, both with a std::shared_ptr to the object kept alive and without.
+ * Usage: mexMemory_bench_sharedPtrConversion [conversions = 10000000]
+ */
+int main(int argc, char** argv)
+{
+    const size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+    std::cout << "Converting a Ref " << count << " times\n";
+
+    auto ref = makeRef<Session>(42);
+    const auto capturing = [](const Ref<Session>& session) {
+        return std::shared_ptr<Session>(session.get(), [owner = session](Session*) mutable { owner.reset(); });
+    };
+
+    run("capturing deleter", count, ref, capturing);
+    run("to_shared_ptr", count, ref, [](const Ref<Session>& session) { return to_shared_ptr(session); });
+
+    {
+        auto held = to_shared_ptr(ref);
+        run("capturing, held", count, ref, capturing);
+        run("to_shared_ptr, held", count, ref, [](const Ref<Session>& session) { return to_shared_ptr(session); });
+    }
+
+    return 0;
+}
@@ -7,7 +7,13 @@
 #include "refCounting/allocationMap.h"
 #include "refCounting/referenceCasting.h"
 #include "refCounting/cycleDetection.h"
+#include "refCounting/cycleCollector.h"
+#include "refCounting/retentionAnalyzer.h"
+#include "refCounting/heapGraph.h"
 #include "refCounting/stdInterop.h"
+#include "refCounting/hugePageAllocator.h"
+#include "refCounting/numaAllocator.h"
+#include "refCounting/refTrace.h"
 
 /// @brief Namespace for memory management with reference counting \namespace memory
 namespace memory
@@ -15,11 +21,27 @@ namespace memory
     using refCounting::Ref;
     using refCounting::WeakRef;
     using refCounting::makeRef;
+    using refCounting::tryMakeRef;
     using refCounting::makeRefWithAllocator;
+    using refCounting::makeRefs;
+    using refCounting::makeRefBatch;
     using refCounting::enableReferenceDebugging;
     using refCounting::enableAllocationTracking;
     using refCounting::DefaultAllocator;
+    using refCounting::HugePageAllocator;
+    using refCounting::HugePageConfig;
+    using refCounting::NumaAllocator;
+    using refCounting::NumaNodeScope;
     using refCounting::AllocationTracker;
+    using refCounting::AllocationTag;
+    using refCounting::BudgetExceeded;
+    using refCounting::BudgetEvent;
+    using refCounting::BudgetScope;
+
+    // Binary reference count tracing
+    using refCounting::RefTrace;
+    using refCounting::TraceFile;
+    using refCounting::TraceEvent;
     
     // Enhanced pointer casting functions
     using refCounting::static_pointer_cast;
@@ -29,11 +51,19 @@ namespace memory
     
     // Cycle detection functionality
     using refCounting::CycleDetector;
+    using refCounting::RefVisitor;
+    using refCounting::OwnershipGraph;
     using refCounting::enableCycleDetection;
+    using refCounting::CycleCollector;
+    using refCounting::ObjectGraph;
+    using refCounting::RetentionAnalyzer;
+    using refCounting::HeapGraph;
+    using refCounting::GraphFormat;
     
     // std::shared_ptr interoperability
     using refCounting::to_shared_ptr;
     using refCounting::from_shared_ptr;
+    using refCounting::to_weak_ptr;
     using refCounting::adopt_raw_ptr;
     using refCounting::DualRefObject;
     using refCounting::makeDualRef;
@@ -2,6 +2,17 @@
 #define MEXMEMORY_ALLOCATIONMAP_H
 
 #include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <mutex>
 #include <vector>
 #include <iostream>
@@ -10,15 +21,203 @@
 #include <stdlib.h>
 #include <cstdlib>
 #include <cxxabi.h>
+#include <memory/refCounting/histogram.h>
+#include <memory/refCounting/metricsWriter.h>
+
+#if defined(__GNUC__)
+#define MEXMEMORY_SHARED __attribute__((visibility("default")))
+#else
+#define MEXMEMORY_SHARED
+#endif
+
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define MEXMEMORY_HAS_BACKTRACE 1
+#endif
 
 /// @brief Namespace for memory management with reference counting \namespace memory::refCounting
 namespace memory::refCounting
 {
+    class ControlBlockBase;
+
+    /**
+     * @brief What a memory budget applies to.
+     */
+    enum class BudgetScope
+    {
+        Global,
+        Type,
+        Tag
+    };
+
+    /**
+     * @brief Describes a budget whose soft limit was crossed, or whose hard limit refused an allocation.
+     */
+    struct BudgetEvent
+    {
+        BudgetScope scope{BudgetScope::Global};
+        std::string name;
+        size_t limit{0};
+        size_t live_bytes{0};
+        size_t requested_bytes{0};
+    };
+
+    /**
+     * @brief Thrown by makeRef when an allocation would take a budget past its hard limit.
+     * It derives from std::bad_alloc, so code that already handles allocation failure handles it too.
+     */
+    class BudgetExceeded : public std::bad_alloc
+    {
+    public:
+
+        /**
+         * @brief Constructs the exception for the budget that refused the allocation.
+         * @param event The budget, its limit and the allocation that was refused.
+         */
+        explicit BudgetExceeded(BudgetEvent event) : event_(std::move(event)) {}
+
+        /**
+         * @brief Gets a description of the error.
+         * @return A static string.
+         */
+        [[nodiscard]] const char* what() const noexcept override
+        {
+            return "allocation exceeds memory budget";
+        }
+
+        /**
+         * @brief Gets the budget that refused the allocation.
+         * @return The budget event.
+         */
+        [[nodiscard]] const BudgetEvent& event() const noexcept
+        {
+            return event_;
+        }
+
+    private:
+        BudgetEvent event_;
+    };
+
     /// @brief Class for tracking memory allocations and detecting leaks. \class AllocationTracker
     class AllocationTracker
     {
     public:
 
+        /**
+         * @brief Number of NUMA nodes that per-node statistics are kept for.
+         */
+        static constexpr int maxNumaNodes = 64;
+
+        /**
+         * @brief Number of slots in the filter that lets untrackAllocation skip pointers that were never recorded.
+         */
+        static constexpr size_t trackedFilterSlots = 4096;
+
+        /**
+         * @brief Maximum number of frames captured per allocation stack.
+         */
+        static constexpr size_t maxStackDepth = 64;
+
+        /**
+         * @brief Stack id of allocations recorded without a stack, or whose stack did not fit in the stack table.
+         */
+        static constexpr uint32_t noStack = 0;
+
+        /**
+         * @brief Number of shards per type for the live metrics counters; threads are spread over them round-robin.
+         */
+        static constexpr size_t metricShards = 16;
+
+        /**
+         * @brief Number of shards per type for the size histograms, which are larger than the plain counters.
+         */
+        static constexpr size_t histogramShards = 4;
+
+        /**
+         * @brief Number of shards the allocation records are split over, each with its own lock.
+         */
+        static constexpr size_t recordShards = 16;
+
+        /**
+         * @brief Maximum number of distinct allocation tags, including the untagged id 0.
+         */
+        static constexpr uint32_t maxTags = 256;
+
+        /**
+         * @brief Tag id of allocations made outside any AllocationTag scope.
+         */
+        static constexpr uint32_t untagged = 0;
+
+        /**
+         * @brief Live metrics of a single type, as returned by getLiveMetrics.
+         */
+        struct TypeMetrics
+        {
+            std::string type;
+            size_t live_count{0};
+            size_t live_bytes{0};
+            size_t peak_count{0};
+            size_t peak_bytes{0};
+            size_t total_allocations{0};
+            size_t total_allocated_bytes{0};
+            size_t total_frees{0};
+            size_t total_freed_bytes{0};
+        };
+
+        /**
+         * @brief Live metrics of a single allocation tag, as returned by getLiveMetrics.
+         * Tags are attributed through the allocation records, so in sampling mode these are estimates.
+         */
+        struct TagMetrics
+        {
+            std::string tag;
+            uint32_t id{untagged};
+            size_t live_count{0};
+            size_t live_bytes{0};
+            size_t total_allocations{0};
+            size_t total_allocated_bytes{0};
+            size_t total_frees{0};
+            size_t total_freed_bytes{0};
+        };
+
+        /**
+         * @brief Process-wide live metrics, maintained incrementally on every tracked allocation and free.
+         */
+        struct LiveMetrics
+        {
+            size_t live_count{0};
+            size_t live_bytes{0};
+            size_t peak_bytes{0};
+            size_t total_allocations{0};
+            size_t total_allocated_bytes{0};
+            size_t total_frees{0};
+            size_t total_freed_bytes{0};
+            std::vector<TypeMetrics> types;
+            std::vector<TagMetrics> tags;
+        };
+
+        /**
+         * @brief Size and lifetime distributions of a single type, as returned by getHistograms.
+         */
+        struct TypeHistograms
+        {
+            std::string type;
+            Histogram sizes;
+            Histogram lifetimes_ns;
+        };
+
+        /**
+         * @brief Size and lifetime distributions, in total and per type.
+         * Sizes are in bytes and cover every tracked allocation. Lifetimes run from tracking to the release of
+         * the last strong reference, in nanoseconds, and cover recorded allocations (the samples in sampling mode).
+         */
+        struct Histograms
+        {
+            Histogram sizes;
+            Histogram lifetimes_ns;
+            std::vector<TypeHistograms> types;
+        };
+
         /**
          * @brief Struct to hold information about a memory allocation.
          */
@@ -29,6 +228,12 @@ namespace memory::refCounting
             std::string type;
             std::string file;
             int line;
+            double weight;
+            uint32_t stackId = noStack;
+            std::chrono::steady_clock::time_point allocated_at{};
+            uint32_t tag = untagged;
+            uint32_t thread = 0;
+            ControlBlockBase* owner = nullptr;
 
             /**
              * @brief Constructor to initialize AllocationInfo.
@@ -37,137 +242,1735 @@ namespace memory::refCounting
              * @param t The type of the allocated object.
              * @param f The file where the allocation occurred.
              * @param l The line number where the allocation occurred.
+             * @param w The number of allocations this record stands for; above 1 for sampled allocations.
              */
-            AllocationInfo(void* p, size_t s, const std::string& t, const std::string& f, int l)
+            AllocationInfo(void* p, size_t s, const std::string& t, const std::string& f, int l, double w = 1.0)
                 : ptr(p)
                 , size(s)
                 , type(t)
                 , file(f)
                 , line(l)
+                , weight(w)
             {
 
             }
         };
 
     private:
-        static inline std::unordered_map<void*, AllocationInfo> allocations_;
-        static inline std::mutex mutex_;
-        static inline bool enabled_ = false;
-        static inline bool breakOnLeak_ = false;
-        static inline std::ostream* leakStream_ = &std::cerr;
 
-    public:
+        /**
+         * @brief One shard of the allocation records, keyed by pointer.
+         */
+        struct alignas(64) RecordShard
+        {
+            std::mutex mutex;
+            std::unordered_map<void*, AllocationInfo> records;
+        };
+
+
+        /**
+         * @brief Groups records by type and call site while a snapshot is taken; the strings are interned per snapshot.
+         */
+        struct SiteKey
+        {
+            std::string_view type;
+            uint32_t stackId;
+            std::string_view file;
+            int line;
+
+            bool operator==(const SiteKey&) const = default;
+        };
+
+        /**
+         * @brief Hash for SiteKey.
+         */
+        struct SiteKeyHash
+        {
+            size_t operator()(const SiteKey& key) const noexcept
+            {
+                size_t hash = std::hash<std::string_view>{}(key.type);
+                hash = hash * 31 + std::hash<std::string_view>{}(key.file);
+                hash = hash * 31 + static_cast<size_t>(key.line);
+                return hash * 31 + key.stackId;
+            }
+        };
+        static inline thread_local int64_t bytesUntilSample_ = 0;
+        static inline thread_local uint64_t samplingRng_ = 0;
+
+        /**
+         * @brief Hash for captured frame sequences, used to deduplicate stacks.
+         */
+        struct FramesHash
+        {
+            size_t operator()(const std::vector<void*>& frames) const noexcept
+            {
+                uint64_t hash = 0xcbf29ce484222325ull;
+                for (void* frame : frames)
+                {
+                    hash = (hash ^ static_cast<uint64_t>(reinterpret_cast<uintptr_t>(frame))) * 0x100000001b3ull;
+                }
+                return static_cast<size_t>(hash);
+            }
+        };
+
+        /**
+         * @brief A deduplicated allocation stack; its symbols are resolved the first time a report needs them.
+         */
+        struct StackEntry
+        {
+            std::vector<void*> frames;
+            std::vector<std::string> symbols;
+        };
+
+        /**
+         * @brief One shard of a type's counters. All counters only grow; live values are differences.
+         */
+        struct alignas(64) MetricShard
+        {
+            std::atomic<uint64_t> allocations{0};
+            std::atomic<uint64_t> allocatedBytes{0};
+            std::atomic<uint64_t> frees{0};
+            std::atomic<uint64_t> freedBytes{0};
+        };
+
+        /**
+         * @brief Soft and hard limit of a budget in bytes; 0 means no limit.
+         */
+        struct BudgetLimits
+        {
+            std::atomic<size_t> soft;
+            std::atomic<size_t> hard;
+        };
+
+        /**
+         * @brief Counters of one type, registered in a lock-free list the first time the type is tracked.
+         * Entries are never freed, so a scrape can walk the list while other threads register new types.
+         */
+        struct TypeCounters
+        {
+            std::string type;
+            TypeCounters* next = nullptr;
+            MetricShard shards[metricShards];
+            std::atomic<uint64_t> peakCount{0};
+            std::atomic<uint64_t> peakBytes{0};
+            AtomicHistogram sizes[histogramShards];
+            AtomicHistogram lifetimes;
+            BudgetLimits budget;
+            std::atomic<bool> budgeted{false};
+            std::atomic<int64_t> budgetBytes{0};
+
+            /**
+             * @brief Constructs the counters of a type and pushes them onto the registry.
+             * @param name The demangled name of the type.
+             */
+            explicit TypeCounters(std::string name) : type(std::move(name))
+            {
+                next = state().typeRegistry.load(std::memory_order_relaxed);
+                while (!state().typeRegistry.compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed))
+                {
+                }
+            }
+        };
+
+        static inline thread_local size_t metricShard_ = metricShards;
+
+        /**
+         * @brief Counters of one allocation tag, updated as tagged records are added and removed.
+         */
+        struct alignas(64) TagCounters
+        {
+            std::atomic<uint64_t> allocations;
+            std::atomic<uint64_t> allocatedBytes;
+            std::atomic<uint64_t> frees;
+            std::atomic<uint64_t> freedBytes;
+        };
+
+        static inline thread_local uint32_t currentTag_ = untagged;
+        static inline thread_local uint32_t threadIndex_ = 0;
+
+        /**
+         * @brief Everything the tracker shares between threads and shared objects.
+         * There is one instance per process: it is created on first use and intentionally never destroyed, so Refs
+         * released during static destruction, or by plugins being unloaded, still find a valid tracker.
+         */
+        struct State
+        {
+            // Settings and the stack table, guarded by mutex.
+            std::mutex mutex;
+            bool enabled = false;
+            bool breakOnLeak = false;
+            std::ostream* leakStream = &std::cerr;
+            std::atomic<size_t> samplingInterval{0};
+            std::atomic<size_t> stackDepth{0};
+            size_t stackTableLimit = 4096;
+            std::unordered_map<std::vector<void*>, uint32_t, FramesHash> stackIds;
+            std::vector<StackEntry> stacks;
+            std::function<void(const BudgetEvent&)> softLimitCallback;
+
+            // Allocation records.
+            RecordShard recordTable[recordShards];
+            std::atomic<uint32_t> trackedFilter[trackedFilterSlots];
+            std::atomic<size_t> recordedBytes{0};
+            std::atomic<size_t> recordedCount{0};
+
+            // Live metrics.
+            std::atomic<TypeCounters*> typeRegistry{nullptr};
+            std::atomic<size_t> nextMetricShard{0};
+            std::atomic<int64_t> liveBytes{0};
+            std::atomic<int64_t> peakBytes{0};
+
+            // Huge page and NUMA occupancy.
+            std::atomic<size_t> hugePageAllocations{0};
+            std::atomic<size_t> hugePageBytes{0};
+            std::atomic<size_t> hugeTlbAllocations{0};
+            std::atomic<size_t> numaAllocations[maxNumaNodes];
+            std::atomic<size_t> numaBytes[maxNumaNodes];
+
+            // Budgets.
+            std::atomic<bool> budgetsActive{false};
+            BudgetLimits globalBudget;
+            BudgetLimits tagBudgets[maxTags];
+            std::atomic<uint64_t> budgetRejections{0};
+
+            // Tags and threads.
+            TagCounters tagCounters[maxTags];
+            std::string tagNames[maxTags];
+            std::unordered_map<std::string, uint32_t> tagIds;
+            std::atomic<uint32_t> tagCount{1};
+            std::atomic<uint32_t> nextThreadIndex{0};
+
+            std::atomic<bool> leaksReported{false};
+        };
 
         /**
-         * @brief Gets the current allocations map.
-         * @return A constant reference to the map of allocations.
+         * @brief Gets the process-wide tracker state.
+         * The accessor has default visibility and its instance is a static local of an inline function, which the
+         * GNU toolchain binds uniquely across the process even for libraries built with hidden visibility or loaded
+         * with RTLD_LOCAL. Every copy of this header therefore shares one tracker. After the first call this is a
+         * plain load of an initialized guard and a pointer, without a lock.
+         * @return The tracker state.
          */
-        static const std::unordered_map<void*, AllocationInfo>& getAllocations() noexcept
+        MEXMEMORY_SHARED static State& state() noexcept
         {
-            return allocations_;
+            static State* const instance = new State();
+            return *instance;
         }
 
+        friend class AllocationTag;
+
         /**
-         * @brief Gets the mutex used for thread-safe access to the allocations map.
-         * @return A reference to the mutex.
+         * @brief Turns on budget checks once a limit has been set.
+         * @param softLimit The soft limit that was set.
+         * @param hardLimit The hard limit that was set.
          */
-        static std::mutex& getMutex() noexcept
+        static void activateBudgets(size_t softLimit, size_t hardLimit) noexcept
         {
-            return mutex_;
+            if (softLimit != 0 || hardLimit != 0)
+            {
+                state().budgetsActive.store(true, std::memory_order_relaxed);
+            }
         }
 
         /**
-         * @brief Enables or disables memory allocation tracking.
-         * @param enable The flag to enable or disable tracking.
+         * @brief Resets the counters of every tag to zero.
          */
-        static void enableTracking(bool enable) noexcept
+        static void resetTagCounters() noexcept
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            enabled_ = enable;
+            for (TagCounters& counters : state().tagCounters)
+            {
+                counters.allocations.store(0, std::memory_order_relaxed);
+                counters.allocatedBytes.store(0, std::memory_order_relaxed);
+                counters.frees.store(0, std::memory_order_relaxed);
+                counters.freedBytes.store(0, std::memory_order_relaxed);
+            }
         }
 
         /**
-         * @brief Setter for the breakOnLeak flag.
-         * @param enable The flag to enable or disable breaking on memory leaks.
+         * @brief Adds or removes a record's share of its tag's counters.
+         * A record stands for weight allocations, so in sampling mode the counters are estimates.
+         * @param info The record.
+         * @param added True when the record is added, false when it is removed.
          */
-        static void setBreakOnLeak(bool enable) noexcept
+        static void countTagged(const AllocationInfo& info, bool added) noexcept
         {
-            breakOnLeak_ = enable;
+            if (info.tag == untagged)
+            {
+                return;
+            }
+            TagCounters& counters = state().tagCounters[info.tag];
+            const auto count = static_cast<uint64_t>(std::llround(info.weight));
+            const auto bytes = static_cast<uint64_t>(std::llround(info.weight * static_cast<double>(info.size)));
+            if (added)
+            {
+                counters.allocations.fetch_add(count, std::memory_order_relaxed);
+                counters.allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+            }
+            else
+            {
+                counters.frees.fetch_add(count, std::memory_order_relaxed);
+                counters.freedBytes.fetch_add(bytes, std::memory_order_relaxed);
+            }
         }
 
         /**
-         * @brief Sets the output stream for leak reports.
-         * @param stream The output stream to use for reporting memory leaks.
+         * @brief Gets the counters of a type, registering them on first use.
+         * @tparam T The type.
+         * @return The counters, which live until the end of the process.
          */
-        static void setLeakStream(std::ostream* stream) noexcept
+        template<typename T>
+        static TypeCounters& countersOf()
         {
-            leakStream_ = stream;
+            static TypeCounters* counters = registerType(demangleTypeName<T>());
+            return *counters;
         }
 
         /**
-         * @brief Demangles the type name of a given type T.
-         * @tparam T The type to demangle.
-         * @return A string containing the demangled type name.
+         * @brief Finds the counters registered for a type name, or registers new ones.
+         * Every shared object instantiates countersOf separately; looking the name up first keeps one entry per type.
+         * @param name The demangled name of the type.
+         * @return The counters of the type.
+         */
+        static TypeCounters* registerType(std::string name)
+        {
+            std::lock_guard<std::mutex> lock(state().mutex);
+            for (TypeCounters* counters = state().typeRegistry.load(std::memory_order_acquire); counters; counters = counters->next)
+            {
+                if (counters->type == name)
+                {
+                    return counters;
+                }
+            }
+            return new TypeCounters(std::move(name));
+        }
+
+        /**
+         * @brief Gets the counter shard of the calling thread.
+         * @param counters The counters of the type.
+         * @return The shard this thread updates.
+         */
+        static MetricShard& shardOf(TypeCounters& counters) noexcept
+        {
+            if (metricShard_ == metricShards)
+            {
+                metricShard_ = state().nextMetricShard.fetch_add(1, std::memory_order_relaxed) % metricShards;
+            }
+            return counters.shards[metricShard_];
+        }
+
+        /**
+         * @brief Updates the live metrics for an allocation.
+         * @param counters The counters of the allocated type.
+         * @param bytes The size of the allocation.
+         */
+        static void countAllocation(TypeCounters& counters, size_t bytes) noexcept
+        {
+            MetricShard& shard = shardOf(counters);
+            shard.allocations.fetch_add(1, std::memory_order_relaxed);
+            shard.allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+            counters.sizes[metricShard_ % histogramShards].record(bytes);
+            if (counters.budgeted.load(std::memory_order_relaxed))
+            {
+                counters.budgetBytes.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+            }
+
+            const int64_t live = state().liveBytes.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed) + static_cast<int64_t>(bytes);
+            int64_t peak = state().peakBytes.load(std::memory_order_relaxed);
+            while (live > peak && !state().peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        /**
+         * @brief Updates the live metrics for a free.
+         * @param counters The counters of the freed type.
+         * @param bytes The size of the allocation.
+         */
+        static void countFree(TypeCounters& counters, size_t bytes) noexcept
+        {
+            MetricShard& shard = shardOf(counters);
+            shard.frees.fetch_add(1, std::memory_order_relaxed);
+            shard.freedBytes.fetch_add(bytes, std::memory_order_relaxed);
+            state().liveBytes.fetch_sub(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+            if (counters.budgeted.load(std::memory_order_relaxed))
+            {
+                counters.budgetBytes.fetch_sub(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * @brief Checks an allocation against one budget, calling the soft limit callback if it crosses the soft limit.
+         * @param limits The limits of the budget.
+         * @param live The bytes currently charged to the budget.
+         * @param bytes The size of the allocation.
+         * @param scope What the budget applies to.
+         * @param name The type or tag name of the budget.
+         * @param exceeded Filled with the budget if its hard limit refuses the allocation; may be null.
+         * @return False if the allocation would take the budget past its hard limit.
+         */
+        static bool checkLimit(const BudgetLimits& limits, int64_t live, size_t bytes, BudgetScope scope,
+                               std::string_view name, BudgetEvent* exceeded)
+        {
+            const size_t current = static_cast<size_t>(std::max<int64_t>(0, live));
+            const size_t hard = limits.hard.load(std::memory_order_relaxed);
+            if (hard != 0 && current + bytes > hard)
+            {
+                state().budgetRejections.fetch_add(1, std::memory_order_relaxed);
+                if (exceeded)
+                {
+                    *exceeded = BudgetEvent{scope, std::string(name), hard, current, bytes};
+                }
+                return false;
+            }
+
+            const size_t soft = limits.soft.load(std::memory_order_relaxed);
+            if (soft != 0 && current <= soft && current + bytes > soft)
+            {
+                std::function<void(const BudgetEvent&)> callback;
+                {
+                    std::lock_guard<std::mutex> lock(state().mutex);
+                    callback = state().softLimitCallback;
+                }
+                if (callback)
+                {
+                    callback(BudgetEvent{scope, std::string(name), soft, current, bytes});
+                }
+            }
+            return true;
+        }
+
+        /**
+         * @brief Totals of one type's counters, read without allocating.
+         */
+        struct CounterTotals
+        {
+            uint64_t allocations{0};
+            uint64_t allocatedBytes{0};
+            uint64_t frees{0};
+            uint64_t freedBytes{0};
+            uint64_t liveCount{0};
+            uint64_t liveBytes{0};
+            uint64_t peakCount{0};
+            uint64_t peakBytes{0};
+        };
+
+        /**
+         * @brief Sums the shards of a type's counters and folds the current live values into its peaks.
+         * @param counters The counters of the type.
+         * @return The totals.
+         */
+        static CounterTotals totalsOf(TypeCounters& counters) noexcept
+        {
+            CounterTotals totals;
+            for (const MetricShard& shard : counters.shards)
+            {
+                totals.allocations += shard.allocations.load(std::memory_order_relaxed);
+                totals.allocatedBytes += shard.allocatedBytes.load(std::memory_order_relaxed);
+                totals.frees += shard.frees.load(std::memory_order_relaxed);
+                totals.freedBytes += shard.freedBytes.load(std::memory_order_relaxed);
+            }
+            totals.liveCount = totals.allocations > totals.frees ? totals.allocations - totals.frees : 0;
+            totals.liveBytes = totals.allocatedBytes > totals.freedBytes ? totals.allocatedBytes - totals.freedBytes : 0;
+
+            uint64_t peak = counters.peakCount.load(std::memory_order_relaxed);
+            while (totals.liveCount > peak && !counters.peakCount.compare_exchange_weak(peak, totals.liveCount, std::memory_order_relaxed))
+            {
+            }
+            totals.peakCount = std::max(peak, totals.liveCount);
+            peak = counters.peakBytes.load(std::memory_order_relaxed);
+            while (totals.liveBytes > peak && !counters.peakBytes.compare_exchange_weak(peak, totals.liveBytes, std::memory_order_relaxed))
+            {
+            }
+            totals.peakBytes = std::max(peak, totals.liveBytes);
+            return totals;
+        }
+
+        /**
+         * @brief Reads one bucket of a type's size histogram, summed over its shards.
+         * @param counters The counters of the type.
+         * @param index The bucket index.
+         * @return The number of allocations in the bucket.
+         */
+        static uint64_t sizeBucket(const TypeCounters& counters, size_t index) noexcept
+        {
+            uint64_t count = 0;
+            for (const auto& shard : counters.sizes)
+            {
+                count += shard.buckets[index].load(std::memory_order_relaxed);
+            }
+            return count;
+        }
+
+        /**
+         * @brief Reads one bucket of a type's lifetime histogram.
+         * @param counters The counters of the type.
+         * @param index The bucket index.
+         * @return The number of objects in the bucket.
+         */
+        static uint64_t lifetimeBucket(const TypeCounters& counters, size_t index) noexcept
+        {
+            return counters.lifetimes.buckets[index].load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Writes one OpenMetrics histogram series, with cumulative buckets at the non-empty bucket bounds.
+         * Types with an empty histogram are left out.
+         * @param out The writer.
+         * @param name The metric family name.
+         * @param counters The counters of the type.
+         * @param bucketOf Reads one bucket of the histogram.
+         * @param scale Factor converting bucket bounds to the unit of the metric.
+         */
+        static void writeOpenMetricsHistogram(MetricsWriter& out, std::string_view name, const TypeCounters& counters,
+                                              uint64_t (*bucketOf)(const TypeCounters&, size_t), double scale) noexcept
+        {
+            uint64_t total = 0;
+            for (size_t i = 0; i < HistogramBuckets::count; ++i)
+            {
+                total += bucketOf(counters, i);
+            }
+            if (total == 0)
+            {
+                return;
+            }
+
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i + 1 < HistogramBuckets::count; ++i)
+            {
+                const uint64_t count = bucketOf(counters, i);
+                cumulative += count;
+                if (count == 0)
+                {
+                    continue;
+                }
+                out.text(name).text("_bucket{type=").quoted(counters.type, MetricsWriter::Escape::OpenMetricsLabel).text(",le=\"");
+                if (scale == 1.0)
+                {
+                    out.number(HistogramBuckets::upperBound(i));
+                }
+                else
+                {
+                    out.number(static_cast<double>(HistogramBuckets::upperBound(i)) * scale);
+                }
+                out.text("\"} ").number(cumulative).text("\n");
+            }
+            out.text(name).text("_bucket{type=").quoted(counters.type, MetricsWriter::Escape::OpenMetricsLabel)
+               .text(",le=\"+Inf\"} ").number(total).text("\n");
+            out.text(name).text("_count{type=").quoted(counters.type, MetricsWriter::Escape::OpenMetricsLabel)
+               .text("} ").number(total).text("\n");
+        }
+
+        /**
+         * @brief Writes one histogram as a JSON array of [lower, upper, count] triples for its non-empty buckets.
+         * @param out The writer.
+         * @param counters The counters of the type.
+         * @param bucketOf Reads one bucket of the histogram.
+         */
+        static void writeJsonHistogram(MetricsWriter& out, const TypeCounters& counters, uint64_t (*bucketOf)(const TypeCounters&, size_t)) noexcept
+        {
+            out.text("[");
+            bool first = true;
+            for (size_t i = 0; i < HistogramBuckets::count; ++i)
+            {
+                if (const uint64_t count = bucketOf(counters, i))
+                {
+                    out.text(first ? "[" : ",[").number(HistogramBuckets::lowerBound(i)).text(",")
+                       .number(HistogramBuckets::upperBound(i)).text(",").number(count).text("]");
+                    first = false;
+                }
+            }
+            out.text("]");
+        }
+
+        /**
+         * @brief Removes the record of an allocation, if there is one.
+         * @param ptr The pointer to the allocated memory.
+         * @param allocatedAt Receives the time the allocation was tracked, if not null.
+         * @return True if a record was removed.
+         */
+        static bool eraseRecord(void* ptr, std::chrono::steady_clock::time_point* allocatedAt) noexcept
+        {
+            auto& slot = state().trackedFilter[filterSlot(ptr)];
+            if (slot.load(std::memory_order_relaxed) == 0) return false;
+
+            RecordShard& shard = recordShardOf(ptr);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.records.find(ptr);
+            if (it == shard.records.end()) return false;
+
+            if (allocatedAt)
+            {
+                *allocatedAt = it->second.allocated_at;
+            }
+            state().recordedBytes.fetch_sub(it->second.size, std::memory_order_relaxed);
+            state().recordedCount.fetch_sub(1, std::memory_order_relaxed);
+            countTagged(it->second, false);
+            shard.records.erase(it);
+            slot.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        /**
+         * @brief Gets the record shard a pointer belongs to.
+         * @param ptr The pointer.
+         * @return The shard holding the record of ptr, if there is one.
+         */
+        static RecordShard& recordShardOf(const void* ptr) noexcept
+        {
+            return state().recordTable[filterSlot(ptr) % recordShards];
+        }
+
+        /**
+         * @brief Calls a visitor for every allocation record, locking one shard at a time.
+         * Allocations and frees on other shards proceed while a shard is visited.
+         * @tparam Visitor The type of the visitor, callable with a const AllocationInfo&.
+         * @param visit The visitor.
+         */
+        template<typename Visitor>
+        static void forEachRecord(Visitor&& visit)
+        {
+            for (auto& shard : state().recordTable)
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                for (const auto& [ptr, info] : shard.records)
+                {
+                    visit(info);
+                }
+            }
+        }
+
+
+        /**
+         * @brief Captures the call stack of the caller, outside the tracker lock.
+         * @param depth The maximum number of frames to keep.
+         * @return The return addresses, innermost first, without the tracker's own frames.
+         */
+        static std::vector<void*> captureStack(size_t depth) noexcept
+        {
+            std::vector<void*> frames;
+#if defined(MEXMEMORY_HAS_BACKTRACE)
+            // Skip captureStack and trackAllocation themselves.
+            constexpr int skip = 2;
+            void* buffer[maxStackDepth + skip];
+            const int captured = backtrace(buffer, static_cast<int>(std::min(depth, maxStackDepth)) + skip);
+            if (captured > skip)
+            {
+                frames.assign(buffer + skip, buffer + captured);
+            }
+#else
+            (void)depth;
+#endif
+            return frames;
+        }
+
+        /**
+         * @brief Looks up or adds a stack in the stack table. Must be called with the tracker mutex held.
+         * @param frames The captured frames.
+         * @return The id of the stack, or noStack if there are no frames or the table is full.
+         */
+        static uint32_t internStack(std::vector<void*>&& frames)
+        {
+            if (frames.empty())
+            {
+                return noStack;
+            }
+            if (auto it = state().stackIds.find(frames); it != state().stackIds.end())
+            {
+                return it->second;
+            }
+            if (state().stacks.size() >= state().stackTableLimit)
+            {
+                return noStack;
+            }
+            state().stacks.push_back(StackEntry{frames, {}});
+            const auto id = static_cast<uint32_t>(state().stacks.size());
+            state().stackIds.emplace(std::move(frames), id);
+            return id;
+        }
+
+        /**
+         * @brief Resolves a single return address to a readable, demangled name.
+         * @param frame The return address.
+         * @param raw The text produced by backtrace_symbols for the address.
+         * @return The demangled function name with its offset, or the raw text if it cannot be demangled.
+         */
+        static std::string describeFrame(void* frame, const char* raw)
+        {
+            std::string text = raw ? raw : "";
+            // glibc formats frames as "module(mangled+0xoffset) [address]".
+            const auto open = text.find('(');
+            const auto plus = text.find('+', open == std::string::npos ? 0 : open);
+            if (open != std::string::npos && plus != std::string::npos && plus > open + 1)
+            {
+                const std::string mangled = text.substr(open + 1, plus - open - 1);
+                int status = 0;
+                if (char* demangled = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status))
+                {
+                    const auto close = text.find(')', plus);
+                    std::string result = std::string(demangled) + text.substr(plus, close == std::string::npos ? std::string::npos : close - plus);
+                    free(demangled);
+                    return result;
+                }
+            }
+            if (text.empty())
+            {
+                std::ostringstream oss;
+                oss << frame;
+                return oss.str();
+            }
+            return text;
+        }
+
+        /**
+         * @brief Symbolizes a stack on first use. Must be called with the tracker mutex held.
+         * @param id The stack id.
+         * @return The symbols of the stack, innermost first, or an empty vector for noStack.
+         */
+        static const std::vector<std::string>& symbolsOf(uint32_t id)
+        {
+            static const std::vector<std::string> none;
+            if (id == noStack || id > state().stacks.size())
+            {
+                return none;
+            }
+            StackEntry& entry = state().stacks[id - 1];
+            if (entry.symbols.empty())
+            {
+#if defined(MEXMEMORY_HAS_BACKTRACE)
+                char** raw = backtrace_symbols(entry.frames.data(), static_cast<int>(entry.frames.size()));
+                for (size_t i = 0; i < entry.frames.size(); ++i)
+                {
+                    entry.symbols.push_back(describeFrame(entry.frames[i], raw ? raw[i] : nullptr));
+                }
+                free(raw);
+#else
+                for (void* frame : entry.frames)
+                {
+                    entry.symbols.push_back(describeFrame(frame, nullptr));
+                }
+#endif
+                // Drop the library's own frames so the report starts at the caller. The function name is
+                // everything before the argument list, which may include a return type for templates.
+                const auto caller = std::find_if(entry.symbols.begin(), entry.symbols.end(), [](const std::string& symbol) {
+                    return symbol.substr(0, symbol.find('(')).find("memory::refCounting::") == std::string::npos;
+                });
+                if (caller != entry.symbols.end())
+                {
+                    entry.symbols.erase(entry.symbols.begin(), caller);
+                }
+            }
+            return entry.symbols;
+        }
+
+        /**
+         * @brief Gets the filter slot of a pointer.
+         * @param ptr The pointer.
+         * @return The index of the slot counting recorded allocations that hash to it.
+         */
+        static size_t filterSlot(const void* ptr) noexcept
+        {
+            const auto bits = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr) >> 4);
+            return static_cast<size_t>((bits * 0x9E3779B97F4A7C15ull) >> 52) % trackedFilterSlots;
+        }
+
+        /**
+         * @brief Draws the number of bytes until the next sample, exponentially distributed around the interval.
+         * @param interval The mean sampling interval in bytes.
+         * @return The distance to the next sample in bytes, at least 1.
+         */
+        static int64_t nextSampleDistance(size_t interval) noexcept
+        {
+            if (samplingRng_ == 0)
+            {
+                const auto now = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+                samplingRng_ = (now ^ reinterpret_cast<uintptr_t>(&samplingRng_)) | 1;
+            }
+            // xorshift64*; the top 53 bits give a uniform value in (0, 1].
+            samplingRng_ ^= samplingRng_ >> 12;
+            samplingRng_ ^= samplingRng_ << 25;
+            samplingRng_ ^= samplingRng_ >> 27;
+            const double uniform = (static_cast<double>((samplingRng_ * 0x2545F4914F6CDD1Dull) >> 11) + 1.0) / 9007199254740992.0;
+            const double distance = -std::log(uniform) * static_cast<double>(interval);
+            return std::max<int64_t>(1, static_cast<int64_t>(std::min(distance, 9.0e18)));
+        }
+
+        /**
+         * @brief Slow path of sampling, taken when the byte countdown of this thread runs out.
+         * @param bytes The size of the allocation that ran the countdown out.
+         * @param interval The mean sampling interval in bytes.
+         * @return The weight of the allocation if it is sampled, or 0 if it is not.
+         */
+        static double takeSample(size_t bytes, size_t interval) noexcept
+        {
+            if (samplingRng_ == 0)
+            {
+                // First allocation on this thread: start a fresh countdown instead of always sampling it.
+                bytesUntilSample_ = nextSampleDistance(interval) - static_cast<int64_t>(bytes);
+                if (bytesUntilSample_ > 0)
+                {
+                    return 0.0;
+                }
+            }
+            bytesUntilSample_ = nextSampleDistance(interval);
+
+            // An allocation of s bytes is sampled with probability 1 - exp(-s / interval).
+            const double probability = -std::expm1(-static_cast<double>(bytes) / static_cast<double>(interval));
+            return probability > 0.0 ? 1.0 / probability : 1.0;
+        }
+
+    public:
+
+        /**
+         * @brief Gets a copy of the current allocation records, collected one shard at a time.
+         * @return The map of allocations, keyed by pointer.
+         */
+        static std::unordered_map<void*, AllocationInfo> getAllocations()
+        {
+            std::unordered_map<void*, AllocationInfo> allocations;
+            allocations.reserve(state().recordedCount.load(std::memory_order_relaxed));
+            forEachRecord([&allocations](const AllocationInfo& info) {
+                allocations.emplace(info.ptr, info);
+            });
+            return allocations;
+        }
+
+        /**
+         * @brief Calls a visitor for every allocation record without copying the records, locking one shard at
+         * a time. The visitor must not allocate or free tracked objects.
+         * @tparam Visitor The type of the visitor, callable with a const AllocationInfo&.
+         * @param visit The visitor.
+         */
+        template<typename Visitor>
+        static void forEachAllocation(Visitor&& visit)
+        {
+            forEachRecord(std::forward<Visitor>(visit));
+        }
+
+        /**
+         * @brief Gets the mutex guarding the tracker settings and the stack table.
+         * The allocation records are sharded and locked separately, so holding it does not block tracking.
+         * @return A reference to the mutex.
+         */
+        static std::mutex& getMutex() noexcept
+        {
+            return state().mutex;
+        }
+
+        /**
+         * @brief Enables or disables memory allocation tracking.
+         * @param enable The flag to enable or disable tracking.
+         */
+        static void enableTracking(bool enable) noexcept
+        {
+            std::lock_guard<std::mutex> lock(state().mutex);
+            state().enabled = enable;
+        }
+
+        /**
+         * @brief Setter for the breakOnLeak flag.
+         * @param enable The flag to enable or disable breaking on memory leaks.
+         */
+        static void setBreakOnLeak(bool enable) noexcept
+        {
+            state().breakOnLeak = enable;
+        }
+
+        /**
+         * @brief Sets the output stream for leak reports.
+         * @param stream The output stream to use for reporting memory leaks.
+         */
+        static void setLeakStream(std::ostream* stream) noexcept
+        {
+            state().leakStream = stream;
+        }
+
+        /**
+         * @brief Demangles the type name of a given type T.
+         * @tparam T The type to demangle.
+         * @return A string containing the demangled type name.
+         */
+        template<typename T>
+        static std::string demangleTypeName()
+        {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(typeid(T).name(), nullptr, nullptr, &status);
+            if (demangled)
+            {
+                std::string result(demangled);
+                free(demangled);
+                return result;
+            }
+            return typeid(T).name();
+        }
+
+        /**
+         * @brief Tracks a memory allocation for a given pointer and type.
+         * @tparam T The type of the allocated object.
+         * @param ptr The pointer to the allocated memory.
+         * @param count The number of elements allocated (default is 1).
+         * @param file The file where the allocation occurred (default is empty).
+         * @param line The line number where the allocation occurred (default is 0).
+         * @param owner The control block managing the object, if it is owned by Refs.
+         */
+        template<typename T>
+        static void trackAllocation(T* ptr, size_t count = 1, std::string_view file = {}, int line = 0, ControlBlockBase* owner = nullptr)
+        {
+            if (!state().enabled) return;
+
+            const size_t bytes = sizeof(T) * count;
+            countAllocation(countersOf<std::remove_cv_t<T>>(), bytes);
+
+            double weight = 1.0;
+            if (const size_t interval = state().samplingInterval.load(std::memory_order_relaxed))
+            {
+                bytesUntilSample_ -= static_cast<int64_t>(bytes);
+                if (bytesUntilSample_ > 0) return;
+
+                weight = takeSample(bytes, interval);
+                if (weight == 0.0) return;
+            }
+
+            std::string typeName = demangleTypeName<T>();
+            std::vector<void*> frames;
+            if (const size_t depth = state().stackDepth.load(std::memory_order_relaxed))
+            {
+                frames = captureStack(depth);
+            }
+
+            AllocationInfo info{ptr, bytes, typeName, std::string(file), line, weight};
+            info.allocated_at = std::chrono::steady_clock::now();
+            info.tag = currentTag_;
+            info.thread = currentThreadIndex();
+            info.owner = owner;
+            if (!frames.empty())
+            {
+                std::lock_guard<std::mutex> lock(state().mutex);
+                info.stackId = internStack(std::move(frames));
+            }
+
+            RecordShard& shard = recordShardOf(ptr);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            const auto [it, inserted] = shard.records.emplace(ptr, std::move(info));
+            if (inserted)
+            {
+                countTagged(it->second, true);
+                state().trackedFilter[filterSlot(ptr)].fetch_add(1, std::memory_order_relaxed);
+                state().recordedBytes.fetch_add(bytes, std::memory_order_relaxed);
+                state().recordedCount.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * @brief Registers an allocation tag, or looks up one registered before.
+         * Hot scopes should register their tag once and open AllocationTag with the id.
+         * @param name The name of the tag, e.g. the subsystem owning the allocations.
+         * @return The id of the tag, or untagged if maxTags tags are already registered.
+         */
+        static uint32_t registerTag(std::string_view name)
+        {
+            std::lock_guard<std::mutex> lock(state().mutex);
+            std::string key(name);
+            if (auto it = state().tagIds.find(key); it != state().tagIds.end())
+            {
+                return it->second;
+            }
+            const uint32_t id = state().tagCount.load(std::memory_order_relaxed);
+            if (id >= maxTags)
+            {
+                return untagged;
+            }
+            state().tagNames[id] = key;
+            state().tagIds.emplace(std::move(key), id);
+            state().tagCount.store(id + 1, std::memory_order_release);
+            return id;
+        }
+
+        /**
+         * @brief Gets the name of a registered tag.
+         * @param id The id of the tag.
+         * @return The name, or an empty string for untagged and unknown ids.
+         */
+        static std::string getTagName(uint32_t id)
+        {
+            if (id == untagged || id >= state().tagCount.load(std::memory_order_acquire))
+            {
+                return {};
+            }
+            return state().tagNames[id];
+        }
+
+        /**
+         * @brief Gets the tag that allocations on the calling thread are attributed to.
+         * @return The id of the innermost AllocationTag on this thread, or untagged.
+         */
+        static uint32_t getCurrentTag() noexcept
+        {
+            return currentTag_;
+        }
+
+        /**
+         * @brief Gets the index of the calling thread, as recorded in AllocationInfo::thread.
+         * Threads are numbered from 1 in the order in which they first record an allocation.
+         * @return The index of the calling thread.
+         */
+        static uint32_t currentThreadIndex() noexcept
+        {
+            if (threadIndex_ == 0)
+            {
+                threadIndex_ = state().nextThreadIndex.fetch_add(1, std::memory_order_relaxed) + 1;
+            }
+            return threadIndex_;
+        }
+
+        /**
+         * @brief Enables call stack capture for recorded allocations.
+         * Stacks are captured with backtrace(), deduplicated into a stack table and only symbolized when a
+         * report or getStackSymbols needs them. Combined with setSamplingInterval, only sampled allocations pay
+         * for the unwind, which bounds the overhead under load; setStackTableLimit bounds the memory.
+         * @param depth The number of frames to keep per stack, up to maxStackDepth, or 0 to disable capture.
+         */
+        static void setStackCaptureDepth(size_t depth) noexcept
+        {
+            state().stackDepth.store(std::min(depth, maxStackDepth), std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Gets the number of frames captured per allocation stack.
+         * @return The capture depth, or 0 if stacks are not captured.
+         */
+        static size_t getStackCaptureDepth() noexcept
+        {
+            return state().stackDepth.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Limits the number of distinct stacks kept; allocations from further stacks are recorded without one.
+         * @param limit The maximum number of stacks in the stack table.
+         */
+        static void setStackTableLimit(size_t limit) noexcept
+        {
+            std::lock_guard<std::mutex> lock(state().mutex);
+            state().stackTableLimit = limit;
+        }
+
+        /**
+         * @brief Gets the number of distinct stacks captured so far.
+         * @return The size of the stack table.
+         */
+        static size_t getStackCount() noexcept
+        {
+            std::lock_guard<std::mutex> lock(state().mutex);
+            return state().stacks.size();
+        }
+
+        /**
+         * @brief Gets the symbolized frames of a captured stack, starting at the first frame outside the library.
+         * @param stackId The id of the stack, as found in AllocationInfo::stackId.
+         * @return The frames, innermost first, or an empty vector for noStack or an unknown id.
+         */
+        static std::vector<std::string> getStackSymbols(uint32_t stackId)
+        {
+            std::lock_guard<std::mutex> lock(state().mutex);
+            return symbolsOf(stackId);
+        }
+
+        /**
+         * @brief Untracks a memory allocation for a given pointer.
+         * Pointers that were never recorded, such as allocations skipped by sampling, return without taking the lock.
+         * @param ptr The pointer to the allocated memory to untrack.
+         */
+        static void untrackAllocation(void* ptr) noexcept
+        {
+            if (!state().enabled) return;
+            eraseRecord(ptr, nullptr);
+        }
+
+        /**
+         * @brief Untracks a memory allocation of a known type, also updating the live metrics of that type.
+         * @tparam T The type of the allocated object.
+         * @param ptr The pointer to the allocated memory to untrack.
+         * @param count The number of elements allocated (default is 1).
+         */
+        template<typename T, typename = std::enable_if_t<!std::is_void_v<T>>>
+        static void untrackAllocation(T* ptr, size_t count = 1) noexcept
+        {
+            if (!state().enabled) return;
+
+            TypeCounters& counters = countersOf<std::remove_cv_t<T>>();
+            countFree(counters, sizeof(T) * count);
+
+            std::chrono::steady_clock::time_point allocatedAt;
+            if (eraseRecord(const_cast<void*>(static_cast<const volatile void*>(ptr)), &allocatedAt))
+            {
+                const auto lifetime = std::chrono::steady_clock::now() - allocatedAt;
+                counters.lifetimes.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(lifetime).count()));
+            }
+        }
+
+        /**
+         * @brief Gets the size and lifetime histograms, in total and per type, without taking the tracker lock.
+         * Use lifetimes to choose an allocation strategy: types whose objects die young and together suit an
+         * arena, long-lived types of a fixed size suit a pool.
+         * @return The histograms of every type that has been tracked.
+         */
+        static Histograms getHistograms()
+        {
+            Histograms histograms;
+            for (TypeCounters* counters = state().typeRegistry.load(std::memory_order_acquire); counters; counters = counters->next)
+            {
+                TypeHistograms type;
+                type.type = counters->type;
+                for (const auto& shard : counters->sizes)
+                {
+                    type.sizes.add(Histogram::from(shard));
+                }
+                type.lifetimes_ns = Histogram::from(counters->lifetimes);
+                if (type.sizes.total == 0 && type.lifetimes_ns.total == 0)
+                {
+                    continue;
+                }
+                histograms.sizes.add(type.sizes);
+                histograms.lifetimes_ns.add(type.lifetimes_ns);
+                histograms.types.push_back(std::move(type));
+            }
+            return histograms;
+        }
+
+        /**
+         * @brief Prints the size and lifetime histograms of every type, with their medians and 99th percentiles.
+         * @param stream The output stream to print to (default: std::cout).
+         */
+        static void printHistograms(std::ostream* stream = &std::cout)
+        {
+            if (!stream) return;
+
+            const auto histograms = getHistograms();
+            *stream << "\n=== Allocation Histograms ===\n";
+            for (const auto& type : histograms.types)
+            {
+                *stream << type.type << "\n";
+                *stream << "  sizes (bytes): " << type.sizes.total << " allocations, p50 " << type.sizes.percentile(50)
+                       << ", p99 " << type.sizes.percentile(99) << "\n";
+                type.sizes.print(*stream, "B");
+                if (type.lifetimes_ns.total > 0)
+                {
+                    *stream << "  lifetimes (ns): " << type.lifetimes_ns.total << " objects, p50 " << type.lifetimes_ns.percentile(50)
+                           << ", p99 " << type.lifetimes_ns.percentile(99) << "\n";
+                    type.lifetimes_ns.print(*stream, "ns");
+                }
+            }
+            *stream << "=============================\n\n";
+        }
+
+        /**
+         * @brief Gets the live metrics without walking the allocation map or taking the tracker lock.
+         * The cost is proportional to the number of tracked types. Counts are kept for every allocation,
+         * including those skipped by sampling. The process-wide peak is exact; per-type peaks are updated
+         * whenever metrics are read, so they are as fine-grained as the scrape interval.
+         * Frees of objects allocated while tracking was disabled are not matched by an allocation, so live
+         * values are clamped at zero.
+         * @return The current metrics, with one entry per type that has been tracked.
+         */
+        static LiveMetrics getLiveMetrics() noexcept
+        {
+            LiveMetrics metrics;
+            for (TypeCounters* counters = state().typeRegistry.load(std::memory_order_acquire); counters; counters = counters->next)
+            {
+                const CounterTotals totals = totalsOf(*counters);
+                if (totals.allocations == 0 && totals.frees == 0)
+                {
+                    continue;
+                }
+
+                TypeMetrics type;
+                type.type = counters->type;
+                type.live_count = totals.liveCount;
+                type.live_bytes = totals.liveBytes;
+                type.peak_count = totals.peakCount;
+                type.peak_bytes = totals.peakBytes;
+                type.total_allocations = totals.allocations;
+                type.total_allocated_bytes = totals.allocatedBytes;
+                type.total_frees = totals.frees;
+                type.total_freed_bytes = totals.freedBytes;
+
+                metrics.live_count += type.live_count;
+                metrics.total_allocations += type.total_allocations;
+                metrics.total_allocated_bytes += type.total_allocated_bytes;
+                metrics.total_frees += type.total_frees;
+                metrics.total_freed_bytes += type.total_freed_bytes;
+                metrics.types.push_back(std::move(type));
+            }
+            metrics.live_bytes = static_cast<size_t>(std::max<int64_t>(0, state().liveBytes.load(std::memory_order_relaxed)));
+            metrics.peak_bytes = static_cast<size_t>(std::max<int64_t>(0, state().peakBytes.load(std::memory_order_relaxed)));
+
+            const uint32_t tags = state().tagCount.load(std::memory_order_acquire);
+            for (uint32_t id = 1; id < tags; ++id)
+            {
+                const TagCounters& counters = state().tagCounters[id];
+                TagMetrics tag;
+                tag.total_allocations = counters.allocations.load(std::memory_order_relaxed);
+                tag.total_allocated_bytes = counters.allocatedBytes.load(std::memory_order_relaxed);
+                tag.total_frees = counters.frees.load(std::memory_order_relaxed);
+                tag.total_freed_bytes = counters.freedBytes.load(std::memory_order_relaxed);
+                if (tag.total_allocations == 0 && tag.total_frees == 0)
+                {
+                    continue;
+                }
+                tag.tag = state().tagNames[id];
+                tag.id = id;
+                tag.live_count = tag.total_allocations > tag.total_frees ? tag.total_allocations - tag.total_frees : 0;
+                tag.live_bytes = tag.total_allocated_bytes > tag.total_freed_bytes ? tag.total_allocated_bytes - tag.total_freed_bytes : 0;
+                metrics.tags.push_back(std::move(tag));
+            }
+            return metrics;
+        }
+
+        /**
+         * @brief Gets the number of bytes currently allocated by tracked allocations, including unsampled ones.
+         * @return The live byte count, read from a single counter.
+         */
+        static size_t getLiveBytes() noexcept
+        {
+            return static_cast<size_t>(std::max<int64_t>(0, state().liveBytes.load(std::memory_order_relaxed)));
+        }
+
+        /**
+         * @brief Resets all live metrics counters, peaks and histograms to zero, e.g. between test runs.
+         * Objects allocated before the reset are no longer counted when they are freed.
+         */
+        static void resetLiveMetrics() noexcept
+        {
+            for (TypeCounters* counters = state().typeRegistry.load(std::memory_order_acquire); counters; counters = counters->next)
+            {
+                for (MetricShard& shard : counters->shards)
+                {
+                    shard.allocations.store(0, std::memory_order_relaxed);
+                    shard.allocatedBytes.store(0, std::memory_order_relaxed);
+                    shard.frees.store(0, std::memory_order_relaxed);
+                    shard.freedBytes.store(0, std::memory_order_relaxed);
+                }
+                counters->peakCount.store(0, std::memory_order_relaxed);
+                counters->peakBytes.store(0, std::memory_order_relaxed);
+                counters->budgetBytes.store(0, std::memory_order_relaxed);
+                for (auto& shard : counters->sizes)
+                {
+                    shard.reset();
+                }
+                counters->lifetimes.reset();
+            }
+            state().liveBytes.store(0, std::memory_order_relaxed);
+            state().peakBytes.store(0, std::memory_order_relaxed);
+            resetTagCounters();
+        }
+
+        /**
+         * @brief Sets the process-wide budget on live tracked bytes.
+         * Budgets are checked by makeRef, makeRefWithAllocator, makeRefs and tryMakeRef while allocation tracking
+         * is enabled. Allocations racing a check can overshoot a limit by at most one allocation per thread.
+         * @param softLimit Live bytes above which the soft limit callback is called, or 0 for none.
+         * @param hardLimit Live bytes above which allocations are refused, or 0 for none.
+         */
+        static void setGlobalBudget(size_t softLimit, size_t hardLimit) noexcept
+        {
+            state().globalBudget.soft.store(softLimit, std::memory_order_relaxed);
+            state().globalBudget.hard.store(hardLimit, std::memory_order_relaxed);
+            activateBudgets(softLimit, hardLimit);
+        }
+
+        /**
+         * @brief Sets the budget on live bytes of one type. Only objects created as exactly T are charged;
+         * arrays are charged to their element type. Bytes are counted from the current live metrics on.
+         * @tparam T The type to limit.
+         * @param softLimit Live bytes above which the soft limit callback is called, or 0 for none.
+         * @param hardLimit Live bytes above which allocations are refused, or 0 for none.
+         */
+        template<typename T>
+        static void setTypeBudget(size_t softLimit, size_t hardLimit)
+        {
+            TypeCounters& counters = countersOf<std::remove_cv_t<T>>();
+            counters.budget.soft.store(softLimit, std::memory_order_relaxed);
+            counters.budget.hard.store(hardLimit, std::memory_order_relaxed);
+            const bool active = softLimit != 0 || hardLimit != 0;
+            if (active && !counters.budgeted.load(std::memory_order_relaxed))
+            {
+                // The per-type byte count is only maintained while the type has a budget; seed it from the shards.
+                int64_t live = 0;
+                for (const MetricShard& shard : counters.shards)
+                {
+                    live += static_cast<int64_t>(shard.allocatedBytes.load(std::memory_order_relaxed));
+                    live -= static_cast<int64_t>(shard.freedBytes.load(std::memory_order_relaxed));
+                }
+                counters.budgetBytes.store(live, std::memory_order_relaxed);
+            }
+            counters.budgeted.store(active, std::memory_order_relaxed);
+            activateBudgets(softLimit, hardLimit);
+        }
+
+        /**
+         * @brief Sets the budget on live bytes allocated under one AllocationTag.
+         * Tag bytes come from the allocation records, so in sampling mode the limits apply to estimates.
+         * @param tag The id of the tag, as returned by registerTag.
+         * @param softLimit Live bytes above which the soft limit callback is called, or 0 for none.
+         * @param hardLimit Live bytes above which allocations are refused, or 0 for none.
+         */
+        static void setTagBudget(uint32_t tag, size_t softLimit, size_t hardLimit) noexcept
+        {
+            if (tag == untagged || tag >= maxTags)
+            {
+                return;
+            }
+            state().tagBudgets[tag].soft.store(softLimit, std::memory_order_relaxed);
+            state().tagBudgets[tag].hard.store(hardLimit, std::memory_order_relaxed);
+            activateBudgets(softLimit, hardLimit);
+        }
+
+        /**
+         * @brief Removes every global, type and tag budget.
+         */
+        static void clearBudgets() noexcept
+        {
+            state().budgetsActive.store(false, std::memory_order_relaxed);
+            state().globalBudget.soft.store(0, std::memory_order_relaxed);
+            state().globalBudget.hard.store(0, std::memory_order_relaxed);
+            for (BudgetLimits& limits : state().tagBudgets)
+            {
+                limits.soft.store(0, std::memory_order_relaxed);
+                limits.hard.store(0, std::memory_order_relaxed);
+            }
+            for (TypeCounters* counters = state().typeRegistry.load(std::memory_order_acquire); counters; counters = counters->next)
+            {
+                counters->budgeted.store(false, std::memory_order_relaxed);
+                counters->budget.soft.store(0, std::memory_order_relaxed);
+                counters->budget.hard.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * @brief Sets the function called when an allocation takes a budget past its soft limit, e.g. to evict
+         * cache entries. It is called on the allocating thread, once per crossing from below the limit, and
+         * may free tracked objects.
+         * @param callback The function to call, or nullptr for none.
+         */
+        static void setSoftLimitCallback(std::function<void(const BudgetEvent&)> callback)
+        {
+            std::lock_guard<std::mutex> lock(state().mutex);
+            state().softLimitCallback = std::move(callback);
+        }
+
+        /**
+         * @brief Gets the number of allocations refused by hard limits since the process started.
+         * @return The number of refused allocations.
+         */
+        static uint64_t getBudgetRejections() noexcept
+        {
+            return state().budgetRejections.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Checks an allocation against the global budget, the budget of its type and that of the current tag.
+         * Without budgets this is one relaxed load; with them, one relaxed compare per applicable budget.
+         * @tparam T The type about to be allocated.
+         * @param bytes The size of the allocation.
+         * @param exceeded Filled with the budget that refused the allocation; may be null.
+         * @return False if a hard limit refuses the allocation.
+         */
+        template<typename T>
+        static bool withinBudget(size_t bytes, BudgetEvent* exceeded = nullptr)
+        {
+            if (!state().enabled || !state().budgetsActive.load(std::memory_order_relaxed)) return true;
+
+            if (!checkLimit(state().globalBudget, state().liveBytes.load(std::memory_order_relaxed), bytes, BudgetScope::Global, {}, exceeded))
+            {
+                return false;
+            }
+
+            TypeCounters& counters = countersOf<std::remove_cv_t<T>>();
+            if (counters.budgeted.load(std::memory_order_relaxed)
+                && !checkLimit(counters.budget, counters.budgetBytes.load(std::memory_order_relaxed), bytes, BudgetScope::Type, counters.type, exceeded))
+            {
+                return false;
+            }
+
+            if (const uint32_t tag = currentTag_; tag != untagged)
+            {
+                const TagCounters& tagged = state().tagCounters[tag];
+                const auto live = static_cast<int64_t>(tagged.allocatedBytes.load(std::memory_order_relaxed)
+                                                       - tagged.freedBytes.load(std::memory_order_relaxed));
+                return checkLimit(state().tagBudgets[tag], live, bytes, BudgetScope::Tag, state().tagNames[tag], exceeded);
+            }
+            return true;
+        }
+
+        /**
+         * @brief Checks an allocation against the budgets like withinBudget, throwing if a hard limit refuses it.
+         * @tparam T The type about to be allocated.
+         * @param bytes The size of the allocation.
+         * @throws BudgetExceeded If the allocation would take a budget past its hard limit.
+         */
+        template<typename T>
+        static void enforceBudget(size_t bytes)
+        {
+            BudgetEvent exceeded;
+            if (!withinBudget<T>(bytes, &exceeded))
+            {
+                throw BudgetExceeded(std::move(exceeded));
+            }
+        }
+
+        /**
+         * @brief Prints the live metrics, one line per type.
+         * @param stream The output stream to print to (default: std::cout).
+         */
+        static void printLiveMetrics(std::ostream* stream = &std::cout)
+        {
+            if (!stream) return;
+
+            const auto metrics = getLiveMetrics();
+            *stream << "\n=== Live Allocation Metrics ===\n";
+            *stream << "Live: " << metrics.live_count << " objects, " << metrics.live_bytes << " bytes (peak "
+                   << metrics.peak_bytes << " bytes)\n";
+            *stream << "Since start: " << metrics.total_allocations << " allocations, " << metrics.total_frees << " frees\n";
+            for (const auto& type : metrics.types)
+            {
+                *stream << "  " << std::setw(30) << type.type
+                       << ": " << std::setw(8) << type.live_count << " live, "
+                       << std::setw(10) << type.live_bytes << " bytes (peak "
+                       << type.peak_bytes << "), " << type.total_allocations << " allocated\n";
+            }
+            for (const auto& tag : metrics.tags)
+            {
+                *stream << "  tag " << std::setw(26) << tag.tag
+                       << ": " << std::setw(8) << tag.live_count << " live, "
+                       << std::setw(10) << tag.live_bytes << " bytes, " << tag.total_allocations << " allocated\n";
+            }
+            *stream << "===============================\n\n";
+        }
+
+        /**
+         * @brief Writes the live metrics, histograms, high-water marks, per-tag occupancy and huge page and NUMA occupancy in the
+         * OpenMetrics text exposition format. Everything is read from the incremental counters, without walking
+         * the allocation records, taking a lock or allocating memory. As with getLiveMetrics, per-type peaks
+         * include the values seen by this scrape.
+         * @param buffer The buffer to write to.
+         * @param capacity The size of the buffer in bytes.
+         * @return The length of the exposition excluding the terminating null. If it is not smaller than capacity
+         * the output was truncated; retry with a buffer of at least the returned length plus one.
+         */
+        static size_t exportOpenMetrics(char* buffer, size_t capacity) noexcept
+        {
+            MetricsWriter out(buffer, capacity);
+            struct Family
+            {
+                std::string_view name;
+                std::string_view type;
+                std::string_view help;
+                uint64_t CounterTotals::*value;
+            };
+            static constexpr Family families[] = {
+                {"mexmemory_live_objects", "gauge", "Live tracked objects.", &CounterTotals::liveCount},
+                {"mexmemory_live_bytes", "gauge", "Bytes held by live tracked objects.", &CounterTotals::liveBytes},
+                {"mexmemory_peak_objects", "gauge", "High-water mark of live objects.", &CounterTotals::peakCount},
+                {"mexmemory_peak_bytes", "gauge", "High-water mark of live bytes.", &CounterTotals::peakBytes},
+                {"mexmemory_allocations", "counter", "Tracked allocations.", &CounterTotals::allocations},
+                {"mexmemory_allocated_bytes", "counter", "Bytes allocated by tracked allocations.", &CounterTotals::allocatedBytes},
+                {"mexmemory_frees", "counter", "Tracked frees.", &CounterTotals::frees},
+                {"mexmemory_freed_bytes", "counter", "Bytes released by tracked frees.", &CounterTotals::freedBytes},
+            };
+
+            for (const Family& family : families)
+            {
+                const bool counter = family.type == "counter";
+                out.text("# TYPE ").text(family.name).text(" ").text(family.type).text("\n");
+                out.text("# HELP ").text(family.name).text(" ").text(family.help).text("\n");
+                for (TypeCounters* counters = state().typeRegistry.load(std::memory_order_acquire); counters; counters = counters->next)
+                {
+                    const CounterTotals totals = totalsOf(*counters);
+                    if (totals.allocations == 0 && totals.frees == 0)
+                    {
+                        continue;
+                    }
+                    out.text(family.name).text(counter ? "_total{type=" : "{type=")
+                       .quoted(counters->type, MetricsWriter::Escape::OpenMetricsLabel).text("} ").number(totals.*family.value).text("\n");
+                }
+            }
+
+            out.text("# TYPE mexmemory_process_live_bytes gauge\n# HELP mexmemory_process_live_bytes Bytes held by all live tracked objects.\n");
+            out.text("mexmemory_process_live_bytes ").number(getLiveBytes()).text("\n");
+            out.text("# TYPE mexmemory_process_peak_bytes gauge\n# HELP mexmemory_process_peak_bytes High-water mark of all live tracked bytes.\n");
+            out.text("mexmemory_process_peak_bytes ").number(static_cast<uint64_t>(std::max<int64_t>(0, state().peakBytes.load(std::memory_order_relaxed)))).text("\n");
+            out.text("# TYPE mexmemory_budget_rejections counter\n# HELP mexmemory_budget_rejections Allocations refused by hard budget limits.\n");
+            out.text("mexmemory_budget_rejections_total ").number(getBudgetRejections()).text("\n");
+
+            const uint32_t tags = state().tagCount.load(std::memory_order_acquire);
+            out.text("# TYPE mexmemory_tag_live_objects gauge\n# HELP mexmemory_tag_live_objects Live recorded objects by allocation tag.\n");
+            for (uint32_t id = 1; id < tags; ++id)
+            {
+                const TagCounters& counters = state().tagCounters[id];
+                const uint64_t allocations = counters.allocations.load(std::memory_order_relaxed);
+                const uint64_t frees = counters.frees.load(std::memory_order_relaxed);
+                if (allocations > 0)
+                {
+                    out.text("mexmemory_tag_live_objects{tag=").quoted(state().tagNames[id], MetricsWriter::Escape::OpenMetricsLabel)
+                       .text("} ").number(allocations > frees ? allocations - frees : uint64_t{0}).text("\n");
+                }
+            }
+            out.text("# TYPE mexmemory_tag_live_bytes gauge\n# HELP mexmemory_tag_live_bytes Bytes held by live recorded objects by allocation tag.\n");
+            for (uint32_t id = 1; id < tags; ++id)
+            {
+                const TagCounters& counters = state().tagCounters[id];
+                const uint64_t allocated = counters.allocatedBytes.load(std::memory_order_relaxed);
+                const uint64_t freed = counters.freedBytes.load(std::memory_order_relaxed);
+                if (counters.allocations.load(std::memory_order_relaxed) > 0)
+                {
+                    out.text("mexmemory_tag_live_bytes{tag=").quoted(state().tagNames[id], MetricsWriter::Escape::OpenMetricsLabel)
+                       .text("} ").number(allocated > freed ? allocated - freed : uint64_t{0}).text("\n");
+                }
+            }
+
+            out.text("# TYPE mexmemory_allocation_size_bytes histogram\n# HELP mexmemory_allocation_size_bytes Sizes of tracked allocations.\n");
+            for (TypeCounters* counters = state().typeRegistry.load(std::memory_order_acquire); counters; counters = counters->next)
+            {
+                writeOpenMetricsHistogram(out, "mexmemory_allocation_size_bytes", *counters, sizeBucket, 1.0);
+            }
+            out.text("# TYPE mexmemory_object_lifetime_seconds histogram\n# HELP mexmemory_object_lifetime_seconds Time from allocation to the last strong release.\n");
+            for (TypeCounters* counters = state().typeRegistry.load(std::memory_order_acquire); counters; counters = counters->next)
+            {
+                writeOpenMetricsHistogram(out, "mexmemory_object_lifetime_seconds", *counters, lifetimeBucket, 1e-9);
+            }
+
+            out.text("# TYPE mexmemory_huge_page_mappings gauge\n# HELP mexmemory_huge_page_mappings Live huge page mappings.\n");
+            out.text("mexmemory_huge_page_mappings{backing=\"any\"} ").number(static_cast<uint64_t>(state().hugePageAllocations.load(std::memory_order_relaxed))).text("\n");
+            out.text("mexmemory_huge_page_mappings{backing=\"hugetlbfs\"} ").number(static_cast<uint64_t>(state().hugeTlbAllocations.load(std::memory_order_relaxed))).text("\n");
+            out.text("# TYPE mexmemory_huge_page_bytes gauge\n# HELP mexmemory_huge_page_bytes Bytes in live huge page mappings.\n");
+            out.text("mexmemory_huge_page_bytes ").number(static_cast<uint64_t>(state().hugePageBytes.load(std::memory_order_relaxed))).text("\n");
+
+            out.text("# TYPE mexmemory_numa_allocations gauge\n# HELP mexmemory_numa_allocations Live NumaAllocator allocations by node.\n");
+            for (int node = 0; node < maxNumaNodes; ++node)
+            {
+                if (const size_t count = state().numaAllocations[node].load(std::memory_order_relaxed))
+                {
+                    out.text("mexmemory_numa_allocations{node=\"").number(static_cast<int64_t>(node)).text("\"} ").number(static_cast<uint64_t>(count)).text("\n");
+                }
+            }
+            out.text("# TYPE mexmemory_numa_bytes gauge\n# HELP mexmemory_numa_bytes Bytes in live NumaAllocator allocations by node.\n");
+            for (int node = 0; node < maxNumaNodes; ++node)
+            {
+                if (state().numaAllocations[node].load(std::memory_order_relaxed) > 0)
+                {
+                    out.text("mexmemory_numa_bytes{node=\"").number(static_cast<int64_t>(node)).text("\"} ")
+                       .number(static_cast<uint64_t>(state().numaBytes[node].load(std::memory_order_relaxed))).text("\n");
+                }
+            }
+            out.text("# EOF\n");
+            return out.finish();
+        }
+
+        /**
+         * @brief Writes the same data as exportOpenMetrics as a single JSON object. Per-type fields are named as in
+         * TypeMetrics; histograms are arrays of [lower, upper, count] for their non-empty buckets, sizes in bytes
+         * and lifetimes in nanoseconds. Nothing is allocated and no lock is taken.
+         * @param buffer The buffer to write to.
+         * @param capacity The size of the buffer in bytes.
+         * @return The length of the document excluding the terminating null, as for exportOpenMetrics.
+         */
+        static size_t exportJson(char* buffer, size_t capacity) noexcept
+        {
+            MetricsWriter out(buffer, capacity);
+            CounterTotals process;
+            out.text("{\"types\":[");
+            bool first = true;
+            for (TypeCounters* counters = state().typeRegistry.load(std::memory_order_acquire); counters; counters = counters->next)
+            {
+                const CounterTotals totals = totalsOf(*counters);
+                if (totals.allocations == 0 && totals.frees == 0)
+                {
+                    continue;
+                }
+                process.liveCount += totals.liveCount;
+                process.allocations += totals.allocations;
+                process.allocatedBytes += totals.allocatedBytes;
+                process.frees += totals.frees;
+                process.freedBytes += totals.freedBytes;
+
+                out.text(first ? "{\"type\":" : ",{\"type\":").quoted(counters->type, MetricsWriter::Escape::Json)
+                   .text(",\"live_count\":").number(totals.liveCount)
+                   .text(",\"live_bytes\":").number(totals.liveBytes)
+                   .text(",\"peak_count\":").number(totals.peakCount)
+                   .text(",\"peak_bytes\":").number(totals.peakBytes)
+                   .text(",\"total_allocations\":").number(totals.allocations)
+                   .text(",\"total_allocated_bytes\":").number(totals.allocatedBytes)
+                   .text(",\"total_frees\":").number(totals.frees)
+                   .text(",\"total_freed_bytes\":").number(totals.freedBytes)
+                   .text(",\"sizes\":");
+                writeJsonHistogram(out, *counters, sizeBucket);
+                out.text(",\"lifetimes_ns\":");
+                writeJsonHistogram(out, *counters, lifetimeBucket);
+                out.text("}");
+                first = false;
+            }
+
+            out.text("],\"live_count\":").number(process.liveCount)
+               .text(",\"live_bytes\":").number(getLiveBytes())
+               .text(",\"peak_bytes\":").number(static_cast<uint64_t>(std::max<int64_t>(0, state().peakBytes.load(std::memory_order_relaxed))))
+               .text(",\"total_allocations\":").number(process.allocations)
+               .text(",\"total_allocated_bytes\":").number(process.allocatedBytes)
+               .text(",\"total_frees\":").number(process.frees)
+               .text(",\"total_freed_bytes\":").number(process.freedBytes)
+               .text(",\"budget_rejections\":").number(getBudgetRejections())
+               .text(",\"huge_pages\":{\"mappings\":").number(static_cast<uint64_t>(state().hugePageAllocations.load(std::memory_order_relaxed)))
+               .text(",\"hugetlb_mappings\":").number(static_cast<uint64_t>(state().hugeTlbAllocations.load(std::memory_order_relaxed)))
+               .text(",\"bytes\":").number(static_cast<uint64_t>(state().hugePageBytes.load(std::memory_order_relaxed)))
+               .text("},\"numa_nodes\":[");
+            first = true;
+            for (int node = 0; node < maxNumaNodes; ++node)
+            {
+                if (const size_t count = state().numaAllocations[node].load(std::memory_order_relaxed))
+                {
+                    out.text(first ? "{\"node\":" : ",{\"node\":").number(static_cast<int64_t>(node))
+                       .text(",\"allocations\":").number(static_cast<uint64_t>(count))
+                       .text(",\"bytes\":").number(static_cast<uint64_t>(state().numaBytes[node].load(std::memory_order_relaxed))).text("}");
+                    first = false;
+                }
+            }
+            out.text("],\"tags\":[");
+            first = true;
+            const uint32_t tags = state().tagCount.load(std::memory_order_acquire);
+            for (uint32_t id = 1; id < tags; ++id)
+            {
+                const TagCounters& counters = state().tagCounters[id];
+                const uint64_t allocations = counters.allocations.load(std::memory_order_relaxed);
+                if (allocations == 0)
+                {
+                    continue;
+                }
+                const uint64_t frees = counters.frees.load(std::memory_order_relaxed);
+                const uint64_t allocated = counters.allocatedBytes.load(std::memory_order_relaxed);
+                const uint64_t freed = counters.freedBytes.load(std::memory_order_relaxed);
+                out.text(first ? "{\"tag\":" : ",{\"tag\":").quoted(state().tagNames[id], MetricsWriter::Escape::Json)
+                   .text(",\"live_count\":").number(allocations > frees ? allocations - frees : uint64_t{0})
+                   .text(",\"live_bytes\":").number(allocated > freed ? allocated - freed : uint64_t{0})
+                   .text(",\"total_allocations\":").number(allocations)
+                   .text(",\"total_allocated_bytes\":").number(allocated)
+                   .text("}");
+                first = false;
+            }
+            out.text("]}");
+            return out.finish();
+        }
+
+        /**
+         * @brief Switches between recording every allocation and sampling.
+         * In sampling mode an allocation is recorded on average once every interval bytes allocated by a thread,
+         * with Poisson-distributed gaps, so recording cost is independent of the allocation rate.
+         * getStatistics scales sampled records back up to unbiased estimates. Threads pick up a new interval
+         * after their current countdown expires.
+         * @param interval The mean number of bytes between samples, or 0 to record every allocation.
+         */
+        static void setSamplingInterval(size_t interval) noexcept
+        {
+            state().samplingInterval.store(interval, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Gets the sampling interval.
+         * @return The mean number of bytes between samples, or 0 if every allocation is recorded.
+         */
+        static size_t getSamplingInterval() noexcept
+        {
+            return state().samplingInterval.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Records a huge page mapping made by a HugePageAllocator.
+         * These are reported separately from the per-object allocations.
+         * @param bytes The size of the mapping in bytes.
+         * @param hugeTlb True if the mapping is backed by explicit hugetlbfs pages.
+         * @return True if the mapping was recorded and must be untracked later.
+         */
+        static bool trackHugePageMapping(size_t bytes, bool hugeTlb) noexcept
+        {
+            if (!state().enabled) return false;
+            state().hugePageAllocations.fetch_add(1, std::memory_order_relaxed);
+            state().hugePageBytes.fetch_add(bytes, std::memory_order_relaxed);
+            if (hugeTlb)
+            {
+                state().hugeTlbAllocations.fetch_add(1, std::memory_order_relaxed);
+            }
+            return true;
+        }
+
+        /**
+         * @brief Removes a huge page mapping previously recorded with trackHugePageMapping.
+         * @param bytes The size of the mapping in bytes.
+         * @param hugeTlb True if the mapping is backed by explicit hugetlbfs pages.
          */
-        template<typename T>
-        static std::string demangleTypeName()
+        static void untrackHugePageMapping(size_t bytes, bool hugeTlb) noexcept
         {
-            int status = 0;
-            char* demangled = abi::__cxa_demangle(typeid(T).name(), nullptr, nullptr, &status);
-            if (demangled)
+            state().hugePageAllocations.fetch_sub(1, std::memory_order_relaxed);
+            state().hugePageBytes.fetch_sub(bytes, std::memory_order_relaxed);
+            if (hugeTlb)
             {
-                std::string result(demangled);
-                free(demangled);
-                return result;
+                state().hugeTlbAllocations.fetch_sub(1, std::memory_order_relaxed);
             }
-            return typeid(T).name();
         }
 
         /**
-         * @brief Tracks a memory allocation for a given pointer and type.
-         * @tparam T The type of the allocated object.
-         * @param ptr The pointer to the allocated memory.
-         * @param count The number of elements allocated (default is 1).
-         * @param file The file where the allocation occurred (default is empty).
-         * @param line The line number where the allocation occurred (default is 0).
+         * @brief Records an allocation made by a NumaAllocator on a given node.
+         * @param node The node the allocation was placed on.
+         * @param bytes The size of the allocation in bytes.
+         * @return True if the allocation was recorded and must be untracked later.
          */
-        template<typename T>
-        static void trackAllocation(T* ptr, size_t count = 1, const std::string& file = "", int line = 0)
+        static bool trackNumaAllocation(int node, size_t bytes) noexcept
         {
-            if (!enabled_) return;
+            if (!state().enabled || node < 0 || node >= maxNumaNodes) return false;
+            state().numaAllocations[node].fetch_add(1, std::memory_order_relaxed);
+            state().numaBytes[node].fetch_add(bytes, std::memory_order_relaxed);
+            return true;
+        }
 
-            std::lock_guard<std::mutex> lock(mutex_);
-            std::string typeName = demangleTypeName<T>();
-            allocations_.emplace(ptr, AllocationInfo{
-                ptr,
-                sizeof(T) * count,
-                typeName,
-                file,
-                line
-            });
+        /**
+         * @brief Removes an allocation previously recorded with trackNumaAllocation.
+         * @param node The node the allocation was placed on.
+         * @param bytes The size of the allocation in bytes.
+         */
+        static void untrackNumaAllocation(int node, size_t bytes) noexcept
+        {
+            state().numaAllocations[node].fetch_sub(1, std::memory_order_relaxed);
+            state().numaBytes[node].fetch_sub(bytes, std::memory_order_relaxed);
         }
 
         /**
-         * @brief Untracks a memory allocation for a given pointer.
-         * @param ptr The pointer to the allocated memory to untrack.
+         * @brief Clears all tracked memory allocations.
          */
-        static void untrackAllocation(void* ptr) noexcept
+        static void clearAllocations() noexcept
         {
-            if (!enabled_) return;
-            std::lock_guard<std::mutex> lock(mutex_);
-            if (allocations_.contains(ptr))
+            std::lock_guard<std::mutex> lock(state().mutex);
+            for (auto& shard : state().recordTable)
+            {
+                std::lock_guard<std::mutex> shardLock(shard.mutex);
+                shard.records.clear();
+            }
+            state().recordedBytes.store(0, std::memory_order_relaxed);
+            state().recordedCount.store(0, std::memory_order_relaxed);
+            resetTagCounters();
+            state().stackIds.clear();
+            state().stacks.clear();
+            for (auto& slot : state().trackedFilter)
             {
-                allocations_.erase(ptr);
+                slot.store(0, std::memory_order_relaxed);
             }
         }
 
         /**
-         * @brief Clears all tracked memory allocations.
+         * @brief Runs checkLeaks once per process, from whichever LeakDetector is destroyed first.
+         * @return The number of leaked allocations, or 0 if the report was already made.
          */
-        static void clearAllocations() noexcept
+        static size_t checkLeaksAtExit()
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            allocations_.clear();
+            if (state().leaksReported.exchange(true, std::memory_order_acq_rel))
+            {
+                return 0;
+            }
+            return checkLeaks();
         }
 
         /**
@@ -176,31 +1979,37 @@ namespace memory::refCounting
          */
         static size_t checkLeaks()
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            if (allocations_.empty())
+            std::vector<AllocationInfo> leaks;
+            forEachRecord([&leaks](const AllocationInfo& info) {
+                leaks.push_back(info);
+            });
+            if (leaks.empty())
             {
                 return 0;
             }
 
-            *leakStream_ << "\n=== MEMORY LEAKS DETECTION REPORT ===\n";
-            *leakStream_ << std::setw(20) << "Pointer"
-                        << std::setw(10) << "Size"
-                        << std::setw(30) << "Type"
-                        << std::setw(30) << "File"
-                        << std::setw(5) << "Line"
-                        << "\n";
+            std::lock_guard<std::mutex> lock(state().mutex);
+            std::ostream& stream = *state().leakStream;
+
+            stream << "\n=== MEMORY LEAKS DETECTION REPORT ===\n";
+            stream << std::setw(20) << "Pointer"
+                   << std::setw(10) << "Size"
+                   << std::setw(30) << "Type"
+                   << std::setw(30) << "File"
+                   << std::setw(5) << "Line"
+                   << "\n";
 
             size_t totalLeaked = 0;
-            for (const auto& [ptr, info] : allocations_)
+            for (const auto& info : leaks)
             {
-                *leakStream_ << std::setw(20) << info.ptr
-                            << std::setw(10) << info.size
-                            << std::setw(30) << info.type
-                            << std::setw(30) << info.file
-                            << std::setw(5) << info.line
-                            << "\n";
+                stream << std::setw(20) << info.ptr
+                       << std::setw(10) << info.size
+                       << std::setw(30) << info.type
+                       << std::setw(30) << info.file
+                       << std::setw(5) << info.line
+                       << "\n";
 
-                if (!info.file.empty() && breakOnLeak_)
+                if (!info.file.empty() && state().breakOnLeak)
                 {
                     std::ostringstream oss;
                     oss << "Memory leak detected at " << info.file << ":" << info.line
@@ -212,40 +2021,92 @@ namespace memory::refCounting
                 totalLeaked += info.size;
             }
 
-            *leakStream_ << "\nTotal leaked memory: " << totalLeaked << " bytes\n";
-            *leakStream_ << "====================================\n";
+            stream << "\nTotal leaked memory: " << totalLeaked << " bytes\n";
+            printLeaksByStack(leaks);
+            stream << "====================================\n";
 
-            if (breakOnLeak_)
+            if (state().breakOnLeak)
             {
                 abort();
             }
 
-            return allocations_.size();
+            return leaks.size();
+        }
+
+        /**
+         * @brief Writes the leaked allocations grouped by allocating stack, largest first.
+         * Must be called with the tracker mutex held; does nothing if no stacks were captured.
+         * @param leaks The leaked allocations.
+         */
+        static void printLeaksByStack(const std::vector<AllocationInfo>& leaks)
+        {
+            struct Group
+            {
+                size_t count = 0;
+                size_t bytes = 0;
+                std::string type;
+            };
+
+            std::unordered_map<uint32_t, Group> groups;
+            for (const auto& info : leaks)
+            {
+                if (info.stackId == noStack)
+                {
+                    continue;
+                }
+                Group& group = groups[info.stackId];
+                ++group.count;
+                group.bytes += info.size;
+                if (group.type.empty())
+                {
+                    group.type = info.type;
+                }
+                else if (group.type != info.type && group.type.find(info.type) == std::string::npos)
+                {
+                    group.type += ", " + info.type;
+                }
+            }
+            if (groups.empty())
+            {
+                return;
+            }
+
+            std::vector<std::pair<uint32_t, Group>> sorted(groups.begin(), groups.end());
+            std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+                return a.second.bytes > b.second.bytes;
+            });
+
+            std::ostream& stream = *state().leakStream;
+            stream << "\nLeaks by allocating stack:\n";
+            for (const auto& [id, group] : sorted)
+            {
+                stream << "  stack #" << id << ": " << group.count << " allocations, "
+                       << group.bytes << " bytes (" << group.type << ")\n";
+                for (const auto& symbol : symbolsOf(id))
+                {
+                    stream << "      at " << symbol << "\n";
+                }
+            }
         }
 
         /**
          * @brief Gets the number of currently tracked allocations.
+         * In sampling mode this is the number of samples; see getStatistics for estimates.
          * @return The number of tracked allocations.
          */
         static size_t getAllocationCount() noexcept
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            return allocations_.size();
+            return state().recordedCount.load(std::memory_order_relaxed);
         }
 
         /**
          * @brief Gets the total number of bytes allocated across all tracked allocations.
+         * Kept up to date as records are added and removed, so this does not lock or walk the map.
          * @return The total number of bytes allocated.
          */
         static size_t getTotalAllocatedBytes() noexcept
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            size_t total = 0;
-            for (const auto& [ptr, info] : allocations_)
-            {
-                total += info.size;
-            }
-            return total;
+            return state().recordedBytes.load(std::memory_order_relaxed);
         }
 
         /**
@@ -260,28 +2121,90 @@ namespace memory::refCounting
             double average_allocation_size{0.0};
             std::unordered_map<std::string, size_t> allocations_by_type;
             std::unordered_map<std::string, size_t> bytes_by_type;
+            size_t huge_page_allocations{0};
+            size_t huge_page_bytes{0};
+            size_t huge_tlb_allocations{0};
+            std::unordered_map<int, size_t> allocations_by_node;
+            std::unordered_map<int, size_t> bytes_by_node;
+            size_t sampling_interval{0};
+            size_t sampled_allocations{0};
+            std::unordered_map<uint32_t, size_t> allocations_by_stack;
+            std::unordered_map<uint32_t, size_t> bytes_by_stack;
+            std::unordered_map<std::string, size_t> allocations_by_tag;
+            std::unordered_map<std::string, size_t> bytes_by_tag;
+            std::unordered_map<uint32_t, size_t> allocations_by_thread;
+            std::unordered_map<uint32_t, size_t> bytes_by_thread;
         };
 
         /**
          * @brief Gets detailed memory usage statistics.
+         * In sampling mode the counts and byte totals are estimates, obtained by weighting each sample
+         * by the inverse of its sampling probability.
          * @return MemoryStatistics structure containing detailed information.
          */
         static MemoryStatistics getStatistics() noexcept
         {
-            std::lock_guard<std::mutex> lock(mutex_);
             MemoryStatistics stats;
+            stats.sampling_interval = state().samplingInterval.load(std::memory_order_relaxed);
 
-            stats.total_allocations = allocations_.size();
-            
-            for (const auto& [ptr, info] : allocations_)
-            {
-                stats.total_bytes += info.size;
+            double estimatedAllocations = 0.0;
+            double estimatedBytes = 0.0;
+            std::unordered_map<std::string, std::pair<double, double>> estimatedByType;
+            std::unordered_map<uint32_t, std::pair<double, double>> estimatedByStack;
+            std::unordered_map<uint32_t, std::pair<double, double>> estimatedByTag;
+            std::unordered_map<uint32_t, std::pair<double, double>> estimatedByThread;
+            forEachRecord([&](const AllocationInfo& info) {
+                ++stats.sampled_allocations;
+                const double bytes = info.weight * static_cast<double>(info.size);
+                estimatedAllocations += info.weight;
+                estimatedBytes += bytes;
                 stats.largest_allocation = std::max(stats.largest_allocation, info.size);
                 stats.smallest_allocation = std::min(stats.smallest_allocation, info.size);
                 
                 // Count by type
-                stats.allocations_by_type[info.type]++;
-                stats.bytes_by_type[info.type] += info.size;
+                auto& [count, typeBytes] = estimatedByType[info.type];
+                count += info.weight;
+                typeBytes += bytes;
+
+                if (info.stackId != noStack)
+                {
+                    auto& [stackCount, stackBytes] = estimatedByStack[info.stackId];
+                    stackCount += info.weight;
+                    stackBytes += bytes;
+                }
+                if (info.tag != untagged)
+                {
+                    auto& [tagCount, tagBytes] = estimatedByTag[info.tag];
+                    tagCount += info.weight;
+                    tagBytes += bytes;
+                }
+                auto& [threadCount, threadBytes] = estimatedByThread[info.thread];
+                threadCount += info.weight;
+                threadBytes += bytes;
+            });
+
+            stats.total_allocations = static_cast<size_t>(std::llround(estimatedAllocations));
+            stats.total_bytes = static_cast<size_t>(std::llround(estimatedBytes));
+            for (const auto& [type, estimate] : estimatedByType)
+            {
+                stats.allocations_by_type[type] = static_cast<size_t>(std::llround(estimate.first));
+                stats.bytes_by_type[type] = static_cast<size_t>(std::llround(estimate.second));
+            }
+            for (const auto& [id, estimate] : estimatedByStack)
+            {
+                stats.allocations_by_stack[id] = static_cast<size_t>(std::llround(estimate.first));
+                stats.bytes_by_stack[id] = static_cast<size_t>(std::llround(estimate.second));
+            }
+            for (const auto& [id, estimate] : estimatedByTag)
+            {
+                const std::string name = getTagName(id);
+                stats.allocations_by_tag[name] = static_cast<size_t>(std::llround(estimate.first));
+                stats.bytes_by_tag[name] = static_cast<size_t>(std::llround(estimate.second));
+            }
+            for (const auto& [thread, estimate] : estimatedByThread)
+            {
+                stats.allocations_by_thread[thread] = static_cast<size_t>(std::llround(estimate.first));
+                stats.bytes_by_thread[thread] = static_cast<size_t>(std::llround(estimate.second));
             }
 
             if (stats.total_allocations > 0)
@@ -293,6 +2216,20 @@ namespace memory::refCounting
                 stats.smallest_allocation = 0;
             }
 
+            stats.huge_page_allocations = state().hugePageAllocations.load(std::memory_order_relaxed);
+            stats.huge_page_bytes = state().hugePageBytes.load(std::memory_order_relaxed);
+            stats.huge_tlb_allocations = state().hugeTlbAllocations.load(std::memory_order_relaxed);
+
+            for (int node = 0; node < maxNumaNodes; ++node)
+            {
+                const size_t count = state().numaAllocations[node].load(std::memory_order_relaxed);
+                if (count > 0)
+                {
+                    stats.allocations_by_node[node] = count;
+                    stats.bytes_by_node[node] = state().numaBytes[node].load(std::memory_order_relaxed);
+                }
+            }
+
             return stats;
         }
 
@@ -308,6 +2245,11 @@ namespace memory::refCounting
             
             *stream << "\n=== Memory Usage Statistics ===\n";
             *stream << "Total allocations: " << stats.total_allocations << "\n";
+            if (stats.sampling_interval > 0)
+            {
+                *stream << "Sampling: 1 per " << stats.sampling_interval << " bytes, "
+                       << stats.sampled_allocations << " samples (totals are estimates)\n";
+            }
             *stream << "Total bytes: " << stats.total_bytes << "\n";
             
             if (stats.total_allocations > 0)
@@ -329,6 +2271,66 @@ namespace memory::refCounting
                            << std::setw(10) << bytes << " bytes\n";
                 }
             }
+
+            if (!stats.allocations_by_tag.empty())
+            {
+                *stream << "\nAllocations by tag:\n";
+                for (const auto& [tag, count] : stats.allocations_by_tag)
+                {
+                    *stream << "  " << std::setw(30) << tag
+                           << ": " << std::setw(6) << count << " allocations, "
+                           << std::setw(10) << stats.bytes_by_tag.at(tag) << " bytes\n";
+                }
+            }
+
+            if (stats.allocations_by_thread.size() > 1)
+            {
+                *stream << "\nAllocations by thread:\n";
+                for (const auto& [thread, count] : stats.allocations_by_thread)
+                {
+                    *stream << "  thread " << std::setw(4) << thread
+                           << ": " << std::setw(6) << count << " allocations, "
+                           << std::setw(10) << stats.bytes_by_thread.at(thread) << " bytes\n";
+                }
+            }
+
+            if (stats.huge_page_allocations > 0)
+            {
+                *stream << "\nHuge page mappings: " << stats.huge_page_allocations
+                       << " (" << stats.huge_tlb_allocations << " hugetlbfs), "
+                       << stats.huge_page_bytes << " bytes\n";
+            }
+
+            if (!stats.allocations_by_node.empty())
+            {
+                *stream << "\nNUMA allocations by node:\n";
+                for (const auto& [node, count] : stats.allocations_by_node)
+                {
+                    *stream << "  node " << std::setw(2) << node
+                           << ": " << std::setw(6) << count << " allocations, "
+                           << std::setw(10) << stats.bytes_by_node.at(node) << " bytes\n";
+                }
+            }
+
+            if (!stats.bytes_by_stack.empty())
+            {
+                std::vector<std::pair<uint32_t, size_t>> stacks(stats.bytes_by_stack.begin(), stats.bytes_by_stack.end());
+                std::sort(stacks.begin(), stacks.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+                if (stacks.size() > 10)
+                {
+                    stacks.resize(10);
+                }
+
+                *stream << "\nTop allocating stacks:\n";
+                for (const auto& [id, bytes] : stacks)
+                {
+                    const auto symbols = getStackSymbols(id);
+                    *stream << "  stack #" << std::setw(4) << id
+                           << ": " << std::setw(6) << stats.allocations_by_stack.at(id) << " allocations, "
+                           << std::setw(10) << bytes << " bytes"
+                           << (symbols.empty() ? "" : "  at " + symbols.front()) << "\n";
+                }
+            }
             *stream << "==============================\n\n";
         }
 
@@ -339,19 +2341,327 @@ namespace memory::refCounting
          */
         static std::vector<AllocationInfo> getAllocationsByType(const std::string& typeName) noexcept
         {
-            std::lock_guard<std::mutex> lock(mutex_);
             std::vector<AllocationInfo> result;
-            
-            for (const auto& [ptr, info] : allocations_)
-            {
+            forEachRecord([&](const AllocationInfo& info) {
                 if (info.type == typeName)
                 {
                     result.push_back(info);
                 }
+            });
+
+            return result;
+        }
+
+        /**
+         * @brief Live allocations of one type from one call site.
+         * The call site is the captured stack if there is one, and the file and line given to trackAllocation otherwise.
+         * In sampling mode count and bytes are estimates.
+         */
+        struct SiteUsage
+        {
+            std::string type;
+            uint32_t stackId{noStack};
+            std::string file;
+            int line{0};
+            size_t count{0};
+            size_t bytes{0};
+        };
+
+        /**
+         * @brief HeapSnapshot is an immutable view of the live allocations at one point in time,
+         * grouped by type and call site so that it stays small however many objects are alive.
+         */
+        class HeapSnapshot
+        {
+        public:
+
+            /**
+             * @brief Gets the live allocations grouped by type and call site.
+             * @return The sites, ordered by type, stack id, file and line.
+             */
+            const std::vector<SiteUsage>& sites() const noexcept
+            {
+                return sites_;
+            }
+
+            /**
+             * @brief Gets the number of live allocations.
+             * @return The number of allocations in the snapshot.
+             */
+            size_t count() const noexcept
+            {
+                return count_;
+            }
+
+            /**
+             * @brief Gets the number of live bytes.
+             * @return The number of bytes in the snapshot.
+             */
+            size_t bytes() const noexcept
+            {
+                return bytes_;
+            }
+
+            /**
+             * @brief Gets the time the snapshot was taken.
+             * @return The time the first shard was visited.
+             */
+            std::chrono::steady_clock::time_point takenAt() const noexcept
+            {
+                return takenAt_;
+            }
+
+        private:
+            friend class AllocationTracker;
+
+            std::vector<SiteUsage> sites_;
+            size_t count_{0};
+            size_t bytes_{0};
+            std::chrono::steady_clock::time_point takenAt_{};
+        };
+
+        /**
+         * @brief Change of one call site between two snapshots.
+         */
+        struct SiteGrowth
+        {
+            std::string type;
+            uint32_t stackId{noStack};
+            std::string file;
+            int line{0};
+            int64_t count_delta{0};
+            int64_t bytes_delta{0};
+            size_t count{0};
+            size_t bytes{0};
+        };
+
+        /**
+         * @brief Change of one type between two snapshots.
+         */
+        struct TypeGrowth
+        {
+            std::string type;
+            int64_t count_delta{0};
+            int64_t bytes_delta{0};
+            size_t count{0};
+            size_t bytes{0};
+        };
+
+        /**
+         * @brief Difference between two snapshots. Types and sites that did not change are left out;
+         * the others are ordered by byte growth, largest first. count and bytes are those of the later snapshot.
+         */
+        struct SnapshotDiff
+        {
+            std::chrono::nanoseconds elapsed{0};
+            int64_t count_delta{0};
+            int64_t bytes_delta{0};
+            std::vector<TypeGrowth> types;
+            std::vector<SiteGrowth> sites;
+        };
+
+        /**
+         * @brief Takes a snapshot of the live allocations, for leak hunting in processes that never exit.
+         * The records are aggregated one shard at a time, so tracking on the other shards is never blocked and
+         * the cost is linear in the number of live records. The snapshot is therefore not atomic: allocations made
+         * or freed while it is taken may or may not be in it.
+         * Stack ids stay valid until clearAllocations; resolve them with getStackSymbols.
+         * @return The snapshot.
+         */
+        static HeapSnapshot snapshot()
+        {
+            HeapSnapshot result;
+            result.takenAt_ = std::chrono::steady_clock::now();
+
+            std::unordered_set<std::string> strings;
+            std::unordered_map<SiteKey, std::pair<double, double>, SiteKeyHash> sites;
+            for (auto& shard : state().recordTable)
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                for (const auto& [ptr, info] : shard.records)
+                {
+                    const SiteKey key{*strings.insert(info.type).first, info.stackId, *strings.insert(info.file).first, info.line};
+                    auto& [count, bytes] = sites[key];
+                    count += info.weight;
+                    bytes += info.weight * static_cast<double>(info.size);
+                }
             }
-            
+
+            result.sites_.reserve(sites.size());
+            for (const auto& [key, estimate] : sites)
+            {
+                SiteUsage usage{std::string(key.type), key.stackId, std::string(key.file), key.line,
+                                static_cast<size_t>(std::llround(estimate.first)), static_cast<size_t>(std::llround(estimate.second))};
+                result.count_ += usage.count;
+                result.bytes_ += usage.bytes;
+                result.sites_.push_back(std::move(usage));
+            }
+            std::sort(result.sites_.begin(), result.sites_.end(), siteLess);
+            return result;
+        }
+
+        /**
+         * @brief Compares two snapshots by type and call site.
+         * Take two snapshots some time apart in a running service; sites that keep growing point at slow leaks.
+         * @param before The earlier snapshot.
+         * @param after The later snapshot.
+         * @return The growth of every type and site that changed.
+         */
+        static SnapshotDiff diff(const HeapSnapshot& before, const HeapSnapshot& after)
+        {
+            SnapshotDiff result;
+            result.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(after.takenAt() - before.takenAt());
+            result.count_delta = static_cast<int64_t>(after.count()) - static_cast<int64_t>(before.count());
+            result.bytes_delta = static_cast<int64_t>(after.bytes()) - static_cast<int64_t>(before.bytes());
+
+            std::unordered_map<std::string, TypeGrowth> types;
+            auto a = before.sites().begin();
+            auto b = after.sites().begin();
+            while (a != before.sites().end() || b != after.sites().end())
+            {
+                const bool takeBefore = b == after.sites().end() || (a != before.sites().end() && !siteLess(*b, *a));
+                const bool takeAfter = a == before.sites().end() || (b != after.sites().end() && !siteLess(*a, *b));
+                const SiteUsage& site = takeAfter ? *b : *a;
+
+                SiteGrowth growth{site.type, site.stackId, site.file, site.line};
+                if (takeAfter)
+                {
+                    growth.count = b->count;
+                    growth.bytes = b->bytes;
+                    ++b;
+                }
+                growth.count_delta = static_cast<int64_t>(growth.count);
+                growth.bytes_delta = static_cast<int64_t>(growth.bytes);
+                if (takeBefore)
+                {
+                    growth.count_delta -= static_cast<int64_t>(a->count);
+                    growth.bytes_delta -= static_cast<int64_t>(a->bytes);
+                    ++a;
+                }
+
+                TypeGrowth& type = types[growth.type];
+                type.count += growth.count;
+                type.bytes += growth.bytes;
+                type.count_delta += growth.count_delta;
+                type.bytes_delta += growth.bytes_delta;
+                if (growth.count_delta != 0 || growth.bytes_delta != 0)
+                {
+                    result.sites.push_back(std::move(growth));
+                }
+            }
+
+            for (auto& [name, type] : types)
+            {
+                if (type.count_delta != 0 || type.bytes_delta != 0)
+                {
+                    type.type = name;
+                    result.types.push_back(std::move(type));
+                }
+            }
+
+            const auto byGrowth = [](const auto& x, const auto& y) {
+                return std::tie(y.bytes_delta, y.count_delta) < std::tie(x.bytes_delta, x.count_delta);
+            };
+            std::sort(result.types.begin(), result.types.end(), byGrowth);
+            std::sort(result.sites.begin(), result.sites.end(), byGrowth);
             return result;
         }
+
+        /**
+         * @brief Prints the difference between two snapshots, largest growth first.
+         * @param diff The difference, as returned by diff.
+         * @param stream The output stream to print to (default: std::cout).
+         * @param limit The maximum number of call sites to print.
+         */
+        static void printDiff(const SnapshotDiff& diff, std::ostream* stream = &std::cout, size_t limit = 10)
+        {
+            if (!stream) return;
+
+            *stream << "\n=== Heap Snapshot Diff ===\n";
+            *stream << "Elapsed: " << std::chrono::duration_cast<std::chrono::milliseconds>(diff.elapsed).count() << " ms, "
+                   << std::showpos << diff.count_delta << " allocations, " << diff.bytes_delta << " bytes" << std::noshowpos << "\n";
+
+            if (!diff.types.empty())
+            {
+                *stream << "\nGrowth by type:\n";
+                for (const auto& type : diff.types)
+                {
+                    *stream << "  " << std::setw(30) << type.type << ": " << std::showpos << std::setw(8) << type.count_delta
+                           << " allocations, " << std::setw(10) << type.bytes_delta << " bytes" << std::noshowpos
+                           << " (now " << type.count << ", " << type.bytes << " bytes)\n";
+                }
+            }
+
+            if (!diff.sites.empty())
+            {
+                *stream << "\nGrowth by call site:\n";
+                for (size_t i = 0; i < diff.sites.size() && i < limit; ++i)
+                {
+                    const SiteGrowth& site = diff.sites[i];
+                    std::string location = site.file.empty() ? "unknown" : site.file + ":" + std::to_string(site.line);
+                    if (site.stackId != noStack)
+                    {
+                        const auto symbols = getStackSymbols(site.stackId);
+                        location = "stack #" + std::to_string(site.stackId) + (symbols.empty() ? "" : " at " + symbols.front());
+                    }
+                    *stream << "  " << std::showpos << std::setw(8) << site.count_delta << " allocations, "
+                           << std::setw(10) << site.bytes_delta << " bytes" << std::noshowpos
+                           << "  " << site.type << "  " << location << "\n";
+                }
+            }
+            *stream << "==========================\n\n";
+        }
+
+    private:
+
+        /**
+         * @brief Orders call sites by type, stack id, file and line.
+         * @param a The first site.
+         * @param b The second site.
+         * @return True if a comes before b.
+         */
+        static bool siteLess(const SiteUsage& a, const SiteUsage& b) noexcept
+        {
+            return std::tie(a.type, a.stackId, a.file, a.line) < std::tie(b.type, b.stackId, b.file, b.line);
+        }
+    };
+
+    /**
+     * @brief AllocationTag attributes the allocations this thread records to a named tag while it is alive.
+     * Tags nest; the innermost one wins. Opening a tag by id is a pair of thread-local stores.
+     */
+    class AllocationTag
+    {
+    public:
+
+        /**
+         * @brief Constructs a tag scope, registering the name if it is new.
+         * @param name The name of the tag.
+         */
+        explicit AllocationTag(std::string_view name) : AllocationTag(AllocationTracker::registerTag(name)) {}
+
+        /**
+         * @brief Constructs a tag scope for a tag returned by AllocationTracker::registerTag.
+         * @param id The id of the tag.
+         */
+        explicit AllocationTag(uint32_t id) noexcept : previous_(AllocationTracker::currentTag_)
+        {
+            AllocationTracker::currentTag_ = id;
+        }
+
+        /**
+         * @brief Restores the tag that was in effect before this scope.
+         */
+        ~AllocationTag()
+        {
+            AllocationTracker::currentTag_ = previous_;
+        }
+
+        AllocationTag(const AllocationTag&) = delete;
+        AllocationTag& operator=(const AllocationTag&) = delete;
+
+    private:
+        uint32_t previous_;
     };
 
     /// @brief LeakDetector class to automatically check for memory leaks on destruction. \class LeakDetector
@@ -364,16 +2674,23 @@ namespace memory::refCounting
          */
         ~LeakDetector()
         {
-            AllocationTracker::checkLeaks();
+            AllocationTracker::checkLeaksAtExit();
         }
     };
 
-    static inline LeakDetector globalLeakDetector;
+    /**
+     * @brief Reports leaks at exit. Every shared object built with this header has one; only the first to be
+     * destroyed reports, and the tracker it reports from outlives all of them.
+     */
+    inline LeakDetector globalLeakDetector;
 }
 
 #define TRACK_ALLOC(ptr) \
     memory::refCounting::AllocationTracker::trackAllocation(ptr, 1, __FILE__, __LINE__)
 
+#define TRACK_REF_ALLOC(ptr, block) \
+    memory::refCounting::AllocationTracker::trackAllocation(ptr, 1, __FILE__, __LINE__, block)
+
 #define UNTRACK_ALLOC(ptr) \
     memory::refCounting::AllocationTracker::untrackAllocation(ptr)
 
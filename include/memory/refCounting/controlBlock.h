@@ -2,11 +2,17 @@
 #define MEXMEMORY_CONTROLBLOCK_H
 
 #include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <utility>
 #include <iostream>
 #include <string_view>
+#include <vector>
 #include <memory/refCounting/allocationMap.h>
+#include <memory/refCounting/ownershipGraph.h>
+#include <memory/refCounting/refTrace.h>
+#include <memory/refCounting/refVisitor.h>
 
 /// @brief memory::refCounting namespace, which contains the ControlBlock class for reference counting memory management \namespace memory::refCounting
 namespace memory::refCounting
@@ -33,33 +39,13 @@ namespace memory::refCounting
         template <typename... Args>
         static T* allocate(Args&&... args) { return new T(std::forward<Args>(args)...); }
 
-        /**
-         * @brief Deallocates memory for a polymorphic object of type T.
-         * @tparam U The type of the object to deallocate, which must be polymorphic.
-         * @param ptr The pointer to the object to deallocate.
-         */
-        template <typename U>
-        static void deallocate_polymorphic(U* ptr)
-        {
-            delete ptr;
-        }
-
         /**
          * @brief Deallocates memory for a single object of type T.
+         * The control block always calls this with the type the object was created as,
+         * so no virtual destructor or runtime type check is needed.
          * @param ptr The pointer to the object to deallocate.
          */
-        static void deallocate(T* ptr)
-        {
-            if constexpr (std::is_polymorphic_v<T>)
-            {
-                deallocate_polymorphic(ptr);
-                //delete ptr;
-            }
-            else
-            {
-                delete ptr;
-            }
-        }
+        static void deallocate(T* ptr) { delete ptr; }
     };
 
     /**
@@ -93,173 +79,466 @@ namespace memory::refCounting
     };
 
     /**
-     * @brief ControlBlock is a reference counting control block for managing the lifetime of objects.
-     * It supports strong and weak references, and provides thread-safe reference counting.
-     * @tparam T The type of object being managed.
-     * @tparam Allocator The allocator to use for memory management (default is DefaultAllocator).
+     * @brief Operations a control block performs through its disposer: destroying the object and freeing the block
+     * when the counts drop to zero, and tracing the object for the CycleCollector.
      */
-    template <typename T, typename Allocator = DefaultAllocator<T>>
-    class ControlBlock
+    enum class DisposeOp
+    {
+        Object,
+        Block,
+        Trace
+    };
+
+    class ControlBlockBase;
+
+    /**
+     * @brief Type-erased disposal function chosen when a control block is created.
+     * It knows the exact type of the object and of the block, so Refs of any instantiation can share a block.
+     * DisposeOp::Object also untracks the object, since only the disposer knows its type and size, and removes it
+     * from the OwnershipGraph.
+     * The visitor is only used by DisposeOp::Trace and is null otherwise.
+     */
+    using Disposer = void (*)(ControlBlockBase* block, DisposeOp op, RefVisitor* visitor);
+
+    /**
+     * @brief RefSlab is the header of a single allocation holding the control blocks and objects of a batch
+     * created with makeRefs. The slab is returned to the heap when its last control block is released.
+     */
+    struct RefSlab
+    {
+        std::atomic<size_t> liveBlocks;
+        std::align_val_t alignment;
+
+        /**
+         * @brief Constructs a slab header for a given number of control blocks.
+         * @param blocks The number of control blocks that will live in the slab.
+         * @param align The alignment the slab memory was allocated with.
+         */
+        RefSlab(size_t blocks, std::align_val_t align) noexcept : liveBlocks(blocks), alignment(align) {}
+
+        /**
+         * @brief Releases one control block, freeing the slab memory if it was the last one.
+         */
+        void release() noexcept
+        {
+            if (liveBlocks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                const std::align_val_t align = alignment;
+                this->~RefSlab();
+                ::operator delete(static_cast<void*>(this), align);
+            }
+        }
+    };
+
+    /**
+     * @brief PossibleRoots is the buffer of control blocks that may be part of a garbage cycle. While cycle
+     * collection is enabled, a block is added when a strong reference to it is dropped and others remain;
+     * CycleCollector::collectCycles drains it. A buffered block is kept allocated until it is drained.
+     *
+     * It also holds the epoch a collection runs in. Once collection has been enabled, dropping a strong reference
+     * announces itself in a per-thread slot, so the collector can wait for the drops in progress; while an epoch
+     * is open, releasing the last one is deferred to the end of the epoch, so no object or block the collector
+     * may be tracing is freed under it.
+     */
+    class PossibleRoots
     {
     public:
 
         /**
-         * @brief Constructs a ControlBlock with a pointer to an object of type T.
-         * @param ptr The pointer to the object.
+         * @brief Checks if blocks are buffered when strong references are dropped.
+         * @return True if cycle collection is enabled.
          */
-        explicit ControlBlock(T* ptr) : objectPtr(ptr)
+        static bool isEnabled() noexcept
         {
-            TRACK_ALLOC(ptr);
-            logCreation();
+            return state().enabled.load(std::memory_order_relaxed);
         }
 
         /**
-         * @brief Constructs a ControlBlock with constructor arguments for the object of type T. (with our Allocator)
-         * @tparam Args The types of the constructor arguments.
-         * @param args The constructor arguments.
+         * @brief Gets the number of buffered blocks.
+         * @return The number of blocks waiting for the next collection.
          */
-        template <typename... Args>
-        explicit ControlBlock(Args&&... args) : objectPtr(Allocator::allocate(std::forward<Args>(args)...)), typeInfo(&typeid(T))
+        static size_t size()
         {
-            TRACK_ALLOC(objectPtr);
-            logCreation();
+            State& roots = state();
+            std::lock_guard<std::mutex> lock(roots.mutex);
+            return roots.blocks.size();
         }
 
+    private:
+        friend class ControlBlockBase;
+        friend class CycleCollector;
+
+        static constexpr size_t releaseSlots = 16;
+
         /**
-         * @brief Default constructor for ControlBlock, initializes with a nullptr object pointer.
+         * @brief Number of strong references being dropped on the threads that map to a slot.
          */
-        ~ControlBlock()
+        struct alignas(64) ReleaseSlot
         {
-            std::lock_guard lock(AllocationTracker::getMutex());
-            logDestruction();
-            if (objectPtr)
+            std::atomic<uint32_t> releasing;
+        };
+
+        /**
+         * @brief The buffer, shared by every module of the process like the AllocationTracker state.
+         * wakeAt is the buffer size at which wake is notified, or 0 if no background collector waits on it.
+         */
+        struct State
+        {
+            std::atomic<bool> enabled;
+            std::atomic<bool> synchronized;
+            std::atomic<bool> epoch;
+            ReleaseSlot slots[releaseSlots];
+            std::mutex mutex;
+            std::mutex collecting;
+            std::condition_variable wake;
+            size_t wakeAt;
+            std::vector<ControlBlockBase*> blocks;
+            std::vector<ControlBlockBase*> deferred;
+        };
+
+        /**
+         * @brief Scope of dropping a strong reference, announced in the slot of its thread. Releasing the last
+         * one either runs in the scope or is deferred to the end of the open epoch.
+         */
+        class Release
+        {
+        public:
+
+            /**
+             * @brief Announces the drop, if collection has ever been enabled.
+             */
+            Release() noexcept
+                : slot_(state().synchronized.load(std::memory_order_relaxed)
+                    ? &state().slots[AllocationTracker::currentThreadIndex() % releaseSlots].releasing
+                    : nullptr)
             {
-                if (strongRefs.load(std::memory_order_relaxed) > 0)
+                if (slot_)
                 {
-                    UNTRACK_ALLOC(objectPtr);
-                    Allocator::deallocate(objectPtr);
-                    objectPtr = nullptr;
+                    slot_->fetch_add(1, std::memory_order_seq_cst);
+                    ++depth_;
                 }
             }
-        }
+
+            Release(const Release&) = delete;
+            Release& operator=(const Release&) = delete;
+
+            /**
+             * @brief Ends the announcement.
+             */
+            ~Release()
+            {
+                if (slot_)
+                {
+                    --depth_;
+                    slot_->fetch_sub(1, std::memory_order_release);
+                }
+            }
+
+            /**
+             * @brief Defers the release of a block if an epoch is open.
+             * @param block The block whose last strong reference was dropped.
+             * @return True if the release was deferred and must not run now.
+             */
+            bool defer(ControlBlockBase* block)
+            {
+                if (!slot_ || !state().epoch.load(std::memory_order_seq_cst)) return false;
+
+                State& roots = state();
+                std::lock_guard<std::mutex> lock(roots.mutex);
+                roots.deferred.push_back(block);
+                return true;
+            }
+
+            /**
+             * @brief Gets the number of drops in progress on the calling thread, which a collection started
+             * from a destructor must not wait for.
+             * @return The number of nested drops.
+             */
+            static uint32_t depth() noexcept
+            {
+                return depth_;
+            }
+
+        private:
+            std::atomic<uint32_t>* slot_;
+            static inline thread_local uint32_t depth_ = 0;
+        };
 
         /**
-         * @brief Casts the object pointer to a different type U if possible.
-         * @tparam U The type to cast to.
-         * @return A pointer to the object of type U if the cast is valid, otherwise nullptr.
+         * @brief Gets the process-wide buffer, which is never destroyed so Refs released during static
+         * destruction can still reach it.
+         * @return The buffer.
          */
-        template<typename U>
-        U* cast()
+        MEXMEMORY_SHARED static State& state() noexcept
         {
-            if (typeid(U) == *typeInfo || std::is_base_of_v<U, T> || std::is_base_of_v<T, U>)
-            {
-                return static_cast<U*>(objectPtr);
-            }
-            return nullptr;
+            static State* const instance = new State();
+            return *instance;
         }
 
         /**
-         * @brief Safely casts the object pointer to a different type U, using dynamic_cast if necessary.
-         * @tparam U The type to cast to.
-         * @param ptr The pointer to the object of type T.
-         * @return A pointer to the object of type U if the cast is valid, otherwise nullptr.
+         * @brief Adds a block to the buffer.
+         * @param block The block, which the caller has marked as buffered.
          */
-        template<typename U>
-        static U* safe_cast(T* ptr)
+        static void add(ControlBlockBase* block)
         {
-            if constexpr (std::is_base_of_v<T, U> || std::is_base_of_v<U, T>)
+            State& roots = state();
+            bool wake = false;
             {
-                return static_cast<U*>(ptr);
+                std::lock_guard<std::mutex> lock(roots.mutex);
+                roots.blocks.push_back(block);
+                wake = roots.blocks.size() == roots.wakeAt;
             }
-            else
+            if (wake)
             {
-                return dynamic_cast<U*>(ptr);
+                roots.wake.notify_one();
             }
         }
+    };
+
+    /**
+     * @brief SharedPtrState is what to_shared_ptr keeps for a control block, created on its first conversion. It
+     * holds a std::weak_ptr to the last std::shared_ptr made, so converting again while that one is alive only
+     * increments its count, and a slot the std::shared_ptr control block is constructed in through Allocator, so
+     * converting after it died does not allocate either. The state is freed once both the control block and the
+     * std::shared_ptr control blocks allocated through it are gone.
+     */
+    class SharedPtrState
+    {
+    public:
 
         /**
-         * @brief Deallocates the object managed by this ControlBlock, if it exists.
-         * This method is called when the last strong reference to the object is released.
+         * @brief Size of the slot, enough for the std::shared_ptr control block of a pointer, a deleter holding a
+         * control block and an Allocator.
          */
-        void deallocateObject()
+        static constexpr size_t slotSize = 64;
+
+        /**
+         * @brief Allocator passed to std::shared_ptr, which constructs its control block in the slot if the slot
+         * is free and on the heap otherwise. Every block it allocates keeps the state alive.
+         * @tparam U The type to allocate, rebound by std::shared_ptr to its control block type.
+         */
+        template<typename U>
+        class Allocator
         {
-            if (objectPtr)
+        public:
+            using value_type = U;
+
+            /**
+             * @brief Constructs an allocator for a state.
+             * @param state The state of the control block being converted.
+             */
+            explicit Allocator(SharedPtrState* state) noexcept : state_(state) {}
+
+            /**
+             * @brief Rebinding constructor.
+             * @tparam V The type the other allocator allocates.
+             * @param other The allocator to copy the state from.
+             */
+            template<typename V>
+            Allocator(const Allocator<V>& other) noexcept : state_(other.state_) {}
+
+            /**
+             * @brief Allocates storage, in the slot if one object of U fits and the slot is free.
+             * @param count The number of objects.
+             * @return The storage.
+             */
+            U* allocate(size_t count)
+            {
+                U* storage = nullptr;
+                if constexpr (sizeof(U) <= slotSize && alignof(U) <= alignof(std::max_align_t))
+                {
+                    if (count == 1 && !state_->slotUsed_.exchange(true, std::memory_order_acquire))
+                    {
+                        storage = reinterpret_cast<U*>(state_->slot_);
+                    }
+                }
+                if (!storage)
+                {
+                    storage = std::allocator<U>().allocate(count);
+                }
+                state_->retain();
+                return storage;
+            }
+
+            /**
+             * @brief Frees storage, returning the slot if that is where it was.
+             * @param storage The storage.
+             * @param count The number of objects.
+             */
+            void deallocate(U* storage, size_t count) noexcept
             {
-                UNTRACK_ALLOC(objectPtr);
-                if (*typeInfo == typeid(T))
+                SharedPtrState* state = state_;
+                if (static_cast<void*>(storage) == static_cast<void*>(state->slot_))
                 {
-                    Allocator::deallocate(static_cast<T*>(objectPtr));
+                    state->slotUsed_.store(false, std::memory_order_release);
                 }
                 else
                 {
-                    operator delete(objectPtr);
+                    std::allocator<U>().deallocate(storage, count);
                 }
-                objectPtr = nullptr;
+                state->release();
             }
-        }
+
+            /**
+             * @brief Compares allocators; those of one state can free each other's storage.
+             * @tparam V The type the other allocator allocates.
+             * @param other The other allocator.
+             * @return True if both allocate for the same state.
+             */
+            template<typename V>
+            bool operator==(const Allocator<V>& other) const noexcept
+            {
+                return state_ == other.state_;
+            }
+
+        private:
+            template<typename V>
+            friend class Allocator;
+
+            SharedPtrState* state_;
+        };
 
         /**
-         * @brief Sets the object pointer to a new pointer, deallocating the old object if it exists.
-         * @param ptr The new pointer to set.
+         * @brief Takes the lock guarding the cached std::weak_ptr, spinning since it is only held to copy it.
          */
-        void setObjectPtr(T* ptr) noexcept
+        void lock() noexcept
         {
-            if (objectPtr)
+            while (locked_.exchange(true, std::memory_order_acquire))
             {
-                logAction("Deleting old object");
-                UNTRACK_ALLOC(objectPtr);
-                Allocator::deallocate(objectPtr);
+                while (locked_.load(std::memory_order_relaxed))
+                {
+                }
             }
-            objectPtr = ptr;
-            if (ptr)
+        }
+
+        /**
+         * @brief Releases the lock.
+         */
+        void unlock() noexcept
+        {
+            locked_.store(false, std::memory_order_release);
+        }
+
+        /**
+         * @brief The last std::shared_ptr made for the control block; guarded by the lock.
+         */
+        std::weak_ptr<const volatile void> cached;
+
+        /**
+         * @brief Counts the std::shared_ptrs sharing the cached control block.
+         * @return The number of std::shared_ptr owners, which hold a single strong reference between them.
+         */
+        long useCount() noexcept
+        {
+            lock();
+            const long count = cached.use_count();
+            unlock();
+            return count;
+        }
+
+    private:
+        friend class ControlBlockBase;
+
+        std::atomic<uint32_t> refs_{1};
+        std::atomic<bool> locked_{false};
+        std::atomic<bool> slotUsed_{false};
+        alignas(std::max_align_t) unsigned char slot_[slotSize];
+
+        /**
+         * @brief Adds an owner of the state.
+         */
+        void retain() noexcept
+        {
+            refs_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Drops an owner of the state, freeing it after the last one.
+         */
+        void release() noexcept
+        {
+            if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
             {
-                TRACK_ALLOC(ptr);
+                delete this;
             }
-            logAction("Setting new object");
         }
 
         /**
-         * @brief Gets the pointer to the object managed by this ControlBlock.
-         * @return A pointer to the object.
+         * @brief Detaches the state from its control block, which is being freed. The std::shared_ptr control
+         * block it caches has no strong owners left, so dropping the std::weak_ptr may free it.
          */
-        [[nodiscard]] T* getObjectPtr() const noexcept
+        void detach() noexcept
         {
-            return objectPtr;
+            lock();
+            cached.reset();
+            unlock();
+            release();
         }
+    };
+
+    /**
+     * @brief ControlBlockBase holds the reference counts shared by all Refs and WeakRefs to one object.
+     * It is not templated, so Refs to a base class, to a member or to a casted type all use the same block
+     * without casting it. Destroying the object and freeing the block go through a single Disposer.
+     */
+    class ControlBlockBase
+    {
+    public:
+
+        ControlBlockBase(const ControlBlockBase&) = delete;
+        ControlBlockBase& operator=(const ControlBlockBase&) = delete;
 
         /**
          * @brief Increments the strong reference count.
          */
         void incrementStrong() noexcept
         {
-            strongRefs.fetch_add(1, std::memory_order_acq_rel);
-            logReferenceChange("Increment strong reference", strongRefs.load());
+            const size_t count = strongRefs.fetch_add(1, std::memory_order_acq_rel) + 1;
+            traceEvent(TraceEvent::IncrementStrong, count);
+            logReferenceChange("Increment strong reference", count);
+        }
+
+        /**
+         * @brief Increments the strong reference count unless it is zero, for upgrading a weak reference.
+         * Objects claimed by the cycle collector cannot be upgraded either.
+         * @return True if the count was incremented.
+         */
+        bool tryIncrementStrong() noexcept
+        {
+            size_t count = strongRefs.load(std::memory_order_relaxed);
+            do
+            {
+                if (count == 0 || (count & claimedFlag) != 0) return false;
+            }
+            while (!strongRefs.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+            traceEvent(TraceEvent::IncrementStrong, count + 1);
+            logReferenceChange("Increment strong reference", count + 1);
+            return true;
         }
 
         /**
          * @brief Decrements the strong reference count and deletes the object if it reaches zero.
+         * While cycle collection is enabled, a block that keeps other strong references is buffered as a
+         * possible root of a garbage cycle. It is marked while this reference still keeps it alive, and added
+         * once the count has dropped, so a collection never sees a root before its decrement.
          */
         void decrementStrong() noexcept
         {
+            PossibleRoots::Release release;
+            const bool buffer = PossibleRoots::isEnabled() && strongRefs.load(std::memory_order_relaxed) > 1 && markBuffered();
+
             auto prev = strongRefs.fetch_sub(1, std::memory_order_acq_rel);
-            logReferenceChange("Decrement strong reference", prev - 1);
+            traceEvent(TraceEvent::DecrementStrong, (prev & ~claimedFlag) - 1);
+            logReferenceChange("Decrement strong reference", (prev & ~claimedFlag) - 1);
 
-            if (prev == 1)
+            if (buffer)
             {
-                //std::lock_guard lock(AllocationTracker::getMutex());
-                if (objectPtr)
-                {
-                    logAction("Deleting object");
-                    Allocator::deallocate(objectPtr);
-                    UNTRACK_ALLOC(objectPtr);
-                }
-                objectPtr = nullptr;
-
-                if (weakRefs.load(std::memory_order_acquire) == 0)
-                {
-                    logAction("Deleting control block (no weak references)");
-                    delete this;
-                }
+                PossibleRoots::add(this);
+            }
+            if (prev == 1 && !release.defer(this))
+            {
+                releaseObject();
             }
         }
 
@@ -268,8 +547,9 @@ namespace memory::refCounting
          */
         void incrementWeak() noexcept
         {
-            weakRefs.fetch_add(1, std::memory_order_relaxed);
-            logReferenceChange("Increment weak reference", weakRefs.load());
+            const size_t count = (weakRefs.fetch_add(1, std::memory_order_relaxed) & ~bufferedFlag) + 1;
+            traceEvent(TraceEvent::IncrementWeak, count);
+            logReferenceChange("Increment weak reference", count);
         }
 
         /**
@@ -278,14 +558,17 @@ namespace memory::refCounting
         void decrementWeak() noexcept
         {
             auto prev = weakRefs.fetch_sub(1, std::memory_order_acq_rel);
-            logReferenceChange("Decrement weak reference", prev - 1);
+            traceEvent(TraceEvent::DecrementWeak, (prev & ~bufferedFlag) - 1);
+            logReferenceChange("Decrement weak reference", (prev & ~bufferedFlag) - 1);
 
+            // With no strong references left but the object not yet destroyed, the release in progress frees the block.
             if (prev == 1)
             {
-                if (strongRefs.load(std::memory_order_relaxed) == 0)
+                if (strongRefs.load(std::memory_order_relaxed) == 0 && !objectPtr)
                 {
+                    traceEvent(TraceEvent::DestroyBlock, 0);
                     logAction("Deleting control block (no strong references)");
-                    delete this;
+                    dispose_(this, DisposeOp::Block, nullptr);
                 }
             }
         }
@@ -296,7 +579,7 @@ namespace memory::refCounting
          */
         [[nodiscard]] size_t strongCount() const noexcept
         {
-            return strongRefs.load(std::memory_order_relaxed);
+            return strongRefs.load(std::memory_order_relaxed) & ~claimedFlag;
         }
 
         /**
@@ -307,6 +590,7 @@ namespace memory::refCounting
         size_t setStrongCount(size_t count) noexcept
         {
             strongRefs.store(count, std::memory_order_relaxed);
+            traceEvent(TraceEvent::SetStrong, count);
             logReferenceChange("Set strong reference count", count);
             return count;
         }
@@ -317,7 +601,7 @@ namespace memory::refCounting
          */
         [[nodiscard]] size_t weakCount() const noexcept
         {
-            return weakRefs.load(std::memory_order_relaxed);
+            return weakRefs.load(std::memory_order_relaxed) & ~bufferedFlag;
         }
 
         /**
@@ -330,81 +614,668 @@ namespace memory::refCounting
         }
 
         /**
-         * @brief Gets the object pointer.
-         * @return A pointer to the object managed by this ControlBlock.
+         * @brief Gets the address of the managed object, without its type.
+         * @return The address of the object, or nullptr once it has been destroyed.
          */
-        T* get() const noexcept
+        [[nodiscard]] void* getObjectAddress() const noexcept
         {
             return objectPtr;
         }
 
-    private:
-        T* objectPtr;
-        std::type_info const* typeInfo;
-        std::atomic<size_t> strongRefs{1};
-        std::atomic<size_t> weakRefs{0};
-
         /**
-         * @brief Logs creattion of a object.
+         * @brief Gets the state to_shared_ptr keeps for the block, creating it on first use.
+         * @return The state, which lives as long as the block.
          */
-        void logCreation() const
+        SharedPtrState* sharedPtrState()
         {
-            if (DebugConfig::enableLogging)
+            SharedPtrState* state = sharedPtrState_.load(std::memory_order_acquire);
+            if (!state)
             {
-                *DebugConfig::logStream
-                        << "[ControlBlock] Created for object at "
-                        << static_cast<const void*>(objectPtr)
-                        << "\n";
+                auto* created = new SharedPtrState();
+                if (sharedPtrState_.compare_exchange_strong(state, created, std::memory_order_acq_rel))
+                {
+                    state = created;
+                }
+                else
+                {
+                    delete created;
+                }
             }
+            return state;
         }
 
         /**
-         * @brief Logs destruction of a object.
+         * @brief Gets the state to_shared_ptr keeps for the block without creating it.
+         * @return The state, or nullptr if the block has never been converted.
          */
-        void logDestruction() const
+        [[nodiscard]] SharedPtrState* getSharedPtrState() const noexcept
         {
-            if (DebugConfig::enableLogging)
-            {
-                *DebugConfig::logStream
-                        << "[ControlBlock] Destroyed for object at "
-                        << static_cast<const void*>(objectPtr)
-                        << "\n";
-            }
+            return sharedPtrState_.load(std::memory_order_acquire);
         }
 
         /**
-         * @brief Logs changes in reference counts.
-         * @param action The action being logged (increment/decrement).
-         * @param count The current count after the change.
+         * @brief Gets the disposer of the block, which identifies the kind of block it is.
+         * @return The function that destroys the object and frees the block.
          */
-        void logReferenceChange(const std::string_view action, size_t count) const
+        [[nodiscard]] Disposer getDisposer() const noexcept
         {
-            if (DebugConfig::enableLogging)
+            return dispose_;
+        }
+
+        /**
+         * @brief Shows the strong references held by the object to a visitor, through the trace function of the
+         * type the object was created as. Nothing is shown once the object has been destroyed.
+         * @param visitor The visitor to call for every reference.
+         */
+        void traceObject(RefVisitor& visitor)
+        {
+            if (objectPtr)
             {
-                *DebugConfig::logStream
-                        << "[ControlBlock] " << action
-                        << ", current count: " << count
-                        << " for object at "
-                        << static_cast<const void*>(objectPtr)
-                        << "\n";
+                dispose_(this, DisposeOp::Trace, &visitor);
             }
         }
 
+    protected:
+        friend class CycleCollector;
+
         /**
-         * @brief Logs an action performed on the ControlBlock.
-         * @param action The action being logged.
+         * @brief Bit of the weak count set while the block is in the PossibleRoots buffer; it keeps the block
+         * allocated like a weak reference does, without changing the count WeakRefs see.
          */
-        void logAction(const std::string_view action) const
+        static constexpr size_t bufferedFlag = size_t(1) << (sizeof(size_t) * 8 - 1);
+
+        /**
+         * @brief Bit of the strong count set while the cycle collector decides whether to free the object.
+         * The last strong reference dropped meanwhile leaves the release to the collector, and the object
+         * cannot be upgraded to from a WeakRef.
+         */
+        static constexpr size_t claimedFlag = size_t(1) << (sizeof(size_t) * 8 - 1);
+
+        void* objectPtr;
+        std::atomic<size_t> strongRefs{1};
+        std::atomic<size_t> weakRefs{0};
+        Disposer dispose_;
+        std::atomic<SharedPtrState*> sharedPtrState_{nullptr};
+
+        /**
+         * @brief Constructs a control block for an object.
+         * @param ptr The address of the object.
+         * @param disposer The function that destroys the object and frees the block.
+         */
+        ControlBlockBase(void* ptr, Disposer disposer) noexcept : objectPtr(ptr), dispose_(disposer)
         {
-            if (DebugConfig::enableLogging)
-            {
-                *DebugConfig::logStream
-                        << "[ControlBlock] " << action
+            traceEvent(TraceEvent::Create, 1);
+        }
+
+        /**
+         * @brief Destructor; blocks are only destroyed by their disposer, which knows their exact type.
+         */
+        ~ControlBlockBase()
+        {
+            if (SharedPtrState* state = sharedPtrState_.load(std::memory_order_acquire))
+            {
+                state->detach();
+            }
+        }
+
+        /**
+         * @brief Destroys the object after its last strong reference has been released, and frees the block
+         * if no weak references remain.
+         */
+        void releaseObject() noexcept
+        {
+            // Pin the block while the object is destroyed: its destructor may drop the last WeakRef to
+            // this block, e.g. a child holding a weak back-reference to its parent.
+            weakRefs.fetch_add(1, std::memory_order_relaxed);
+            if (objectPtr)
+            {
+                traceEvent(TraceEvent::DestroyObject, 0);
+                logAction("Deleting object");
+                dispose_(this, DisposeOp::Object, nullptr);
+            }
+            objectPtr = nullptr;
+
+            // A buffered block is freed by the cycle collector once it has been drained from the buffer.
+            if (weakRefs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                traceEvent(TraceEvent::DestroyBlock, 0);
+                logAction("Deleting control block (no weak references)");
+                dispose_(this, DisposeOp::Block, nullptr);
+            }
+        }
+
+        /**
+         * @brief Clears the claim of the cycle collector, releasing the object if its last strong reference
+         * was dropped while it was claimed.
+         */
+        void releaseClaim() noexcept
+        {
+            if ((strongRefs.fetch_and(~claimedFlag, std::memory_order_acq_rel) & ~claimedFlag) == 0)
+            {
+                releaseObject();
+            }
+        }
+
+        /**
+         * @brief Marks the block as buffered, unless it already is.
+         * @return True if the caller marked it and must add it to the buffer.
+         */
+        bool markBuffered() noexcept
+        {
+            return (weakRefs.load(std::memory_order_seq_cst) & bufferedFlag) == 0
+                && (weakRefs.fetch_or(bufferedFlag, std::memory_order_seq_cst) & bufferedFlag) == 0;
+        }
+
+        /**
+         * @brief Clears the buffered mark, freeing the block if nothing else references it and its object has
+         * been released.
+         */
+        void unmarkBuffered() noexcept
+        {
+            if (weakRefs.fetch_and(~bufferedFlag, std::memory_order_seq_cst) == bufferedFlag
+                && strongRefs.load(std::memory_order_relaxed) == 0 && !objectPtr)
+            {
+                traceEvent(TraceEvent::DestroyBlock, 0);
+                logAction("Deleting control block (collected)");
+                dispose_(this, DisposeOp::Block, nullptr);
+            }
+        }
+
+        /**
+         * @brief Removes the object from the ownership graph before it is destroyed, if incremental cycle
+         * detection is enabled.
+         */
+        void untrackOwner() noexcept
+        {
+            if (OwnershipGraph::isEnabled())
+            {
+                OwnershipGraph::remove(this);
+            }
+        }
+
+        /**
+         * @brief Records a reference count event if binary tracing is active.
+         * @param event The kind of event.
+         * @param count The count after the event.
+         */
+        void traceEvent(TraceEvent event, size_t count) const noexcept
+        {
+            if (RefTrace::isActive())
+            {
+                RefTrace::record(event, this, count);
+            }
+        }
+
+        /**
+         * @brief Logs creattion of a object.
+         */
+        void logCreation() const
+        {
+            if (DebugConfig::enableLogging)
+            {
+                *DebugConfig::logStream
+                        << "[ControlBlock] Created for object at "
+                        << static_cast<const void*>(objectPtr)
+                        << "\n";
+            }
+        }
+
+        /**
+         * @brief Logs destruction of a object.
+         */
+        void logDestruction() const
+        {
+            if (DebugConfig::enableLogging)
+            {
+                *DebugConfig::logStream
+                        << "[ControlBlock] Destroyed for object at "
+                        << static_cast<const void*>(objectPtr)
+                        << "\n";
+            }
+        }
+
+        /**
+         * @brief Logs changes in reference counts.
+         * @param action The action being logged (increment/decrement).
+         * @param count The current count after the change.
+         */
+        void logReferenceChange(const std::string_view action, size_t count) const
+        {
+            if (DebugConfig::enableLogging)
+            {
+                *DebugConfig::logStream
+                        << "[ControlBlock] " << action
+                        << ", current count: " << count
                         << " for object at "
                         << static_cast<const void*>(objectPtr)
                         << "\n";
             }
         }
+
+        /**
+         * @brief Logs an action performed on the ControlBlock.
+         * @param action The action being logged.
+         */
+        void logAction(const std::string_view action) const
+        {
+            if (DebugConfig::enableLogging)
+            {
+                *DebugConfig::logStream
+                        << "[ControlBlock] " << action
+                        << " for object at "
+                        << static_cast<const void*>(objectPtr)
+                        << "\n";
+            }
+        }
+    };
+
+    /**
+     * @brief ControlBlock is a reference counting control block for managing the lifetime of objects.
+     * It supports strong and weak references, and provides thread-safe reference counting.
+     * The object is released through the Allocator it was created with, whatever Ref type drops the last reference.
+     * @tparam T The type of object being managed.
+     * @tparam Allocator The allocator to use for memory management (default is DefaultAllocator).
+     */
+    template <typename T, typename Allocator = DefaultAllocator<T>>
+    class ControlBlock : public ControlBlockBase
+    {
+    public:
+
+        /**
+         * @brief Constructs a ControlBlock with a pointer to an object of type T.
+         * @param ptr The pointer to the object.
+         */
+        explicit ControlBlock(T* ptr) : ControlBlockBase(erase(ptr), &disposeWithAllocator)
+        {
+            TRACK_REF_ALLOC(static_cast<std::remove_cv_t<T>*>(objectPtr), this);
+            trackOwner();
+            logCreation();
+        }
+
+        /**
+         * @brief Constructs a ControlBlock with constructor arguments for the object of type T. (with our Allocator)
+         * @tparam Args The types of the constructor arguments.
+         * @param args The constructor arguments.
+         */
+        template <typename... Args>
+        explicit ControlBlock(Args&&... args)
+            : ControlBlockBase(erase(Allocator::allocate(std::forward<Args>(args)...)), &disposeWithAllocator)
+        {
+            TRACK_REF_ALLOC(static_cast<std::remove_cv_t<T>*>(objectPtr), this);
+            trackOwner();
+            logCreation();
+        }
+
+        /**
+         * @brief Destructor, which releases the object if the block is destroyed while it is still referenced.
+         */
+        ~ControlBlock()
+        {
+            logDestruction();
+            if (objectPtr && strongRefs.load(std::memory_order_relaxed) > 0)
+            {
+                untrackOwner();
+                UNTRACK_ALLOC(get());
+                Allocator::deallocate(get());
+                objectPtr = nullptr;
+            }
+        }
+
+        /**
+         * @brief Casts the object pointer to a different type U if possible.
+         * @tparam U The type to cast to.
+         * @return A pointer to the object of type U if the cast is valid, otherwise nullptr.
+         */
+        template<typename U>
+        U* cast()
+        {
+            if constexpr (std::is_same_v<U, T> || std::is_base_of_v<U, T> || std::is_base_of_v<T, U>)
+            {
+                return static_cast<U*>(get());
+            }
+            else
+            {
+                return nullptr;
+            }
+        }
+
+        /**
+         * @brief Safely casts the object pointer to a different type U, using dynamic_cast if necessary.
+         * @tparam U The type to cast to.
+         * @param ptr The pointer to the object of type T.
+         * @return A pointer to the object of type U if the cast is valid, otherwise nullptr.
+         */
+        template<typename U>
+        static U* safe_cast(T* ptr)
+        {
+            if constexpr (std::is_base_of_v<T, U> || std::is_base_of_v<U, T>)
+            {
+                return static_cast<U*>(ptr);
+            }
+            else
+            {
+                return dynamic_cast<U*>(ptr);
+            }
+        }
+
+        /**
+         * @brief Deallocates the object managed by this ControlBlock, if it exists.
+         * This method is called when the last strong reference to the object is released.
+         */
+        void deallocateObject()
+        {
+            if (objectPtr)
+            {
+                dispose_(this, DisposeOp::Object, nullptr);
+                objectPtr = nullptr;
+            }
+        }
+
+        /**
+         * @brief Sets the object pointer to a new pointer, deallocating the old object if it exists.
+         * @param ptr The new pointer to set.
+         */
+        void setObjectPtr(T* ptr) noexcept
+        {
+            if (objectPtr)
+            {
+                logAction("Deleting old object");
+                dispose_(this, DisposeOp::Object, nullptr);
+            }
+            objectPtr = erase(ptr);
+            if (ptr)
+            {
+                TRACK_REF_ALLOC(static_cast<std::remove_cv_t<T>*>(objectPtr), this);
+                trackOwner();
+            }
+            logAction("Setting new object");
+        }
+
+        /**
+         * @brief Gets the pointer to the object managed by this ControlBlock.
+         * @return A pointer to the object.
+         */
+        [[nodiscard]] T* getObjectPtr() const noexcept
+        {
+            return get();
+        }
+
+        /**
+         * @brief Gets the object pointer.
+         * @return A pointer to the object managed by this ControlBlock.
+         */
+        T* get() const noexcept
+        {
+            return static_cast<T*>(objectPtr);
+        }
+
+    protected:
+
+        /**
+         * @brief Constructs a ControlBlock for an object that is disposed of by a derived block.
+         * @param ptr The pointer to the object.
+         * @param disposer The function that destroys the object and frees the derived block.
+         */
+        ControlBlock(T* ptr, Disposer disposer) : ControlBlockBase(erase(ptr), disposer)
+        {
+            TRACK_REF_ALLOC(static_cast<std::remove_cv_t<T>*>(objectPtr), this);
+            trackOwner();
+            logCreation();
+        }
+
+        /**
+         * @brief Traces the object of a block. The elements of arrays are not traced.
+         * @param block The control block of the object.
+         * @param visitor The visitor to pass on.
+         */
+        static void trace(ControlBlock* block, RefVisitor& visitor)
+        {
+            if constexpr (!std::is_same_v<Allocator, DefaultAllocator<T[]>>)
+            {
+                RefVisitor::traceObject<std::remove_cv_t<T>>(block->get(), visitor);
+            }
+        }
+
+        /**
+         * @brief Adds the new object to the ownership graph with the Refs stored inside it, if incremental cycle
+         * detection is enabled. Arrays are not added.
+         */
+        void trackOwner()
+        {
+            if constexpr (!std::is_same_v<Allocator, DefaultAllocator<T[]>>)
+            {
+                if (OwnershipGraph::isEnabled())
+                {
+                    std::vector<RefVisitor::Edge> edges;
+                    std::vector<const void*> sites;
+                    RefVisitor visitor(edges, sites);
+                    trace(this, visitor);
+                    OwnershipGraph::add(this, objectPtr, sizeof(T), &AllocationTracker::demangleTypeName<std::remove_cv_t<T>>, edges, sites);
+                }
+            }
+        }
+
+        /**
+         * @brief Drops const and volatile from an object pointer so it can be stored in the base block.
+         * @param ptr The pointer to the object.
+         * @return The same address as a void pointer.
+         */
+        static void* erase(T* ptr) noexcept
+        {
+            return const_cast<void*>(static_cast<const volatile void*>(ptr));
+        }
+
+    private:
+
+        /**
+         * @brief Default disposer, which releases the object through the Allocator and deletes the block.
+         * @param block The control block being disposed of.
+         * @param op Whether to destroy the object, free the block or trace the object.
+         * @param visitor The visitor to trace the object with.
+         */
+        static void disposeWithAllocator(ControlBlockBase* block, DisposeOp op, RefVisitor* visitor)
+        {
+            auto* self = static_cast<ControlBlock*>(block);
+            if (op == DisposeOp::Object)
+            {
+                self->untrackOwner();
+                UNTRACK_ALLOC(self->get());
+                Allocator::deallocate(self->get());
+            }
+            else if (op == DisposeOp::Trace)
+            {
+                trace(self, *visitor);
+            }
+            else
+            {
+                delete self;
+            }
+        }
+    };
+
+    /**
+     * @brief SlabControlBlock is a ControlBlock whose object lives next to it in a RefSlab created by makeRefs.
+     * The object is destroyed in place and the block returns itself to the slab instead of using the Allocator.
+     * @tparam T The type of object being managed.
+     * @tparam Allocator The allocator of the Ref type the block is used with.
+     */
+    template <typename T, typename Allocator = DefaultAllocator<T>>
+    class SlabControlBlock : public ControlBlock<T, Allocator>
+    {
+    public:
+
+        /**
+         * @brief Constructs a SlabControlBlock for an object constructed in the slab.
+         * @param ptr The pointer to the object.
+         * @param slab The slab that owns the memory of both the block and the object.
+         */
+        SlabControlBlock(T* ptr, RefSlab* slab) : ControlBlock<T, Allocator>(ptr, &disposeInSlab), slab_(slab)
+        {
+        }
+
+    private:
+        RefSlab* slab_;
+
+        /**
+         * @brief Disposer that destroys the object in place and returns the block to its slab.
+         * @param block The control block being disposed of.
+         * @param op Whether to destroy the object, free the block or trace the object.
+         * @param visitor The visitor to trace the object with.
+         */
+        static void disposeInSlab(ControlBlockBase* block, DisposeOp op, RefVisitor* visitor)
+        {
+            auto* self = static_cast<SlabControlBlock*>(block);
+            if (op == DisposeOp::Object)
+            {
+                self->untrackOwner();
+                UNTRACK_ALLOC(self->get());
+                std::destroy_at(self->get());
+            }
+            else if (op == DisposeOp::Trace)
+            {
+                ControlBlock<T, Allocator>::trace(self, *visitor);
+            }
+            else
+            {
+                RefSlab* slab = self->slab_;
+                std::destroy_at(self);
+                slab->release();
+            }
+        }
+    };
+
+    /**
+     * @brief DeleterControlBlock is a ControlBlock that destroys its object with a custom deleter.
+     * The deleter is stored in the block itself, so only blocks created with a deleter pay for it.
+     * @tparam T The type of object being managed.
+     * @tparam Allocator The allocator of the Ref type the block is used with.
+     * @tparam Deleter The type of the deleter, invoked with a T*.
+     */
+    template <typename T, typename Allocator, typename Deleter>
+    class DeleterControlBlock : public ControlBlock<T, Allocator>
+    {
+    public:
+
+        /**
+         * @brief Constructs a DeleterControlBlock that takes ownership of an object.
+         * @param ptr The pointer to the object.
+         * @param deleter The deleter to invoke when the last strong reference is released.
+         */
+        DeleterControlBlock(T* ptr, Deleter deleter)
+            : ControlBlock<T, Allocator>(ptr, &disposeWithDeleter)
+            , deleter_(std::move(deleter))
+        {
+        }
+
+    private:
+        Deleter deleter_;
+
+        /**
+         * @brief Disposer that invokes the stored deleter and frees the derived block.
+         * @param block The control block being disposed of.
+         * @param op Whether to destroy the object, free the block or trace the object.
+         * @param visitor The visitor to trace the object with.
+         */
+        static void disposeWithDeleter(ControlBlockBase* block, DisposeOp op, RefVisitor* visitor)
+        {
+            auto* self = static_cast<DeleterControlBlock*>(block);
+            if (op == DisposeOp::Object)
+            {
+                self->untrackOwner();
+                UNTRACK_ALLOC(self->get());
+                self->deleter_(self->get());
+            }
+            else if (op == DisposeOp::Trace)
+            {
+                ControlBlock<T, Allocator>::trace(self, *visitor);
+            }
+            else
+            {
+                delete self;
+            }
+        }
+    };
+
+    /**
+     * @brief SharedPtrControlBlock is a ControlBlock for an object owned by std::shared_ptr. It holds a
+     * std::shared_ptr for as long as Refs reference the object, so whichever side lets go last destroys it, and a
+     * std::weak_ptr for as long as the block lives. The object itself is neither copied nor allocated again.
+     * @tparam T The type of object being managed.
+     * @tparam Allocator The allocator of the Ref type the block is used with.
+     */
+    template <typename T, typename Allocator>
+    class SharedPtrControlBlock : public ControlBlock<T, Allocator>
+    {
+    public:
+
+        /**
+         * @brief Constructs a SharedPtrControlBlock that shares ownership of an object.
+         * @param owner The std::shared_ptr that owns the object; must not be empty.
+         */
+        explicit SharedPtrControlBlock(std::shared_ptr<T> owner)
+            : ControlBlock<T, Allocator>(owner.get(), &disposeShared)
+            , observer_(owner)
+            , owner_(std::move(owner))
+        {
+        }
+
+        /**
+         * @brief Gets a block as a SharedPtrControlBlock, if that is what it is.
+         * @param block The control block, or null.
+         * @return The block, or null if it is not a SharedPtrControlBlock of this type.
+         */
+        static SharedPtrControlBlock* from(ControlBlockBase* block) noexcept
+        {
+            return block && block->getDisposer() == &disposeShared ? static_cast<SharedPtrControlBlock*>(block) : nullptr;
+        }
+
+        /**
+         * @brief Gets the std::shared_ptr the block holds. The caller must hold a strong reference to the block.
+         * @return The owner of the object.
+         */
+        [[nodiscard]] const std::shared_ptr<T>& share() const noexcept
+        {
+            return owner_;
+        }
+
+        /**
+         * @brief Gets a std::weak_ptr to the object, which follows the std::shared_ptr owners of the object
+         * rather than the Refs.
+         * @return The weak pointer.
+         */
+        [[nodiscard]] const std::weak_ptr<T>& observe() const noexcept
+        {
+            return observer_;
+        }
+
+    private:
+        std::weak_ptr<T> observer_;
+        std::shared_ptr<T> owner_;
+
+        /**
+         * @brief Disposer that drops the std::shared_ptr and frees the derived block.
+         * @param block The control block being disposed of.
+         * @param op Whether to release the object, free the block or trace the object.
+         * @param visitor The visitor to trace the object with.
+         */
+        static void disposeShared(ControlBlockBase* block, DisposeOp op, RefVisitor* visitor)
+        {
+            auto* self = static_cast<SharedPtrControlBlock*>(block);
+            if (op == DisposeOp::Object)
+            {
+                self->untrackOwner();
+                UNTRACK_ALLOC(self->get());
+                self->owner_.reset();
+            }
+            else if (op == DisposeOp::Trace)
+            {
+                ControlBlock<T, Allocator>::trace(self, *visitor);
+            }
+            else
+            {
+                delete self;
+            }
+        }
     };
 }
 
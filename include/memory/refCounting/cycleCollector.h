@@ -0,0 +1,656 @@
+#ifndef MEXMEMORY_CYCLECOLLECTOR_H
+#define MEXMEMORY_CYCLECOLLECTOR_H
+
+#include "controlBlock.h"
+#include "histogram.h"
+#include "refVisitor.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Namespace for memory management with reference counting \namespace memory::refCounting
+namespace memory::refCounting
+{
+    /**
+     * @brief Cycle collector for Ref graphs, after the trial deletion algorithm of Bacon and Rajan.
+     * While it is enabled, dropping a strong reference that leaves others buffers the block as a possible root.
+     * collectCycles subtracts the references objects reachable from the roots hold on each other, as reported by
+     * their trace functions; objects whose count drops to zero are only referenced from inside the subgraph,
+     * and the cycles they form are freed. The trial counts are kept on the side, so the reference counts of the
+     * objects are never modified, and the cost is proportional to the subgraph reachable from the roots.
+     *
+     * A collection may run while other threads copy and drop Refs. It opens an epoch during which releases of
+     * last references are deferred, so nothing it traces is freed under it, and unmarks the roots it drains
+     * before scanning them, so a reference dropped meanwhile buffers its block again. Before freeing, it claims the
+     * candidates, which stops WeakRefs from upgrading to them, and checks that their counts and edges are the
+     * ones it scanned; if anything changed, the candidates are kept and their roots retried next time.
+     * Trace functions then run on the collecting thread, so an object whose Refs other threads assign must guard
+     * its trace with the lock those threads use. Destructors of collected objects must not use the Refs they
+     * hold to other objects of the same cycle, which may already have been destroyed.
+     */
+    class CycleCollector
+    {
+    public:
+
+        /**
+         * @brief Result of a collection. A collection is abandoned when the candidates changed while they were
+         * scanned; nothing is freed and the roots are retried.
+         */
+        struct CollectionStats
+        {
+            size_t roots_examined;
+            size_t objects_scanned;
+            size_t objects_collected;
+            bool abandoned;
+            uint64_t handshake_ns;
+            uint64_t duration_ns;
+        };
+
+        /**
+         * @brief When the background collector runs a collection; a trigger set to zero is off.
+         * Every trigger requires at least one buffered root.
+         */
+        struct BackgroundConfig
+        {
+            size_t root_threshold = 10000;
+            std::chrono::milliseconds interval{1000};
+            size_t live_bytes_threshold = 0;
+            std::chrono::milliseconds poll_interval{50};
+        };
+
+        /**
+         * @brief Totals over all collections since the last reset, with the distributions of their durations and
+         * of the time they waited for drops in progress on other threads, in nanoseconds.
+         */
+        struct CollectorMetrics
+        {
+            uint64_t collections;
+            uint64_t abandoned_collections;
+            uint64_t objects_collected;
+            uint64_t max_duration_ns;
+            Histogram durations;
+            Histogram handshakes;
+        };
+
+        /**
+         * @brief Enables or disables buffering of possible roots. Blocks buffered before collection is
+         * disabled stay allocated until the next call to collectCycles. Enable collection before Refs are
+         * shared between threads: from then on, releases of last references take part in the epoch handshake.
+         * @param enable True to enable cycle collection, false to disable.
+         */
+        static void enable(bool enable) noexcept
+        {
+            if (enable)
+            {
+                PossibleRoots::state().synchronized.store(true, std::memory_order_seq_cst);
+            }
+            PossibleRoots::state().enabled.store(enable, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Checks if cycle collection is enabled.
+         * @return True if possible roots are buffered.
+         */
+        static bool isEnabled() noexcept
+        {
+            return PossibleRoots::isEnabled();
+        }
+
+        /**
+         * @brief Gets the number of possible roots waiting for the next collection.
+         * @return The number of buffered blocks.
+         */
+        static size_t getBufferedRoots()
+        {
+            return PossibleRoots::size();
+        }
+
+        /**
+         * @brief Drains the possible roots and frees the garbage cycles reachable from them.
+         * Collections are serialized; Refs may be copied and dropped on other threads meanwhile.
+         * @return The number of roots, of objects traced and of objects freed, and how long it took.
+         */
+        static CollectionStats collectCycles()
+        {
+            PossibleRoots::State& buffer = PossibleRoots::state();
+            std::lock_guard<std::mutex> collecting(buffer.collecting);
+            const auto start = std::chrono::steady_clock::now();
+
+            CollectionStats stats{};
+            stats.handshake_ns = openEpoch();
+            std::vector<ControlBlockBase*> drained;
+            {
+                std::lock_guard<std::mutex> lock(buffer.mutex);
+                drained.swap(buffer.blocks);
+            }
+
+            // Unmark the roots before they are scanned, so that dropping a reference to one during the collection
+            // buffers it again; roots whose objects are gone are freed here.
+            std::vector<ControlBlockBase*> roots;
+            for (ControlBlockBase* root : drained)
+            {
+                if (root->strongCount() > 0)
+                {
+                    roots.push_back(root);
+                }
+                root->unmarkBuffered();
+            }
+            stats.handshake_ns += awaitDrops();
+
+            Graph graph;
+            for (ControlBlockBase* root : roots)
+            {
+                graph.markGray(graph.nodeOf(root));
+            }
+            for (ControlBlockBase* root : roots)
+            {
+                const auto it = graph.index.find(root);
+                if (it != graph.index.end())
+                {
+                    graph.scan(it->second);
+                }
+            }
+
+            std::vector<size_t> garbage;
+            for (size_t i = 0; i < graph.nodes.size(); ++i)
+            {
+                if (graph.nodes[i].color == Color::White)
+                {
+                    garbage.push_back(i);
+                }
+            }
+            for (size_t node : garbage)
+            {
+                graph.nodes[node].block->strongRefs.fetch_or(ControlBlockBase::claimedFlag, std::memory_order_acq_rel);
+            }
+
+            stats.roots_examined = drained.size();
+            stats.objects_scanned = graph.nodes.size();
+            if (graph.unchanged(garbage))
+            {
+                freeGarbage(graph, garbage);
+                stats.objects_collected = garbage.size();
+            }
+            else
+            {
+                retry(graph, garbage, roots);
+                stats.abandoned = true;
+            }
+            closeEpoch();
+
+            stats.duration_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+            record(stats);
+            return stats;
+        }
+
+        /**
+         * @brief Starts a background thread with the default triggers.
+         */
+        static void startBackground()
+        {
+            startBackground(BackgroundConfig{});
+        }
+
+        /**
+         * @brief Starts a background thread that runs collections when a trigger fires, and enables cycle
+         * collection. Does nothing if the thread is already running.
+         * @param config The triggers.
+         */
+        static void startBackground(const BackgroundConfig& config)
+        {
+            State& collector = state();
+            std::lock_guard<std::mutex> control(collector.control);
+            if (collector.worker.joinable()) return;
+
+            enable(true);
+            collector.config = config;
+            collector.stopping.store(false, std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> lock(PossibleRoots::state().mutex);
+                PossibleRoots::state().wakeAt = config.root_threshold;
+            }
+            collector.worker = std::thread(&CycleCollector::backgroundLoop);
+        }
+
+        /**
+         * @brief Stops the background thread after its collection in progress, if any; collection stays enabled.
+         * Call it before the process exits, so that no collection runs during static destruction.
+         */
+        static void stopBackground()
+        {
+            State& collector = state();
+            std::lock_guard<std::mutex> control(collector.control);
+            if (!collector.worker.joinable()) return;
+
+            collector.stopping.store(true, std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> lock(PossibleRoots::state().mutex);
+                PossibleRoots::state().wakeAt = 0;
+            }
+            PossibleRoots::state().wake.notify_all();
+            collector.worker.join();
+        }
+
+        /**
+         * @brief Checks if the background collector is running.
+         * @return True if the background thread has been started and not stopped.
+         */
+        static bool isBackgroundRunning()
+        {
+            State& collector = state();
+            std::lock_guard<std::mutex> control(collector.control);
+            return collector.worker.joinable();
+        }
+
+        /**
+         * @brief Gets the totals and the pause distributions of the collections run so far.
+         * @return The metrics.
+         */
+        static CollectorMetrics getMetrics()
+        {
+            const State& collector = state();
+            return CollectorMetrics{
+                collector.collections.load(std::memory_order_relaxed),
+                collector.abandoned.load(std::memory_order_relaxed),
+                collector.collected.load(std::memory_order_relaxed),
+                collector.maxDuration.load(std::memory_order_relaxed),
+                Histogram::from(collector.durations),
+                Histogram::from(collector.handshakes)
+            };
+        }
+
+        /**
+         * @brief Resets the metrics.
+         */
+        static void resetMetrics() noexcept
+        {
+            State& collector = state();
+            collector.collections.store(0, std::memory_order_relaxed);
+            collector.abandoned.store(0, std::memory_order_relaxed);
+            collector.collected.store(0, std::memory_order_relaxed);
+            collector.maxDuration.store(0, std::memory_order_relaxed);
+            collector.durations.reset();
+            collector.handshakes.reset();
+        }
+
+    private:
+
+        /**
+         * @brief Black nodes are live or not yet examined, gray nodes have had their internal references
+         * subtracted, white nodes are garbage.
+         */
+        enum class Color : uint8_t
+        {
+            Black,
+            Gray,
+            White
+        };
+
+        /**
+         * @brief A block reached from the roots, with the strong count it had when it was reached, its trial count
+         * and the range of its children in the graph.
+         */
+        struct Node
+        {
+            ControlBlockBase* block;
+            size_t snapshot;
+            int64_t count;
+            Color color;
+            bool traced;
+            size_t firstChild;
+            size_t childCount;
+        };
+
+        /**
+         * @brief The subgraph reachable from the roots, built while it is marked. Every phase walks it with an
+         * explicit stack, so deep graphs do not overflow the call stack.
+         */
+        struct Graph
+        {
+            std::vector<Node> nodes;
+            std::vector<size_t> children;
+            std::unordered_map<ControlBlockBase*, size_t> index;
+            std::vector<RefVisitor::Edge> edges;
+            std::vector<size_t> stack;
+            std::vector<size_t> pending;
+
+            /**
+             * @brief Gets the node of a block, adding it with its current strong count on first use.
+             * @param block The block.
+             * @return The index of the node.
+             */
+            size_t nodeOf(ControlBlockBase* block)
+            {
+                const auto [it, inserted] = index.try_emplace(block, nodes.size());
+                if (inserted)
+                {
+                    const size_t count = block->strongCount();
+                    nodes.push_back(Node{block, count, static_cast<int64_t>(count), Color::Black, false, 0, 0});
+                }
+                return it->second;
+            }
+
+            /**
+             * @brief Traces the object of a node the first time its children are needed.
+             * @param node The index of the node.
+             */
+            void expand(size_t node)
+            {
+                if (nodes[node].traced) return;
+
+                edges.clear();
+                RefVisitor visitor(edges);
+                nodes[node].block->traceObject(visitor);
+                const size_t first = children.size();
+                for (const RefVisitor::Edge& edge : edges)
+                {
+                    children.push_back(nodeOf(edge.block));
+                }
+                nodes[node].traced = true;
+                nodes[node].firstChild = first;
+                nodes[node].childCount = children.size() - first;
+            }
+
+            /**
+             * @brief Subtracts the references held by the subgraph of a root from the trial counts.
+             * @param root The index of the root.
+             */
+            void markGray(size_t root)
+            {
+                if (nodes[root].color == Color::Gray) return;
+
+                nodes[root].color = Color::Gray;
+                stack.push_back(root);
+                while (!stack.empty())
+                {
+                    const size_t node = stack.back();
+                    stack.pop_back();
+                    expand(node);
+                    for (size_t i = 0; i < nodes[node].childCount; ++i)
+                    {
+                        const size_t child = children[nodes[node].firstChild + i];
+                        --nodes[child].count;
+                        if (nodes[child].color != Color::Gray)
+                        {
+                            nodes[child].color = Color::Gray;
+                            stack.push_back(child);
+                        }
+                    }
+                }
+            }
+
+            /**
+             * @brief Colors the gray subgraph of a root white, except for what is still referenced from outside it.
+             * @param root The index of the root.
+             */
+            void scan(size_t root)
+            {
+                stack.push_back(root);
+                while (!stack.empty())
+                {
+                    const size_t node = stack.back();
+                    stack.pop_back();
+                    if (nodes[node].color != Color::Gray) continue;
+
+                    if (nodes[node].count > 0)
+                    {
+                        scanBlack(node);
+                        continue;
+                    }
+                    nodes[node].color = Color::White;
+                    for (size_t i = 0; i < nodes[node].childCount; ++i)
+                    {
+                        stack.push_back(children[nodes[node].firstChild + i]);
+                    }
+                }
+            }
+
+            /**
+             * @brief Colors a live node and everything it reaches black, restoring their trial counts.
+             * @param live The index of the node.
+             */
+            void scanBlack(size_t live)
+            {
+                pending.push_back(live);
+                nodes[live].color = Color::Black;
+                while (!pending.empty())
+                {
+                    const size_t node = pending.back();
+                    pending.pop_back();
+                    for (size_t i = 0; i < nodes[node].childCount; ++i)
+                    {
+                        const size_t child = children[nodes[node].firstChild + i];
+                        ++nodes[child].count;
+                        if (nodes[child].color != Color::Black)
+                        {
+                            nodes[child].color = Color::Black;
+                            pending.push_back(child);
+                        }
+                    }
+                }
+            }
+
+            /**
+             * @brief Checks that claimed candidates still have the strong counts and the edges they were scanned
+             * with. Once claimed, a candidate can only gain references from Refs that already exist, so unchanged
+             * counts and edges mean that no other thread holds one.
+             * @param candidates The indices of the candidates.
+             * @return True if no candidate changed.
+             */
+            bool unchanged(const std::vector<size_t>& candidates)
+            {
+                for (size_t node : candidates)
+                {
+                    if (nodes[node].block->strongCount() != nodes[node].snapshot) return false;
+
+                    edges.clear();
+                    RefVisitor visitor(edges);
+                    nodes[node].block->traceObject(visitor);
+                    if (edges.size() != nodes[node].childCount) return false;
+                    for (size_t i = 0; i < edges.size(); ++i)
+                    {
+                        if (edges[i].block != nodes[children[nodes[node].firstChild + i]].block) return false;
+                    }
+                }
+                return true;
+            }
+        };
+
+        /**
+         * @brief State of the background collector and the metrics, shared by every module of the process.
+         */
+        struct State
+        {
+            std::mutex control;
+            std::thread worker;
+            std::atomic<bool> stopping;
+            BackgroundConfig config;
+            std::atomic<uint64_t> collections;
+            std::atomic<uint64_t> abandoned;
+            std::atomic<uint64_t> collected;
+            std::atomic<uint64_t> maxDuration;
+            AtomicHistogram durations;
+            AtomicHistogram handshakes;
+        };
+
+        /**
+         * @brief Gets the process-wide collector state, which is never destroyed.
+         * @return The state.
+         */
+        MEXMEMORY_SHARED static State& state() noexcept
+        {
+            static State* const instance = new State();
+            return *instance;
+        }
+
+        /**
+         * @brief Opens an epoch and waits for the drops that started before it to finish.
+         * @return The time spent waiting, in nanoseconds.
+         */
+        static uint64_t openEpoch()
+        {
+            PossibleRoots::state().epoch.store(true, std::memory_order_seq_cst);
+            return awaitDrops();
+        }
+
+        /**
+         * @brief Waits for the strong references being dropped to be released, so that the counts read after it
+         * include them. Drops on the calling thread, when the collection runs from a destructor, are not waited for.
+         * @return The time spent waiting, in nanoseconds.
+         */
+        static uint64_t awaitDrops()
+        {
+            const auto start = std::chrono::steady_clock::now();
+            PossibleRoots::State& buffer = PossibleRoots::state();
+            const size_t own = AllocationTracker::currentThreadIndex() % PossibleRoots::releaseSlots;
+            for (size_t i = 0; i < PossibleRoots::releaseSlots; ++i)
+            {
+                const uint32_t ignored = i == own ? PossibleRoots::Release::depth() : 0;
+                while (buffer.slots[i].releasing.load(std::memory_order_seq_cst) > ignored)
+                {
+                    std::this_thread::yield();
+                }
+            }
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+
+        /**
+         * @brief Closes the epoch and runs the releases deferred during it.
+         */
+        static void closeEpoch()
+        {
+            PossibleRoots::State& buffer = PossibleRoots::state();
+            buffer.epoch.store(false, std::memory_order_seq_cst);
+
+            std::vector<ControlBlockBase*> deferred;
+            {
+                std::lock_guard<std::mutex> lock(buffer.mutex);
+                deferred.swap(buffer.deferred);
+            }
+            for (ControlBlockBase* block : deferred)
+            {
+                block->releaseObject();
+            }
+        }
+
+        /**
+         * @brief Frees the claimed garbage objects. The claim keeps destroying one object from releasing another
+         * through the references it drops; each garbage block is also marked as buffered, so those drops do not
+         * buffer it again. Clearing the claims at the end frees the blocks, except those another thread buffered
+         * meanwhile, which the next collection frees.
+         * @param graph The scanned graph.
+         * @param garbage The indices of the garbage nodes.
+         */
+        static void freeGarbage(const Graph& graph, const std::vector<size_t>& garbage)
+        {
+            std::vector<bool> marked(garbage.size());
+            for (size_t i = 0; i < garbage.size(); ++i)
+            {
+                marked[i] = graph.nodes[garbage[i]].block->markBuffered();
+            }
+            for (size_t node : garbage)
+            {
+                ControlBlockBase* block = graph.nodes[node].block;
+                block->traceEvent(TraceEvent::DestroyObject, 0);
+                block->logAction("Deleting object (collected)");
+                block->dispose_(block, DisposeOp::Object, nullptr);
+                block->objectPtr = nullptr;
+            }
+            for (size_t i = 0; i < garbage.size(); ++i)
+            {
+                ControlBlockBase* block = graph.nodes[garbage[i]].block;
+                if (marked[i])
+                {
+                    block->unmarkBuffered();
+                }
+                block->releaseClaim();
+            }
+        }
+
+        /**
+         * @brief Gives up on candidates that changed: clears their claims and buffers the live roots again.
+         * @param graph The scanned graph.
+         * @param garbage The indices of the candidates.
+         * @param roots The roots that were scanned.
+         */
+        static void retry(const Graph& graph, const std::vector<size_t>& garbage, const std::vector<ControlBlockBase*>& roots)
+        {
+            for (size_t node : garbage)
+            {
+                graph.nodes[node].block->releaseClaim();
+            }
+            for (ControlBlockBase* block : roots)
+            {
+                if (block->strongCount() > 0 && block->markBuffered())
+                {
+                    PossibleRoots::add(block);
+                }
+            }
+        }
+
+        /**
+         * @brief Adds a collection to the metrics.
+         * @param stats The result of the collection.
+         */
+        static void record(const CollectionStats& stats) noexcept
+        {
+            State& collector = state();
+            collector.collections.fetch_add(1, std::memory_order_relaxed);
+            collector.abandoned.fetch_add(stats.abandoned ? 1 : 0, std::memory_order_relaxed);
+            collector.collected.fetch_add(stats.objects_collected, std::memory_order_relaxed);
+            collector.durations.record(stats.duration_ns);
+            collector.handshakes.record(stats.handshake_ns);
+            uint64_t longest = collector.maxDuration.load(std::memory_order_relaxed);
+            while (stats.duration_ns > longest
+                && !collector.maxDuration.compare_exchange_weak(longest, stats.duration_ns, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        /**
+         * @brief Body of the background thread: wakes when the root buffer reaches its threshold or every poll
+         * interval, and collects when a trigger fires.
+         */
+        static void backgroundLoop()
+        {
+            State& collector = state();
+            PossibleRoots::State& buffer = PossibleRoots::state();
+            const BackgroundConfig config = collector.config;
+            const auto wait = config.interval.count() > 0 ? std::min(config.interval, config.poll_interval) : config.poll_interval;
+            auto lastCollection = std::chrono::steady_clock::now();
+
+            while (true)
+            {
+                size_t buffered = 0;
+                {
+                    std::unique_lock<std::mutex> lock(buffer.mutex);
+                    buffer.wake.wait_for(lock, wait, [&]() {
+                        return collector.stopping.load(std::memory_order_relaxed)
+                            || (config.root_threshold != 0 && buffer.blocks.size() >= config.root_threshold);
+                    });
+                    buffered = buffer.blocks.size();
+                }
+                if (collector.stopping.load(std::memory_order_relaxed)) break;
+                if (buffered == 0) continue;
+
+                const auto now = std::chrono::steady_clock::now();
+                const bool collect = (config.root_threshold != 0 && buffered >= config.root_threshold)
+                    || (config.interval.count() > 0 && now - lastCollection >= config.interval)
+                    || (config.live_bytes_threshold != 0 && AllocationTracker::getLiveBytes() >= config.live_bytes_threshold);
+                if (collect)
+                {
+                    collectCycles();
+                    lastCollection = std::chrono::steady_clock::now();
+                }
+            }
+        }
+    };
+}
+
+#endif //MEXMEMORY_CYCLECOLLECTOR_H
@@ -1,33 +1,115 @@
 #ifndef MEXMEMORY_CYCLEDETECTION_H
 #define MEXMEMORY_CYCLEDETECTION_H
 
+#include "objectGraph.h"
 #include "reference.h"
-#include <unordered_set>
+#include "refVisitor.h"
+#include "strongReference.h"
+#include "weakReference.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <functional>
+#include <ostream>
 
 /// @brief Namespace for memory management with reference counting \namespace memory::refCounting
 namespace memory::refCounting
 {
     /**
      * @brief Circular reference detector for debugging memory leaks caused by cycles.
+     * It walks the strong references that objects report through trace, so only traced types contribute edges.
+     * detectCycle searches the objects reachable from one Ref; findLeaks analyzes every tracked object at once.
+     * With incremental detection enabled, a Ref assigned inside an object is checked when it is assigned.
      */
     class CycleDetector
     {
     public:
         /**
          * @brief Information about detected cycles.
+         * The path lists every object of the cycle once, in reference order; the last one references the first.
          */
         struct CycleInfo
         {
             std::vector<void*> cycle_path;
+            std::vector<std::string> cycle_types;
             size_t cycle_length;
             std::string description;
         };
 
+        /**
+         * @brief A leaked object, with the type and size recorded by the AllocationTracker.
+         */
+        struct LeakedObject
+        {
+            void* object;
+            std::string type;
+            size_t size;
+        };
+
+        /**
+         * @brief A strong reference inside a leaked component; making every such reference of a component weak
+         * leaves it without cycles.
+         */
+        struct WeakCandidate
+        {
+            void* from;
+            void* to;
+            std::string from_type;
+            std::string to_type;
+        };
+
+        /**
+         * @brief A strongly connected component of leaked objects that keeps itself alive.
+         * retained_objects and retained_bytes add the acyclic leaked objects first reached from it, which are
+         * freed once the component is.
+         */
+        struct LeakedComponent
+        {
+            std::vector<LeakedObject> objects;
+            size_t bytes;
+            size_t retained_objects;
+            size_t retained_bytes;
+            std::vector<WeakCandidate> weak_candidates;
+        };
+
+        /**
+         * @brief What incremental detection does when a Ref assignment closes a cycle: report it through the
+         * cycle callback, or report it and abort so a debugger stops at the assignment.
+         */
+        enum class CycleAction
+        {
+            Report,
+            Abort
+        };
+
+#if defined(NDEBUG)
+        static constexpr CycleAction defaultCycleAction = CycleAction::Report;
+#else
+        static constexpr CycleAction defaultCycleAction = CycleAction::Abort;
+#endif
+
+        /**
+         * @brief Result of a whole-graph leak analysis, with the components sorted by retained bytes, largest
+         * first.
+         */
+        struct LeakReport
+        {
+            size_t objects_analyzed;
+            size_t references_analyzed;
+            size_t leaked_objects;
+            size_t leaked_bytes;
+            std::vector<LeakedComponent> components;
+        };
+
     private:
         static inline bool enabled_ = false;
         static inline std::function<void(const CycleInfo&)> callback_ = nullptr;
+        static inline std::atomic<CycleAction> incrementalAction_{CycleAction::Report};
 
     public:
         /**
@@ -58,7 +140,61 @@ namespace memory::refCounting
         }
 
         /**
-         * @brief Performs a depth-first search to detect cycles starting from a given control block.
+         * @brief Enables or disables incremental detection: while it is enabled, the Refs stored inside objects
+         * created since are kept as an ownership graph in topological order, and the assignment of a Ref that
+         * closes a cycle reports the cycle on the assigning thread, starting with the object assigned to. An
+         * assignment that agrees with the order costs a lookup and a comparison; one that does not reorders
+         * only the objects between its ends. Refs in containers, like std::vector elements, are not part of
+         * the graph; findLeaks covers them. Disabling forgets the graph.
+         * @param enable True to enable incremental detection.
+         * @param action Whether to abort after reporting a cycle; by default, debug builds abort.
+         */
+        static void enableIncremental(bool enable, CycleAction action = defaultCycleAction)
+        {
+            incrementalAction_.store(action, std::memory_order_relaxed);
+            OwnershipGraph::enable(enable, &closedCycle);
+        }
+
+        /**
+         * @brief Checks if incremental detection is enabled.
+         * @return True if Ref assignments are checked for cycles.
+         */
+        static bool isIncrementalEnabled() noexcept
+        {
+            return OwnershipGraph::isEnabled();
+        }
+
+        /**
+         * @brief Gets the counters of incremental detection since it was enabled.
+         * @return The objects and references in the ownership graph, the insertions that reordered it and the
+         * cycles found.
+         */
+        static OwnershipGraph::Stats getIncrementalStats()
+        {
+            return OwnershipGraph::getStats();
+        }
+
+        /**
+         * @brief Searches the objects reachable from a reference for a cycle of strong references and reports the
+         * first one found. The graph must not be modified while it is searched.
+         * @tparam T The type of object being referenced.
+         * @tparam Allocator The allocator type.
+         * @param root The reference to start the search from.
+         * @return True if a cycle is detected, false otherwise.
+         */
+        template<typename T, typename Allocator>
+        static bool detectCycle(const Ref<T, Allocator>& root)
+        {
+            if (!enabled_ || !root.get()) return false;
+
+            std::vector<RefVisitor::Edge> edges;
+            RefVisitor visitor(edges);
+            visitor(root);
+            return search(edges.front());
+        }
+
+        /**
+         * @brief Searches the objects reachable from a control block for a cycle of strong references.
          * @tparam T The type of object being referenced.
          * @tparam Allocator The allocator type.
          * @param startBlock The control block to start the search from.
@@ -67,79 +203,406 @@ namespace memory::refCounting
         template<typename T, typename Allocator>
         static bool detectCycle(ControlBlock<T, Allocator>* startBlock)
         {
-            if (!enabled_ || !startBlock) return false;
-
-            std::unordered_set<void*> visited;
-            std::unordered_set<void*> recursionStack;
-            std::vector<void*> path;
+            if (!enabled_ || !startBlock || !startBlock->getObjectPtr()) return false;
 
-            return dfsDetectCycle(startBlock, visited, recursionStack, path);
+            return search(RefVisitor::makeEdge<std::remove_cv_t<T>>(startBlock, startBlock->getObjectPtr()));
         }
 
         /**
          * @brief Reports a detected cycle.
-         * @param cycle_path The path of pointers that form the cycle.
+         * @param cycle_path The objects that form the cycle.
+         * @param cycle_types The type names of the objects, if known.
          */
-        static void reportCycle(const std::vector<void*>& cycle_path)
+        static void reportCycle(const std::vector<void*>& cycle_path, const std::vector<std::string>& cycle_types = {})
         {
             if (!callback_) return;
 
             CycleInfo info;
             info.cycle_path = cycle_path;
+            info.cycle_types = cycle_types;
             info.cycle_length = cycle_path.size();
             info.description = "Detected circular reference chain of length " + std::to_string(info.cycle_length);
+            for (size_t i = 0; i < cycle_types.size(); ++i)
+            {
+                info.description += (i == 0 ? ": " : " -> ") + cycle_types[i];
+            }
+            if (!cycle_types.empty())
+            {
+                info.description += " -> " + cycle_types.front();
+            }
 
             callback_(info);
         }
 
+        /**
+         * @brief Finds every cycle of strong references that is no longer reachable from outside the tracked
+         * objects. It runs in time linear in the objects and references tracked:
+         * - the Ref-owned objects recorded by the AllocationTracker are traced once to build an ObjectGraph;
+         * - an object with more strong references than tracked objects hold on it is referenced from outside,
+         *   by a stack, a global or an untracked object, and everything reachable from it is live;
+         * - an iterative Tarjan search splits the rest into strongly connected components, and every component
+         *   with a cycle is reported, with the back edges of the search as the references to make weak.
+         *
+         * Allocation tracking must be enabled when the objects are created; with sampling, unsampled objects are
+         * treated as outside references, so only leaks among sampled objects are found. The graph must not be
+         * modified while it is analyzed.
+         * @return The leaked components.
+         */
+        static LeakReport findLeaks()
+        {
+            const ObjectGraph graph = ObjectGraph::fromTracker();
+            LeakSearch search(graph);
+            search.markLive();
+            search.findComponents();
+            return search.report();
+        }
+
+        /**
+         * @brief Prints a leak report, one component per paragraph.
+         * @param report The report to print.
+         * @param stream The stream to print to (default: std::cerr).
+         * @param limit The maximum number of components to print.
+         */
+        static void printLeakReport(const LeakReport& report, std::ostream* stream = &std::cerr, size_t limit = 10)
+        {
+            if (!stream) return;
+
+            (*stream) << "Leak analysis: " << report.leaked_objects << " of " << report.objects_analyzed
+                      << " objects leaked (" << report.leaked_bytes << " bytes) in " << report.components.size()
+                      << " cycles" << std::endl;
+            for (size_t i = 0; i < report.components.size() && i < limit; ++i)
+            {
+                const LeakedComponent& component = report.components[i];
+                (*stream) << "  Cycle of " << component.objects.size() << " objects, " << component.bytes
+                          << " bytes, retaining " << component.retained_bytes << " bytes in "
+                          << component.retained_objects << " objects" << std::endl;
+                for (const LeakedObject& object : component.objects)
+                {
+                    (*stream) << "    " << object.object << " " << object.type << " (" << object.size << " bytes)" << std::endl;
+                }
+                for (const WeakCandidate& edge : component.weak_candidates)
+                {
+                    (*stream) << "    make weak: " << edge.from_type << " " << edge.from << " -> "
+                              << edge.to_type << " " << edge.to << std::endl;
+                }
+            }
+            if (report.components.size() > limit)
+            {
+                (*stream) << "  ... " << report.components.size() - limit << " more cycles" << std::endl;
+            }
+        }
+
     private:
         /**
-         * @brief Depth-first search implementation for cycle detection.
-         * @param current The current control block being visited.
-         * @param visited Set of already visited control blocks.
-         * @param recursionStack Set of control blocks in the current recursion path.
-         * @param path Current path being explored.
-         * @return True if a cycle is detected, false otherwise.
+         * @brief Reports a cycle closed by a Ref assignment, and aborts if incremental detection was enabled
+         * with CycleAction::Abort.
+         * @param objects The objects of the cycle, starting with the one assigned to.
+         * @param types Their type names.
+         */
+        static void closedCycle(std::vector<void*>&& objects, std::vector<std::string>&& types)
+        {
+            reportCycle(objects, types);
+            if (incrementalAction_.load(std::memory_order_relaxed) == CycleAction::Abort)
+            {
+                std::cerr << "Strong reference cycle of " << objects.size() << " objects created";
+                for (size_t i = 0; i < types.size(); ++i)
+                {
+                    std::cerr << (i == 0 ? ": " : " -> ") << types[i];
+                }
+                std::cerr << std::endl;
+                abort();
+            }
+        }
+
+        /**
+         * @brief The passes of findLeaks over the graph of all tracked objects.
          */
-        static bool dfsDetectCycle(void* current, 
-                                 std::unordered_set<void*>& visited,
-                                 std::unordered_set<void*>& recursionStack,
-                                 std::vector<void*>& path)
+        struct LeakSearch
         {
-            if (!current) return false;
+            using Index = ObjectGraph::Index;
+            static constexpr Index none = ObjectGraph::none;
+
+            const ObjectGraph& graph;
+            std::vector<bool> live;
+            std::vector<Index> component;
+            std::vector<std::pair<Index, Index>> backEdges;
+            Index components = 0;
+
+            /**
+             * @brief Constructs the search over a graph.
+             * @param objects The graph of all tracked objects.
+             */
+            explicit LeakSearch(const ObjectGraph& objects) : graph(objects) {}
 
-            // If we've seen this node in the current path, we found a cycle
-            if (recursionStack.find(current) != recursionStack.end())
+            /**
+             * @brief Marks everything reachable from the nodes referenced from outside the graph as live.
+             */
+            void markLive()
             {
-                // Extract the cycle from the path
-                auto cycleStart = std::find(path.begin(), path.end(), current);
-                if (cycleStart != path.end())
+                live.assign(graph.size(), false);
+                std::vector<Index> stack;
+                for (size_t i = 0; i < graph.size(); ++i)
                 {
-                    std::vector<void*> cyclePath(cycleStart, path.end());
-                    cyclePath.push_back(current); // Complete the cycle
-                    reportCycle(cyclePath);
-                    return true;
+                    if (graph.external[i])
+                    {
+                        live[i] = true;
+                        stack.push_back(static_cast<Index>(i));
+                    }
+                }
+                while (!stack.empty())
+                {
+                    const Index node = stack.back();
+                    stack.pop_back();
+                    for (size_t e = graph.firstEdge[node]; e < graph.firstEdge[node + 1]; ++e)
+                    {
+                        if (!live[graph.targets[e]])
+                        {
+                            live[graph.targets[e]] = true;
+                            stack.push_back(graph.targets[e]);
+                        }
+                    }
                 }
             }
 
-            // If already visited and not in recursion stack, no cycle from this node
-            if (visited.find(current) != visited.end())
-                return false;
+            /**
+             * @brief Iterative Tarjan search over the leaked nodes. Components are numbered in the order they
+             * are completed, which puts every component after the ones it references; references to nodes still
+             * on the search path are the back edges.
+             */
+            void findComponents()
+            {
+                /**
+                 * @brief A node on the search path and its next reference to follow.
+                 */
+                struct Frame
+                {
+                    Index node;
+                    size_t next;
+                };
+
+                std::vector<Index> order(graph.size(), none);
+                std::vector<Index> low(graph.size(), 0);
+                std::vector<bool> onPath(graph.size(), false);
+                std::vector<Index> open;
+                std::vector<Frame> path;
+                component.assign(graph.size(), none);
+                Index visited = 0;
+
+                const auto enter = [&](Index node) {
+                    order[node] = low[node] = visited++;
+                    onPath[node] = true;
+                    open.push_back(node);
+                    path.push_back(Frame{node, graph.firstEdge[node]});
+                };
+
+                for (size_t start = 0; start < graph.size(); ++start)
+                {
+                    if (live[start] || order[start] != none) continue;
+
+                    enter(static_cast<Index>(start));
+                    while (!path.empty())
+                    {
+                        const Index node = path.back().node;
+                        if (path.back().next < graph.firstEdge[node + 1])
+                        {
+                            const Index target = graph.targets[path.back().next++];
+                            if (live[target]) continue;
 
-            // Mark as visited and add to recursion stack
-            visited.insert(current);
-            recursionStack.insert(current);
-            path.push_back(current);
+                            if (order[target] == none)
+                            {
+                                enter(target);
+                            }
+                            else if (component[target] == none)
+                            {
+                                low[node] = std::min(low[node], order[target]);
+                                if (onPath[target])
+                                {
+                                    backEdges.emplace_back(node, target);
+                                }
+                            }
+                            continue;
+                        }
 
-            // Note: In a real implementation, we would traverse the actual references
-            // from the control block. For now, this is a basic framework.
-            // The actual implementation would need to examine the object's member variables
-            // that are Ref or WeakRef types.
+                        path.pop_back();
+                        onPath[node] = false;
+                        if (low[node] == order[node])
+                        {
+                            Index member;
+                            do
+                            {
+                                member = open.back();
+                                open.pop_back();
+                                component[member] = components;
+                            }
+                            while (member != node);
+                            ++components;
+                        }
+                        if (!path.empty())
+                        {
+                            low[path.back().node] = std::min(low[path.back().node], low[node]);
+                        }
+                    }
+                }
+            }
 
-            // Remove from recursion stack and path when done with this node
-            recursionStack.erase(current);
-            path.pop_back();
+            /**
+             * @brief Groups the leaked nodes into the report. Components are visited from the ones nothing
+             * references, so each acyclic leaked node is attributed to the first cycle that reaches it.
+             * @return The report.
+             */
+            LeakReport report() const
+            {
+                LeakReport result{graph.size(), graph.targets.size(), 0, 0, {}};
+                std::vector<bool> cyclic(components, false);
+                for (const auto& [from, to] : backEdges)
+                {
+                    cyclic[component[from]] = true;
+                }
+                std::vector<Index> entry(components, none);
+                for (Index c = 0; c < components; ++c)
+                {
+                    if (cyclic[c])
+                    {
+                        entry[c] = static_cast<Index>(result.components.size());
+                        result.components.push_back(LeakedComponent{{}, 0, 0, 0, {}});
+                    }
+                }
 
+                // The members of each component, grouped in one array by a counting sort.
+                std::vector<size_t> firstMember(components + 1, 0);
+                for (size_t i = 0; i < graph.size(); ++i)
+                {
+                    if (component[i] != none)
+                    {
+                        ++firstMember[component[i] + 1];
+                    }
+                }
+                for (Index c = 0; c < components; ++c)
+                {
+                    firstMember[c + 1] += firstMember[c];
+                }
+                std::vector<Index> members(firstMember[components]);
+                std::vector<size_t> filled(firstMember.begin(), firstMember.end() - 1);
+                for (size_t i = 0; i < graph.size(); ++i)
+                {
+                    if (component[i] != none)
+                    {
+                        members[filled[component[i]]++] = static_cast<Index>(i);
+                    }
+                }
+
+                std::vector<Index> retainer(components, none);
+                for (Index c = components; c-- > 0;)
+                {
+                    if (entry[c] != none)
+                    {
+                        retainer[c] = entry[c];
+                    }
+                    for (size_t m = firstMember[c]; m < firstMember[c + 1]; ++m)
+                    {
+                        const Index node = members[m];
+                        const ObjectGraph::Node& object = graph.nodes[node];
+                        result.leaked_objects += 1;
+                        result.leaked_bytes += object.size;
+                        if (retainer[c] == none) continue;
+
+                        LeakedComponent& owner = result.components[retainer[c]];
+                        owner.retained_objects += 1;
+                        owner.retained_bytes += object.size;
+                        if (entry[c] != none)
+                        {
+                            owner.objects.push_back(LeakedObject{object.object, graph.typeName(node), object.size});
+                            owner.bytes += object.size;
+                        }
+                        for (size_t e = graph.firstEdge[node]; e < graph.firstEdge[node + 1]; ++e)
+                        {
+                            const Index next = component[graph.targets[e]];
+                            if (next != none && entry[next] == none && retainer[next] == none)
+                            {
+                                retainer[next] = retainer[c];
+                            }
+                        }
+                    }
+                }
+
+                for (const auto& [from, to] : backEdges)
+                {
+                    result.components[entry[component[from]]].weak_candidates.push_back(WeakCandidate{
+                        graph.nodes[from].object, graph.nodes[to].object, graph.typeName(from), graph.typeName(to)});
+                }
+
+                std::stable_sort(result.components.begin(), result.components.end(),
+                    [](const LeakedComponent& a, const LeakedComponent& b) {
+                        return a.retained_bytes > b.retained_bytes;
+                    });
+                return result;
+            }
+        };
+
+        /**
+         * @brief Iterative depth-first search for a cycle, using an explicit stack so that the depth of the
+         * graph is bounded by memory rather than by the call stack.
+         * @param root The edge to the object to start from.
+         * @return True if a cycle is detected, false otherwise.
+         */
+        static bool search(const RefVisitor::Edge& root)
+        {
+            /**
+             * @brief An object on the current path and the range of its outgoing edges still to be followed.
+             */
+            struct Frame
+            {
+                RefVisitor::Edge node;
+                size_t begin;
+                size_t next;
+                size_t end;
+            };
+
+            // Objects on the current path map to their depth; objects whose subgraph is done map to finished.
+            constexpr size_t finished = SIZE_MAX;
+            std::unordered_map<ControlBlockBase*, size_t> depthOf;
+            std::vector<RefVisitor::Edge> edges;
+            std::vector<Frame> path;
+
+            const auto enter = [&](const RefVisitor::Edge& node) {
+                depthOf[node.block] = path.size();
+                const size_t begin = edges.size();
+                RefVisitor visitor(edges);
+                node.trace(node.object, visitor);
+                path.push_back(Frame{node, begin, begin, edges.size()});
+            };
+
+            enter(root);
+            while (!path.empty())
+            {
+                Frame& frame = path.back();
+                if (frame.next == frame.end)
+                {
+                    depthOf[frame.node.block] = finished;
+                    edges.resize(frame.begin);
+                    path.pop_back();
+                    continue;
+                }
+
+                const RefVisitor::Edge edge = edges[frame.next++];
+                const auto it = depthOf.find(edge.block);
+                if (it == depthOf.end())
+                {
+                    enter(edge);
+                }
+                else if (it->second != finished)
+                {
+                    std::vector<void*> cyclePath;
+                    std::vector<std::string> cycleTypes;
+                    for (size_t i = it->second; i < path.size(); ++i)
+                    {
+                        cyclePath.push_back(const_cast<void*>(path[i].node.object));
+                        cycleTypes.push_back(path[i].node.typeName());
+                    }
+                    reportCycle(cyclePath, cycleTypes);
+                    return true;
+                }
+            }
             return false;
         }
     };
@@ -152,7 +615,7 @@ namespace memory::refCounting
     inline void enableCycleDetection(bool enable, std::ostream* logStream = &std::cerr)
     {
         CycleDetector::enableDetection(enable);
-        
+
         if (enable)
         {
             CycleDetector::setCycleCallback([logStream](const CycleDetector::CycleInfo& info) {
@@ -162,7 +625,12 @@ namespace memory::refCounting
                     (*logStream) << "Cycle path contains " << info.cycle_length << " objects" << std::endl;
                     for (size_t i = 0; i < info.cycle_path.size(); ++i)
                     {
-                        (*logStream) << "  [" << i << "] " << info.cycle_path[i] << std::endl;
+                        (*logStream) << "  [" << i << "] " << info.cycle_path[i];
+                        if (i < info.cycle_types.size())
+                        {
+                            (*logStream) << " " << info.cycle_types[i];
+                        }
+                        (*logStream) << std::endl;
                     }
                     (*logStream) << std::endl;
                 }
@@ -175,4 +643,4 @@ namespace memory::refCounting
     }
 }
 
-#endif //MEXMEMORY_CYCLEDETECTION_H
\ No newline at end of file
+#endif //MEXMEMORY_CYCLEDETECTION_H
@@ -0,0 +1,676 @@
+#ifndef MEXMEMORY_HEAPGRAPH_H
+#define MEXMEMORY_HEAPGRAPH_H
+
+#include "allocationMap.h"
+#include "controlBlock.h"
+#include "refVisitor.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/// @brief Namespace for memory management with reference counting \namespace memory::refCounting
+namespace memory::refCounting
+{
+    /**
+     * @brief Output formats of a heap graph dump.
+     */
+    enum class GraphFormat
+    {
+        Dot,
+        GraphML,
+        Binary
+    };
+
+    /**
+     * @brief HeapGraph dumps the live Ref-owned objects the AllocationTracker has recorded, with the references
+     * their trace functions report, for analysis in other tools. Nodes carry the type, size and strong and weak
+     * counts of an object and are identified by the address of its control block; edges are labelled strong or
+     * weak. The dump is streamed to a file descriptor record by record through a fixed buffer, so writing it
+     * takes no memory in proportion to the heap.
+     *
+     * The binary format is a header followed by tagged records, in the byte order of the machine that wrote it:
+     * type names the first time a node uses them, nodes, the edges of each node right after it, and an end
+     * record with the totals. A binary dump can be loaded back with load and written again as text.
+     *
+     * Edges can lead to objects that are not nodes: objects created while tracking was off or not sampled.
+     * Allocation tracking must be enabled when the objects are created, and the graph must not be modified while
+     * it is written; each record shard stays locked while its objects are traced and written.
+     */
+    class HeapGraph
+    {
+    public:
+
+        /**
+         * @brief Magic bytes at the start of every binary dump.
+         */
+        static constexpr char magic[8] = {'M', 'E', 'X', 'G', 'R', 'A', 'P', 'H'};
+
+        /**
+         * @brief Version of the binary format.
+         */
+        static constexpr uint32_t version = 1;
+
+        /**
+         * @brief An object, as recorded in a dump.
+         */
+        struct Node
+        {
+            uint64_t block;
+            uint64_t object;
+            uint64_t size;
+            uint32_t type;
+            uint32_t strong;
+            uint32_t weak;
+        };
+
+        /**
+         * @brief A reference from the object with one control block to the object with another.
+         */
+        struct Edge
+        {
+            uint64_t from;
+            uint64_t to;
+            bool weak;
+        };
+
+        /**
+         * @brief What a dump contained: the records written, the size of the output, and whether all of it
+         * reached the file descriptor.
+         */
+        struct ExportStats
+        {
+            size_t nodes;
+            size_t strong_edges;
+            size_t weak_edges;
+            size_t types;
+            size_t bytes;
+            bool complete;
+        };
+
+        std::vector<std::string> typeNames;
+        std::vector<Node> nodes;
+        std::vector<Edge> edges;
+        bool complete = false;
+
+        /**
+         * @brief Streams the graph of the tracked objects to a file descriptor, which is left open.
+         * @param fd The file descriptor to write to.
+         * @param format The format to write.
+         * @return The number of records and bytes written.
+         */
+        static ExportStats exportGraph(int fd, GraphFormat format)
+        {
+            Writer out(fd, format);
+            out.begin();
+
+            std::unordered_map<std::string, uint32_t> typeIndex;
+            const std::string* lastType = nullptr;
+            uint32_t lastIndex = 0;
+            std::vector<RefVisitor::Edge> strongEdges;
+            std::vector<RefVisitor::Edge> weakEdges;
+            AllocationTracker::forEachAllocation([&](const AllocationTracker::AllocationInfo& info) {
+                if (!info.owner) return;
+
+                // Records of one type usually come in runs, so most nodes skip the lookup.
+                if (!lastType || *lastType != info.type)
+                {
+                    const auto [it, inserted] = typeIndex.try_emplace(info.type, static_cast<uint32_t>(typeIndex.size()));
+                    if (inserted)
+                    {
+                        out.type(it->second, it->first);
+                    }
+                    lastType = &it->first;
+                    lastIndex = it->second;
+                }
+
+                const uint64_t block = reinterpret_cast<uintptr_t>(info.owner);
+                out.node(Node{block, reinterpret_cast<uintptr_t>(info.ptr), info.size, lastIndex,
+                              static_cast<uint32_t>(info.owner->strongCount()), static_cast<uint32_t>(info.owner->weakCount())});
+
+                strongEdges.clear();
+                weakEdges.clear();
+                RefVisitor visitor(strongEdges, weakEdges);
+                info.owner->traceObject(visitor);
+                for (const RefVisitor::Edge& edge : strongEdges)
+                {
+                    out.edge(Edge{block, reinterpret_cast<uintptr_t>(edge.block), false});
+                }
+                for (const RefVisitor::Edge& edge : weakEdges)
+                {
+                    out.edge(Edge{block, reinterpret_cast<uintptr_t>(edge.block), true});
+                }
+            });
+            return out.finish();
+        }
+
+        /**
+         * @brief Streams the graph of the tracked objects to a file.
+         * @param path The file to write; it is truncated.
+         * @param format The format to write.
+         * @return The number of records and bytes written; not complete if the file could not be opened.
+         */
+        static ExportStats exportGraph(const std::string& path, GraphFormat format)
+        {
+            const int fd = openForWriting(path);
+            if (fd < 0)
+            {
+                return ExportStats{0, 0, 0, 0, 0, false};
+            }
+            const ExportStats stats = exportGraph(fd, format);
+            const bool closed = closeFile(fd);
+            return ExportStats{stats.nodes, stats.strong_edges, stats.weak_edges, stats.types, stats.bytes, stats.complete && closed};
+        }
+
+        /**
+         * @brief Loads a binary dump. A dump cut short is loaded as far as it goes and is not complete.
+         * @param path The file written by exportGraph.
+         * @return The graph.
+         * @throws std::runtime_error If the file cannot be read or is not a heap graph dump.
+         */
+        static HeapGraph load(const std::string& path)
+        {
+            std::FILE* file = std::fopen(path.c_str(), "rb");
+            if (!file)
+            {
+                throw std::runtime_error("Cannot open heap graph " + path);
+            }
+            std::vector<char> data;
+            char chunk[1 << 16];
+            size_t read = 0;
+            while ((read = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+            {
+                data.insert(data.end(), chunk, chunk + read);
+            }
+            std::fclose(file);
+
+            Reader in{data.data(), data.data() + data.size()};
+            char fileMagic[sizeof(magic)];
+            uint32_t fileVersion = 0;
+            uint32_t reserved = 0;
+            if (!in.get(fileMagic) || !in.get(fileVersion) || !in.get(reserved) ||
+                std::memcmp(fileMagic, magic, sizeof(magic)) != 0 || fileVersion != version)
+            {
+                throw std::runtime_error("Not a mexMemory heap graph: " + path);
+            }
+
+            HeapGraph graph;
+            while (in.position < in.end)
+            {
+                const auto kind = static_cast<Record>(*in.position++);
+                if (kind == Record::Type)
+                {
+                    uint32_t index = 0;
+                    uint32_t length = 0;
+                    if (!in.get(index) || !in.get(length) || index != graph.typeNames.size() || in.end - in.position < length) break;
+                    graph.typeNames.emplace_back(in.position, length);
+                    in.position += length;
+                }
+                else if (kind == Record::Node)
+                {
+                    Node node{};
+                    if (!in.get(node.block) || !in.get(node.object) || !in.get(node.size) ||
+                        !in.get(node.type) || !in.get(node.strong) || !in.get(node.weak)) break;
+                    graph.nodes.push_back(node);
+                }
+                else if (kind == Record::StrongEdge || kind == Record::WeakEdge)
+                {
+                    Edge edge{0, 0, kind == Record::WeakEdge};
+                    if (!in.get(edge.from) || !in.get(edge.to)) break;
+                    graph.edges.push_back(edge);
+                }
+                else if (kind == Record::End)
+                {
+                    uint64_t nodeCount = 0;
+                    uint64_t edgeCount = 0;
+                    if (!in.get(nodeCount) || !in.get(edgeCount)) break;
+                    graph.complete = nodeCount == graph.nodes.size() && edgeCount == graph.edges.size();
+                    break;
+                }
+                else
+                {
+                    break;
+                }
+            }
+            return graph;
+        }
+
+        /**
+         * @brief Writes a loaded graph to a file descriptor, which is left open; used to turn a binary dump into
+         * text for a graph tool.
+         * @param fd The file descriptor to write to.
+         * @param format The format to write.
+         * @return The number of records and bytes written.
+         */
+        ExportStats write(int fd, GraphFormat format) const
+        {
+            Writer out(fd, format);
+            out.begin();
+            for (size_t i = 0; i < typeNames.size(); ++i)
+            {
+                out.type(static_cast<uint32_t>(i), typeNames[i]);
+            }
+            // Edges follow the node they start from, as in a dump.
+            size_t next = 0;
+            for (const Node& node : nodes)
+            {
+                out.node(node);
+                for (; next < edges.size() && edges[next].from == node.block; ++next)
+                {
+                    out.edge(edges[next]);
+                }
+            }
+            for (; next < edges.size(); ++next)
+            {
+                out.edge(edges[next]);
+            }
+            return out.finish();
+        }
+
+    private:
+
+        /**
+         * @brief Tags of the binary records.
+         */
+        enum class Record : uint8_t
+        {
+            Type = 1,
+            Node = 2,
+            StrongEdge = 3,
+            WeakEdge = 4,
+            End = 5
+        };
+
+        /**
+         * @brief Cursor over the records of a loaded dump.
+         */
+        struct Reader
+        {
+            const char* position;
+            const char* end;
+
+            /**
+             * @brief Reads a fixed-size field.
+             * @tparam T The type of the field.
+             * @param value Receives the field.
+             * @return False if the dump ends first.
+             */
+            template<typename T>
+            bool get(T& value) noexcept
+            {
+                if (static_cast<size_t>(end - position) < sizeof(T)) return false;
+                std::memcpy(&value, position, sizeof(T));
+                position += sizeof(T);
+                return true;
+            }
+        };
+
+        /**
+         * @brief Formats records into a fixed buffer and writes it to the file descriptor whenever it fills up.
+         * After a failed write the rest of the output is counted but dropped.
+         */
+        class Writer
+        {
+        public:
+
+            /**
+             * @brief Constructs a writer.
+             * @param fd The file descriptor to write to.
+             * @param format The format to write.
+             */
+            Writer(int fd, GraphFormat format) noexcept : fd_(fd), format_(format) {}
+
+            /**
+             * @brief Writes what comes before the first record.
+             */
+            void begin() noexcept
+            {
+                if (format_ == GraphFormat::Dot)
+                {
+                    text("digraph mexMemory {\n");
+                }
+                else if (format_ == GraphFormat::GraphML)
+                {
+                    text("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                         "<graphml xmlns=\"http://graphml.graphdrawing.org/xmlns\">\n"
+                         "  <key id=\"type\" for=\"node\" attr.name=\"type\" attr.type=\"string\"/>\n"
+                         "  <key id=\"size\" for=\"node\" attr.name=\"size\" attr.type=\"long\"/>\n"
+                         "  <key id=\"strong\" for=\"node\" attr.name=\"strong\" attr.type=\"long\"/>\n"
+                         "  <key id=\"weak\" for=\"node\" attr.name=\"weak\" attr.type=\"long\"/>\n"
+                         "  <key id=\"kind\" for=\"edge\" attr.name=\"kind\" attr.type=\"string\"/>\n"
+                         "  <graph id=\"mexMemory\" edgedefault=\"directed\">\n");
+                }
+                else
+                {
+                    const uint32_t header[2] = {version, 0};
+                    put(magic, sizeof(magic));
+                    put(header, sizeof(header));
+                }
+            }
+
+            /**
+             * @brief Declares a type name. The binary format writes it as a record; the text formats escape it once
+             * here and copy it into every node of the type.
+             * @param index The index nodes refer to it by.
+             * @param name The type name.
+             */
+            void type(uint32_t index, std::string_view name)
+            {
+                ++stats_.types;
+                if (format_ != GraphFormat::Binary)
+                {
+                    if (names_.size() <= index)
+                    {
+                        names_.resize(index + 1, "?");
+                    }
+                    names_[index] = escape(name);
+                    return;
+                }
+
+                const auto length = static_cast<uint32_t>(name.size());
+                tag(Record::Type);
+                put(&index, sizeof(index));
+                put(&length, sizeof(length));
+                put(name.data(), name.size());
+            }
+
+            /**
+             * @brief Writes a node.
+             * @param node The node, whose type has been declared.
+             */
+            void node(const Node& node) noexcept
+            {
+                ++stats_.nodes;
+                const std::string_view typeName = node.type < names_.size() ? std::string_view(names_[node.type]) : std::string_view("?");
+                if (format_ == GraphFormat::Dot)
+                {
+                    text("  ");
+                    id(node.block);
+                    text(" [label=\"");
+                    text(typeName);
+                    text("\\n");
+                    number(node.size);
+                    text(" bytes\", type=\"");
+                    text(typeName);
+                    text("\", size=");
+                    number(node.size);
+                    text(", strong=");
+                    number(node.strong);
+                    text(", weak=");
+                    number(node.weak);
+                    text("];\n");
+                }
+                else if (format_ == GraphFormat::GraphML)
+                {
+                    text("    <node id=\"");
+                    id(node.block);
+                    text("\"><data key=\"type\">");
+                    text(typeName);
+                    text("</data><data key=\"size\">");
+                    number(node.size);
+                    text("</data><data key=\"strong\">");
+                    number(node.strong);
+                    text("</data><data key=\"weak\">");
+                    number(node.weak);
+                    text("</data></node>\n");
+                }
+                else
+                {
+                    tag(Record::Node);
+                    put(&node.block, sizeof(node.block));
+                    put(&node.object, sizeof(node.object));
+                    put(&node.size, sizeof(node.size));
+                    put(&node.type, sizeof(node.type));
+                    put(&node.strong, sizeof(node.strong));
+                    put(&node.weak, sizeof(node.weak));
+                }
+            }
+
+            /**
+             * @brief Writes an edge.
+             * @param edge The edge.
+             */
+            void edge(const Edge& edge) noexcept
+            {
+                ++(edge.weak ? stats_.weak_edges : stats_.strong_edges);
+                if (format_ == GraphFormat::Dot)
+                {
+                    text("  ");
+                    id(edge.from);
+                    text(" -> ");
+                    id(edge.to);
+                    text(edge.weak ? " [kind=weak, style=dashed];\n" : " [kind=strong];\n");
+                }
+                else if (format_ == GraphFormat::GraphML)
+                {
+                    text("    <edge source=\"");
+                    id(edge.from);
+                    text("\" target=\"");
+                    id(edge.to);
+                    text(edge.weak ? "\"><data key=\"kind\">weak</data></edge>\n" : "\"><data key=\"kind\">strong</data></edge>\n");
+                }
+                else
+                {
+                    tag(edge.weak ? Record::WeakEdge : Record::StrongEdge);
+                    put(&edge.from, sizeof(edge.from));
+                    put(&edge.to, sizeof(edge.to));
+                }
+            }
+
+            /**
+             * @brief Writes what comes after the last record and flushes the buffer.
+             * @return The number of records and bytes written.
+             */
+            ExportStats finish() noexcept
+            {
+                if (format_ == GraphFormat::Dot)
+                {
+                    text("}\n");
+                }
+                else if (format_ == GraphFormat::GraphML)
+                {
+                    text("  </graph>\n</graphml>\n");
+                }
+                else
+                {
+                    const uint64_t totals[2] = {stats_.nodes, stats_.strong_edges + stats_.weak_edges};
+                    tag(Record::End);
+                    put(totals, sizeof(totals));
+                }
+                flush();
+                stats_.complete = !failed_;
+                return stats_;
+            }
+
+        private:
+            int fd_;
+            GraphFormat format_;
+            bool failed_ = false;
+            size_t used_ = 0;
+            ExportStats stats_{0, 0, 0, 0, 0, false};
+            std::vector<std::string> names_;
+            char buffer_[1 << 16];
+
+            /**
+             * @brief Writes the tag of a binary record.
+             * @param record The kind of record.
+             */
+            void tag(Record record) noexcept
+            {
+                const auto value = static_cast<uint8_t>(record);
+                put(&value, 1);
+            }
+
+            /**
+             * @brief Writes text as is.
+             * @param text The text.
+             */
+            void text(std::string_view text) noexcept
+            {
+                put(text.data(), text.size());
+            }
+
+            /**
+             * @brief Writes an unsigned integer in decimal.
+             * @param value The value.
+             */
+            void number(uint64_t value) noexcept
+            {
+                char digits[24];
+                const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+                put(digits, static_cast<size_t>(result.ptr - digits));
+            }
+
+            /**
+             * @brief Writes a node id: the control block address in hexadecimal, after a letter so that it is a
+             * valid identifier in both text formats.
+             * @param block The control block address.
+             */
+            void id(uint64_t block) noexcept
+            {
+                char digits[24] = {'n'};
+                const auto result = std::to_chars(digits + 1, digits + sizeof(digits), block, 16);
+                put(digits, static_cast<size_t>(result.ptr - digits));
+            }
+
+            /**
+             * @brief Escapes a type name for the text format; DOT strings escape quotes and backslashes, XML the
+             * markup characters that C++ type names contain.
+             * @param name The type name.
+             * @return The escaped name.
+             */
+            [[nodiscard]] std::string escape(std::string_view name) const
+            {
+                std::string result;
+                for (const char c : name)
+                {
+                    if (format_ == GraphFormat::Dot && (c == '"' || c == '\\'))
+                    {
+                        result += '\\';
+                        result += c;
+                    }
+                    else if (format_ == GraphFormat::GraphML && c == '<')
+                    {
+                        result += "&lt;";
+                    }
+                    else if (format_ == GraphFormat::GraphML && c == '>')
+                    {
+                        result += "&gt;";
+                    }
+                    else if (format_ == GraphFormat::GraphML && c == '&')
+                    {
+                        result += "&amp;";
+                    }
+                    else
+                    {
+                        result += c;
+                    }
+                }
+                return result;
+            }
+
+            /**
+             * @brief Appends bytes to the buffer, writing it out each time it fills up.
+             * @param data The bytes.
+             * @param size The number of bytes.
+             */
+            void put(const void* data, size_t size) noexcept
+            {
+                stats_.bytes += size;
+                const char* bytes = static_cast<const char*>(data);
+                while (size > 0)
+                {
+                    if (used_ == sizeof(buffer_))
+                    {
+                        flush();
+                    }
+                    const size_t count = std::min(size, sizeof(buffer_) - used_);
+                    std::memcpy(buffer_ + used_, bytes, count);
+                    used_ += count;
+                    bytes += count;
+                    size -= count;
+                }
+            }
+
+            /**
+             * @brief Writes out the buffer, retrying short and interrupted writes.
+             */
+            void flush() noexcept
+            {
+                for (size_t done = 0; done < used_ && !failed_; )
+                {
+                    const auto written = writeFile(fd_, buffer_ + done, used_ - done);
+                    if (written > 0)
+                    {
+                        done += static_cast<size_t>(written);
+                    }
+                    else if (written == 0 || errno != EINTR)
+                    {
+                        failed_ = true;
+                    }
+                }
+                used_ = 0;
+            }
+        };
+
+        /**
+         * @brief Opens a file for writing, truncating it.
+         * @param path The file.
+         * @return The file descriptor, or -1 on failure.
+         */
+        static int openForWriting(const std::string& path) noexcept
+        {
+#if defined(_WIN32)
+            return ::_open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#else
+            return ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+        }
+
+        /**
+         * @brief Closes a file descriptor.
+         * @param fd The file descriptor.
+         * @return True if the data written reached the file.
+         */
+        static bool closeFile(int fd) noexcept
+        {
+#if defined(_WIN32)
+            return ::_close(fd) == 0;
+#else
+            return ::close(fd) == 0;
+#endif
+        }
+
+        /**
+         * @brief Writes to a file descriptor once.
+         * @param fd The file descriptor.
+         * @param data The bytes to write.
+         * @param size The number of bytes.
+         * @return The number of bytes written, or -1 on failure.
+         */
+        static long long writeFile(int fd, const char* data, size_t size) noexcept
+        {
+#if defined(_WIN32)
+            return ::_write(fd, data, static_cast<unsigned>(size));
+#else
+            return ::write(fd, data, size);
+#endif
+        }
+    };
+}
+
+#endif //MEXMEMORY_HEAPGRAPH_H
@@ -0,0 +1,220 @@
+#ifndef MEXMEMORY_HISTOGRAM_H
+#define MEXMEMORY_HISTOGRAM_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// @brief Namespace for memory management with reference counting \namespace memory::refCounting
+namespace memory::refCounting
+{
+    /**
+     * @brief HistogramBuckets defines the fixed, log-linear bucket layout shared by all histograms.
+     * Every power of two is split into 2^subBucketBits linear sub-buckets, HDR-style, which bounds the
+     * relative error of a bucket to 1 / 2^subBucketBits. Values of 2^maxValueBits and above share the last bucket.
+     */
+    struct HistogramBuckets
+    {
+        static constexpr unsigned subBucketBits = 2;
+        static constexpr unsigned maxValueBits = 48;
+        static constexpr size_t count = size_t{maxValueBits - subBucketBits + 1} << subBucketBits;
+
+        /**
+         * @brief Gets the bucket a value falls into.
+         * @param value The value.
+         * @return The bucket index, below count.
+         */
+        static constexpr size_t indexOf(uint64_t value) noexcept
+        {
+            if (value < (uint64_t{1} << subBucketBits))
+            {
+                return static_cast<size_t>(value);
+            }
+            const unsigned exponent = static_cast<unsigned>(std::bit_width(value)) - 1;
+            if (exponent >= maxValueBits)
+            {
+                return count - 1;
+            }
+            const uint64_t sub = (value >> (exponent - subBucketBits)) & ((uint64_t{1} << subBucketBits) - 1);
+            return (size_t{exponent - subBucketBits + 1} << subBucketBits) + static_cast<size_t>(sub);
+        }
+
+        /**
+         * @brief Gets the smallest value in a bucket.
+         * @param index The bucket index.
+         * @return The lower bound, inclusive.
+         */
+        static constexpr uint64_t lowerBound(size_t index) noexcept
+        {
+            if (index < (size_t{1} << subBucketBits))
+            {
+                return index;
+            }
+            const unsigned exponent = static_cast<unsigned>(index >> subBucketBits) + subBucketBits - 1;
+            const uint64_t sub = index & ((size_t{1} << subBucketBits) - 1);
+            return ((uint64_t{1} << subBucketBits) + sub) << (exponent - subBucketBits);
+        }
+
+        /**
+         * @brief Gets the largest value in a bucket.
+         * @param index The bucket index.
+         * @return The upper bound, inclusive; the last bucket is unbounded.
+         */
+        static constexpr uint64_t upperBound(size_t index) noexcept
+        {
+            return index + 1 < count ? lowerBound(index + 1) - 1 : UINT64_MAX;
+        }
+    };
+
+    static_assert(HistogramBuckets::indexOf(HistogramBuckets::lowerBound(57)) == 57, "bucket bounds must round-trip");
+
+    /**
+     * @brief AtomicHistogram is a fixed array of relaxed atomic bucket counters that threads record into.
+     */
+    struct AtomicHistogram
+    {
+        std::atomic<uint64_t> buckets[HistogramBuckets::count] = {};
+
+        /**
+         * @brief Records one value.
+         * @param value The value to record.
+         */
+        void record(uint64_t value) noexcept
+        {
+            buckets[HistogramBuckets::indexOf(value)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Resets every bucket to zero.
+         */
+        void reset() noexcept
+        {
+            for (auto& bucket : buckets)
+            {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    /**
+     * @brief Histogram is a snapshot of a distribution, holding only its non-empty buckets.
+     */
+    struct Histogram
+    {
+        /**
+         * @brief A single non-empty bucket.
+         */
+        struct Bucket
+        {
+            uint64_t lower;
+            uint64_t upper;
+            uint64_t count;
+        };
+
+        std::vector<Bucket> buckets;
+        uint64_t total{0};
+
+        /**
+         * @brief Takes a snapshot of an AtomicHistogram.
+         * @param source The histogram to read.
+         * @return The snapshot, holding the non-empty buckets of source.
+         */
+        static Histogram from(const AtomicHistogram& source)
+        {
+            Histogram snapshot;
+            for (size_t i = 0; i < HistogramBuckets::count; ++i)
+            {
+                if (const uint64_t count = source.buckets[i].load(std::memory_order_relaxed))
+                {
+                    snapshot.buckets.push_back(Bucket{HistogramBuckets::lowerBound(i), HistogramBuckets::upperBound(i), count});
+                    snapshot.total += count;
+                }
+            }
+            return snapshot;
+        }
+
+        /**
+         * @brief Adds the counts of another snapshot to this one.
+         * @param other The snapshot to add.
+         */
+        void add(const Histogram& other)
+        {
+            std::vector<Bucket> merged;
+            merged.reserve(buckets.size() + other.buckets.size());
+            size_t a = 0;
+            size_t b = 0;
+            while (a < buckets.size() || b < other.buckets.size())
+            {
+                if (b == other.buckets.size() || (a < buckets.size() && buckets[a].lower < other.buckets[b].lower))
+                {
+                    merged.push_back(buckets[a++]);
+                }
+                else if (a == buckets.size() || other.buckets[b].lower < buckets[a].lower)
+                {
+                    merged.push_back(other.buckets[b++]);
+                }
+                else
+                {
+                    merged.push_back(Bucket{buckets[a].lower, buckets[a].upper, buckets[a].count + other.buckets[b].count});
+                    ++a;
+                    ++b;
+                }
+            }
+            buckets = std::move(merged);
+            total += other.total;
+        }
+
+        /**
+         * @brief Estimates a percentile from the buckets.
+         * @param percentile The percentile, between 0 and 100.
+         * @return The upper bound of the bucket containing the percentile, or 0 for an empty histogram.
+         */
+        [[nodiscard]] uint64_t percentile(double percentile) const noexcept
+        {
+            if (total == 0)
+            {
+                return 0;
+            }
+            const double rank = percentile / 100.0 * static_cast<double>(total);
+            uint64_t seen = 0;
+            for (const auto& bucket : buckets)
+            {
+                seen += bucket.count;
+                if (static_cast<double>(seen) >= rank)
+                {
+                    return bucket.upper;
+                }
+            }
+            return buckets.back().upper;
+        }
+
+        /**
+         * @brief Prints the histogram as one bar per bucket.
+         * @param stream The output stream to print to.
+         * @param unit The unit appended to the bucket bounds.
+         * @param indent The indentation of each line.
+         */
+        void print(std::ostream& stream, const std::string& unit, const std::string& indent = "    ") const
+        {
+            uint64_t largest = 0;
+            for (const auto& bucket : buckets)
+            {
+                largest = std::max(largest, bucket.count);
+            }
+            for (const auto& bucket : buckets)
+            {
+                const size_t width = static_cast<size_t>(40 * bucket.count / largest);
+                stream << indent << std::setw(14) << bucket.lower << " " << std::setw(2) << unit << " "
+                       << std::setw(10) << bucket.count << " " << std::string(std::max<size_t>(width, 1), '#') << "\n";
+            }
+        }
+    };
+}
+
+#endif //MEXMEMORY_HISTOGRAM_H
@@ -0,0 +1,299 @@
+#ifndef MEXMEMORY_HUGEPAGEALLOCATOR_H
+#define MEXMEMORY_HUGEPAGEALLOCATOR_H
+
+#include <new>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <type_traits>
+#include <memory/refCounting/allocationMap.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+/// @brief Namespace for memory management with reference counting \namespace memory::refCounting
+namespace memory::refCounting
+{
+    /**
+     * @brief HugePageConfig holds the process-wide settings used by HugePageAllocator.
+     */
+    struct HugePageConfig
+    {
+        static constexpr size_t hugePageSize = size_t{2} * 1024 * 1024;
+        static inline size_t threshold = hugePageSize;
+        static inline bool tryHugeTlb = true;
+    };
+
+    /// @brief Namespace for implementation details of the huge page backend \namespace memory::refCounting::hugePages
+    namespace hugePages
+    {
+        /**
+         * @brief Kind of backing store used for a HugePageAllocator allocation.
+         */
+        enum class Backing : uint32_t
+        {
+            Heap,
+            TransparentHugePages,
+            HugeTlb
+        };
+
+        /**
+         * @brief Header placed in front of every HugePageAllocator allocation.
+         * It records how the block was obtained so that it can be returned the same way.
+         */
+        struct alignas(64) Header
+        {
+            void* base;
+            size_t mappedBytes;
+            size_t elementCount;
+            Backing backing;
+            bool tracked;
+        };
+
+        static_assert(sizeof(Header) == 64, "Header must occupy exactly one cache line");
+
+        /**
+         * @brief Rounds a size up to a multiple of the huge page size.
+         * @param bytes The size to round up.
+         * @return The rounded size.
+         */
+        constexpr size_t roundUp(size_t bytes) noexcept
+        {
+            return (bytes + HugePageConfig::hugePageSize - 1) & ~(HugePageConfig::hugePageSize - 1);
+        }
+
+        /**
+         * @brief Maps an anonymous region, preferring explicit hugetlbfs pages, then transparent huge pages.
+         * @param bytes The number of bytes needed, including the header.
+         * @param header The header to fill with the mapping details.
+         * @return The base address of the mapping, or nullptr if no mapping could be made.
+         */
+        inline void* mapRegion(size_t bytes, Header& header) noexcept
+        {
+#if defined(__linux__)
+            const size_t length = roundUp(bytes);
+
+#if defined(MAP_HUGETLB)
+            if (HugePageConfig::tryHugeTlb)
+            {
+                void* base = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (base != MAP_FAILED)
+                {
+                    header.base = base;
+                    header.mappedBytes = length;
+                    header.backing = Backing::HugeTlb;
+                    return base;
+                }
+            }
+#endif
+
+            // Over-map by one huge page so the region can be trimmed to a huge page boundary,
+            // otherwise the kernel can only back the aligned interior with huge pages.
+            const size_t padded = length + HugePageConfig::hugePageSize;
+            void* raw = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (raw == MAP_FAILED)
+            {
+                return nullptr;
+            }
+
+            const auto rawAddr = reinterpret_cast<uintptr_t>(raw);
+            const uintptr_t aligned = (rawAddr + HugePageConfig::hugePageSize - 1) & ~(HugePageConfig::hugePageSize - 1);
+            const size_t head = aligned - rawAddr;
+            const size_t tail = padded - head - length;
+            if (head > 0)
+            {
+                munmap(raw, head);
+            }
+            if (tail > 0)
+            {
+                munmap(reinterpret_cast<void*>(aligned + length), tail);
+            }
+
+            void* base = reinterpret_cast<void*>(aligned);
+#if defined(MADV_HUGEPAGE)
+            madvise(base, length, MADV_HUGEPAGE);
+#endif
+            header.base = base;
+            header.mappedBytes = length;
+            header.backing = Backing::TransparentHugePages;
+            return base;
+#else
+            (void)bytes;
+            (void)header;
+            return nullptr;
+#endif
+        }
+
+        /**
+         * @brief Obtains storage for a payload of the given size, with a Header in front of it.
+         * Small requests, and large ones that cannot be mapped, are served from the regular heap.
+         * @param payloadBytes The size of the payload in bytes.
+         * @return A pointer to the payload.
+         * @throws std::bad_alloc If no storage could be obtained.
+         */
+        inline void* acquire(size_t payloadBytes)
+        {
+            const size_t total = sizeof(Header) + payloadBytes;
+            Header header{nullptr, 0, 0, Backing::Heap, false};
+
+            void* base = nullptr;
+            if (payloadBytes >= HugePageConfig::threshold)
+            {
+                base = mapRegion(total, header);
+            }
+
+            if (!base)
+            {
+                base = ::operator new(total, std::align_val_t{alignof(Header)});
+                header.base = base;
+                header.mappedBytes = total;
+                header.backing = Backing::Heap;
+            }
+            else
+            {
+                header.tracked = AllocationTracker::trackHugePageMapping(header.mappedBytes, header.backing == Backing::HugeTlb);
+            }
+
+            auto* stored = ::new (base) Header(header);
+            return stored + 1;
+        }
+
+        /**
+         * @brief Returns storage obtained with acquire.
+         * @param payload The payload pointer returned by acquire.
+         */
+        inline void release(void* payload) noexcept
+        {
+            if (!payload)
+            {
+                return;
+            }
+
+            const Header header = *(static_cast<Header*>(payload) - 1);
+            if (header.backing == Backing::Heap)
+            {
+                ::operator delete(header.base, std::align_val_t{alignof(Header)});
+                return;
+            }
+
+            if (header.tracked)
+            {
+                AllocationTracker::untrackHugePageMapping(header.mappedBytes, header.backing == Backing::HugeTlb);
+            }
+#if defined(__linux__)
+            munmap(header.base, header.mappedBytes);
+#endif
+        }
+    }
+
+    /**
+     * @brief HugePageAllocator maps large objects with mmap and asks the kernel to back them with huge pages.
+     * Allocations below HugePageConfig::threshold use the regular heap.
+     * @tparam T The type of object to allocate.
+     */
+    template <typename T>
+    struct HugePageAllocator
+    {
+        static_assert(alignof(T) <= alignof(hugePages::Header), "HugePageAllocator supports alignments up to 64 bytes");
+
+        /**
+         * @brief Allocates memory for a single object of type T with constructor arguments.
+         * @tparam Args The types of the constructor arguments.
+         * @param args The constructor arguments.
+         * @return A pointer to the allocated object.
+         */
+        template <typename... Args>
+        static T* allocate(Args&&... args)
+        {
+            void* storage = hugePages::acquire(sizeof(T));
+            try
+            {
+                return ::new (storage) T(std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                hugePages::release(storage);
+                throw;
+            }
+        }
+
+        /**
+         * @brief Destroys and deallocates a single object of type T.
+         * @param ptr The pointer to the object to deallocate.
+         */
+        static void deallocate(T* ptr) noexcept
+        {
+            if (!ptr)
+            {
+                return;
+            }
+            ptr->~T();
+            hugePages::release(ptr);
+        }
+    };
+
+    /**
+     * @brief Specialization of HugePageAllocator for arrays of type T.
+     * The array length is kept in the allocation header so deallocate only needs the pointer.
+     * @tparam T The type of objects in the array.
+     */
+    template <typename T>
+    struct HugePageAllocator<T[]>
+    {
+        static_assert(alignof(T) <= alignof(hugePages::Header), "HugePageAllocator supports alignments up to 64 bytes");
+
+        /**
+         * @brief Allocates memory for an array of type T.
+         * Trivially constructible elements are left uninitialized, as with new T[size].
+         * @param size The number of elements in the array.
+         * @return A pointer to the allocated array.
+         */
+        static T* allocate(size_t size)
+        {
+            void* storage = hugePages::acquire(sizeof(T) * size);
+            if constexpr (!std::is_trivially_default_constructible_v<T>)
+            {
+                std::uninitialized_default_construct_n(static_cast<T*>(storage), size);
+            }
+            if constexpr (!std::is_trivially_destructible_v<T>)
+            {
+                header(static_cast<T*>(storage)).elementCount = size;
+            }
+            return static_cast<T*>(storage);
+        }
+
+        /**
+         * @brief Deallocates memory for an array of type T.
+         * @param ptr The pointer to the array to deallocate.
+         */
+        static void deallocate(T* ptr) noexcept
+        {
+            if (!ptr)
+            {
+                return;
+            }
+            if constexpr (!std::is_trivially_destructible_v<T>)
+            {
+                std::destroy_n(ptr, header(ptr).elementCount);
+            }
+            hugePages::release(ptr);
+        }
+
+    private:
+
+        /**
+         * @brief Gets the allocation header that precedes an array.
+         * @param ptr The pointer to the array.
+         * @return A reference to the header.
+         */
+        static hugePages::Header& header(T* ptr) noexcept
+        {
+            return *(reinterpret_cast<hugePages::Header*>(ptr) - 1);
+        }
+    };
+}
+
+#endif //MEXMEMORY_HUGEPAGEALLOCATOR_H
@@ -0,0 +1,160 @@
+#ifndef MEXMEMORY_METRICSWRITER_H
+#define MEXMEMORY_METRICSWRITER_H
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+/// @brief Namespace for memory management with reference counting \namespace memory::refCounting
+namespace memory::refCounting
+{
+    /**
+     * @brief MetricsWriter formats text into a caller-supplied buffer without allocating.
+     * Output that does not fit is dropped but still counted, so the caller can retry with the length
+     * returned by finish, the same way as with snprintf.
+     */
+    class MetricsWriter
+    {
+    public:
+
+        /**
+         * @brief How escaped strings are quoted.
+         */
+        enum class Escape
+        {
+            OpenMetricsLabel,
+            Json
+        };
+
+        /**
+         * @brief Constructs a writer over a buffer.
+         * @param buffer The buffer to write to; may be null if capacity is 0.
+         * @param capacity The size of the buffer in bytes, including room for the terminating null.
+         */
+        MetricsWriter(char* buffer, size_t capacity) noexcept : buffer_(buffer), capacity_(capacity) {}
+
+        /**
+         * @brief Appends text as is.
+         * @param text The text to append.
+         * @return This writer.
+         */
+        MetricsWriter& text(std::string_view text) noexcept
+        {
+            put(text.data(), text.size());
+            return *this;
+        }
+
+        /**
+         * @brief Appends an unsigned integer in decimal.
+         * @param value The value to append.
+         * @return This writer.
+         */
+        MetricsWriter& number(uint64_t value) noexcept
+        {
+            char digits[24];
+            const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+            put(digits, static_cast<size_t>(result.ptr - digits));
+            return *this;
+        }
+
+        /**
+         * @brief Appends a signed integer in decimal.
+         * @param value The value to append.
+         * @return This writer.
+         */
+        MetricsWriter& number(int64_t value) noexcept
+        {
+            char digits[24];
+            const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+            put(digits, static_cast<size_t>(result.ptr - digits));
+            return *this;
+        }
+
+        /**
+         * @brief Appends a floating point number in its shortest round-trip form.
+         * @param value The value to append.
+         * @return This writer.
+         */
+        MetricsWriter& number(double value) noexcept
+        {
+            char digits[32];
+            const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+            put(digits, static_cast<size_t>(result.ptr - digits));
+            return *this;
+        }
+
+        /**
+         * @brief Appends a string between double quotes, escaped for the given format.
+         * @param text The string to append.
+         * @param escape The escaping rules to apply.
+         * @return This writer.
+         */
+        MetricsWriter& quoted(std::string_view text, Escape escape) noexcept
+        {
+            put("\"", 1);
+            for (const char c : text)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    const char escaped[2] = {'\\', c};
+                    put(escaped, 2);
+                }
+                else if (c == '\n')
+                {
+                    put("\\n", 2);
+                }
+                else if (escape == Escape::Json && static_cast<unsigned char>(c) < 0x20)
+                {
+                    static constexpr char hex[] = "0123456789abcdef";
+                    const char escaped[6] = {'\\', 'u', '0', '0', hex[(c >> 4) & 0xf], hex[c & 0xf]};
+                    put(escaped, 6);
+                }
+                else
+                {
+                    put(&c, 1);
+                }
+            }
+            put("\"", 1);
+            return *this;
+        }
+
+        /**
+         * @brief Terminates the output with a null character.
+         * @return The length of the complete output, excluding the null; larger than or equal to the
+         * capacity if the output was truncated.
+         */
+        size_t finish() noexcept
+        {
+            if (capacity_ > 0)
+            {
+                buffer_[std::min(length_, capacity_ - 1)] = '\0';
+            }
+            return length_;
+        }
+
+    private:
+        char* buffer_;
+        size_t capacity_;
+        size_t length_ = 0;
+
+        /**
+         * @brief Copies as much of a range as fits, leaving room for the terminating null, and counts all of it.
+         * @param data The characters to copy.
+         * @param size The number of characters.
+         */
+        void put(const char* data, size_t size) noexcept
+        {
+            if (length_ + 1 < capacity_)
+            {
+                const size_t room = capacity_ - 1 - length_;
+                std::memcpy(buffer_ + length_, data, std::min(size, room));
+            }
+            length_ += size;
+        }
+    };
+}
+
+#endif //MEXMEMORY_METRICSWRITER_H
@@ -0,0 +1,337 @@
+#ifndef MEXMEMORY_NUMAALLOCATOR_H
+#define MEXMEMORY_NUMAALLOCATOR_H
+
+#include <new>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <type_traits>
+#include <memory/refCounting/allocationMap.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/// @brief Namespace for memory management with reference counting \namespace memory::refCounting
+namespace memory::refCounting
+{
+    /// @brief Namespace for NUMA topology queries and placement helpers \namespace memory::refCounting::numa
+    namespace numa
+    {
+        /**
+         * @brief Maximum number of nodes the allocator and the tracker keep separate statistics for.
+         */
+        inline constexpr int maxNodes = AllocationTracker::maxNumaNodes;
+
+        /**
+         * @brief Node requested by the innermost NumaNodeScope on this thread, or -1 for the calling thread's node.
+         */
+        inline thread_local int scopedNode = -1;
+
+        /**
+         * @brief Gets the number of online NUMA nodes, read once from sysfs.
+         * @return The number of nodes, which is 1 on machines without NUMA support.
+         */
+        inline int nodeCount() noexcept
+        {
+            static const int count = []() noexcept
+            {
+#if defined(__linux__)
+                // The file holds a range list such as "0" or "0-1"; the last number is the highest node.
+                std::ifstream online("/sys/devices/system/node/online");
+                std::string ranges;
+                if (online >> ranges)
+                {
+                    const auto pos = ranges.find_last_of("-,");
+                    const int highest = std::atoi(ranges.c_str() + (pos == std::string::npos ? 0 : pos + 1));
+                    if (highest >= 0 && highest < maxNodes)
+                    {
+                        return highest + 1;
+                    }
+                }
+#endif
+                return 1;
+            }();
+            return count;
+        }
+
+        /**
+         * @brief Gets the NUMA node of the CPU the calling thread is running on.
+         * @return The node index, or 0 if it cannot be determined.
+         */
+        inline int currentNode() noexcept
+        {
+#if defined(__linux__) && defined(SYS_getcpu)
+            if (nodeCount() > 1)
+            {
+                unsigned cpu = 0;
+                unsigned node = 0;
+                if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 && node < static_cast<unsigned>(maxNodes))
+                {
+                    return static_cast<int>(node);
+                }
+            }
+#endif
+            return 0;
+        }
+
+        /**
+         * @brief Gets the node the next allocation on this thread should be placed on.
+         * @return The scoped node if one is set and exists, otherwise the calling thread's node.
+         */
+        inline int targetNode() noexcept
+        {
+            if (scopedNode >= 0 && scopedNode < nodeCount())
+            {
+                return scopedNode;
+            }
+            return currentNode();
+        }
+
+        /**
+         * @brief Binds a page-aligned range to a node with a preferred policy, so the kernel can still
+         * fall back to other nodes under memory pressure.
+         * @param addr The start of the range.
+         * @param length The length of the range in bytes.
+         * @param node The node to prefer.
+         * @return True if the policy was applied.
+         */
+        inline bool preferNode(void* addr, size_t length, int node) noexcept
+        {
+#if defined(__linux__) && defined(SYS_mbind)
+            constexpr int mpolPreferred = 1;
+            unsigned long mask[(maxNodes + 63) / 64] = {};
+            mask[node / 64] = 1ul << (node % 64);
+            return syscall(SYS_mbind, addr, length, mpolPreferred, mask, static_cast<unsigned long>(maxNodes) + 1, 0) == 0;
+#else
+            (void)addr;
+            (void)length;
+            (void)node;
+            return false;
+#endif
+        }
+
+        /**
+         * @brief Header placed in front of every NumaAllocator allocation.
+         */
+        struct alignas(64) Header
+        {
+            void* base;
+            size_t totalBytes;
+            size_t elementCount;
+            int node;
+            bool mapped;
+            bool tracked;
+        };
+
+        static_assert(sizeof(Header) == 64, "Header must occupy exactly one cache line");
+
+        /**
+         * @brief Obtains storage for a payload on the target node.
+         * Allocations of at least one page are mapped and bound to the node with mbind. Smaller ones
+         * come from the heap and rely on first-touch placement, since the calling thread constructs them.
+         * On single-node machines everything comes from the heap.
+         * @param payloadBytes The size of the payload in bytes.
+         * @return A pointer to the payload.
+         * @throws std::bad_alloc If no storage could be obtained.
+         */
+        inline void* acquire(size_t payloadBytes)
+        {
+            const size_t total = sizeof(Header) + payloadBytes;
+            Header header{nullptr, total, 0, targetNode(), false, false};
+
+#if defined(__linux__)
+            static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            if (nodeCount() > 1 && payloadBytes >= pageSize)
+            {
+                const size_t length = (total + pageSize - 1) & ~(pageSize - 1);
+                void* base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (base != MAP_FAILED)
+                {
+                    preferNode(base, length, header.node);
+                    header.base = base;
+                    header.totalBytes = length;
+                    header.mapped = true;
+                }
+            }
+#endif
+
+            if (!header.base)
+            {
+                header.base = ::operator new(total, std::align_val_t{alignof(Header)});
+            }
+
+            header.tracked = AllocationTracker::trackNumaAllocation(header.node, header.totalBytes);
+            auto* stored = ::new (header.base) Header(header);
+            return stored + 1;
+        }
+
+        /**
+         * @brief Returns storage obtained with acquire.
+         * @param payload The payload pointer returned by acquire.
+         */
+        inline void release(void* payload) noexcept
+        {
+            if (!payload)
+            {
+                return;
+            }
+
+            const Header header = *(static_cast<Header*>(payload) - 1);
+            if (header.tracked)
+            {
+                AllocationTracker::untrackNumaAllocation(header.node, header.totalBytes);
+            }
+
+#if defined(__linux__)
+            if (header.mapped)
+            {
+                munmap(header.base, header.totalBytes);
+                return;
+            }
+#endif
+            ::operator delete(header.base, std::align_val_t{alignof(Header)});
+        }
+    }
+
+    /**
+     * @brief NumaNodeScope directs NumaAllocator allocations made by this thread to an explicit node.
+     * Scopes nest; a node that does not exist falls back to the calling thread's node.
+     */
+    class NumaNodeScope
+    {
+    public:
+
+        /**
+         * @brief Constructs a scope that places allocations on the given node.
+         * @param node The node to allocate from.
+         */
+        explicit NumaNodeScope(int node) noexcept : previous_(numa::scopedNode)
+        {
+            numa::scopedNode = node;
+        }
+
+        /**
+         * @brief Restores the node that was in effect before this scope.
+         */
+        ~NumaNodeScope()
+        {
+            numa::scopedNode = previous_;
+        }
+
+        NumaNodeScope(const NumaNodeScope&) = delete;
+        NumaNodeScope& operator=(const NumaNodeScope&) = delete;
+
+    private:
+        int previous_;
+    };
+
+    /**
+     * @brief NumaAllocator places objects on the calling thread's NUMA node, or on the node of the
+     * innermost NumaNodeScope. It degrades to the regular heap on machines without NUMA.
+     * @tparam T The type of object to allocate.
+     */
+    template <typename T>
+    struct NumaAllocator
+    {
+        static_assert(alignof(T) <= alignof(numa::Header), "NumaAllocator supports alignments up to 64 bytes");
+
+        /**
+         * @brief Allocates memory for a single object of type T with constructor arguments.
+         * @tparam Args The types of the constructor arguments.
+         * @param args The constructor arguments.
+         * @return A pointer to the allocated object.
+         */
+        template <typename... Args>
+        static T* allocate(Args&&... args)
+        {
+            void* storage = numa::acquire(sizeof(T));
+            try
+            {
+                return ::new (storage) T(std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                numa::release(storage);
+                throw;
+            }
+        }
+
+        /**
+         * @brief Destroys and deallocates a single object of type T.
+         * @param ptr The pointer to the object to deallocate.
+         */
+        static void deallocate(T* ptr) noexcept
+        {
+            if (!ptr)
+            {
+                return;
+            }
+            ptr->~T();
+            numa::release(ptr);
+        }
+    };
+
+    /**
+     * @brief Specialization of NumaAllocator for arrays of type T.
+     * @tparam T The type of objects in the array.
+     */
+    template <typename T>
+    struct NumaAllocator<T[]>
+    {
+        static_assert(alignof(T) <= alignof(numa::Header), "NumaAllocator supports alignments up to 64 bytes");
+
+        /**
+         * @brief Allocates memory for an array of type T on the target node.
+         * @param size The number of elements in the array.
+         * @return A pointer to the allocated array.
+         */
+        static T* allocate(size_t size)
+        {
+            void* storage = numa::acquire(sizeof(T) * size);
+            if constexpr (!std::is_trivially_default_constructible_v<T>)
+            {
+                std::uninitialized_default_construct_n(static_cast<T*>(storage), size);
+            }
+            header(static_cast<T*>(storage)).elementCount = size;
+            return static_cast<T*>(storage);
+        }
+
+        /**
+         * @brief Deallocates memory for an array of type T.
+         * @param ptr The pointer to the array to deallocate.
+         */
+        static void deallocate(T* ptr) noexcept
+        {
+            if (!ptr)
+            {
+                return;
+            }
+            if constexpr (!std::is_trivially_destructible_v<T>)
+            {
+                std::destroy_n(ptr, header(ptr).elementCount);
+            }
+            numa::release(ptr);
+        }
+
+    private:
+
+        /**
+         * @brief Gets the allocation header that precedes an array.
+         * @param ptr The pointer to the array.
+         * @return A reference to the header.
+         */
+        static numa::Header& header(T* ptr) noexcept
+        {
+            return *(reinterpret_cast<numa::Header*>(ptr) - 1);
+        }
+    };
+}
+
+#endif //MEXMEMORY_NUMAALLOCATOR_H
@@ -0,0 +1,184 @@
+#ifndef MEXMEMORY_OBJECTGRAPH_H
+#define MEXMEMORY_OBJECTGRAPH_H
+
+#include "allocationMap.h"
+#include "controlBlock.h"
+#include "refVisitor.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// @brief Namespace for memory management with reference counting \namespace memory::refCounting
+namespace memory::refCounting
+{
+    /**
+     * @brief ObjectGraph is the graph of every Ref-owned object the AllocationTracker has recorded, with the strong
+     * references between them as reported by their trace functions. Nodes are numbered and the references of a
+     * node are a range of one array of node numbers, so the whole-heap analyses built on it use flat index arrays
+     * instead of hash sets of pointers.
+     *
+     * Allocation tracking must be enabled when the objects are created; with sampling, only sampled objects are
+     * nodes. The graph must not be modified while it is built.
+     */
+    class ObjectGraph
+    {
+    public:
+
+        /**
+         * @brief Number of a node, or of a type name.
+         */
+        using Index = uint32_t;
+
+        /**
+         * @brief Index of no node.
+         */
+        static constexpr Index none = UINT32_MAX;
+
+        /**
+         * @brief A tracked object owned by Refs.
+         */
+        struct Node
+        {
+            ControlBlockBase* block;
+            void* object;
+            size_t size;
+            Index type;
+        };
+
+        std::vector<Node> nodes;
+        std::vector<std::string> typeNames;
+        std::vector<size_t> firstEdge;
+        std::vector<Index> targets;
+        std::vector<bool> external;
+
+        /**
+         * @brief Builds the graph from the allocation records. A node is external when it has more strong
+         * references than the tracked objects hold on it: a stack, a global or an untracked object references it.
+         * @return The graph.
+         */
+        static ObjectGraph fromTracker()
+        {
+            ObjectGraph graph;
+            std::unordered_map<std::string, Index> typeIndex;
+            graph.nodes.reserve(AllocationTracker::getAllocationCount());
+            AllocationTracker::forEachAllocation([&graph, &typeIndex](const AllocationTracker::AllocationInfo& info) {
+                if (info.owner)
+                {
+                    graph.nodes.push_back(Node{info.owner, info.ptr, info.size, graph.typeOf(info.type, typeIndex)});
+                }
+            });
+            graph.traceNodes();
+            graph.findExternal();
+            return graph;
+        }
+
+        /**
+         * @brief Gets the number of nodes.
+         * @return The number of tracked objects in the graph.
+         */
+        [[nodiscard]] size_t size() const noexcept
+        {
+            return nodes.size();
+        }
+
+        /**
+         * @brief Gets the type name of a node.
+         * @param node The node.
+         * @return The type recorded for its object.
+         */
+        [[nodiscard]] const std::string& typeName(Index node) const noexcept
+        {
+            return typeNames[nodes[node].type];
+        }
+
+    private:
+
+        /**
+         * @brief Interns the type name of a record; records of one type usually come in runs.
+         * @param name The type name.
+         * @param typeIndex The names interned so far.
+         * @return The index of the name.
+         */
+        Index typeOf(const std::string& name, std::unordered_map<std::string, Index>& typeIndex)
+        {
+            if (!nodes.empty() && typeNames[nodes.back().type] == name) return nodes.back().type;
+
+            const auto [it, inserted] = typeIndex.try_emplace(name, static_cast<Index>(typeNames.size()));
+            if (inserted)
+            {
+                typeNames.push_back(name);
+            }
+            return it->second;
+        }
+
+        /**
+         * @brief Traces every node and keeps the references between tracked objects. Control blocks are mapped to
+         * node numbers by an open addressing table at most half full.
+         */
+        void traceNodes()
+        {
+            size_t capacity = 16;
+            while (capacity < 2 * nodes.size())
+            {
+                capacity *= 2;
+            }
+            const size_t mask = capacity - 1;
+            const auto slotOf = [mask](const ControlBlockBase* block) {
+                return static_cast<size_t>((reinterpret_cast<uintptr_t>(block) >> 4) * 0x9E3779B97F4A7C15ull >> 20) & mask;
+            };
+            std::vector<std::pair<const ControlBlockBase*, Index>> index(capacity, {nullptr, none});
+            for (size_t i = 0; i < nodes.size(); ++i)
+            {
+                size_t slot = slotOf(nodes[i].block);
+                while (index[slot].first)
+                {
+                    slot = (slot + 1) & mask;
+                }
+                index[slot] = {nodes[i].block, static_cast<Index>(i)};
+            }
+
+            std::vector<RefVisitor::Edge> edges;
+            firstEdge.reserve(nodes.size() + 1);
+            for (Node& node : nodes)
+            {
+                firstEdge.push_back(targets.size());
+                edges.clear();
+                RefVisitor visitor(edges);
+                node.block->traceObject(visitor);
+                for (const RefVisitor::Edge& edge : edges)
+                {
+                    for (size_t slot = slotOf(edge.block); index[slot].first; slot = (slot + 1) & mask)
+                    {
+                        if (index[slot].first == edge.block)
+                        {
+                            targets.push_back(index[slot].second);
+                            break;
+                        }
+                    }
+                }
+            }
+            firstEdge.push_back(targets.size());
+        }
+
+        /**
+         * @brief Compares the strong count of every node with the references the graph holds on it.
+         */
+        void findExternal()
+        {
+            std::vector<Index> inside(nodes.size(), 0);
+            for (Index target : targets)
+            {
+                ++inside[target];
+            }
+            external.resize(nodes.size());
+            for (size_t i = 0; i < nodes.size(); ++i)
+            {
+                external[i] = nodes[i].block->strongCount() > inside[i];
+            }
+        }
+    };
+}
+
+#endif //MEXMEMORY_OBJECTGRAPH_H
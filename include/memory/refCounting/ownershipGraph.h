@@ -0,0 +1,562 @@
+#ifndef MEXMEMORY_OWNERSHIPGRAPH_H
+#define MEXMEMORY_OWNERSHIPGRAPH_H
+
+#include <memory/refCounting/allocationMap.h>
+#include <memory/refCounting/refVisitor.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// @brief Namespace for memory management with reference counting \namespace memory::refCounting
+namespace memory::refCounting
+{
+    class ControlBlockBase;
+
+    /**
+     * @brief OwnershipGraph is the graph of strong references held in the fields of Ref-owned objects, kept up
+     * to date as Refs are assigned, so that a reference closing a cycle is caught when it is created. Its user
+     * interface is CycleDetector::enableIncremental.
+     *
+     * While it is enabled, objects created by control blocks are nodes, and a Ref stored inside a node (a
+     * member, or a member of a member) is an edge from the node to its target; Refs in heap buffers the object
+     * owns, like the elements of a std::vector, are not. A Ref finds the node it lives in by its own address.
+     *
+     * The nodes are kept in a topological order, maintained with the Pearce-Kelly algorithm: an edge that agrees
+     * with the order costs a comparison, and one that does not only reorders the nodes between its ends. An edge
+     * that cannot be ordered closes a cycle; it is reported and set aside, so it does not constrain the order.
+     */
+    class OwnershipGraph
+    {
+    public:
+
+        /**
+         * @brief Function called with the objects of a cycle and their type names, in reference order from the
+         * object whose field closed it. It runs on the thread that closed the cycle, with no lock held.
+         */
+        using Reporter = void (*)(std::vector<void*>&& objects, std::vector<std::string>&& types);
+
+        /**
+         * @brief Counters of the graph since it was enabled: the objects and ordered references it holds, the
+         * references inserted, how many of them reordered objects and how many objects they moved, and the
+         * cycles found.
+         */
+        struct Stats
+        {
+            size_t objects;
+            size_t references;
+            size_t insertions;
+            size_t reorders;
+            size_t reordered_objects;
+            size_t cycles;
+        };
+
+        /**
+         * @brief Checks if the graph is maintained.
+         * @return True if incremental cycle detection is enabled.
+         */
+        static bool isEnabled() noexcept
+        {
+            return state().enabled.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Starts or stops maintaining the graph. Stopping forgets every node; objects created before
+         * the graph is enabled are never nodes.
+         * @param enable True to maintain the graph.
+         * @param reporter The function to call for every cycle found.
+         */
+        static void enable(bool enable, Reporter reporter)
+        {
+            State& graph = state();
+            std::lock_guard<std::mutex> lock(graph.mutex);
+            graph.nodes.clear();
+            graph.byAddress.clear();
+            graph.byBlock.clear();
+            graph.freeNodes.clear();
+            graph.setAside.clear();
+            graph.lowestOrder = 0;
+            graph.lowest.store(UINTPTR_MAX, std::memory_order_relaxed);
+            graph.highest.store(0, std::memory_order_relaxed);
+            graph.stats = Stats{};
+            graph.reporter = reporter;
+            graph.enabled.store(enable, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Gets the counters.
+         * @return The current counters.
+         */
+        static Stats getStats()
+        {
+            State& graph = state();
+            std::lock_guard<std::mutex> lock(graph.mutex);
+            return graph.stats;
+        }
+
+        /**
+         * @brief Adds a new object with the references its trace function shows, keeping those stored inside it.
+         * @param block The control block of the object.
+         * @param object The object.
+         * @param size The size of the object.
+         * @param typeName The function naming the type of the object.
+         * @param edges The references the object holds.
+         * @param sites The address of the Ref of each edge.
+         */
+        static void add(ControlBlockBase* block, const void* object, size_t size, RefVisitor::TypeNameFunction typeName,
+                        const std::vector<RefVisitor::Edge>& edges, const std::vector<const void*>& sites)
+        {
+            State& graph = state();
+            const auto begin = reinterpret_cast<uintptr_t>(object);
+            Cycle cycle;
+            {
+                std::lock_guard<std::mutex> lock(graph.mutex);
+                if (!graph.enabled.load(std::memory_order_relaxed)) return;
+
+                Index node;
+                if (graph.freeNodes.empty())
+                {
+                    node = static_cast<Index>(graph.nodes.size());
+                    graph.nodes.emplace_back();
+                }
+                else
+                {
+                    node = graph.freeNodes.back();
+                    graph.freeNodes.pop_back();
+                }
+                // A new object is referenced by nothing yet, so it can come first in the order.
+                Node& added = graph.nodes[node];
+                added.block = block;
+                added.begin = begin;
+                added.size = size;
+                added.typeName = typeName;
+                added.order = --graph.lowestOrder;
+                graph.byAddress[begin] = node;
+                graph.byBlock[block] = node;
+                ++graph.stats.objects;
+                if (begin < graph.lowest.load(std::memory_order_relaxed))
+                {
+                    graph.lowest.store(begin, std::memory_order_relaxed);
+                }
+                if (begin + size > graph.highest.load(std::memory_order_relaxed))
+                {
+                    graph.highest.store(begin + size, std::memory_order_relaxed);
+                }
+
+                for (size_t i = 0; i < edges.size(); ++i)
+                {
+                    const auto site = reinterpret_cast<uintptr_t>(sites[i]);
+                    const auto target = graph.byBlock.find(edges[i].block);
+                    if (site >= begin && site < begin + size && target != graph.byBlock.end())
+                    {
+                        graph.insert(node, target->second, cycle);
+                    }
+                }
+            }
+            report(graph, cycle);
+        }
+
+        /**
+         * @brief Removes an object about to be destroyed, with every reference from and to it.
+         * @param block The control block of the object.
+         */
+        static void remove(ControlBlockBase* block)
+        {
+            State& graph = state();
+            std::lock_guard<std::mutex> lock(graph.mutex);
+            const auto found = graph.byBlock.find(block);
+            if (found == graph.byBlock.end()) return;
+
+            const Index node = found->second;
+            Node& removed = graph.nodes[node];
+            for (Index target : removed.out)
+            {
+                erase(graph.nodes[target].in, node);
+            }
+            for (Index source : removed.in)
+            {
+                erase(graph.nodes[source].out, node);
+            }
+            graph.stats.references -= removed.out.size() + removed.in.size();
+            std::erase_if(graph.setAside, [node](const std::pair<Index, Index>& edge) {
+                return edge.first == node || edge.second == node;
+            });
+            removed.out.clear();
+            removed.in.clear();
+            removed.block = nullptr;
+            graph.byAddress.erase(removed.begin);
+            graph.byBlock.erase(found);
+            graph.freeNodes.push_back(node);
+            --graph.stats.objects;
+        }
+
+        /**
+         * @brief Records a Ref that starts referencing a block, if it lives inside a node.
+         * @param site The address of the Ref.
+         * @param target The control block it references.
+         */
+        static void link(const void* site, ControlBlockBase* target)
+        {
+            State& graph = state();
+            if (!graph.covers(site)) return;
+
+            Cycle cycle;
+            {
+                std::lock_guard<std::mutex> lock(graph.mutex);
+                graph.link(site, target, cycle);
+            }
+            report(graph, cycle);
+        }
+
+        /**
+         * @brief Records a Ref that stops referencing a block, if it lives inside a node.
+         * @param site The address of the Ref.
+         * @param target The control block it referenced.
+         */
+        static void unlink(const void* site, ControlBlockBase* target)
+        {
+            State& graph = state();
+            if (!graph.covers(site)) return;
+
+            std::lock_guard<std::mutex> lock(graph.mutex);
+            graph.unlink(site, target);
+        }
+
+        /**
+         * @brief Records a reference moved from one Ref to another.
+         * @param from The address of the Ref moved from.
+         * @param to The address of the Ref moved to.
+         * @param target The control block referenced.
+         */
+        static void move(const void* from, const void* to, ControlBlockBase* target)
+        {
+            State& graph = state();
+            if (!graph.covers(from) && !graph.covers(to)) return;
+
+            Cycle cycle;
+            {
+                std::lock_guard<std::mutex> lock(graph.mutex);
+                graph.unlink(from, target);
+                graph.link(to, target, cycle);
+            }
+            report(graph, cycle);
+        }
+
+    private:
+        using Index = uint32_t;
+        static constexpr Index none = UINT32_MAX;
+
+        /**
+         * @brief An object: its address range, its place in the order, its references both ways, with one entry
+         * per Ref, and the scratch fields of the searches.
+         */
+        struct Node
+        {
+            ControlBlockBase* block = nullptr;
+            uintptr_t begin = 0;
+            size_t size = 0;
+            RefVisitor::TypeNameFunction typeName = nullptr;
+            int64_t order = 0;
+            uint64_t mark = 0;
+            Index parent = none;
+            std::vector<Index> out;
+            std::vector<Index> in;
+        };
+
+        /**
+         * @brief The objects of a cycle found under the lock, reported after it is released.
+         */
+        struct Cycle
+        {
+            std::vector<void*> objects;
+            std::vector<RefVisitor::TypeNameFunction> typeNames;
+        };
+
+        /**
+         * @brief The graph, shared by every module of the process like the AllocationTracker state. lowest and
+         * highest bound the addresses of the nodes, so Refs on the stack are dismissed without the lock.
+         */
+        struct State
+        {
+            std::atomic<bool> enabled{false};
+            std::atomic<uintptr_t> lowest{UINTPTR_MAX};
+            std::atomic<uintptr_t> highest{0};
+            std::mutex mutex;
+            Reporter reporter = nullptr;
+            std::vector<Node> nodes;
+            std::map<uintptr_t, Index> byAddress;
+            std::unordered_map<ControlBlockBase*, Index> byBlock;
+            std::vector<Index> freeNodes;
+            std::vector<std::pair<Index, Index>> setAside;
+            std::vector<Index> forward;
+            std::vector<Index> backward;
+            std::vector<Index> stack;
+            std::vector<int64_t> orders;
+            int64_t lowestOrder = 0;
+            uint64_t epoch = 0;
+            Stats stats{};
+
+            /**
+             * @brief Checks if an address may be inside a node.
+             * @param site The address.
+             * @return False if it is outside every node.
+             */
+            bool covers(const void* site) const noexcept
+            {
+                const auto address = reinterpret_cast<uintptr_t>(site);
+                return address >= lowest.load(std::memory_order_relaxed) && address < highest.load(std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief Finds the node a Ref lives in.
+             * @param site The address of the Ref.
+             * @return The node, or none.
+             */
+            Index ownerOf(const void* site) const
+            {
+                const auto address = reinterpret_cast<uintptr_t>(site);
+                auto it = byAddress.upper_bound(address);
+                if (it == byAddress.begin()) return none;
+
+                --it;
+                const Node& node = nodes[it->second];
+                return address < node.begin + node.size ? it->second : none;
+            }
+
+            /**
+             * @brief Adds the edge of a Ref, if it lives inside a node and references one.
+             */
+            void link(const void* site, ControlBlockBase* target, Cycle& cycle)
+            {
+                const Index from = ownerOf(site);
+                if (from == none) return;
+
+                const auto to = byBlock.find(target);
+                if (to != byBlock.end())
+                {
+                    insert(from, to->second, cycle);
+                }
+            }
+
+            /**
+             * @brief Removes the edge of a Ref, if it lives inside a node and references one.
+             */
+            void unlink(const void* site, ControlBlockBase* target)
+            {
+                const Index from = ownerOf(site);
+                if (from == none) return;
+
+                const auto to = byBlock.find(target);
+                if (to == byBlock.end()) return;
+
+                const auto aside = std::find(setAside.begin(), setAside.end(), std::make_pair(from, to->second));
+                if (aside != setAside.end())
+                {
+                    setAside.erase(aside);
+                }
+                else if (erase(nodes[from].out, to->second))
+                {
+                    erase(nodes[to->second].in, from);
+                    --stats.references;
+                }
+            }
+
+            /**
+             * @brief Inserts an edge, reordering the nodes between its ends if it goes against the order: the
+             * nodes reachable from its target that come before its source, and the nodes reaching its source that
+             * come after its target, swap places. If the source is among the first, the edge closes a cycle.
+             * @param from The node holding the Ref.
+             * @param to The node referenced.
+             * @param cycle Receives the cycle, if the edge closes one and cycle holds none yet.
+             */
+            void insert(Index from, Index to, Cycle& cycle)
+            {
+                ++stats.insertions;
+                if (from != to && nodes[from].order < nodes[to].order)
+                {
+                    addEdge(from, to);
+                    return;
+                }
+
+                const Index last = from == to ? to : searchForward(from, to);
+                if (last != none)
+                {
+                    setAside.emplace_back(from, to);
+                    ++stats.cycles;
+                    if (!cycle.objects.empty()) return;
+
+                    for (Index node = last; node != none; node = nodes[node].parent)
+                    {
+                        cycle.objects.push_back(reinterpret_cast<void*>(nodes[node].begin));
+                        cycle.typeNames.push_back(nodes[node].typeName);
+                    }
+                    cycle.objects.push_back(reinterpret_cast<void*>(nodes[from].begin));
+                    cycle.typeNames.push_back(nodes[from].typeName);
+                    std::reverse(cycle.objects.begin(), cycle.objects.end());
+                    std::reverse(cycle.typeNames.begin(), cycle.typeNames.end());
+                    if (from == to)
+                    {
+                        cycle.objects.pop_back();
+                        cycle.typeNames.pop_back();
+                    }
+                    return;
+                }
+
+                searchBackward(from, to);
+                reorder();
+                addEdge(from, to);
+            }
+
+            /**
+             * @brief Collects the nodes reachable from to that come before from in the order.
+             * @return The node from which from was reached, closing a cycle, or none.
+             */
+            Index searchForward(Index from, Index to)
+            {
+                const int64_t bound = nodes[from].order;
+                ++epoch;
+                forward.clear();
+                stack.assign(1, to);
+                nodes[to].mark = epoch;
+                nodes[to].parent = none;
+                while (!stack.empty())
+                {
+                    const Index node = stack.back();
+                    stack.pop_back();
+                    forward.push_back(node);
+                    for (Index next : nodes[node].out)
+                    {
+                        if (next == from) return node;
+
+                        if (nodes[next].mark != epoch && nodes[next].order < bound)
+                        {
+                            nodes[next].mark = epoch;
+                            nodes[next].parent = node;
+                            stack.push_back(next);
+                        }
+                    }
+                }
+                return none;
+            }
+
+            /**
+             * @brief Collects the nodes reaching from that come after to in the order.
+             */
+            void searchBackward(Index from, Index to)
+            {
+                const int64_t bound = nodes[to].order;
+                ++epoch;
+                backward.clear();
+                stack.assign(1, from);
+                nodes[from].mark = epoch;
+                while (!stack.empty())
+                {
+                    const Index node = stack.back();
+                    stack.pop_back();
+                    backward.push_back(node);
+                    for (Index previous : nodes[node].in)
+                    {
+                        if (nodes[previous].mark != epoch && nodes[previous].order > bound)
+                        {
+                            nodes[previous].mark = epoch;
+                            stack.push_back(previous);
+                        }
+                    }
+                }
+            }
+
+            /**
+             * @brief Gives the places of the collected nodes to the nodes reaching from first, then to the nodes
+             * reachable from to, each keeping their relative order.
+             */
+            void reorder()
+            {
+                const auto byOrder = [this](Index a, Index b) { return nodes[a].order < nodes[b].order; };
+                std::sort(backward.begin(), backward.end(), byOrder);
+                std::sort(forward.begin(), forward.end(), byOrder);
+                orders.clear();
+                for (Index node : backward)
+                {
+                    orders.push_back(nodes[node].order);
+                }
+                for (Index node : forward)
+                {
+                    orders.push_back(nodes[node].order);
+                }
+                std::sort(orders.begin(), orders.end());
+                size_t next = 0;
+                for (Index node : backward)
+                {
+                    nodes[node].order = orders[next++];
+                }
+                for (Index node : forward)
+                {
+                    nodes[node].order = orders[next++];
+                }
+                ++stats.reorders;
+                stats.reordered_objects += orders.size();
+            }
+
+            /**
+             * @brief Adds an edge that agrees with the order.
+             */
+            void addEdge(Index from, Index to)
+            {
+                nodes[from].out.push_back(to);
+                nodes[to].in.push_back(from);
+                ++stats.references;
+            }
+        };
+
+        /**
+         * @brief Gets the process-wide graph, which is never destroyed so Refs released during static
+         * destruction can still reach it.
+         * @return The graph.
+         */
+        MEXMEMORY_SHARED static State& state() noexcept
+        {
+            static State* const instance = new State();
+            return *instance;
+        }
+
+        /**
+         * @brief Removes one entry from a list of references.
+         * @param list The list.
+         * @param node The entry.
+         * @return True if it was found.
+         */
+        static bool erase(std::vector<Index>& list, Index node) noexcept
+        {
+            const auto it = std::find(list.begin(), list.end(), node);
+            if (it == list.end()) return false;
+
+            *it = list.back();
+            list.pop_back();
+            return true;
+        }
+
+        /**
+         * @brief Reports a cycle found under the lock.
+         * @param graph The graph.
+         * @param cycle The cycle, empty if none was found.
+         */
+        static void report(const State& graph, Cycle& cycle)
+        {
+            if (cycle.objects.empty() || !graph.reporter) return;
+
+            std::vector<std::string> types;
+            for (RefVisitor::TypeNameFunction typeName : cycle.typeNames)
+            {
+                types.push_back(typeName ? typeName() : std::string());
+            }
+            graph.reporter(std::move(cycle.objects), std::move(types));
+        }
+    };
+}
+
+#endif //MEXMEMORY_OWNERSHIPGRAPH_H
@@ -0,0 +1,507 @@
+#ifndef MEXMEMORY_REFTRACE_H
+#define MEXMEMORY_REFTRACE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Namespace for memory management with reference counting \namespace memory::refCounting
+namespace memory::refCounting
+{
+    /**
+     * @brief Kinds of reference count events recorded by RefTrace.
+     */
+    enum class TraceEvent : uint8_t
+    {
+        Create,
+        IncrementStrong,
+        DecrementStrong,
+        IncrementWeak,
+        DecrementWeak,
+        SetStrong,
+        DestroyObject,
+        DestroyBlock
+    };
+
+    /**
+     * @brief A single fixed-size trace record, written to the trace file as is.
+     * The count is the strong or weak count after the event; the thread is a small id assigned by RefTrace.
+     */
+    struct TraceRecord
+    {
+        uint64_t timestamp;
+        uint64_t block;
+        uint64_t count;
+        uint32_t thread;
+        TraceEvent event;
+        uint8_t reserved[3];
+    };
+
+    static_assert(sizeof(TraceRecord) == 32, "TraceRecord must stay 32 bytes, it is the on-disk format");
+
+    /**
+     * @brief Header at the start of a trace file. The tick and nanosecond pairs taken at start and stop
+     * let a reader convert record timestamps, which are raw CPU ticks where available, to nanoseconds.
+     */
+    struct TraceFileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t recordSize;
+        uint64_t startTicks;
+        uint64_t startNs;
+        uint64_t endTicks;
+        uint64_t endNs;
+        uint64_t records;
+        uint64_t dropped;
+    };
+
+    /**
+     * @brief RefTrace records reference count events into per-thread lock-free ring buffers, which a
+     * background writer drains to a binary file. Recording an event costs a timestamp read and a 32 byte
+     * store, so tracing hardly changes the timing of the program being traced.
+     * When a thread outruns the writer its ring fills up and further events are counted as dropped.
+     */
+    class RefTrace
+    {
+    public:
+
+        /**
+         * @brief Number of records in each thread's ring buffer; a power of two.
+         */
+        static constexpr size_t ringCapacity = 8192;
+
+        /**
+         * @brief Magic bytes at the start of every trace file.
+         */
+        static constexpr char magic[8] = {'M', 'E', 'X', 'T', 'R', 'A', 'C', 'E'};
+
+        /**
+         * @brief Version of the trace file format.
+         */
+        static constexpr uint32_t version = 1;
+
+        /**
+         * @brief Starts tracing to a file.
+         * @param path The file to write the trace to; it is truncated.
+         * @param flushInterval How often the writer drains the ring buffers.
+         * @return True if tracing started, false if it was already active or the file could not be opened.
+         */
+        static bool start(const std::string& path, std::chrono::milliseconds flushInterval = std::chrono::milliseconds(10))
+        {
+            std::lock_guard<std::mutex> lock(controlMutex_);
+            if (active_.load(std::memory_order_relaxed))
+            {
+                return false;
+            }
+
+            file_ = std::fopen(path.c_str(), "wb");
+            if (!file_)
+            {
+                return false;
+            }
+
+            // Discard events left over from a previous trace and remember the drops counted so far.
+            droppedAtStart_ = 0;
+            for (Ring* ring = rings_.load(std::memory_order_acquire); ring; ring = ring->next)
+            {
+                ring->tail.store(ring->head.load(std::memory_order_acquire), std::memory_order_release);
+                droppedAtStart_ += ring->dropped.load(std::memory_order_relaxed);
+            }
+
+            header_ = TraceFileHeader{};
+            std::memcpy(header_.magic, magic, sizeof(magic));
+            header_.version = version;
+            header_.recordSize = sizeof(TraceRecord);
+            header_.startTicks = now();
+            header_.startNs = steadyNanoseconds();
+            written_.store(0, std::memory_order_relaxed);
+            std::fwrite(&header_, sizeof(header_), 1, file_);
+
+            stopping_ = false;
+            flushInterval_ = flushInterval;
+            writer_ = std::thread(writerLoop);
+            active_.store(true, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief Stops tracing, writes the remaining events and closes the file.
+         * Events recorded by threads racing with stop may be left out.
+         */
+        static void stop()
+        {
+            std::lock_guard<std::mutex> lock(controlMutex_);
+            if (!active_.load(std::memory_order_relaxed))
+            {
+                return;
+            }
+            active_.store(false, std::memory_order_release);
+
+            {
+                std::lock_guard<std::mutex> writerLock(writerMutex_);
+                stopping_ = true;
+            }
+            wake_.notify_one();
+            writer_.join();
+
+            uint64_t dropped = 0;
+            for (Ring* ring = rings_.load(std::memory_order_acquire); ring; ring = ring->next)
+            {
+                dropped += ring->dropped.load(std::memory_order_relaxed);
+            }
+            header_.endTicks = now();
+            header_.endNs = steadyNanoseconds();
+            header_.dropped = dropped - droppedAtStart_;
+            std::fseek(file_, 0, SEEK_SET);
+            std::fwrite(&header_, sizeof(header_), 1, file_);
+            std::fclose(file_);
+            file_ = nullptr;
+        }
+
+        /**
+         * @brief Checks whether tracing is active; this is the only cost of the hooks while it is not.
+         * @return True between start and stop.
+         */
+        static bool isActive() noexcept
+        {
+            return active_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Records an event into the calling thread's ring buffer.
+         * @param event The kind of event.
+         * @param block The control block the event happened on.
+         * @param count The reference count after the event.
+         */
+        static void record(TraceEvent event, const void* block, size_t count) noexcept
+        {
+            Ring* ring = localRing_;
+            if (!ring)
+            {
+                ring = acquireRing();
+                if (!ring) return;
+            }
+
+            const uint64_t head = ring->head.load(std::memory_order_relaxed);
+            if (head - ring->cachedTail >= ringCapacity)
+            {
+                ring->cachedTail = ring->tail.load(std::memory_order_acquire);
+                if (head - ring->cachedTail >= ringCapacity)
+                {
+                    ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                    return;
+                }
+            }
+
+            ring->records[head & (ringCapacity - 1)] = TraceRecord{now(), reinterpret_cast<uintptr_t>(block), count, ring->thread, event, {}};
+            ring->head.store(head + 1, std::memory_order_release);
+        }
+
+        /**
+         * @brief Gets the number of records written to the current or last trace file.
+         * @return The number of records.
+         */
+        static uint64_t getRecordCount() noexcept
+        {
+            return written_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Reads the timestamp counter used for trace records.
+         * @return CPU ticks on x86, steady clock nanoseconds elsewhere.
+         */
+        static uint64_t now() noexcept
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            return __builtin_ia32_rdtsc();
+#else
+            return steadyNanoseconds();
+#endif
+        }
+
+    private:
+
+        /**
+         * @brief Single-producer single-consumer ring of one thread's records. Rings are never freed;
+         * a ring whose thread exited is handed to the next thread that starts recording.
+         */
+        struct alignas(64) Ring
+        {
+            TraceRecord records[ringCapacity];
+            alignas(64) std::atomic<uint64_t> head{0};
+            uint64_t cachedTail{0};
+            std::atomic<uint64_t> dropped{0};
+            uint32_t thread{0};
+            alignas(64) std::atomic<uint64_t> tail{0};
+            std::atomic<bool> owned{true};
+            Ring* next = nullptr;
+        };
+
+        /**
+         * @brief Releases the calling thread's ring when the thread exits.
+         */
+        struct RingOwner
+        {
+            Ring* ring;
+
+            constexpr RingOwner() noexcept : ring(nullptr) {}
+
+            ~RingOwner()
+            {
+                if (ring)
+                {
+                    localRing_ = nullptr;
+                    ring->owned.store(false, std::memory_order_release);
+                }
+            }
+        };
+
+        static inline std::atomic<bool> active_{false};
+        static inline std::atomic<Ring*> rings_{nullptr};
+        static inline std::atomic<uint32_t> nextThread_{0};
+        static inline std::atomic<uint64_t> written_{0};
+        static inline thread_local Ring* localRing_ = nullptr;
+        static inline thread_local RingOwner owner_;
+        static inline std::mutex controlMutex_;
+        static inline std::mutex writerMutex_;
+        static inline std::condition_variable wake_;
+        static inline bool stopping_ = false;
+        static inline std::chrono::milliseconds flushInterval_{10};
+        static inline std::thread writer_;
+        static inline std::FILE* file_ = nullptr;
+        static inline TraceFileHeader header_{};
+        static inline uint64_t droppedAtStart_ = 0;
+
+        /**
+         * @brief Reads the steady clock in nanoseconds.
+         * @return The time since the steady clock's epoch.
+         */
+        static uint64_t steadyNanoseconds() noexcept
+        {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        /**
+         * @brief Gives the calling thread a ring, reusing one released by an exited thread if possible.
+         * @return The ring, or nullptr if none could be allocated.
+         */
+        static Ring* acquireRing() noexcept
+        {
+            Ring* ring = nullptr;
+            for (Ring* candidate = rings_.load(std::memory_order_acquire); candidate; candidate = candidate->next)
+            {
+                bool expected = false;
+                if (!candidate->owned.load(std::memory_order_relaxed) &&
+                    candidate->owned.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                {
+                    ring = candidate;
+                    break;
+                }
+            }
+
+            if (!ring)
+            {
+                ring = new (std::nothrow) Ring();
+                if (!ring) return nullptr;
+                ring->next = rings_.load(std::memory_order_relaxed);
+                while (!rings_.compare_exchange_weak(ring->next, ring, std::memory_order_release, std::memory_order_relaxed))
+                {
+                }
+            }
+
+            ring->thread = nextThread_.fetch_add(1, std::memory_order_relaxed) + 1;
+            ring->cachedTail = ring->tail.load(std::memory_order_acquire);
+            localRing_ = ring;
+            owner_.ring = ring;
+            return ring;
+        }
+
+        /**
+         * @brief Writes the pending records of every ring to the file.
+         */
+        static void drain() noexcept
+        {
+            for (Ring* ring = rings_.load(std::memory_order_acquire); ring; ring = ring->next)
+            {
+                uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+                const uint64_t head = ring->head.load(std::memory_order_acquire);
+                while (tail != head)
+                {
+                    const size_t index = static_cast<size_t>(tail & (ringCapacity - 1));
+                    const size_t count = static_cast<size_t>(std::min<uint64_t>(head - tail, ringCapacity - index));
+                    std::fwrite(&ring->records[index], sizeof(TraceRecord), count, file_);
+                    tail += count;
+                    header_.records += count;
+                    written_.store(header_.records, std::memory_order_relaxed);
+                }
+                ring->tail.store(tail, std::memory_order_release);
+            }
+        }
+
+        /**
+         * @brief Body of the background writer: drains the rings every flush interval until stopped.
+         */
+        static void writerLoop()
+        {
+            std::unique_lock<std::mutex> lock(writerMutex_);
+            while (!stopping_)
+            {
+                lock.unlock();
+                drain();
+                lock.lock();
+                wake_.wait_for(lock, flushInterval_, [] { return stopping_; });
+            }
+            lock.unlock();
+            drain();
+        }
+    };
+
+    /**
+     * @brief Reference count history of one object, from the creation of its control block until the
+     * block is freed or the trace ends.
+     */
+    struct ObjectTimeline
+    {
+        uint64_t block{0};
+        std::vector<TraceRecord> events;
+        bool objectDestroyed{false};
+        bool blockDestroyed{false};
+        uint32_t lastReleaser{0};
+        size_t peakStrong{0};
+        size_t strongAtEnd{0};
+        std::unordered_map<uint32_t, int64_t> strongByThread;
+    };
+
+    /**
+     * @brief TraceFile is a trace read back from disk, for offline analysis.
+     */
+    struct TraceFile
+    {
+        TraceFileHeader header{};
+        std::vector<TraceRecord> records;
+
+        /**
+         * @brief Loads a trace file and orders its records by time.
+         * @param path The file written by RefTrace.
+         * @return The trace.
+         * @throws std::runtime_error If the file cannot be read or is not a trace file.
+         */
+        static TraceFile load(const std::string& path)
+        {
+            std::FILE* file = std::fopen(path.c_str(), "rb");
+            if (!file)
+            {
+                throw std::runtime_error("Cannot open trace file " + path);
+            }
+
+            TraceFile trace;
+            const bool valid = std::fread(&trace.header, sizeof(trace.header), 1, file) == 1 &&
+                               std::memcmp(trace.header.magic, RefTrace::magic, sizeof(RefTrace::magic)) == 0 &&
+                               trace.header.version == RefTrace::version &&
+                               trace.header.recordSize == sizeof(TraceRecord);
+            if (!valid)
+            {
+                std::fclose(file);
+                throw std::runtime_error("Not a mexMemory trace file: " + path);
+            }
+
+            TraceRecord record;
+            while (std::fread(&record, sizeof(record), 1, file) == 1)
+            {
+                trace.records.push_back(record);
+            }
+            std::fclose(file);
+
+            std::stable_sort(trace.records.begin(), trace.records.end(), [](const TraceRecord& a, const TraceRecord& b) {
+                return a.timestamp < b.timestamp;
+            });
+            return trace;
+        }
+
+        /**
+         * @brief Converts a record timestamp to nanoseconds since the start of the trace.
+         * @param timestamp The timestamp of a record.
+         * @return The time since the trace started, in nanoseconds.
+         */
+        [[nodiscard]] double toNanoseconds(uint64_t timestamp) const noexcept
+        {
+            const double ticks = static_cast<double>(header.endTicks - header.startTicks);
+            const double ns = static_cast<double>(header.endNs - header.startNs);
+            const double scale = ticks > 0.0 ? ns / ticks : 1.0;
+            return static_cast<double>(static_cast<int64_t>(timestamp - header.startTicks)) * scale;
+        }
+
+        /**
+         * @brief Splits the trace into per-object timelines. A block address that is freed and reused
+         * starts a new timeline at its next Create event.
+         * strongByThread nets each thread's strong increments against its decrements; a reference moved to
+         * another thread shows up as a surplus on one thread and a deficit on the other.
+         * @return The timelines, in order of creation; objects created before the trace started come first.
+         */
+        [[nodiscard]] std::vector<ObjectTimeline> timelines() const
+        {
+            std::vector<ObjectTimeline> result;
+            std::unordered_map<uint64_t, size_t> current;
+            for (const TraceRecord& record : records)
+            {
+                auto it = current.find(record.block);
+                if (it == current.end() || record.event == TraceEvent::Create)
+                {
+                    ObjectTimeline timeline;
+                    timeline.block = record.block;
+                    result.push_back(std::move(timeline));
+                    it = current.insert_or_assign(record.block, result.size() - 1).first;
+                }
+
+                ObjectTimeline& timeline = result[it->second];
+                timeline.events.push_back(record);
+                switch (record.event)
+                {
+                    case TraceEvent::Create:
+                    case TraceEvent::SetStrong:
+                        timeline.strongAtEnd = record.count;
+                        timeline.strongByThread[record.thread] += static_cast<int64_t>(record.count);
+                        break;
+                    case TraceEvent::IncrementStrong:
+                        timeline.strongAtEnd = record.count;
+                        ++timeline.strongByThread[record.thread];
+                        break;
+                    case TraceEvent::DecrementStrong:
+                        timeline.strongAtEnd = record.count;
+                        --timeline.strongByThread[record.thread];
+                        if (record.count == 0)
+                        {
+                            timeline.lastReleaser = record.thread;
+                        }
+                        break;
+                    case TraceEvent::DestroyObject:
+                        timeline.objectDestroyed = true;
+                        break;
+                    case TraceEvent::DestroyBlock:
+                        timeline.blockDestroyed = true;
+                        current.erase(it);
+                        break;
+                    default:
+                        break;
+                }
+                timeline.peakStrong = std::max(timeline.peakStrong, timeline.strongAtEnd);
+            }
+            return result;
+        }
+    };
+}
+
+#endif //MEXMEMORY_REFTRACE_H
@@ -0,0 +1,180 @@
+#ifndef MEXMEMORY_REFVISITOR_H
+#define MEXMEMORY_REFVISITOR_H
+
+#include <memory/refCounting/forwardDecl.h>
+#include <memory/refCounting/allocationMap.h>
+#include <ranges>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/// @brief Namespace for memory management with reference counting \namespace memory::refCounting
+namespace memory::refCounting
+{
+    class ControlBlockBase;
+
+    /**
+     * @brief RefVisitor is handed to an object's trace function, which calls it for every Ref the object holds.
+     * A type opts in with a const member function or a free function found by argument-dependent lookup:
+     * @code
+     * struct Node
+     * {
+     *     Ref<Node> next;
+     *     WeakRef<Node> parent;
+     *     std::vector<Ref<Node>> children;
+     *
+     *     void trace(RefVisitor& visit) const
+     *     {
+     *         visit(next);
+     *         visit(parent);
+     *         visit(children);
+     *     }
+     * };
+     * @endcode
+     * Objects are traced through the static type of the Ref that reaches them, so a polymorphic base should
+     * forward trace to a virtual function. A trace function must show every Ref the object owns exactly once:
+     * CycleCollector counts the edges against the strong counts, and reporting a Ref twice can free live objects.
+     */
+    class RefVisitor
+    {
+    public:
+
+        /**
+         * @brief Function that traces an object of a type known when the edge to it was found.
+         */
+        using TraceFunction = void (*)(const void* object, RefVisitor& visitor);
+
+        /**
+         * @brief Function that names the type of an object, used only when a cycle is reported.
+         */
+        using TypeNameFunction = std::string (*)();
+
+        /**
+         * @brief A strong reference from one object to another.
+         */
+        struct Edge
+        {
+            ControlBlockBase* block;
+            const void* object;
+            TraceFunction trace;
+            TypeNameFunction typeName;
+        };
+
+        /**
+         * @brief Constructs a visitor that appends the edges it is shown to a list.
+         * @param edges The list to append to.
+         */
+        explicit RefVisitor(std::vector<Edge>& edges) noexcept : edges_(edges), sites_(nullptr), weakEdges_(nullptr) {}
+
+        /**
+         * @brief Constructs a visitor that also appends the address of the Ref of every edge to a second list.
+         * @param edges The list to append the edges to.
+         * @param sites The list to append the addresses of the Refs to.
+         */
+        RefVisitor(std::vector<Edge>& edges, std::vector<const void*>& sites) noexcept : edges_(edges), sites_(&sites), weakEdges_(nullptr) {}
+
+        /**
+         * @brief Constructs a visitor that also appends the weak references it is shown to a second list.
+         * @param edges The list to append the strong references to.
+         * @param weakEdges The list to append the weak references to.
+         */
+        RefVisitor(std::vector<Edge>& edges, std::vector<Edge>& weakEdges) noexcept : edges_(edges), sites_(nullptr), weakEdges_(&weakEdges) {}
+
+        /**
+         * @brief Records a strong reference; empty references and destroyed objects are skipped.
+         * @tparam U The type of the referenced object.
+         * @tparam A The allocator of the reference.
+         * @param ref The reference.
+         */
+        template<typename U, typename A>
+        void operator()(const Ref<U, A>& ref)
+        {
+            if (const auto* object = ref.get())
+            {
+                edges_.push_back(makeEdge<std::remove_cv_t<std::remove_extent_t<U>>, std::is_array_v<U>>(ref.getControlBlock(), object));
+                if (sites_)
+                {
+                    sites_->push_back(&ref);
+                }
+            }
+        }
+
+        /**
+         * @brief Accepts a weak reference, which cannot keep a cycle alive and is therefore not an edge. It is only
+         * recorded by visitors given a list of weak edges, and only while its object is alive.
+         * @tparam U The type of the referenced object.
+         * @tparam A The allocator of the reference.
+         * @param ref The reference.
+         */
+        template<typename U, typename A>
+        void operator()(const WeakRef<U, A>& ref)
+        {
+            if (weakEdges_ && !ref.expired())
+            {
+                weakEdges_->push_back(makeEdge<std::remove_cv_t<std::remove_extent_t<U>>, std::is_array_v<U>>(ref.getControlBlock(), ref.get()));
+            }
+        }
+
+        /**
+         * @brief Visits every reference in a container.
+         * @tparam Range The type of the container.
+         * @param refs The container of Refs or WeakRefs.
+         */
+        template<std::ranges::range Range>
+        void operator()(const Range& refs)
+        {
+            for (const auto& ref : refs)
+            {
+                (*this)(ref);
+            }
+        }
+
+        /**
+         * @brief Creates the edge to an object, binding the trace function of its type.
+         * @tparam U The type of the object.
+         * @tparam Array True if the reference manages an array, whose elements are not traced.
+         * @param block The control block of the object.
+         * @param object The object.
+         * @return The edge.
+         */
+        template<typename U, bool Array = false>
+        static Edge makeEdge(ControlBlockBase* block, const void* object) noexcept
+        {
+            return Edge{block, object, Array ? &traceNothing : &traceObject<U>, &AllocationTracker::demangleTypeName<U>};
+        }
+
+        /**
+         * @brief Calls the trace function of an object, if its type has one.
+         * @tparam U The type of the object.
+         * @param object The object.
+         * @param visitor The visitor to pass on.
+         */
+        template<typename U>
+        static void traceObject(const void* object, RefVisitor& visitor)
+        {
+            const U& typed = *static_cast<const U*>(object);
+            if constexpr (requires { typed.trace(visitor); })
+            {
+                typed.trace(visitor);
+            }
+            else if constexpr (requires { trace(typed, visitor); })
+            {
+                trace(typed, visitor);
+            }
+        }
+
+    private:
+        std::vector<Edge>& edges_;
+        std::vector<const void*>* sites_;
+        std::vector<Edge>* weakEdges_;
+
+        /**
+         * @brief Trace function of objects without outgoing edges.
+         */
+        static void traceNothing(const void*, RefVisitor&) noexcept
+        {
+        }
+    };
+}
+
+#endif //MEXMEMORY_REFVISITOR_H
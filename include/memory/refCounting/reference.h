@@ -16,24 +16,26 @@ namespace memory::refCounting
      * @tparam Allocator The allocator to use for memory management, defaults to DefaultAllocator.
      */
     template<typename T, typename Allocator>
-    thread_local std::vector<ControlBlock<T, Allocator>*> hazard_pointers;
+    thread_local std::vector<ControlBlockBase*> hazard_pointers;
 
     /**
      * @brief Base class for reference types, providing common functionality for strong and weak references.
      * @tparam T The type of object being referenced, can be a single object or an array.
      * @tparam Allocator The allocator to use for memory management, defaults to DefaultAllocator.
      */
-    template <typename T, typename Allocator = DefaultAllocator<std::remove_extent_t<T>>>
+    template <typename T, typename Allocator = DefaultAllocator<T>>
     class ReferenceBase
     {
     protected:
 
         /**
          * @brief Alias for the element type of T, which can be a single object or an array.
+         * References of every type share the untyped ControlBlockBase and keep their own typed pointer.
          */
         using elementType = std::remove_extent_t<T>;
-        using controlBlockType = ControlBlock<elementType, Allocator>;
+        using controlBlockType = ControlBlockBase;
         controlBlockType* controlBlock = nullptr;
+        elementType* objectPtr = nullptr;
 
         /**
          * @brief Default constructor for ReferenceBase.
@@ -42,9 +44,20 @@ namespace memory::refCounting
 
         /**
          * @brief Constructs a ReferenceBase with a given control block.
+         * @tparam U The type of object managed by the block, which must be convertible to the element type.
+         * @tparam A The allocator of the block.
          * @param cb The control block to associate with this reference.
          */
-        explicit ReferenceBase(controlBlockType* cb) : controlBlock(cb) {}
+        template <typename U, typename A>
+        explicit ReferenceBase(ControlBlock<U, A>* cb) : controlBlock(cb), objectPtr(cb ? cb->get() : nullptr) {}
+
+        /**
+         * @brief Constructs a ReferenceBase with a given control block and the pointer it exposes.
+         * The pointer may differ from the managed object, e.g. for aliasing references to a member.
+         * @param cb The control block to associate with this reference.
+         * @param ptr The pointer returned by get().
+         */
+        ReferenceBase(controlBlockType* cb, elementType* ptr) : controlBlock(cb), objectPtr(ptr) {}
 
         /**
          * @brief Swaps the control block with another ReferenceBase.
@@ -53,6 +66,7 @@ namespace memory::refCounting
         void swap(ReferenceBase& other) noexcept
         {
             std::swap(controlBlock, other.controlBlock);
+            std::swap(objectPtr, other.objectPtr);
         }
 
     public:
@@ -72,7 +86,7 @@ namespace memory::refCounting
          */
         [[nodiscard]] bool isValid() const noexcept
         {
-            return controlBlock and controlBlock->hadObject();
+            return get() != nullptr;
         }
 
         /**
@@ -100,18 +114,23 @@ namespace memory::refCounting
         {
             if (controlBlock)
             {
+                if (OwnershipGraph::isEnabled())
+                {
+                    OwnershipGraph::unlink(this, controlBlock);
+                }
                 controlBlock->decrementStrong();
                 controlBlock = nullptr;
+                objectPtr = nullptr;
             }
         }
 
         /**
-         * @brief Gets the raw pointer to the object managed by this control block.
-         * @return The raw pointer to the object, or nullptr if the control block is null.
+         * @brief Gets the raw pointer held by this reference, which is the managed object or an aliased sub-object.
+         * @return The raw pointer, or nullptr if the reference is empty or the object has been destroyed.
          */
         [[nodiscard]] elementType* get() const noexcept
         {
-            return controlBlock ? controlBlock->get() : nullptr;
+            return controlBlock && controlBlock->hadObject() ? objectPtr : nullptr;
         }
 
         /**
@@ -16,7 +16,7 @@ namespace memory::refCounting
      * @param ref The Ref object to cast from.
      * @return A Ref object of type U, or an empty Ref if the original ref is null.
      */
-    template <typename U, typename T, typename Allocator = DefaultAllocator<std::remove_extent_t<T>>>
+    template <typename U, typename T, typename Allocator = DefaultAllocator<T>>
     Ref<U, Allocator> static_pointer_cast(const Ref<T, Allocator>& ref) noexcept
     {
         if (!ref) return Ref<U, Allocator>(nullptr);
@@ -25,7 +25,8 @@ namespace memory::refCounting
                      "static_pointer_cast can't convert between unrelated types");
 
         Ref<U, Allocator> result;
-        result.controlBlock = reinterpret_cast<typename Ref<U, Allocator>::controlBlockType*>(ref.getControlBlock());
+        result.controlBlock = ref.getControlBlock();
+        result.objectPtr = static_cast<std::remove_extent_t<U>*>(ref.get());
         result.retain();
         return result;
     }
@@ -39,7 +40,7 @@ namespace memory::refCounting
      * @param ref The Ref object to cast from.
      * @return A Ref object of type U if the cast succeeds, or an empty Ref if it fails.
      */
-    template <typename U, typename T, typename Allocator = DefaultAllocator<std::remove_extent_t<T>>>
+    template <typename U, typename T, typename Allocator = DefaultAllocator<T>>
     Ref<U, Allocator> dynamic_pointer_cast(const Ref<T, Allocator>& ref) noexcept
     {
         if (!ref) return Ref<U, Allocator>(nullptr);
@@ -52,7 +53,8 @@ namespace memory::refCounting
         if (auto* castedPtr = dynamic_cast<U*>(ref.get()))
         {
             Ref<U, Allocator> result;
-            result.controlBlock = reinterpret_cast<typename Ref<U, Allocator>::controlBlockType*>(ref.getControlBlock());
+            result.controlBlock = ref.getControlBlock();
+            result.objectPtr = castedPtr;
             result.retain();
             return result;
         }
@@ -67,7 +69,7 @@ namespace memory::refCounting
      * @param ref The Ref object to cast from.
      * @return A Ref object of type U, or an empty Ref if the original ref is null.
      */
-    template <typename U, typename T, typename Allocator = DefaultAllocator<std::remove_extent_t<T>>>
+    template <typename U, typename T, typename Allocator = DefaultAllocator<T>>
     Ref<U, Allocator> const_pointer_cast(const Ref<T, Allocator>& ref) noexcept
     {
         if (!ref) return Ref<U, Allocator>(nullptr);
@@ -76,7 +78,8 @@ namespace memory::refCounting
                       "const_pointer_cast can't convert between unrelated types");
 
         Ref<U, Allocator> result;
-        result.controlBlock = reinterpret_cast<typename Ref<U, Allocator>::controlBlockType*>(ref.getControlBlock());
+        result.controlBlock = ref.getControlBlock();
+        result.objectPtr = const_cast<std::remove_extent_t<U>*>(ref.get());
         result.retain();
         return result;
     }
@@ -90,17 +93,18 @@ namespace memory::refCounting
      * @param ref The Ref object to cast from.
      * @return A Ref object of type U with appropriate allocator, or an empty Ref if the original ref is null.
      */
-    template <typename U, typename T, typename Allocator = DefaultAllocator<std::remove_extent_t<T>>>
-    Ref<U, DefaultAllocator<std::remove_extent_t<U>>> reinterpret_pointer_cast(const Ref<T, Allocator>& ref) noexcept
+    template <typename U, typename T, typename Allocator = DefaultAllocator<T>>
+    Ref<U, DefaultAllocator<U>> reinterpret_pointer_cast(const Ref<T, Allocator>& ref) noexcept
     {
-        using TargetAllocator = DefaultAllocator<std::remove_extent_t<U>>;
+        using TargetAllocator = DefaultAllocator<U>;
         
         if (!ref) return Ref<U, TargetAllocator>(nullptr);
 
         // This is inherently unsafe - we're reinterpreting both the pointer type and the allocator
         // The user must ensure the types are compatible
         Ref<U, TargetAllocator> result;
-        result.controlBlock = reinterpret_cast<typename Ref<U, TargetAllocator>::controlBlockType*>(ref.getControlBlock());
+        result.controlBlock = ref.getControlBlock();
+        result.objectPtr = reinterpret_cast<std::remove_extent_t<U>*>(ref.get());
         result.retain();
         return result;
     }
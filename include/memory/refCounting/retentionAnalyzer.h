@@ -0,0 +1,438 @@
+#ifndef MEXMEMORY_RETENTIONANALYZER_H
+#define MEXMEMORY_RETENTIONANALYZER_H
+
+#include "metricsWriter.h"
+#include "objectGraph.h"
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// @brief Namespace for memory management with reference counting \namespace memory::refCounting
+namespace memory::refCounting
+{
+    /**
+     * @brief Retained size analysis of the Ref object graph: which objects keep the most memory alive.
+     * An object dominates another when every path of strong references from outside the heap to the other
+     * passes through it; the retained size of an object is what would be freed with it, the sizes of the
+     * objects it dominates. The dominator tree is computed with the Lengauer-Tarjan semidominators and the
+     * semi-NCA pass for the immediate dominators, over flat index arrays, in O(m log n).
+     *
+     * The roots are the objects referenced from outside the tracked graph (see ObjectGraph). Objects only
+     * reachable through leaked cycles are attributed as if the first of them found were a root; see
+     * CycleDetector::findLeaks for those. The graph must not be modified while it is analyzed.
+     */
+    class RetentionAnalyzer
+    {
+    public:
+
+        /**
+         * @brief The dominator tree of a graph, per node: its immediate dominator, or none if it is only
+         * dominated by the roots, and its retained size in bytes.
+         */
+        struct Dominators
+        {
+            std::vector<ObjectGraph::Index> idom;
+            std::vector<size_t> retained_bytes;
+            size_t roots;
+        };
+
+        /**
+         * @brief Objects of one type. The retained bytes of a type count each object once, even when objects
+         * of the type dominate each other.
+         */
+        struct RetainedType
+        {
+            std::string type;
+            size_t count;
+            size_t shallow_bytes;
+            size_t retained_bytes;
+        };
+
+        /**
+         * @brief One of the objects retaining the most memory.
+         */
+        struct RetainedObject
+        {
+            void* object;
+            std::string type;
+            size_t size;
+            size_t retained_bytes;
+            void* dominator;
+        };
+
+        /**
+         * @brief Result of an analysis: the types sorted by retained bytes and the objects retaining the most.
+         */
+        struct RetentionReport
+        {
+            size_t objects;
+            size_t references;
+            size_t roots;
+            size_t total_bytes;
+            std::vector<RetainedType> types;
+            std::vector<RetainedObject> largest;
+        };
+
+        /**
+         * @brief Builds the graph of the tracked objects and analyzes it.
+         * @param largest The number of objects retaining the most memory to report.
+         * @return The report.
+         */
+        static RetentionReport analyze(size_t largest = 20)
+        {
+            const ObjectGraph graph = ObjectGraph::fromTracker();
+            return summarize(graph, dominatorsOf(graph), largest);
+        }
+
+        /**
+         * @brief Computes the dominator tree and the retained sizes of a graph.
+         * @param graph The graph.
+         * @return The immediate dominator and retained bytes of every node.
+         */
+        static Dominators dominatorsOf(const ObjectGraph& graph)
+        {
+            using Index = ObjectGraph::Index;
+            constexpr Index none = ObjectGraph::none;
+            const size_t n = graph.size();
+
+            // Depth-first numbering from a virtual root (0) whose children are the roots; nodes left unnumbered
+            // are only reachable through leaked cycles, and the first of each found becomes a root too.
+            std::vector<Index> number(n, none);
+            std::vector<Index> vertex(1, none);
+            std::vector<Index> parent(1, none);
+            std::vector<Index> roots;
+            vertex.reserve(n + 1);
+            parent.reserve(n + 1);
+            std::vector<std::pair<Index, size_t>> path;
+            const auto search = [&](Index start) {
+                number[start] = static_cast<Index>(vertex.size());
+                vertex.push_back(start);
+                parent.push_back(0);
+                path.emplace_back(start, graph.firstEdge[start]);
+                while (!path.empty())
+                {
+                    auto& [node, next] = path.back();
+                    if (next == graph.firstEdge[node + 1])
+                    {
+                        path.pop_back();
+                        continue;
+                    }
+                    const Index target = graph.targets[next++];
+                    if (number[target] == none)
+                    {
+                        number[target] = static_cast<Index>(vertex.size());
+                        vertex.push_back(target);
+                        parent.push_back(number[node]);
+                        path.emplace_back(target, graph.firstEdge[target]);
+                    }
+                }
+            };
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (graph.external[i])
+                {
+                    roots.push_back(static_cast<Index>(i));
+                    if (number[i] == none) search(static_cast<Index>(i));
+                }
+            }
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (number[i] == none)
+                {
+                    roots.push_back(static_cast<Index>(i));
+                    search(static_cast<Index>(i));
+                }
+            }
+
+            // Predecessors of every vertex, by depth-first number.
+            const size_t count = vertex.size();
+            std::vector<size_t> firstPred(count + 1, 0);
+            for (Index target : graph.targets)
+            {
+                ++firstPred[number[target] + 1];
+            }
+            for (Index root : roots)
+            {
+                ++firstPred[number[root] + 1];
+            }
+            for (size_t v = 0; v < count; ++v)
+            {
+                firstPred[v + 1] += firstPred[v];
+            }
+            std::vector<Index> preds(firstPred[count]);
+            std::vector<size_t> filled(firstPred.begin(), firstPred.end() - 1);
+            for (size_t i = 0; i < n; ++i)
+            {
+                for (size_t e = graph.firstEdge[i]; e < graph.firstEdge[i + 1]; ++e)
+                {
+                    preds[filled[number[graph.targets[e]]]++] = number[i];
+                }
+            }
+            for (Index root : roots)
+            {
+                preds[filled[number[root]]++] = 0;
+            }
+
+            // Semidominators in reverse depth-first order, evaluated over a path-compressed forest.
+            std::vector<Index> semi(count);
+            std::vector<Index> label(count);
+            std::vector<Index> ancestor(count, none);
+            for (Index v = 0; v < count; ++v)
+            {
+                semi[v] = label[v] = v;
+            }
+            std::vector<Index> stack;
+            const auto eval = [&](Index v) {
+                if (ancestor[v] == none) return v;
+
+                for (Index u = v; ancestor[ancestor[u]] != none; u = ancestor[u])
+                {
+                    stack.push_back(u);
+                }
+                while (!stack.empty())
+                {
+                    const Index u = stack.back();
+                    stack.pop_back();
+                    const Index a = ancestor[u];
+                    if (semi[label[a]] < semi[label[u]])
+                    {
+                        label[u] = label[a];
+                    }
+                    ancestor[u] = ancestor[a];
+                }
+                return label[v];
+            };
+            for (size_t w = count; w-- > 1;)
+            {
+                for (size_t p = firstPred[w]; p < firstPred[w + 1]; ++p)
+                {
+                    const Index u = eval(preds[p]);
+                    if (semi[u] < semi[w])
+                    {
+                        semi[w] = semi[u];
+                    }
+                }
+                ancestor[w] = parent[w];
+            }
+
+            // Immediate dominators: the nearest common ancestor of the parent and the semidominator.
+            std::vector<Index> idom(count, 0);
+            for (size_t w = 1; w < count; ++w)
+            {
+                Index dominator = parent[w];
+                while (dominator > semi[w])
+                {
+                    dominator = idom[dominator];
+                }
+                idom[w] = dominator;
+            }
+
+            std::vector<size_t> retained(count, 0);
+            for (size_t w = 1; w < count; ++w)
+            {
+                retained[w] = graph.nodes[vertex[w]].size;
+            }
+            for (size_t w = count; w-- > 1;)
+            {
+                retained[idom[w]] += retained[w];
+            }
+
+            Dominators result{std::vector<Index>(n, none), std::vector<size_t>(n, 0), roots.size()};
+            for (size_t i = 0; i < n; ++i)
+            {
+                const Index w = number[i];
+                result.idom[i] = idom[w] == 0 ? none : vertex[idom[w]];
+                result.retained_bytes[i] = retained[w];
+            }
+            return result;
+        }
+
+        /**
+         * @brief Sums the retained sizes by type and picks the objects retaining the most.
+         * @param graph The graph.
+         * @param dominators The dominator tree of the graph.
+         * @param largest The number of objects to report.
+         * @return The report.
+         */
+        static RetentionReport summarize(const ObjectGraph& graph, const Dominators& dominators, size_t largest = 20)
+        {
+            using Index = ObjectGraph::Index;
+            constexpr Index none = ObjectGraph::none;
+            const size_t n = graph.size();
+
+            RetentionReport report{n, graph.targets.size(), dominators.roots, 0, {}, {}};
+            report.types.resize(graph.typeNames.size());
+            for (size_t t = 0; t < graph.typeNames.size(); ++t)
+            {
+                report.types[t] = RetainedType{graph.typeNames[t], 0, 0, 0};
+            }
+            for (const ObjectGraph::Node& node : graph.nodes)
+            {
+                report.types[node.type].count += 1;
+                report.types[node.type].shallow_bytes += node.size;
+                report.total_bytes += node.size;
+            }
+
+            // Walk the dominator tree, counting an object for its type only if no object of the same type
+            // dominates it. The children of each node are grouped in one array; index n is the virtual root.
+            std::vector<size_t> firstChild(n + 2, 0);
+            for (size_t i = 0; i < n; ++i)
+            {
+                ++firstChild[(dominators.idom[i] == none ? n : dominators.idom[i]) + 1];
+            }
+            for (size_t i = 0; i <= n; ++i)
+            {
+                firstChild[i + 1] += firstChild[i];
+            }
+            std::vector<Index> children(n);
+            std::vector<size_t> filled(firstChild.begin(), firstChild.end() - 1);
+            for (size_t i = 0; i < n; ++i)
+            {
+                children[filled[dominators.idom[i] == none ? n : dominators.idom[i]]++] = static_cast<Index>(i);
+            }
+
+            std::vector<uint32_t> open(graph.typeNames.size(), 0);
+            std::vector<std::pair<size_t, size_t>> path{{n, firstChild[n]}};
+            while (!path.empty())
+            {
+                auto& [node, next] = path.back();
+                if (next == firstChild[node + 1])
+                {
+                    if (node != n)
+                    {
+                        --open[graph.nodes[node].type];
+                    }
+                    path.pop_back();
+                    continue;
+                }
+                const Index child = children[next++];
+                const Index type = graph.nodes[child].type;
+                if (open[type]++ == 0)
+                {
+                    report.types[type].retained_bytes += dominators.retained_bytes[child];
+                }
+                path.emplace_back(child, firstChild[child]);
+            }
+            std::stable_sort(report.types.begin(), report.types.end(), [](const RetainedType& a, const RetainedType& b) {
+                return a.retained_bytes > b.retained_bytes;
+            });
+
+            std::vector<Index> order(n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                order[i] = static_cast<Index>(i);
+            }
+            const size_t top = std::min(largest, n);
+            std::partial_sort(order.begin(), order.begin() + static_cast<std::ptrdiff_t>(top), order.end(), [&](Index a, Index b) {
+                return dominators.retained_bytes[a] > dominators.retained_bytes[b];
+            });
+            for (size_t i = 0; i < top; ++i)
+            {
+                const Index node = order[i];
+                const Index dominator = dominators.idom[node];
+                report.largest.push_back(RetainedObject{graph.nodes[node].object, graph.typeName(node), graph.nodes[node].size,
+                    dominators.retained_bytes[node], dominator == none ? nullptr : graph.nodes[dominator].object});
+            }
+            return report;
+        }
+
+        /**
+         * @brief Writes a report as JSON into a buffer. Object addresses are written as numbers, and the dominator
+         * of an object only retained by the roots as null.
+         * @param report The report.
+         * @param buffer The buffer to write to.
+         * @param capacity The size of the buffer, including the terminating null.
+         * @return The length of the full output; if it is not below capacity, the output was truncated.
+         */
+        static size_t exportJson(const RetentionReport& report, char* buffer, size_t capacity) noexcept
+        {
+            MetricsWriter out(buffer, capacity);
+            out.text("{\"objects\":").number(static_cast<uint64_t>(report.objects))
+               .text(",\"references\":").number(static_cast<uint64_t>(report.references))
+               .text(",\"roots\":").number(static_cast<uint64_t>(report.roots))
+               .text(",\"total_bytes\":").number(static_cast<uint64_t>(report.total_bytes))
+               .text(",\"types\":[");
+            bool first = true;
+            for (const RetainedType& type : report.types)
+            {
+                out.text(first ? "{\"type\":" : ",{\"type\":").quoted(type.type, MetricsWriter::Escape::Json)
+                   .text(",\"count\":").number(static_cast<uint64_t>(type.count))
+                   .text(",\"shallow_bytes\":").number(static_cast<uint64_t>(type.shallow_bytes))
+                   .text(",\"retained_bytes\":").number(static_cast<uint64_t>(type.retained_bytes))
+                   .text("}");
+                first = false;
+            }
+            out.text("],\"largest\":[");
+            first = true;
+            for (const RetainedObject& object : report.largest)
+            {
+                out.text(first ? "{\"address\":" : ",{\"address\":").number(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(object.object)))
+                   .text(",\"type\":").quoted(object.type, MetricsWriter::Escape::Json)
+                   .text(",\"size\":").number(static_cast<uint64_t>(object.size))
+                   .text(",\"retained_bytes\":").number(static_cast<uint64_t>(object.retained_bytes))
+                   .text(",\"dominator\":");
+                if (object.dominator)
+                {
+                    out.number(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(object.dominator)));
+                }
+                else
+                {
+                    out.text("null");
+                }
+                out.text("}");
+                first = false;
+            }
+            out.text("]}");
+            return out.finish();
+        }
+
+        /**
+         * @brief Prints a report in the format of AllocationTracker::printStatistics.
+         * @param report The report.
+         * @param stream The stream to print to (default: std::cout).
+         * @param limit The maximum number of types and of objects to print.
+         */
+        static void printRetention(const RetentionReport& report, std::ostream* stream = &std::cout, size_t limit = 20)
+        {
+            if (!stream) return;
+
+            *stream << "\n=== Retained Size Analysis ===\n";
+            *stream << "Objects: " << report.objects << "\n";
+            *stream << "References: " << report.references << "\n";
+            *stream << "Roots: " << report.roots << "\n";
+            *stream << "Total bytes: " << report.total_bytes << "\n";
+
+            if (!report.types.empty())
+            {
+                *stream << "\nRetained by type:\n";
+                for (size_t i = 0; i < report.types.size() && i < limit; ++i)
+                {
+                    const RetainedType& type = report.types[i];
+                    *stream << "  " << std::setw(30) << type.type
+                           << ": " << std::setw(6) << type.count << " objects, "
+                           << std::setw(10) << type.shallow_bytes << " bytes, "
+                           << std::setw(10) << type.retained_bytes << " retained\n";
+                }
+            }
+
+            if (!report.largest.empty())
+            {
+                *stream << "\nLargest retainers:\n";
+                for (size_t i = 0; i < report.largest.size() && i < limit; ++i)
+                {
+                    const RetainedObject& object = report.largest[i];
+                    *stream << "  " << std::setw(30) << object.type
+                           << ": " << std::setw(18) << object.object << ", "
+                           << std::setw(10) << object.size << " bytes, "
+                           << std::setw(10) << object.retained_bytes << " retained\n";
+                }
+            }
+            *stream << "==============================\n\n";
+        }
+    };
+}
+
+#endif //MEXMEMORY_RETENTIONANALYZER_H
@@ -3,22 +3,43 @@
 
 #include "strongReference.h"
 #include "weakReference.h"
+#include <atomic>
 #include <memory>
+#include <mutex>
 
 /// @brief Namespace for memory management with reference counting \namespace memory::refCounting
 namespace memory::refCounting
 {
     /**
-     * @brief Converts a mexMemory Ref to a std::shared_ptr.
-     * Warning: This creates a separate reference counting system. The object
-     * will only be deleted when both the mexMemory references AND the std::shared_ptr
-     * references reach zero. Use with caution.
+     * @brief Deleter of the std::shared_ptrs made by to_shared_ptr, which holds a strong reference to a control
+     * block. It is a named type so that from_shared_ptr can find the block again with std::get_deleter.
+     */
+    struct RefDeleter
+    {
+        ControlBlockBase* block;
+
+        /**
+         * @brief Drops the strong reference when the last std::shared_ptr is destroyed.
+         */
+        void operator()(const volatile void*) const noexcept
+        {
+            block->decrementStrong();
+        }
+    };
+
+    /**
+     * @brief Converts a mexMemory Ref to a std::shared_ptr that shares ownership of the same object.
+     * A Ref made by from_shared_ptr gives back a std::shared_ptr sharing the original std::shared_ptr's control
+     * block. For any other Ref, the std::shared_ptr control block holds one strong reference and is kept in the
+     * SharedPtrState of the Ref's block: while a std::shared_ptr made for the block is alive, converting again
+     * only increments its count, and after the last one died a new control block is constructed in the same
+     * storage. The object lives until both the Refs and the std::shared_ptrs are gone.
      * @tparam T The type of object being referenced.
      * @tparam Allocator The allocator type used by the Ref.
      * @param ref The mexMemory Ref to convert.
      * @return A std::shared_ptr that shares ownership of the same object.
      */
-    template<typename T, typename Allocator = DefaultAllocator<std::remove_extent_t<T>>>
+    template<typename T, typename Allocator = DefaultAllocator<T>>
     std::shared_ptr<T> to_shared_ptr(const Ref<T, Allocator>& ref)
     {
         if (!ref)
@@ -26,29 +47,38 @@ namespace memory::refCounting
             return std::shared_ptr<T>();
         }
 
-        // Create a shared_ptr with a custom deleter that decrements the mexMemory reference
-        // The custom deleter keeps a copy of the mexMemory Ref to maintain the reference count
-        auto mexRef = ref; // Copy to keep reference alive
-        
-        return std::shared_ptr<T>(ref.get(), [mexRef](T*) mutable {
-            // The custom deleter holds the mexMemory reference
-            // When std::shared_ptr is destroyed, this deleter will run
-            // and the mexRef will be destroyed, decrementing the mexMemory reference count
-            mexRef.reset();
-        });
+        ControlBlockBase* block = ref.getControlBlock();
+        if (const auto* bridged = SharedPtrControlBlock<T, Allocator>::from(block))
+        {
+            return std::shared_ptr<T>(bridged->share(), ref.get());
+        }
+
+        SharedPtrState* state = block->sharedPtrState();
+        std::lock_guard<SharedPtrState> lock(*state);
+        if (auto alive = state->cached.lock())
+        {
+            return std::shared_ptr<T>(std::move(alive), ref.get());
+        }
+
+        // Dropping the expired control block first lets the new one reuse its storage.
+        state->cached.reset();
+        block->incrementStrong();
+        std::shared_ptr<T> shared(ref.get(), RefDeleter{block}, SharedPtrState::Allocator<T>(state));
+        state->cached = shared;
+        return shared;
     }
 
     /**
-     * @brief Converts a std::shared_ptr to a mexMemory Ref.
-     * Warning: This creates a separate reference counting system. The object
-     * will only be deleted when both the std::shared_ptr references AND the mexMemory
-     * references reach zero. Use with caution.
+     * @brief Converts a std::shared_ptr to a mexMemory Ref that shares ownership of the same object.
+     * A std::shared_ptr made by to_shared_ptr gives back a Ref to the original control block. Any other one is held
+     * by a SharedPtrControlBlock, so get() returns the same pointer and only the block is allocated; the object
+     * lives until both the std::shared_ptrs and the Refs are gone.
      * @tparam T The type of object being referenced.
      * @tparam Allocator The allocator type to use for the Ref.
      * @param ptr The std::shared_ptr to convert.
      * @return A mexMemory Ref that shares ownership of the same object.
      */
-    template<typename T, typename Allocator = DefaultAllocator<std::remove_extent_t<T>>>
+    template<typename T, typename Allocator = DefaultAllocator<T>>
     Ref<T, Allocator> from_shared_ptr(const std::shared_ptr<T>& ptr)
     {
         if (!ptr)
@@ -56,26 +86,32 @@ namespace memory::refCounting
             return Ref<T, Allocator>();
         }
 
-        // We can't easily integrate with std::shared_ptr's control block,
-        // so we create a wrapper that keeps the shared_ptr alive
-        
-        // This is a simplified approach - in a production system, you might want
-        // to create a custom control block that delegates to shared_ptr's control block
-        
-        // For now, we'll create a new mexMemory-managed object that holds the shared_ptr
-        struct SharedPtrWrapper
+        if (const auto* deleter = std::get_deleter<RefDeleter>(ptr))
         {
-            std::shared_ptr<T> ptr;
-            SharedPtrWrapper(std::shared_ptr<T> p) : ptr(std::move(p)) {}
-            T* get() const { return ptr.get(); }
-        };
-
-        // This approach has limitations but provides basic interoperability
-        // A more sophisticated implementation would require deeper integration
-        
-        // For this basic implementation, we'll just return an empty Ref as a safe fallback
-        // In a real-world scenario, you'd want to implement proper control block sharing
-        return Ref<T, Allocator>();
+            // The std::shared_ptr holds a strong reference, so the block is alive.
+            deleter->block->incrementStrong();
+            return Ref<T, Allocator>(deleter->block, ptr.get());
+        }
+        return Ref<T, Allocator>(new SharedPtrControlBlock<T, Allocator>(ptr));
+    }
+
+    /**
+     * @brief Gets a std::weak_ptr to the object of a WeakRef made from a Ref that came from a std::shared_ptr.
+     * It follows the std::shared_ptr owners, so it can still be locked after the last Ref is gone while the
+     * object lives on. Objects created by mexMemory have no std::weak_ptr; lock the WeakRef and convert the Ref.
+     * @tparam T The type of object being referenced.
+     * @tparam Allocator The allocator type used by the WeakRef.
+     * @param weak The WeakRef to convert.
+     * @return A std::weak_ptr to the object, or an empty one if the object did not come from a std::shared_ptr.
+     */
+    template<typename T, typename Allocator = DefaultAllocator<T>>
+    std::weak_ptr<T> to_weak_ptr(const WeakRef<T, Allocator>& weak)
+    {
+        if (const auto* block = SharedPtrControlBlock<T, Allocator>::from(weak.getControlBlock()))
+        {
+            return block->observe();
+        }
+        return std::weak_ptr<T>();
     }
 
     /**
@@ -86,7 +122,7 @@ namespace memory::refCounting
      * @param rawPtr The raw pointer to the object.
      * @return A mexMemory Ref that manages its own reference count for the object.
      */
-    template<typename T, typename Allocator = DefaultAllocator<std::remove_extent_t<T>>>
+    template<typename T, typename Allocator = DefaultAllocator<T>>
     Ref<T, Allocator> adopt_raw_ptr(T* rawPtr)
     {
         if (!rawPtr)
@@ -100,54 +136,81 @@ namespace memory::refCounting
     }
 
     /**
-     * @brief Utility class for managing objects with dual reference counting systems.
-     * This is an experimental feature for advanced use cases.
+     * @brief Utility class for handing one object out as both std::shared_ptr and mexMemory Ref.
+     * The object is owned by a single Ref control block; the std::shared_ptrs come from to_shared_ptr, so they
+     * hold one strong reference on that block between them, and the object is destroyed when the last handle
+     * of either kind is gone.
+     * @tparam T The type of the object.
      */
     template<typename T>
     class DualRefObject
     {
     private:
-        std::shared_ptr<T> stdPtr_;
-        Ref<T> mexPtr_;
+        Ref<T> ref_;
 
     public:
         /**
-         * @brief Constructor for creating a dual-reference object.
-         * @param obj The object to manage with dual reference counting.
+         * @brief Constructor taking ownership of an object.
+         * @param obj The object to manage, which must have been allocated with new and not be owned elsewhere.
          */
-        explicit DualRefObject(T* obj)
-            : stdPtr_(obj, [](T*) { /* Custom deleter - mexPtr will handle deletion */ })
-            , mexPtr_(makeRef<T>(*obj))
+        explicit DualRefObject(T* obj) : ref_(obj)
         {
         }
 
         /**
-         * @brief Get the std::shared_ptr.
-         * @return The std::shared_ptr to the object.
+         * @brief Constructor sharing the object of a Ref.
+         * @param ref The Ref to the object.
          */
-        std::shared_ptr<T> getSharedPtr() const { return stdPtr_; }
+        explicit DualRefObject(Ref<T> ref) noexcept : ref_(std::move(ref))
+        {
+        }
+
+        /**
+         * @brief Get a std::shared_ptr to the object.
+         * @return A std::shared_ptr sharing ownership of the object with the Refs.
+         */
+        std::shared_ptr<T> getSharedPtr() const { return to_shared_ptr(ref_); }
 
         /**
          * @brief Get the mexMemory Ref.
          * @return The mexMemory Ref to the object.
          */
-        Ref<T> getRef() const { return mexPtr_; }
+        Ref<T> getRef() const { return ref_; }
 
         /**
          * @brief Get the raw pointer.
          * @return The raw pointer to the object.
          */
-        T* get() const { return mexPtr_.get(); }
+        T* get() const { return ref_.get(); }
+
+        /**
+         * @brief Counts the owners of the object through either kind of handle, including this one.
+         * The counts are read one after the other, so the result is a snapshot while other threads convert.
+         * @return The number of Refs and std::shared_ptrs owning the object.
+         */
+        size_t useCount() const
+        {
+            const ControlBlockBase* block = ref_.getControlBlock();
+            if (!block)
+            {
+                return 0;
+            }
+
+            SharedPtrState* state = block->getSharedPtrState();
+            const long shared = state ? state->useCount() : 0;
+            return block->strongCount() - (shared > 0 ? 1 : 0) + static_cast<size_t>(shared);
+        }
 
         /**
          * @brief Check if the object is valid.
          * @return True if the object is valid, false otherwise.
          */
-        bool isValid() const { return mexPtr_.isValid() && stdPtr_; }
+        bool isValid() const { return ref_.isValid(); }
     };
 
     /**
      * @brief Creates a DualRefObject that can be used with both std::shared_ptr and mexMemory Ref.
+     * The object is constructed once, by makeRef.
      * @tparam T The type of object to create.
      * @tparam Args The types of the constructor arguments.
      * @param args The constructor arguments.
@@ -156,8 +219,7 @@ namespace memory::refCounting
     template<typename T, typename... Args>
     DualRefObject<T> makeDualRef(Args&&... args)
     {
-        auto obj = new T(std::forward<Args>(args)...);
-        return DualRefObject<T>(obj);
+        return DualRefObject<T>(makeRef<T>(std::forward<Args>(args)...));
     }
 }
 
@@ -3,8 +3,12 @@
 
 #include "reference.h"
 #include "weakReference.h"
+#include <algorithm>
+#include <cstddef>
 #include <memory>
+#include <optional>
 #include <utility>
+#include <vector>
 
 /// @brief Namespace for memory management with reference counting \namespace memory::refCounting
 namespace memory::refCounting
@@ -14,7 +18,7 @@ namespace memory::refCounting
      * @tparam T The type of object being referenced, can be a single object or an array.
      * @tparam Allocator The allocator to use for memory management, defaults to DefaultAllocator.
      */
-    template <typename T, typename Allocator = DefaultAllocator<std::remove_extent_t<T>>>
+    template <typename T, typename Allocator = DefaultAllocator<T>>
     class Ref : public ReferenceBase<T, Allocator>
     {
         /**
@@ -22,7 +26,9 @@ namespace memory::refCounting
          */
         using base = ReferenceBase<T, Allocator>;
         using base::controlBlock;
+        using base::objectPtr;
         using typename base::controlBlockType;
+        using typename base::elementType;
 
         /**
          * @brief Friend declaration for Ref to allow it to access private members of Ref.
@@ -53,7 +59,7 @@ namespace memory::refCounting
         friend Ref<U, A> const_pointer_cast(const Ref<V, A>& ref) noexcept;
         
         template <typename U, typename V, typename A>
-        friend Ref<U, DefaultAllocator<std::remove_extent_t<U>>> reinterpret_pointer_cast(const Ref<V, A>& ref) noexcept;
+        friend Ref<U, DefaultAllocator<U>> reinterpret_pointer_cast(const Ref<V, A>& ref) noexcept;
 
         /**
          * @brief Retains the strong reference to the object managed by this Ref.
@@ -64,6 +70,7 @@ namespace memory::refCounting
             {
                 controlBlock->incrementStrong();
                 std::atomic_thread_fence(std::memory_order_release);
+                linkOwner();
             }
         }
 
@@ -74,9 +81,47 @@ namespace memory::refCounting
         {
             if (controlBlock)
             {
+                unlinkOwner();
                 controlBlock->decrementStrong();
                 std::atomic_thread_fence(std::memory_order_acquire);
                 controlBlock = nullptr;
+                objectPtr = nullptr;
+            }
+        }
+
+        /**
+         * @brief Records that this Ref references its block, in case it lives inside an object of the ownership
+         * graph.
+         */
+        void linkOwner() const noexcept
+        {
+            if (controlBlock && OwnershipGraph::isEnabled())
+            {
+                OwnershipGraph::link(this, controlBlock);
+            }
+        }
+
+        /**
+         * @brief Records that this Ref stops referencing its block, in case it lives inside an object of the
+         * ownership graph.
+         */
+        void unlinkOwner() const noexcept
+        {
+            if (OwnershipGraph::isEnabled())
+            {
+                OwnershipGraph::unlink(this, controlBlock);
+            }
+        }
+
+        /**
+         * @brief Records that this Ref took over the reference of another one.
+         * @param from The Ref moved from.
+         */
+        void moveOwner(const void* from) const noexcept
+        {
+            if (controlBlock && OwnershipGraph::isEnabled())
+            {
+                OwnershipGraph::move(from, this, controlBlock);
             }
         }
 
@@ -84,11 +129,25 @@ namespace memory::refCounting
 
         /**
          * @brief Constructs a Ref with a given control block.
+         * @tparam U The type of object managed by the block.
+         * @tparam A The allocator of the block.
          * @param cb The control block to associate with this reference.
          */
-        explicit Ref(typename base::controlBlockType* cb) noexcept : base(cb)
+        template <typename U, typename A>
+        explicit Ref(ControlBlock<U, A>* cb) noexcept : base(cb)
         {
             // Don't increment here - ControlBlock already starts with count=1
+            linkOwner();
+        }
+
+        /**
+         * @brief Constructs a Ref with a given control block that exposes the given pointer.
+         * @param cb The control block to associate with this reference; its count must already include this reference.
+         * @param ptr The pointer returned by get().
+         */
+        Ref(controlBlockType* cb, elementType* ptr) noexcept : base(cb, ptr)
+        {
+            linkOwner();
         }
 
     public:
@@ -103,12 +162,18 @@ namespace memory::refCounting
          */
         explicit Ref(std::nullopt_t) noexcept : Ref() {}
 
+        /**
+         * @brief Explicit constructor for an empty Ref from nullptr.
+         */
+        explicit Ref(std::nullptr_t) noexcept : Ref() {}
+
         template <typename OtherT, typename OtherAllocator>
-        explicit Ref(const Ref<OtherT, OtherAllocator>& other, typename std::enable_if_t<std::is_convertible_v<OtherT*, T*>>* = nullptr) : base(other.controlBlock)
+        explicit Ref(const Ref<OtherT, OtherAllocator>& other, typename std::enable_if_t<std::is_convertible_v<OtherT*, T*>>* = nullptr) : base(other.controlBlock, other.objectPtr)
         {
             if (controlBlock)
             {
                 controlBlock->incrementStrong();
+                linkOwner();
             }
         }
 
@@ -121,6 +186,54 @@ namespace memory::refCounting
         explicit Ref(U* ptr) : base(new ControlBlock<U, Allocator>(ptr))
         {
             // ControlBlock constructor already sets count to 1
+            linkOwner();
+        }
+
+        /**
+         * @brief Constructs a Ref that owns a raw pointer and releases it with a custom deleter instead of the Allocator.
+         * The deleter is stored in the control block, which makes this suitable for memory the Allocator did not
+         * produce, such as mmapped regions or objects owned by a foreign pool.
+         * @tparam U The type of object being referenced, which must be convertible to T.
+         * @tparam Deleter The type of the deleter, invocable with a U*.
+         * @param ptr The pointer to the object.
+         * @param deleter The deleter to invoke when the last strong reference is released.
+         */
+        template <typename U, typename Deleter, typename = std::enable_if_t<std::is_convertible_v<U*, T*> && std::is_invocable_v<Deleter&, U*>>>
+        Ref(U* ptr, Deleter deleter)
+            : base(new DeleterControlBlock<U, Allocator, Deleter>(ptr, std::move(deleter)), ptr)
+        {
+            linkOwner();
+        }
+
+        /**
+         * @brief Aliasing constructor: shares ownership with owner but points to member, e.g. a field of the owned object.
+         * No allocation is made; the owner's object stays alive as long as this Ref exists.
+         * @tparam U The type of object referenced by the owner.
+         * @tparam A The allocator used by the owner.
+         * @param owner The Ref whose ownership is shared.
+         * @param member The pointer returned by get(), usually pointing into the owner's object.
+         */
+        template <typename U, typename A>
+        Ref(const Ref<U, A>& owner, elementType* member) noexcept
+            : base(owner.controlBlock, member)
+        {
+            retain();
+        }
+
+        /**
+         * @brief Aliasing move constructor: takes over the owner's reference but points to member.
+         * @tparam U The type of object referenced by the owner.
+         * @tparam A The allocator used by the owner.
+         * @param owner The Ref whose ownership is taken over.
+         * @param member The pointer returned by get(), usually pointing into the owner's object.
+         */
+        template <typename U, typename A>
+        Ref(Ref<U, A>&& owner, elementType* member) noexcept
+            : base(owner.controlBlock, member)
+        {
+            owner.controlBlock = nullptr;
+            owner.objectPtr = nullptr;
+            moveOwner(&owner);
         }
 
 
@@ -128,7 +241,7 @@ namespace memory::refCounting
          * @brief Constructs a Ref from a raw pointer to an object of type Ref&
          * @param other The Ref object to copy from.
          */
-        Ref(const Ref& other) noexcept : base(other.controlBlock)
+        Ref(const Ref& other) noexcept : base(other.controlBlock, other.objectPtr)
         {
             retain();
         }
@@ -140,7 +253,7 @@ namespace memory::refCounting
          * @param other The Ref object to copy from.
          */
         template <typename U, typename A, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
-        Ref(const Ref<U, A>& other) noexcept : base(reinterpret_cast<controlBlockType*>(other.controlBlock))
+        Ref(const Ref<U, A>& other) noexcept : base(other.controlBlock, other.objectPtr)
         {
             retain();
         }
@@ -149,9 +262,11 @@ namespace memory::refCounting
          * @brief Move constructor for Ref that transfers ownership of the control block from another Ref.
          * @param other The Ref object to move from.
          */
-        Ref(Ref&& other) noexcept : base(other.controlBlock)
+        Ref(Ref&& other) noexcept : base(other.controlBlock, other.objectPtr)
         {
             other.controlBlock = nullptr; // Transfer ownership without changing count
+            other.objectPtr = nullptr;
+            moveOwner(&other);
         }
 
         /**
@@ -161,9 +276,11 @@ namespace memory::refCounting
          * @param other The Ref object to move from.
          */
         template <typename U, typename A, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
-        Ref(Ref<U, A>&& other) noexcept : base(reinterpret_cast<typename base::controlBlockType*>(other.controlBlock))
+        Ref(Ref<U, A>&& other) noexcept : base(other.controlBlock, other.objectPtr)
         {
             other.controlBlock = nullptr;
+            other.objectPtr = nullptr;
+            moveOwner(&other);
         }
 
         /**
@@ -182,6 +299,7 @@ namespace memory::refCounting
             {
                 release();
                 controlBlock = other.controlBlock;
+                objectPtr = other.objectPtr;
                 retain();
             }
             return *this;
@@ -201,6 +319,7 @@ namespace memory::refCounting
             {
                 release();
                 controlBlock = other.controlBlock;
+                objectPtr = other.objectPtr;
                 retain();
             }
             return *this;
@@ -217,7 +336,10 @@ namespace memory::refCounting
             {
                 release();
                 controlBlock = other.controlBlock;
+                objectPtr = other.objectPtr;
                 other.controlBlock = nullptr;
+                other.objectPtr = nullptr;
+                moveOwner(&other);
             }
             return *this;
         }
@@ -236,7 +358,10 @@ namespace memory::refCounting
             {
                 release();
                 controlBlock = other.controlBlock;
+                objectPtr = other.objectPtr;
                 other.controlBlock = nullptr; // Transfer ownership without changing count
+                other.objectPtr = nullptr;
+                moveOwner(&other);
             }
             return *this;
         }
@@ -248,16 +373,14 @@ namespace memory::refCounting
          * @param weak The WeakRef object to copy from.
          */
         template <typename U, typename A, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
-        explicit Ref(const WeakRef<U, A>& weak) : base(weak.controlBlock)
+        explicit Ref(const WeakRef<U, A>& weak) : base(weak.controlBlock, weak.objectPtr)
         {
-            if (controlBlock && controlBlock->strongCount() > 0)
-            {
-                controlBlock->incrementStrong();
-            }
-            else
+            if (!controlBlock || !controlBlock->tryIncrementStrong())
             {
                 controlBlock = nullptr;
+                objectPtr = nullptr;
             }
+            linkOwner();
         }
 
         /**
@@ -279,6 +402,14 @@ namespace memory::refCounting
         template <typename U, typename... Args>
         friend Ref<U> makeRef(Args&&... args);
 
+        /**
+         * @brief Friend declaration for tryMakeRef to allow access to private constructor.
+         * @tparam U The type of object being referenced.
+         * @tparam Args The types of constructor arguments for the object.
+         */
+        template <typename U, typename... Args>
+        friend Ref<U> tryMakeRef(Args&&... args);
+
         /**
          * @brief Friend declaration for makeRefWithAllocator to allow access to private constructor.
          * @tparam U The type of object being referenced, which must be convertible to T.
@@ -290,6 +421,14 @@ namespace memory::refCounting
         template <typename U, typename A, typename... Args>
         friend Ref<U, A> makeRefWithAllocator(Args&&... args);
 
+        /**
+         * @brief Friend declaration for makeRefsInSlab to allow access to private constructor.
+         * @tparam U The type of object being referenced.
+         * @tparam Construct The type of the callable constructing each object.
+         */
+        template <typename U, typename Construct>
+        friend std::vector<Ref<U>> makeRefsInSlab(size_t count, Construct&& construct);
+
         template <typename U, typename T2, typename A>
         friend Ref<U, A> static_pointer_cast(const Ref<T2, A>& ref) noexcept;
 
@@ -298,6 +437,14 @@ namespace memory::refCounting
 
         template <typename U, typename T2, typename A>
         friend Ref<U, A> const_pointer_cast(const Ref<T2, A>& ref) noexcept;
+
+        /**
+         * @brief Friend declaration for from_shared_ptr to allow it to adopt the control block it creates.
+         * @tparam U The type of object being referenced.
+         * @tparam A The allocator of the Ref.
+         */
+        template <typename U, typename A>
+        friend Ref<U, A> from_shared_ptr(const std::shared_ptr<U>& ptr);
     };
 
     /**
@@ -306,12 +453,33 @@ namespace memory::refCounting
      * @tparam Args The types of constructor arguments for the object.
      * @param args The constructor arguments for the object.
      * @return A Ref object representing the newly created object.
+     * @throws BudgetExceeded If the allocation would exceed a hard memory budget.
      */
     template <typename T, typename... Args>
     Ref<T> makeRef(Args&&... args)
     {
         using ElementType = std::remove_extent_t<T>;
-        return Ref<T>(new ControlBlock<ElementType, DefaultAllocator<ElementType>>(std::forward<Args>(args)...));
+        AllocationTracker::enforceBudget<ElementType>(sizeof(ElementType));
+        return Ref<T>(new ControlBlock<ElementType, DefaultAllocator<T>>(std::forward<Args>(args)...));
+    }
+
+    /**
+     * @brief Creates a Ref like makeRef, but returns an empty Ref instead of throwing when a hard memory budget
+     * refuses the allocation. Other allocation failures still throw.
+     * @tparam T The type of object being referenced, can be a single object or an array.
+     * @tparam Args The types of constructor arguments for the object.
+     * @param args The constructor arguments for the object.
+     * @return A Ref object representing the newly created object, or an empty Ref if a budget refused it.
+     */
+    template <typename T, typename... Args>
+    Ref<T> tryMakeRef(Args&&... args)
+    {
+        using ElementType = std::remove_extent_t<T>;
+        if (!AllocationTracker::withinBudget<ElementType>(sizeof(ElementType)))
+        {
+            return Ref<T>();
+        }
+        return Ref<T>(new ControlBlock<ElementType, DefaultAllocator<T>>(std::forward<Args>(args)...));
     }
 
     /**
@@ -321,13 +489,114 @@ namespace memory::refCounting
      * @tparam Args The types of constructor arguments for the object.
      * @param args The constructor arguments for the object.
      * @return A Ref object representing the newly created object with the specified allocator.
+     * @throws BudgetExceeded If the allocation would exceed a hard memory budget.
      */
     template <typename T, typename Allocator, typename... Args>
     Ref<T, Allocator> makeRefWithAllocator(Args&&... args)
     {
         using ElementType = std::remove_extent_t<T>;
+        AllocationTracker::enforceBudget<ElementType>(sizeof(ElementType));
         return Ref<T, Allocator>(new ControlBlock<ElementType, Allocator>(std::forward<Args>(args)...));
     }
+
+    /**
+     * @brief Creates count objects and their control blocks in a single slab allocation.
+     * Used by makeRefs and makeRefBatch; each object is constructed by calling construct(storage, index).
+     * @tparam T The type of object being referenced.
+     * @tparam Construct The type of the callable constructing each object.
+     * @param count The number of objects to create.
+     * @param construct The callable that placement-constructs object index at storage and returns it.
+     * @return A vector of independently counted Refs, one per object.
+     * @throws BudgetExceeded If the whole batch would exceed a hard memory budget.
+     */
+    template <typename T, typename Construct>
+    std::vector<Ref<T>> makeRefsInSlab(size_t count, Construct&& construct)
+    {
+        static_assert(!std::is_array_v<T>, "makeRefs does not support array types");
+
+        using BlockType = SlabControlBlock<T, DefaultAllocator<T>>;
+
+        /**
+         * @brief One slab entry: a control block followed by the object it manages.
+         */
+        struct Slot
+        {
+            alignas(BlockType) std::byte block[sizeof(BlockType)];
+            alignas(T) std::byte object[sizeof(T)];
+        };
+
+        std::vector<Ref<T>> refs;
+        if (count == 0)
+        {
+            return refs;
+        }
+        AllocationTracker::enforceBudget<T>(count * sizeof(T));
+        refs.reserve(count);
+
+        constexpr size_t alignment = std::max(alignof(Slot), alignof(RefSlab));
+        constexpr size_t slotsOffset = (sizeof(RefSlab) + alignof(Slot) - 1) & ~(alignof(Slot) - 1);
+        void* memory = ::operator new(slotsOffset + count * sizeof(Slot), std::align_val_t{alignment});
+
+        auto* slots = reinterpret_cast<Slot*>(static_cast<std::byte*>(memory) + slotsOffset);
+        size_t constructed = 0;
+        try
+        {
+            for (; constructed < count; ++constructed)
+            {
+                construct(static_cast<void*>(slots[constructed].object), constructed);
+            }
+        }
+        catch (...)
+        {
+            for (size_t i = 0; i < constructed; ++i)
+            {
+                std::destroy_at(std::launder(reinterpret_cast<T*>(slots[i].object)));
+            }
+            ::operator delete(memory, std::align_val_t{alignment});
+            throw;
+        }
+
+        auto* slab = ::new (memory) RefSlab(count, std::align_val_t{alignment});
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto* object = std::launder(reinterpret_cast<T*>(slots[i].object));
+            refs.push_back(Ref<T>(::new (static_cast<void*>(slots[i].block)) BlockType(object, slab)));
+        }
+        return refs;
+    }
+
+    /**
+     * @brief Creates count Ref objects in one allocation, constructing each from the result of generator(index).
+     * Each Ref is counted independently; the shared slab is freed when the last of them (and its weak references) is gone.
+     * @tparam T The type of object being referenced.
+     * @tparam Generator The type of the callable producing the constructor argument for each object.
+     * @param count The number of objects to create.
+     * @param generator The callable invoked with the index of each object.
+     * @return A vector of Refs, in index order.
+     */
+    template <typename T, typename Generator>
+    std::vector<Ref<T>> makeRefs(size_t count, Generator&& generator)
+    {
+        return makeRefsInSlab<T>(count, [&generator](void* storage, size_t index) {
+            return ::new (storage) T(generator(index));
+        });
+    }
+
+    /**
+     * @brief Creates count Ref objects in one allocation, all constructed from the same arguments.
+     * @tparam T The type of object being referenced.
+     * @tparam Args The types of the constructor arguments.
+     * @param count The number of objects to create.
+     * @param args The constructor arguments, passed to every object.
+     * @return A vector of Refs, in index order.
+     */
+    template <typename T, typename... Args>
+    std::vector<Ref<T>> makeRefBatch(size_t count, const Args&... args)
+    {
+        return makeRefsInSlab<T>(count, [&args...](void* storage, size_t) {
+            return ::new (storage) T(args...);
+        });
+    }
 }
 
 #endif //MEXMEMORY_STRONGREFERENCE_H
\ No newline at end of file
@@ -14,7 +14,7 @@ namespace memory::refCounting
      * @tparam T The type of object being referenced, can be a single object or an array.
      * @tparam Allocator The allocator to use for memory management, defaults to DefaultAllocator.
      */
-    template <typename T, typename Allocator = DefaultAllocator<std::remove_extent_t<T>>>
+    template <typename T, typename Allocator = DefaultAllocator<T>>
     class WeakRef : public ReferenceBase<T, Allocator>
     {
         /**
@@ -22,6 +22,8 @@ namespace memory::refCounting
          */
         using base = ReferenceBase<T, Allocator>;
         using base::controlBlock;
+        using base::objectPtr;
+        using typename base::controlBlockType;
 
         /**
          * @brief Friend declaration for weak reference to allow it to access private members of Ref.
@@ -59,6 +61,7 @@ namespace memory::refCounting
             {
                 controlBlock->decrementWeak();
                 controlBlock = nullptr;
+                objectPtr = nullptr;
             }
         }
 
@@ -73,7 +76,7 @@ namespace memory::refCounting
          * @brief Constructs a WeakRef from a strong reference.
          * @param strongRef The strong reference to create a weak reference from.
          */
-        WeakRef(const Ref<T, Allocator>& strongRef) noexcept : base(strongRef.controlBlock)
+        WeakRef(const Ref<T, Allocator>& strongRef) noexcept : base(strongRef.controlBlock, strongRef.objectPtr)
         {
             retain();
         }
@@ -85,7 +88,7 @@ namespace memory::refCounting
          * @param strongRef The strong reference to create a weak reference from.
          */
         template <typename U, typename A, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
-        WeakRef(const Ref<U, A>& strongRef) noexcept : base(strongRef.controlBlock)
+        WeakRef(const Ref<U, A>& strongRef) noexcept : base(strongRef.controlBlock, strongRef.objectPtr)
         {
             retain();
         }
@@ -94,7 +97,7 @@ namespace memory::refCounting
          * @brief Constructs a WeakRef from another WeakRef.
          * @param other The WeakRef to copy from.
          */
-        WeakRef(const WeakRef& other) noexcept : base(other.controlBlock)
+        WeakRef(const WeakRef& other) noexcept : base(other.controlBlock, other.objectPtr)
         {
             retain();
         }
@@ -106,7 +109,7 @@ namespace memory::refCounting
          * @param other The WeakRef to copy from.
          */
         template <typename U, typename A, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
-        WeakRef(const WeakRef<U, A>& other) noexcept : base(other.controlBlock)
+        WeakRef(const WeakRef<U, A>& other) noexcept : base(other.controlBlock, other.objectPtr)
         {
             retain();
         }
@@ -115,9 +118,10 @@ namespace memory::refCounting
          * @brief Move constructor for WeakRef that transfers ownership of the control block from another WeakRef.
          * @param other The WeakRef to move from.
          */
-        WeakRef(WeakRef&& other) noexcept : base(other.controlBlock)
+        WeakRef(WeakRef&& other) noexcept : base(other.controlBlock, other.objectPtr)
         {
             other.controlBlock = nullptr;
+            other.objectPtr = nullptr;
         }
 
         /**
@@ -127,9 +131,10 @@ namespace memory::refCounting
          * @param other The WeakRef to move from.
          */
         template <typename U, typename A, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
-        WeakRef(WeakRef<U, A>&& other) noexcept : base(other.controlBlock)
+        WeakRef(WeakRef<U, A>&& other) noexcept : base(other.controlBlock, other.objectPtr)
         {
             other.controlBlock = nullptr;
+            other.objectPtr = nullptr;
         }
 
         /**
@@ -151,6 +156,7 @@ namespace memory::refCounting
             {
                 release();
                 controlBlock = other.controlBlock;
+                objectPtr = other.objectPtr;
                 retain();
             }
             return *this;
@@ -170,6 +176,7 @@ namespace memory::refCounting
             {
                 release();
                 controlBlock = other.controlBlock;
+                objectPtr = other.objectPtr;
                 retain();
             }
             return *this;
@@ -186,7 +193,9 @@ namespace memory::refCounting
             {
                 release();
                 controlBlock = other.controlBlock;
+                objectPtr = other.objectPtr;
                 other.controlBlock = nullptr;
+                other.objectPtr = nullptr;
             }
             return *this;
         }
@@ -205,7 +214,9 @@ namespace memory::refCounting
             {
                 release();
                 controlBlock = other.controlBlock;
+                objectPtr = other.objectPtr;
                 other.controlBlock = nullptr;
+                other.objectPtr = nullptr;
             }
             return *this;
         }
@@ -234,10 +245,9 @@ namespace memory::refCounting
          */
         [[nodiscard]] Ref<T, Allocator> lock() const noexcept
         {
-            if (canLock())
+            if (controlBlock && controlBlock->tryIncrementStrong())
             {
-                controlBlock->incrementStrong();
-                return Ref<T, Allocator>(controlBlock);
+                return Ref<T, Allocator>(controlBlock, objectPtr);
             }
             return Ref<T, Allocator>();
         }
@@ -0,0 +1,33 @@
+// A plugin built with hidden visibility and its own copy of the header-only tracker, loaded by testTrackerLifetime.cpp.
+#include "memory/memory.h"
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    struct SharedWidget
+    {
+        char payload[48]{};
+    };
+
+    std::vector<Ref<SharedWidget>> widgets;
+}
+
+extern "C" __attribute__((visibility("default"))) void pluginAllocate(size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        widgets.push_back(makeRef<SharedWidget>());
+    }
+}
+
+extern "C" __attribute__((visibility("default"))) void pluginRelease()
+{
+    widgets.clear();
+}
+
+extern "C" __attribute__((visibility("default"))) size_t pluginLiveBytes()
+{
+    return AllocationTracker::getLiveBytes();
+}
@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <array>
+#include <sstream>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    using Small = std::array<char, 64>;
+    using Large = std::array<char, 65536>;
+}
+
+class AllocationSamplingTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true, false, &leakStream_);
+        AllocationTracker::clearAllocations();
+        AllocationTracker::setSamplingInterval(1024);
+    }
+
+    void TearDown() override
+    {
+        AllocationTracker::setSamplingInterval(0);
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        enableAllocationTracking(false);
+    }
+
+    std::stringstream leakStream_;
+};
+
+TEST_F(AllocationSamplingTest, RecordsOnlyASubsetOfSmallAllocations)
+{
+    std::vector<Small> blocks(100000);
+    for (auto& block : blocks)
+    {
+        AllocationTracker::trackAllocation(&block);
+    }
+
+    // 100000 * 64 bytes at one sample per KiB gives about 6250 samples.
+    const size_t samples = AllocationTracker::getAllocationCount();
+    EXPECT_GT(samples, 4000u);
+    EXPECT_LT(samples, 9000u);
+
+    for (auto& block : blocks)
+    {
+        AllocationTracker::untrackAllocation(&block);
+    }
+    EXPECT_EQ(AllocationTracker::getAllocationCount(), 0u);
+}
+
+TEST_F(AllocationSamplingTest, StatisticsAreUnbiasedEstimates)
+{
+    std::vector<Small> blocks(100000);
+    for (auto& block : blocks)
+    {
+        AllocationTracker::trackAllocation(&block);
+    }
+
+    auto stats = AllocationTracker::getStatistics();
+    EXPECT_EQ(stats.sampling_interval, 1024u);
+    EXPECT_EQ(stats.sampled_allocations, AllocationTracker::getAllocationCount());
+    EXPECT_NEAR(static_cast<double>(stats.total_allocations), 100000.0, 10000.0);
+    EXPECT_NEAR(static_cast<double>(stats.total_bytes), 6400000.0, 640000.0);
+    ASSERT_EQ(stats.allocations_by_type.size(), 1u);
+    EXPECT_EQ(stats.allocations_by_type.begin()->second, stats.total_allocations);
+
+    AllocationTracker::clearAllocations();
+}
+
+TEST_F(AllocationSamplingTest, LargeAllocationsAreAlwaysSampled)
+{
+    std::vector<Large> blocks(16);
+    for (auto& block : blocks)
+    {
+        AllocationTracker::trackAllocation(&block);
+    }
+
+    auto stats = AllocationTracker::getStatistics();
+    EXPECT_EQ(stats.sampled_allocations, 16u);
+    EXPECT_EQ(stats.total_allocations, 16u);
+    EXPECT_EQ(stats.total_bytes, 16 * sizeof(Large));
+
+    for (auto& block : blocks)
+    {
+        AllocationTracker::untrackAllocation(&block);
+    }
+}
+
+TEST_F(AllocationSamplingTest, RefsReleaseSampledAllocations)
+{
+    std::vector<Ref<Small>> refs;
+    for (int i = 0; i < 10000; ++i)
+    {
+        refs.push_back(makeRef<Small>());
+    }
+    EXPECT_GT(AllocationTracker::getAllocationCount(), 0u);
+    EXPECT_LT(AllocationTracker::getAllocationCount(), 10000u);
+
+    refs.clear();
+    EXPECT_EQ(AllocationTracker::getAllocationCount(), 0u);
+}
+
+TEST_F(AllocationSamplingTest, ZeroIntervalRecordsEverything)
+{
+    AllocationTracker::setSamplingInterval(0);
+    std::vector<Small> blocks(1000);
+    for (auto& block : blocks)
+    {
+        AllocationTracker::trackAllocation(&block);
+    }
+
+    auto stats = AllocationTracker::getStatistics();
+    EXPECT_EQ(stats.sampling_interval, 0u);
+    EXPECT_EQ(stats.total_allocations, 1000u);
+    EXPECT_EQ(stats.total_bytes, 1000 * sizeof(Small));
+
+    // Allocations recorded before sampling was switched on are still untracked.
+    AllocationTracker::setSamplingInterval(1024);
+    for (auto& block : blocks)
+    {
+        AllocationTracker::untrackAllocation(&block);
+    }
+    EXPECT_EQ(AllocationTracker::getAllocationCount(), 0u);
+}
+
+TEST_F(AllocationSamplingTest, PrintStatisticsMentionsSampling)
+{
+    Large block{};
+    AllocationTracker::trackAllocation(&block);
+
+    std::stringstream out;
+    AllocationTracker::printStatistics(&out);
+    EXPECT_NE(out.str().find("Sampling: 1 per 1024 bytes"), std::string::npos);
+
+    AllocationTracker::untrackAllocation(&block);
+}
@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    struct TaggedWidget
+    {
+        int values[16]{};
+    };
+
+    const AllocationTracker::TagMetrics* findTag(const AllocationTracker::LiveMetrics& metrics, const std::string& name)
+    {
+        auto it = std::find_if(metrics.tags.begin(), metrics.tags.end(), [&name](const auto& tag) {
+            return tag.tag == name;
+        });
+        return it == metrics.tags.end() ? nullptr : &*it;
+    }
+}
+
+class AllocationTagTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+        AllocationTracker::resetLiveMetrics();
+    }
+
+    void TearDown() override
+    {
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        enableAllocationTracking(false);
+    }
+};
+
+TEST_F(AllocationTagTest, RegistersEachNameOnce)
+{
+    const uint32_t first = AllocationTracker::registerTag("tags.register");
+    const uint32_t second = AllocationTracker::registerTag("tags.register");
+
+    EXPECT_NE(first, AllocationTracker::untagged);
+    EXPECT_EQ(first, second);
+    EXPECT_NE(AllocationTracker::registerTag("tags.register.other"), first);
+    EXPECT_EQ(AllocationTracker::getTagName(first), "tags.register");
+    EXPECT_EQ(AllocationTracker::getTagName(AllocationTracker::untagged), "");
+}
+
+TEST_F(AllocationTagTest, ScopesNestAndRestore)
+{
+    EXPECT_EQ(AllocationTracker::getCurrentTag(), AllocationTracker::untagged);
+    {
+        AllocationTag outer("tags.outer");
+        const uint32_t outerId = AllocationTracker::getCurrentTag();
+        EXPECT_EQ(AllocationTracker::getTagName(outerId), "tags.outer");
+        {
+            AllocationTag inner("tags.inner");
+            EXPECT_EQ(AllocationTracker::getTagName(AllocationTracker::getCurrentTag()), "tags.inner");
+        }
+        EXPECT_EQ(AllocationTracker::getCurrentTag(), outerId);
+    }
+    EXPECT_EQ(AllocationTracker::getCurrentTag(), AllocationTracker::untagged);
+}
+
+TEST_F(AllocationTagTest, RecordsTagAndThreadWithEachAllocation)
+{
+    Ref<TaggedWidget> tagged;
+    {
+        AllocationTag tag("tags.records");
+        tagged = makeRef<TaggedWidget>();
+    }
+    auto untaggedRef = makeRef<TaggedWidget>();
+
+    const auto allocations = AllocationTracker::getAllocations();
+    ASSERT_EQ(allocations.size(), 2u);
+    const auto& taggedInfo = allocations.at(tagged.get());
+    const auto& untaggedInfo = allocations.at(untaggedRef.get());
+    EXPECT_EQ(AllocationTracker::getTagName(taggedInfo.tag), "tags.records");
+    EXPECT_EQ(untaggedInfo.tag, AllocationTracker::untagged);
+    EXPECT_EQ(taggedInfo.thread, AllocationTracker::currentThreadIndex());
+    EXPECT_EQ(untaggedInfo.thread, AllocationTracker::currentThreadIndex());
+}
+
+TEST_F(AllocationTagTest, StatisticsGroupByTagAndThread)
+{
+    std::vector<Ref<TaggedWidget>> parsers;
+    std::vector<Ref<TaggedWidget>> renderers;
+    {
+        AllocationTag tag("tags.parser");
+        for (int i = 0; i < 3; ++i)
+        {
+            parsers.push_back(makeRef<TaggedWidget>());
+        }
+    }
+    {
+        AllocationTag tag("tags.renderer");
+        renderers.push_back(makeRef<TaggedWidget>());
+    }
+
+    std::thread worker([&renderers]() {
+        AllocationTag tag("tags.renderer");
+        renderers.push_back(makeRef<TaggedWidget>());
+    });
+    worker.join();
+
+    const auto stats = AllocationTracker::getStatistics();
+    EXPECT_EQ(stats.allocations_by_tag.at("tags.parser"), 3u);
+    EXPECT_EQ(stats.bytes_by_tag.at("tags.parser"), 3 * sizeof(TaggedWidget));
+    EXPECT_EQ(stats.allocations_by_tag.at("tags.renderer"), 2u);
+    EXPECT_EQ(stats.allocations_by_thread.at(AllocationTracker::currentThreadIndex()), 4u);
+    ASSERT_EQ(stats.allocations_by_thread.size(), 2u);
+
+    size_t perThread = 0;
+    for (const auto& [thread, count] : stats.allocations_by_thread)
+    {
+        perThread += count;
+    }
+    EXPECT_EQ(perThread, stats.total_allocations);
+}
+
+TEST_F(AllocationTagTest, LiveMetricsFollowFrees)
+{
+    std::vector<Ref<TaggedWidget>> widgets;
+    {
+        AllocationTag tag("tags.live");
+        for (int i = 0; i < 4; ++i)
+        {
+            widgets.push_back(makeRef<TaggedWidget>());
+        }
+    }
+    widgets.resize(1);
+
+    const auto metrics = AllocationTracker::getLiveMetrics();
+    const auto* live = findTag(metrics, "tags.live");
+    ASSERT_NE(live, nullptr);
+    EXPECT_EQ(live->total_allocations, 4u);
+    EXPECT_EQ(live->total_frees, 3u);
+    EXPECT_EQ(live->live_count, 1u);
+    EXPECT_EQ(live->live_bytes, sizeof(TaggedWidget));
+    EXPECT_EQ(findTag(metrics, "tags.unused"), nullptr);
+
+    widgets.clear();
+    EXPECT_EQ(findTag(AllocationTracker::getLiveMetrics(), "tags.live")->live_count, 0u);
+}
+
+TEST_F(AllocationTagTest, ThreadsKeepTheirOwnTag)
+{
+    constexpr int perThread = 50;
+    std::vector<std::vector<Ref<TaggedWidget>>> held(4);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([t, &held]() {
+            AllocationTag tag(t % 2 == 0 ? "tags.even" : "tags.odd");
+            for (int i = 0; i < perThread; ++i)
+            {
+                held[t].push_back(makeRef<TaggedWidget>());
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    const auto stats = AllocationTracker::getStatistics();
+    EXPECT_EQ(stats.allocations_by_tag.at("tags.even"), 2u * perThread);
+    EXPECT_EQ(stats.allocations_by_tag.at("tags.odd"), 2u * perThread);
+    EXPECT_EQ(stats.allocations_by_thread.size(), 4u);
+
+    const auto metrics = AllocationTracker::getLiveMetrics();
+    EXPECT_EQ(findTag(metrics, "tags.even")->live_count, 2u * perThread);
+    EXPECT_EQ(findTag(metrics, "tags.odd")->live_count, 2u * perThread);
+}
@@ -0,0 +1,225 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    std::atomic<int> destroyed{0};
+
+    struct BackgroundNode
+    {
+        int id{0};
+        Ref<BackgroundNode> next;
+
+        explicit BackgroundNode(int value = 0) : id(value) {}
+        ~BackgroundNode() { destroyed.fetch_add(1, std::memory_order_relaxed); }
+
+        void trace(RefVisitor& visit) const
+        {
+            visit(next);
+        }
+    };
+
+    struct Collecting
+    {
+        ~Collecting() { CycleCollector::collectCycles(); }
+    };
+
+    void makeGarbageCycle(int id)
+    {
+        auto a = makeRef<BackgroundNode>(id);
+        auto b = makeRef<BackgroundNode>(id);
+        a->next = b;
+        b->next = a;
+    }
+
+    bool waitForDestroyed(int expected)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (destroyed.load() < expected && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return destroyed.load() >= expected;
+    }
+}
+
+class BackgroundCollectorTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+        AllocationTracker::resetLiveMetrics();
+        CycleCollector::collectCycles();
+        CycleCollector::resetMetrics();
+        destroyed = 0;
+    }
+
+    void TearDown() override
+    {
+        CycleCollector::stopBackground();
+        CycleCollector::enable(false);
+        CycleCollector::collectCycles();
+        EXPECT_EQ(CycleCollector::getBufferedRoots(), 0u);
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        enableAllocationTracking(false);
+    }
+
+    static CycleCollector::BackgroundConfig triggers(size_t roots, int intervalMs, size_t liveBytes)
+    {
+        CycleCollector::BackgroundConfig config;
+        config.root_threshold = roots;
+        config.interval = std::chrono::milliseconds(intervalMs);
+        config.live_bytes_threshold = liveBytes;
+        config.poll_interval = std::chrono::milliseconds(2);
+        return config;
+    }
+};
+
+TEST_F(BackgroundCollectorTest, CollectsWhenRootBufferFills)
+{
+    CycleCollector::startBackground(triggers(4, 0, 0));
+    EXPECT_TRUE(CycleCollector::isBackgroundRunning());
+    EXPECT_TRUE(CycleCollector::isEnabled());
+
+    makeGarbageCycle(1);
+    makeGarbageCycle(2);
+    EXPECT_TRUE(waitForDestroyed(4));
+
+    CycleCollector::stopBackground();
+    EXPECT_FALSE(CycleCollector::isBackgroundRunning());
+}
+
+TEST_F(BackgroundCollectorTest, CollectsOnInterval)
+{
+    CycleCollector::startBackground(triggers(0, 5, 0));
+    makeGarbageCycle(1);
+    EXPECT_TRUE(waitForDestroyed(2));
+}
+
+TEST_F(BackgroundCollectorTest, CollectsUnderMemoryPressure)
+{
+    std::vector<Ref<BackgroundNode>> ballast;
+    for (int i = 0; i < 8; ++i)
+    {
+        ballast.push_back(makeRef<BackgroundNode>(i));
+    }
+    CycleCollector::startBackground(triggers(0, 0, 11 * sizeof(BackgroundNode)));
+
+    makeGarbageCycle(1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(destroyed.load(), 0);
+
+    ballast.push_back(makeRef<BackgroundNode>(8));
+    EXPECT_TRUE(waitForDestroyed(2));
+    EXPECT_EQ(ballast.back()->id, 8);
+}
+
+TEST_F(BackgroundCollectorTest, RecordsPauseMetrics)
+{
+    CycleCollector::enable(true);
+    makeGarbageCycle(1);
+    CycleCollector::collectCycles();
+    CycleCollector::collectCycles();
+
+    const auto metrics = CycleCollector::getMetrics();
+    EXPECT_EQ(metrics.collections, 2u);
+    EXPECT_EQ(metrics.objects_collected, 2u);
+    EXPECT_EQ(metrics.abandoned_collections, 0u);
+    EXPECT_EQ(metrics.durations.total, 2u);
+    EXPECT_EQ(metrics.handshakes.total, 2u);
+    EXPECT_GE(metrics.max_duration_ns, metrics.durations.buckets.front().lower);
+
+    CycleCollector::resetMetrics();
+    EXPECT_EQ(CycleCollector::getMetrics().collections, 0u);
+}
+
+TEST_F(BackgroundCollectorTest, CollectingFromADestructorDoesNotWaitForItself)
+{
+    CycleCollector::enable(true);
+    makeGarbageCycle(1);
+    {
+        auto collecting = makeRef<Collecting>();
+    }
+    EXPECT_EQ(destroyed.load(), 2);
+}
+
+TEST_F(BackgroundCollectorTest, MutatorsRunDuringCollections)
+{
+    constexpr int threads = 4;
+    constexpr int rounds = 2000;
+
+    std::vector<Ref<BackgroundNode>> shared;
+    for (int i = 0; i < 16; ++i)
+    {
+        shared.push_back(makeRef<BackgroundNode>(1000 + i));
+    }
+    for (int i = 0; i < 16; ++i)
+    {
+        shared[i]->next = shared[(i + 1) % 16];
+    }
+    CycleCollector::startBackground(triggers(64, 1, 0));
+
+    std::vector<std::thread> mutators;
+    std::atomic<int> corrupted{0};
+    for (int t = 0; t < threads; ++t)
+    {
+        // Worker threads dereference with operator*, since operator-> records a hazard pointer per call in a
+        // thread-local vector that is not freed when the thread exits.
+        mutators.emplace_back([&shared, &corrupted, t]() {
+            WeakRef<BackgroundNode> lastGarbage;
+            for (int i = 0; i < rounds; ++i)
+            {
+                Ref<BackgroundNode> copy = shared[static_cast<size_t>(i + t) % shared.size()];
+                if ((*copy).id < 1000 || (*(*copy).next).id < 1000)
+                {
+                    corrupted.fetch_add(1);
+                }
+
+                auto a = makeRef<BackgroundNode>(i);
+                auto b = makeRef<BackgroundNode>(i);
+                (*a).next = b;
+                (*b).next = a;
+                lastGarbage = a.weak();
+                a.reset();
+                b.reset();
+
+                if (auto resurrected = lastGarbage.lock())
+                {
+                    if ((*resurrected).id != i || (*(*resurrected).next).id != i)
+                    {
+                        corrupted.fetch_add(1);
+                    }
+                }
+            }
+        });
+    }
+    for (auto& mutator : mutators)
+    {
+        mutator.join();
+    }
+    CycleCollector::stopBackground();
+    while (CycleCollector::getBufferedRoots() > 0)
+    {
+        CycleCollector::collectCycles();
+    }
+
+    EXPECT_EQ(corrupted.load(), 0);
+    EXPECT_EQ(destroyed.load(), 2 * threads * rounds);
+    for (int i = 0; i < 16; ++i)
+    {
+        EXPECT_EQ(shared[i]->id, 1000 + i);
+    }
+    shared.front()->next.reset();
+    shared.clear();
+    EXPECT_EQ(destroyed.load(), 2 * threads * rounds + 16);
+}
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <string>
+
+using namespace memory;
+
+namespace
+{
+    struct Record
+    {
+        static inline int live = 0;
+
+        size_t id;
+        std::string name;
+
+        explicit Record(size_t i) : id(i), name("record" + std::to_string(i)) { ++live; }
+        Record(size_t i, std::string n) : id(i), name(std::move(n)) { ++live; }
+        ~Record() { --live; }
+    };
+}
+
+class BatchRefTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+        Record::live = 0;
+    }
+
+    void TearDown() override
+    {
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        enableAllocationTracking(false);
+    }
+};
+
+TEST_F(BatchRefTest, MakeRefsUsesGenerator)
+{
+    auto refs = makeRefs<Record>(100, [](size_t i) { return i * 2; });
+    ASSERT_EQ(refs.size(), 100u);
+    EXPECT_EQ(Record::live, 100);
+    EXPECT_EQ(AllocationTracker::getAllocationCount(), 100u);
+
+    for (size_t i = 0; i < refs.size(); ++i)
+    {
+        EXPECT_EQ(refs[i]->id, i * 2);
+        EXPECT_EQ(refs[i].useCount(), 1u);
+    }
+
+    refs.clear();
+    EXPECT_EQ(Record::live, 0);
+}
+
+TEST_F(BatchRefTest, MakeRefBatchSharesArguments)
+{
+    auto refs = makeRefBatch<Record>(8, size_t{7}, std::string("same"));
+    ASSERT_EQ(refs.size(), 8u);
+    for (const auto& ref : refs)
+    {
+        EXPECT_EQ(ref->id, 7u);
+        EXPECT_EQ(ref->name, "same");
+    }
+    EXPECT_NE(refs[0].get(), refs[1].get());
+}
+
+TEST_F(BatchRefTest, MembersAreCountedIndependently)
+{
+    Ref<Record> survivor;
+    WeakRef<Record> weak;
+    {
+        auto refs = makeRefs<Record>(4, [](size_t i) { return i; });
+        survivor = refs[2];
+        weak = refs[1].weak();
+        EXPECT_EQ(refs[2].useCount(), 2u);
+        EXPECT_EQ(refs[1].useCount(), 1u);
+    }
+
+    EXPECT_EQ(Record::live, 1);
+    EXPECT_EQ(survivor->id, 2u);
+    EXPECT_TRUE(weak.expired());
+
+    survivor.reset();
+    EXPECT_EQ(Record::live, 0);
+}
+
+TEST_F(BatchRefTest, EmptyBatch)
+{
+    auto refs = makeRefs<Record>(0, [](size_t i) { return i; });
+    EXPECT_TRUE(refs.empty());
+}
+
+TEST_F(BatchRefTest, ThrowingGeneratorDestroysConstructedObjects)
+{
+    auto generator = [](size_t i) -> size_t {
+        if (i == 5)
+        {
+            throw std::runtime_error("generator failed");
+        }
+        return i;
+    };
+
+    EXPECT_THROW(makeRefs<Record>(10, generator), std::runtime_error);
+    EXPECT_EQ(Record::live, 0);
+}
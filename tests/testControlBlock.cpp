@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include <memory/refCounting/controlBlock.h>
+#include <memory/memory.h>
 
 using namespace memory::refCounting;
 
@@ -63,4 +64,55 @@ TEST_F(ControlBlockTest, ObjectDeletion)
     auto* block = new ControlBlock<TestObject>(obj);
 
     block->decrementStrong();
-}
\ No newline at end of file
+}
+
+namespace
+{
+    struct PlainBase
+    {
+        int base{1};
+        ~PlainBase() = default; // deliberately not virtual
+    };
+
+    struct PlainDerived : PlainBase
+    {
+        static inline int destroyed = 0;
+        std::string payload{"derived"};
+        ~PlainDerived() { ++destroyed; }
+    };
+}
+
+TEST_F(ControlBlockTest, BlocksDoNotStoreTypeInformation)
+{
+    EXPECT_EQ(sizeof(ControlBlock<TestObject>), sizeof(ControlBlockBase));
+    EXPECT_EQ(sizeof(ControlBlock<PlainDerived>), sizeof(ControlBlock<char>));
+}
+
+TEST_F(ControlBlockTest, BaseRefDestroysDerivedWithoutVirtualDestructor)
+{
+    PlainDerived::destroyed = 0;
+    {
+        memory::Ref<PlainBase> base = memory::makeRef<PlainDerived>();
+        EXPECT_EQ(base->base, 1);
+    }
+    EXPECT_EQ(PlainDerived::destroyed, 1);
+}
+
+TEST_F(ControlBlockTest, ConvertedRefsShareOneBlock)
+{
+    auto derived = memory::makeRef<PlainDerived>();
+    memory::Ref<PlainBase> base = derived;
+    memory::WeakRef<PlainBase> weak = base;
+
+    EXPECT_EQ(static_cast<ControlBlockBase*>(base.getControlBlock()), derived.getControlBlock());
+    EXPECT_EQ(weak.getControlBlock(), derived.getControlBlock());
+    EXPECT_EQ(derived.useCount(), 2u);
+    EXPECT_EQ(derived.getControlBlock()->getObjectAddress(), static_cast<void*>(derived.get()));
+}
+
+TEST_F(ControlBlockTest, ConstElementTypes)
+{
+    memory::Ref<const TestObject> ref = memory::makeRef<const TestObject>();
+    EXPECT_EQ(ref->value, 0);
+    EXPECT_EQ(ref.useCount(), 1u);
+}
@@ -0,0 +1,195 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <string>
+#include <vector>
+#include <cstring>
+#include <sys/mman.h>
+
+using namespace memory;
+
+namespace
+{
+    struct Header
+    {
+        int version = 0;
+        size_t length = 0;
+    };
+
+    struct Message
+    {
+        static inline int live = 0;
+
+        Header header;
+        std::string payload;
+
+        Message(int version, std::string text) : header{version, text.size()}, payload(std::move(text)) { ++live; }
+        ~Message() { --live; }
+    };
+
+    struct CountingDeleter
+    {
+        int* calls;
+
+        void operator()(Message* ptr) const
+        {
+            ++*calls;
+            delete ptr;
+        }
+    };
+}
+
+class CustomDeleterTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+        Message::live = 0;
+    }
+
+    void TearDown() override
+    {
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        EXPECT_EQ(Message::live, 0);
+        enableAllocationTracking(false);
+    }
+};
+
+TEST_F(CustomDeleterTest, DeleterRunsOnLastStrongRelease)
+{
+    int calls = 0;
+    {
+        Ref<Message> ref(new Message(1, "hello"), CountingDeleter{&calls});
+        Ref<Message> copy = ref;
+        EXPECT_EQ(ref.useCount(), 2u);
+        EXPECT_EQ(copy->payload, "hello");
+
+        ref.reset();
+        EXPECT_EQ(calls, 0);
+    }
+    EXPECT_EQ(calls, 1);
+}
+
+TEST_F(CustomDeleterTest, DeleterRunsBeforeWeakRefsExpire)
+{
+    int calls = 0;
+    WeakRef<Message> weak;
+    {
+        Ref<Message> ref(new Message(2, "weak"), CountingDeleter{&calls});
+        weak = ref;
+    }
+    EXPECT_EQ(calls, 1);
+    EXPECT_TRUE(weak.expired());
+    EXPECT_FALSE(weak.lock());
+}
+
+TEST_F(CustomDeleterTest, LambdaDeleterReleasesMappedMemory)
+{
+    constexpr size_t length = 4096;
+    void* region = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(region, MAP_FAILED);
+    std::memcpy(region, "mapped", 7);
+
+    bool unmapped = false;
+    {
+        Ref<char> file(static_cast<char*>(region), [&unmapped](char* ptr)
+        {
+            unmapped = munmap(ptr, length) == 0;
+        });
+        EXPECT_STREQ(file.get(), "mapped");
+    }
+    EXPECT_TRUE(unmapped);
+}
+
+TEST_F(CustomDeleterTest, AliasingRefSharesOwnership)
+{
+    auto message = makeRef<Message>(3, "payload");
+    Ref<std::string> payload(message, &message->payload);
+
+    EXPECT_EQ(message.useCount(), 2u);
+    EXPECT_EQ(payload.get(), &message->payload);
+    EXPECT_EQ(*payload, "payload");
+
+    message.reset();
+    EXPECT_EQ(Message::live, 1);
+    EXPECT_EQ(payload.useCount(), 1u);
+    EXPECT_EQ(*payload, "payload");
+
+    payload.reset();
+    EXPECT_EQ(Message::live, 0);
+}
+
+TEST_F(CustomDeleterTest, AliasingMoveTakesOverReference)
+{
+    auto message = makeRef<Message>(4, "moved");
+    Message* raw = message.get();
+
+    Ref<Header> header(std::move(message), &raw->header);
+    EXPECT_FALSE(message);
+    EXPECT_EQ(header.useCount(), 1u);
+    EXPECT_EQ(header->version, 4);
+    EXPECT_EQ(header->length, 5u);
+}
+
+TEST_F(CustomDeleterTest, AliasingDoesNotAllocate)
+{
+    auto message = makeRef<Message>(5, "zero-copy");
+    const size_t before = AllocationTracker::getAllocationCount();
+
+    std::vector<Ref<Header>> headers;
+    for (int i = 0; i < 16; ++i)
+    {
+        headers.emplace_back(message, &message->header);
+    }
+
+    EXPECT_EQ(AllocationTracker::getAllocationCount(), before);
+    EXPECT_EQ(message.useCount(), 17u);
+}
+
+TEST_F(CustomDeleterTest, AliasingSurvivesCopiesAndWeakRefs)
+{
+    auto message = makeRef<Message>(6, "slice");
+    Ref<Header> header(message, &message->header);
+
+    Ref<Header> copy = header;
+    EXPECT_EQ(copy.get(), &message->header);
+
+    WeakRef<Header> weak = copy;
+    message.reset();
+    header.reset();
+
+    auto locked = weak.lock();
+    ASSERT_TRUE(locked);
+    EXPECT_EQ(locked->version, 6);
+
+    copy.reset();
+    locked.reset();
+    EXPECT_TRUE(weak.expired());
+    EXPECT_EQ(weak.lock().get(), nullptr);
+}
+
+TEST_F(CustomDeleterTest, AliasingSlicesOfSharedBuffer)
+{
+    auto buffer = makeRef<Message>(7, "alpha,beta,gamma");
+    std::string& text = buffer->payload;
+
+    std::vector<Ref<char>> slices;
+    size_t start = 0;
+    while (start <= text.size())
+    {
+        const size_t end = std::min(text.find(',', start), text.size());
+        slices.emplace_back(buffer, text.data() + start);
+        start = end + 1;
+    }
+
+    buffer.reset();
+    ASSERT_EQ(slices.size(), 3u);
+    EXPECT_EQ(std::strncmp(slices[1].get(), "beta", 4), 0);
+    EXPECT_EQ(std::strncmp(slices[2].get(), "gamma", 5), 0);
+    EXPECT_EQ(Message::live, 1);
+
+    slices.clear();
+}
@@ -0,0 +1,212 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <string>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    struct GraphNode
+    {
+        int id{0};
+        Ref<GraphNode> next;
+        WeakRef<GraphNode> parent;
+        std::vector<Ref<GraphNode>> children;
+
+        explicit GraphNode(int value = 0) : id(value) {}
+
+        void trace(RefVisitor& visit) const
+        {
+            visit(next);
+            visit(parent);
+            visit(children);
+        }
+    };
+
+    struct Document;
+
+    struct Section
+    {
+        Ref<Document> owner;
+    };
+
+    struct Document
+    {
+        std::vector<Ref<Section>> sections;
+    };
+
+    // Traced through a free function found by argument-dependent lookup.
+    void trace(const Section& section, RefVisitor& visit)
+    {
+        visit(section.owner);
+    }
+
+    void trace(const Document& document, RefVisitor& visit)
+    {
+        visit(document.sections);
+    }
+
+    struct Untraced
+    {
+        Ref<Untraced> self;
+    };
+}
+
+class CycleDetectionTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        CycleDetector::enableDetection(true);
+        CycleDetector::setCycleCallback([this](const CycleDetector::CycleInfo& info) {
+            cycles.push_back(info);
+        });
+    }
+
+    void TearDown() override
+    {
+        enableCycleDetection(false);
+    }
+
+    std::vector<CycleDetector::CycleInfo> cycles;
+};
+
+TEST_F(CycleDetectionTest, FindsCycleThroughMembers)
+{
+    auto a = makeRef<GraphNode>(1);
+    auto b = makeRef<GraphNode>(2);
+    auto c = makeRef<GraphNode>(3);
+    a->next = b;
+    b->next = c;
+    c->next = a;
+
+    EXPECT_TRUE(CycleDetector::detectCycle(a));
+    ASSERT_EQ(cycles.size(), 1u);
+    EXPECT_EQ(cycles[0].cycle_length, 3u);
+    EXPECT_EQ(cycles[0].cycle_path, (std::vector<void*>{a.get(), b.get(), c.get()}));
+    ASSERT_EQ(cycles[0].cycle_types.size(), 3u);
+    EXPECT_NE(cycles[0].cycle_types[0].find("GraphNode"), std::string::npos);
+    EXPECT_NE(cycles[0].description.find("GraphNode -> "), std::string::npos);
+
+    c->next.reset();
+}
+
+TEST_F(CycleDetectionTest, ReportsOnlyTheCyclicPart)
+{
+    auto head = makeRef<GraphNode>(0);
+    auto loop = makeRef<GraphNode>(1);
+    head->next = loop;
+    loop->next = loop;
+
+    EXPECT_TRUE(CycleDetector::detectCycle(head));
+    ASSERT_EQ(cycles.size(), 1u);
+    EXPECT_EQ(cycles[0].cycle_path, (std::vector<void*>{loop.get()}));
+
+    loop->next.reset();
+}
+
+TEST_F(CycleDetectionTest, SharedSubgraphsAreNotCycles)
+{
+    auto root = makeRef<GraphNode>(0);
+    auto left = makeRef<GraphNode>(1);
+    auto right = makeRef<GraphNode>(2);
+    auto shared = makeRef<GraphNode>(3);
+    root->children = {left, right};
+    left->next = shared;
+    right->next = shared;
+
+    EXPECT_FALSE(CycleDetector::detectCycle(root));
+    EXPECT_TRUE(cycles.empty());
+}
+
+TEST_F(CycleDetectionTest, WeakBackReferencesAreNotCycles)
+{
+    auto parent = makeRef<GraphNode>(0);
+    for (int i = 0; i < 3; ++i)
+    {
+        auto child = makeRef<GraphNode>(i + 1);
+        child->parent = parent.weak();
+        parent->children.push_back(child);
+    }
+
+    EXPECT_FALSE(CycleDetector::detectCycle(parent));
+}
+
+TEST_F(CycleDetectionTest, FollowsEdgesAcrossTypes)
+{
+    auto document = makeRef<Document>();
+    auto section = makeRef<Section>();
+    document->sections.push_back(section);
+    EXPECT_FALSE(CycleDetector::detectCycle(document));
+
+    section->owner = document;
+    EXPECT_TRUE(CycleDetector::detectCycle(section));
+    ASSERT_EQ(cycles.size(), 1u);
+    EXPECT_EQ(cycles[0].cycle_length, 2u);
+    EXPECT_NE(cycles[0].cycle_types[0].find("Section"), std::string::npos);
+    EXPECT_NE(cycles[0].cycle_types[1].find("Document"), std::string::npos);
+
+    section->owner.reset();
+}
+
+TEST_F(CycleDetectionTest, StartsFromAControlBlock)
+{
+    auto node = makeRef<GraphNode>(7);
+    node->next = node;
+    auto* block = static_cast<refCounting::ControlBlock<GraphNode>*>(node.getControlBlock());
+
+    EXPECT_TRUE(CycleDetector::detectCycle(block));
+    node->next.reset();
+}
+
+TEST_F(CycleDetectionTest, UntracedTypesHaveNoEdges)
+{
+    auto node = makeRef<Untraced>();
+    node->self = node;
+
+    EXPECT_FALSE(CycleDetector::detectCycle(node));
+    node->self.reset();
+}
+
+TEST_F(CycleDetectionTest, DisabledDetectionFindsNothing)
+{
+    auto node = makeRef<GraphNode>();
+    node->next = node;
+
+    CycleDetector::enableDetection(false);
+    EXPECT_FALSE(CycleDetector::detectCycle(node));
+    EXPECT_TRUE(cycles.empty());
+    node->next.reset();
+}
+
+TEST_F(CycleDetectionTest, HandlesDeepGraphsWithoutRecursion)
+{
+    constexpr int depth = 300000;
+    std::vector<Ref<GraphNode>> nodes;
+    nodes.reserve(depth);
+    for (int i = 0; i < depth; ++i)
+    {
+        nodes.push_back(makeRef<GraphNode>(i));
+    }
+    for (int i = 0; i + 1 < depth; ++i)
+    {
+        nodes[i]->next = nodes[i + 1];
+    }
+
+    EXPECT_FALSE(CycleDetector::detectCycle(nodes.front()));
+
+    nodes.back()->next = nodes[depth / 2];
+    EXPECT_TRUE(CycleDetector::detectCycle(nodes.front()));
+    ASSERT_EQ(cycles.size(), 1u);
+    EXPECT_EQ(cycles[0].cycle_length, static_cast<size_t>(depth - depth / 2));
+    EXPECT_EQ(cycles[0].cycle_path.front(), nodes[depth / 2].get());
+
+    // Unlink before release so destruction does not recurse down the chain either.
+    for (auto& node : nodes)
+    {
+        node->next.reset();
+    }
+}
@@ -6,6 +6,7 @@ using namespace memory;
 struct TestObject
 {
     int value;
+    TestObject() : value(0) {}
     TestObject(int v) : value(v) {}
 };
 
@@ -96,9 +96,8 @@ TEST_F(EnhancedFeaturesTest, CycleDetection)
 
     EXPECT_TRUE(CycleDetector::isEnabled());
 
-    // Note: Actual cycle detection would require analyzing object member variables
-    // This test mainly verifies the infrastructure is in place
-    
+    // Graph traversal is covered by testCycleDetection.cpp; this only checks enabling and disabling
+
     // Clean up
     enableCycleDetection(false);
     EXPECT_FALSE(CycleDetector::isEnabled());
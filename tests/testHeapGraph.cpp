@@ -0,0 +1,231 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    struct GraphNode
+    {
+        int id{0};
+        Ref<GraphNode> next;
+        WeakRef<GraphNode> parent;
+        std::vector<Ref<GraphNode>> children;
+
+        explicit GraphNode(int value = 0) : id(value) {}
+
+        void trace(RefVisitor& visit) const
+        {
+            visit(next);
+            visit(parent);
+            visit(children);
+        }
+    };
+
+    template<typename T>
+    struct Box
+    {
+        T value{};
+    };
+
+    const HeapGraph::Node* findNode(const HeapGraph& graph, const void* block)
+    {
+        for (const auto& node : graph.nodes)
+        {
+            if (node.block == reinterpret_cast<uintptr_t>(block)) return &node;
+        }
+        return nullptr;
+    }
+}
+
+class HeapGraphTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+        path_ = (std::filesystem::temp_directory_path() / ("mexmemory_graph_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()))).string();
+    }
+
+    void TearDown() override
+    {
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        enableAllocationTracking(false);
+        std::remove(path_.c_str());
+    }
+
+    std::string read() const
+    {
+        std::ifstream file(path_, std::ios::binary);
+        std::ostringstream content;
+        content << file.rdbuf();
+        return content.str();
+    }
+
+    std::string path_;
+};
+
+TEST_F(HeapGraphTest, BinaryDumpsLoadBack)
+{
+    auto root = makeRef<GraphNode>(1);
+    auto child = makeRef<GraphNode>(2);
+    root->next = child;
+    root->children.push_back(makeRef<GraphNode>(3));
+    child->parent = root.weak();
+    auto value = makeRef<int>(4);
+
+    const auto stats = HeapGraph::exportGraph(path_, GraphFormat::Binary);
+    EXPECT_TRUE(stats.complete);
+    EXPECT_EQ(stats.nodes, 4u);
+    EXPECT_EQ(stats.strong_edges, 2u);
+    EXPECT_EQ(stats.weak_edges, 1u);
+    EXPECT_EQ(stats.types, 2u);
+    EXPECT_EQ(stats.bytes, std::filesystem::file_size(path_));
+
+    const auto graph = HeapGraph::load(path_);
+    EXPECT_TRUE(graph.complete);
+    ASSERT_EQ(graph.nodes.size(), 4u);
+    ASSERT_EQ(graph.edges.size(), 3u);
+    ASSERT_EQ(graph.typeNames.size(), 2u);
+
+    const auto* node = findNode(graph, root.getControlBlock());
+    ASSERT_NE(node, nullptr);
+    EXPECT_EQ(node->object, reinterpret_cast<uintptr_t>(root.get()));
+    EXPECT_EQ(node->size, sizeof(GraphNode));
+    EXPECT_EQ(node->strong, 1u);
+    EXPECT_NE(graph.typeNames[node->type].find("GraphNode"), std::string::npos);
+    EXPECT_EQ(findNode(graph, child.getControlBlock())->strong, 2u);
+
+    size_t fromRoot = 0;
+    for (const auto& edge : graph.edges)
+    {
+        if (edge.weak)
+        {
+            EXPECT_EQ(edge.from, reinterpret_cast<uintptr_t>(child.getControlBlock()));
+            EXPECT_EQ(edge.to, reinterpret_cast<uintptr_t>(root.getControlBlock()));
+        }
+        else
+        {
+            EXPECT_EQ(edge.from, reinterpret_cast<uintptr_t>(root.getControlBlock()));
+            ++fromRoot;
+        }
+    }
+    EXPECT_EQ(fromRoot, 2u);
+}
+
+TEST_F(HeapGraphTest, WritesDot)
+{
+    auto root = makeRef<GraphNode>(1);
+    root->next = makeRef<GraphNode>(2);
+    root->next->parent = root.weak();
+
+    const auto stats = HeapGraph::exportGraph(path_, GraphFormat::Dot);
+    EXPECT_TRUE(stats.complete);
+    const std::string dot = read();
+    EXPECT_EQ(dot.size(), stats.bytes);
+    EXPECT_EQ(dot.find("digraph mexMemory {\n"), 0u);
+    EXPECT_NE(dot.find("strong=1, weak="), std::string::npos);
+    EXPECT_NE(dot.find(" [kind=strong];"), std::string::npos);
+    EXPECT_NE(dot.find(" [kind=weak, style=dashed];"), std::string::npos);
+    EXPECT_NE(dot.find(std::to_string(sizeof(GraphNode)) + " bytes\""), std::string::npos);
+    EXPECT_EQ(dot.substr(dot.size() - 2), "}\n");
+}
+
+TEST_F(HeapGraphTest, WritesGraphMLWithEscapedTypeNames)
+{
+    auto box = makeRef<Box<int>>();
+
+    const auto stats = HeapGraph::exportGraph(path_, GraphFormat::GraphML);
+    EXPECT_TRUE(stats.complete);
+    const std::string xml = read();
+    EXPECT_NE(xml.find("<graph id=\"mexMemory\" edgedefault=\"directed\">"), std::string::npos);
+    EXPECT_NE(xml.find("Box&lt;int&gt;</data>"), std::string::npos);
+    EXPECT_EQ(xml.find("Box<int>"), std::string::npos);
+    EXPECT_NE(xml.find("<data key=\"strong\">1</data>"), std::string::npos);
+    EXPECT_EQ(xml.substr(xml.size() - 11), "</graphml>\n");
+}
+
+TEST_F(HeapGraphTest, LoadedDumpsConvertToTheSameText)
+{
+    std::vector<Ref<GraphNode>> nodes;
+    for (int i = 0; i < 50; ++i)
+    {
+        nodes.push_back(makeRef<GraphNode>(i));
+    }
+    for (int i = 1; i < 50; ++i)
+    {
+        nodes[i - 1]->children.push_back(nodes[i]);
+        nodes[i]->parent = nodes[(i * 7) % 50].weak();
+    }
+
+    ASSERT_TRUE(HeapGraph::exportGraph(path_, GraphFormat::Dot).complete);
+    const std::string direct = read();
+    ASSERT_TRUE(HeapGraph::exportGraph(path_, GraphFormat::Binary).complete);
+    const auto graph = HeapGraph::load(path_);
+
+    std::FILE* file = std::fopen(path_.c_str(), "wb");
+    ASSERT_NE(file, nullptr);
+    const auto stats = graph.write(fileno(file), GraphFormat::Dot);
+    std::fclose(file);
+    EXPECT_TRUE(stats.complete);
+    EXPECT_EQ(stats.nodes, 50u);
+    EXPECT_EQ(read(), direct);
+
+    for (auto& node : nodes)
+    {
+        node->children.clear();
+    }
+}
+
+TEST_F(HeapGraphTest, StreamsLargeGraphs)
+{
+    constexpr int count = 20000;
+    std::vector<Ref<GraphNode>> nodes;
+    for (int i = 0; i < count; ++i)
+    {
+        nodes.push_back(makeRef<GraphNode>(i));
+    }
+    for (int i = 0; i + 1 < count; ++i)
+    {
+        nodes[i]->next = nodes[i + 1];
+    }
+
+    const auto stats = HeapGraph::exportGraph(path_, GraphFormat::GraphML);
+    EXPECT_TRUE(stats.complete);
+    EXPECT_EQ(stats.nodes, static_cast<size_t>(count));
+    EXPECT_EQ(stats.strong_edges, static_cast<size_t>(count - 1));
+    EXPECT_GT(stats.bytes, size_t{1} << 16);
+    EXPECT_EQ(std::filesystem::file_size(path_), stats.bytes);
+
+    for (auto& node : nodes)
+    {
+        node->next.reset();
+    }
+}
+
+TEST_F(HeapGraphTest, ReportsIncompleteOutput)
+{
+    auto root = makeRef<GraphNode>(1);
+    EXPECT_FALSE(HeapGraph::exportGraph(-1, GraphFormat::Dot).complete);
+    EXPECT_FALSE(HeapGraph::exportGraph((std::filesystem::path(path_) / "missing" / "graph.dot").string(), GraphFormat::Dot).complete);
+
+    ASSERT_TRUE(HeapGraph::exportGraph(path_, GraphFormat::Binary).complete);
+    const auto size = std::filesystem::file_size(path_);
+    std::filesystem::resize_file(path_, size - 4);
+    const auto truncated = HeapGraph::load(path_);
+    EXPECT_FALSE(truncated.complete);
+    EXPECT_EQ(truncated.nodes.size(), 1u);
+
+    std::ofstream(path_, std::ios::binary) << "not a graph";
+    EXPECT_THROW(HeapGraph::load(path_), std::runtime_error);
+}
@@ -0,0 +1,209 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace memory;
+
+struct SnapshotLeaky
+{
+    int values[16]{};
+};
+
+struct SnapshotSteady
+{
+    double value{0.0};
+};
+
+/**
+ * @brief Allocation site with external linkage, so captured stacks of it can be told apart.
+ */
+__attribute__((noinline)) Ref<SnapshotLeaky> snapshotLeakSite()
+{
+    return makeRef<SnapshotLeaky>();
+}
+
+namespace
+{
+    const AllocationTracker::TypeGrowth* findType(const AllocationTracker::SnapshotDiff& diff, const std::string& name)
+    {
+        auto it = std::find_if(diff.types.begin(), diff.types.end(), [&name](const auto& type) {
+            return type.type.find(name) != std::string::npos;
+        });
+        return it == diff.types.end() ? nullptr : &*it;
+    }
+}
+
+class HeapSnapshotTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+    }
+
+    void TearDown() override
+    {
+        AllocationTracker::setStackCaptureDepth(0);
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        enableAllocationTracking(false);
+    }
+};
+
+TEST_F(HeapSnapshotTest, GroupsRecordsBySite)
+{
+    int values[4] = {};
+    double other = 0.0;
+    for (int& value : values)
+    {
+        AllocationTracker::trackAllocation(&value, 1, "service.cpp", 10);
+    }
+    AllocationTracker::trackAllocation(&other, 1, "service.cpp", 20);
+
+    auto snapshot = AllocationTracker::snapshot();
+    EXPECT_EQ(snapshot.count(), 5u);
+    EXPECT_EQ(snapshot.bytes(), 4 * sizeof(int) + sizeof(double));
+    ASSERT_EQ(snapshot.sites().size(), 2u);
+
+    const auto& doubles = snapshot.sites()[0];
+    const auto& ints = snapshot.sites()[1];
+    EXPECT_EQ(doubles.type, "double");
+    EXPECT_EQ(doubles.line, 20);
+    EXPECT_EQ(doubles.count, 1u);
+    EXPECT_EQ(ints.type, "int");
+    EXPECT_EQ(ints.file, "service.cpp");
+    EXPECT_EQ(ints.line, 10);
+    EXPECT_EQ(ints.count, 4u);
+    EXPECT_EQ(ints.bytes, 4 * sizeof(int));
+
+    for (int& value : values)
+    {
+        AllocationTracker::untrackAllocation(&value);
+    }
+    AllocationTracker::untrackAllocation(&other);
+
+    // The snapshot is a copy and is unaffected by later frees.
+    EXPECT_EQ(snapshot.count(), 5u);
+    EXPECT_EQ(AllocationTracker::snapshot().count(), 0u);
+}
+
+TEST_F(HeapSnapshotTest, DiffReportsGrowthByTypeAndSite)
+{
+    std::vector<Ref<SnapshotSteady>> steady;
+    for (int i = 0; i < 5; ++i)
+    {
+        steady.push_back(makeRef<SnapshotSteady>());
+    }
+    std::vector<Ref<SnapshotLeaky>> leaked;
+    leaked.push_back(makeRef<SnapshotLeaky>());
+
+    const auto before = AllocationTracker::snapshot();
+    for (int i = 0; i < 10; ++i)
+    {
+        leaked.push_back(makeRef<SnapshotLeaky>());
+    }
+    steady.pop_back();
+    const auto after = AllocationTracker::snapshot();
+
+    const auto diff = AllocationTracker::diff(before, after);
+    EXPECT_EQ(diff.count_delta, 9);
+    EXPECT_EQ(diff.bytes_delta, static_cast<int64_t>(10 * sizeof(SnapshotLeaky)) - static_cast<int64_t>(sizeof(SnapshotSteady)));
+    EXPECT_GE(diff.elapsed.count(), 0);
+
+    ASSERT_EQ(diff.types.size(), 2u);
+    EXPECT_NE(diff.types[0].type.find("SnapshotLeaky"), std::string::npos);
+    EXPECT_EQ(diff.types[0].count_delta, 10);
+    EXPECT_EQ(diff.types[0].count, 11u);
+
+    const auto* shrunk = findType(diff, "SnapshotSteady");
+    ASSERT_NE(shrunk, nullptr);
+    EXPECT_EQ(shrunk->count_delta, -1);
+    EXPECT_EQ(shrunk->count, 4u);
+
+    ASSERT_FALSE(diff.sites.empty());
+    EXPECT_EQ(diff.sites.front().bytes_delta, static_cast<int64_t>(10 * sizeof(SnapshotLeaky)));
+}
+
+TEST_F(HeapSnapshotTest, UnchangedHeapGivesEmptyDiff)
+{
+    auto keep = makeRef<SnapshotSteady>();
+    const auto first = AllocationTracker::snapshot();
+    {
+        auto temporary = makeRef<SnapshotLeaky>();
+    }
+    const auto second = AllocationTracker::snapshot();
+
+    const auto diff = AllocationTracker::diff(first, second);
+    EXPECT_EQ(diff.count_delta, 0);
+    EXPECT_TRUE(diff.types.empty());
+    EXPECT_TRUE(diff.sites.empty());
+}
+
+TEST_F(HeapSnapshotTest, CapturedStacksSeparateCallSites)
+{
+    AllocationTracker::setStackCaptureDepth(8);
+
+    std::vector<Ref<SnapshotLeaky>> refs;
+    const auto before = AllocationTracker::snapshot();
+    for (int i = 0; i < 3; ++i)
+    {
+        refs.push_back(snapshotLeakSite());
+    }
+    refs.push_back(makeRef<SnapshotLeaky>());
+    const auto diff = AllocationTracker::diff(before, AllocationTracker::snapshot());
+
+    ASSERT_EQ(diff.sites.size(), 2u);
+    EXPECT_EQ(diff.sites[0].count_delta, 3);
+    EXPECT_NE(diff.sites[0].stackId, AllocationTracker::noStack);
+    EXPECT_NE(diff.sites[0].stackId, diff.sites[1].stackId);
+
+    std::ostringstream out;
+    AllocationTracker::printDiff(diff, &out);
+    EXPECT_NE(out.str().find("Growth by call site"), std::string::npos);
+    EXPECT_NE(out.str().find("stack #"), std::string::npos);
+#if defined(MEXMEMORY_HAS_BACKTRACE)
+    EXPECT_NE(out.str().find("snapshotLeakSite"), std::string::npos);
+#endif
+}
+
+TEST_F(HeapSnapshotTest, SnapshotWhileOtherThreadsAllocate)
+{
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&stop] {
+            std::vector<Ref<SnapshotSteady>> refs;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                refs.push_back(makeRef<SnapshotSteady>());
+                if (refs.size() > 64)
+                {
+                    refs.clear();
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < 50; ++i)
+    {
+        const auto snapshot = AllocationTracker::snapshot();
+        EXPECT_LE(snapshot.count(), 4u * 65u);
+        EXPECT_TRUE(std::is_sorted(snapshot.sites().begin(), snapshot.sites().end(), [](const auto& a, const auto& b) {
+            return std::tie(a.type, a.stackId, a.file, a.line) < std::tie(b.type, b.stackId, b.file, b.line);
+        }));
+    }
+
+    stop = true;
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(AllocationTracker::snapshot().count(), 0u);
+}
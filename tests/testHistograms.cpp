@@ -0,0 +1,172 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace memory;
+using memory::refCounting::Histogram;
+using memory::refCounting::HistogramBuckets;
+using memory::refCounting::AtomicHistogram;
+
+namespace
+{
+    struct ShortLived
+    {
+        int value{0};
+    };
+
+    struct LongLived
+    {
+        char payload[200]{};
+    };
+
+    const AllocationTracker::TypeHistograms* findType(const AllocationTracker::Histograms& histograms, const std::string& name)
+    {
+        auto it = std::find_if(histograms.types.begin(), histograms.types.end(), [&name](const auto& type) {
+            return type.type.find(name) != std::string::npos;
+        });
+        return it == histograms.types.end() ? nullptr : &*it;
+    }
+}
+
+class HistogramTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+        AllocationTracker::resetLiveMetrics();
+    }
+
+    void TearDown() override
+    {
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        enableAllocationTracking(false);
+    }
+};
+
+TEST_F(HistogramTest, BucketsCoverEveryValue)
+{
+    for (uint64_t value : {0ull, 1ull, 3ull, 4ull, 5ull, 7ull, 8ull, 100ull, 4096ull, 123456789ull})
+    {
+        const size_t index = HistogramBuckets::indexOf(value);
+        ASSERT_LT(index, HistogramBuckets::count);
+        EXPECT_LE(HistogramBuckets::lowerBound(index), value);
+        EXPECT_GE(HistogramBuckets::upperBound(index), value);
+    }
+    EXPECT_EQ(HistogramBuckets::indexOf(UINT64_MAX), HistogramBuckets::count - 1);
+
+    for (size_t i = 0; i + 1 < HistogramBuckets::count; ++i)
+    {
+        EXPECT_EQ(HistogramBuckets::upperBound(i) + 1, HistogramBuckets::lowerBound(i + 1));
+    }
+}
+
+TEST_F(HistogramTest, PercentilesAndMerge)
+{
+    AtomicHistogram small;
+    AtomicHistogram large;
+    for (int i = 0; i < 99; ++i)
+    {
+        small.record(16);
+    }
+    large.record(1 << 20);
+
+    Histogram merged = Histogram::from(small);
+    merged.add(Histogram::from(large));
+    EXPECT_EQ(merged.total, 100u);
+    EXPECT_EQ(merged.buckets.size(), 2u);
+    EXPECT_EQ(merged.percentile(50), HistogramBuckets::upperBound(HistogramBuckets::indexOf(16)));
+    EXPECT_EQ(merged.percentile(100), HistogramBuckets::upperBound(HistogramBuckets::indexOf(1 << 20)));
+    EXPECT_EQ(Histogram{}.percentile(50), 0u);
+}
+
+TEST_F(HistogramTest, RecordsSizesPerType)
+{
+    {
+        auto a = makeRef<ShortLived>();
+        auto b = makeRef<LongLived>();
+        auto c = makeRef<LongLived>();
+    }
+
+    auto histograms = AllocationTracker::getHistograms();
+    const auto* shortLived = findType(histograms, "ShortLived");
+    const auto* longLived = findType(histograms, "LongLived");
+    ASSERT_NE(shortLived, nullptr);
+    ASSERT_NE(longLived, nullptr);
+
+    EXPECT_EQ(shortLived->sizes.total, 1u);
+    EXPECT_EQ(longLived->sizes.total, 2u);
+    EXPECT_GE(longLived->sizes.percentile(50), sizeof(LongLived));
+    EXPECT_LE(longLived->sizes.buckets.front().lower, sizeof(LongLived));
+    EXPECT_GE(histograms.sizes.total, 3u);
+}
+
+TEST_F(HistogramTest, RecordsLifetimeUntilLastStrongRelease)
+{
+    auto longLived = makeRef<LongLived>();
+    {
+        auto shortLived = makeRef<ShortLived>();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    auto copy = longLived;
+    longLived.reset();
+    EXPECT_EQ(findType(AllocationTracker::getHistograms(), "LongLived")->lifetimes_ns.total, 0u);
+    copy.reset();
+
+    auto histograms = AllocationTracker::getHistograms();
+    const auto* shortType = findType(histograms, "ShortLived");
+    const auto* longType = findType(histograms, "LongLived");
+    ASSERT_NE(shortType, nullptr);
+    ASSERT_NE(longType, nullptr);
+    ASSERT_EQ(longType->lifetimes_ns.total, 1u);
+    ASSERT_EQ(shortType->lifetimes_ns.total, 1u);
+    EXPECT_GE(longType->lifetimes_ns.percentile(50), 20'000'000u);
+    EXPECT_LT(shortType->lifetimes_ns.percentile(50), longType->lifetimes_ns.percentile(50));
+}
+
+TEST_F(HistogramTest, ThreadsRecordConcurrently)
+{
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([] {
+            for (int i = 0; i < 1000; ++i)
+            {
+                auto ref = makeRef<ShortLived>();
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    auto histograms = AllocationTracker::getHistograms();
+    const auto* type = findType(histograms, "ShortLived");
+    ASSERT_NE(type, nullptr);
+    EXPECT_EQ(type->sizes.total, 4000u);
+    EXPECT_EQ(type->lifetimes_ns.total, 4000u);
+}
+
+TEST_F(HistogramTest, ResetAndPrint)
+{
+    {
+        auto ref = makeRef<LongLived>();
+    }
+
+    std::ostringstream out;
+    AllocationTracker::printHistograms(&out);
+    EXPECT_NE(out.str().find("LongLived"), std::string::npos);
+    EXPECT_NE(out.str().find("lifetimes (ns)"), std::string::npos);
+    EXPECT_NE(out.str().find('#'), std::string::npos);
+
+    AllocationTracker::resetLiveMetrics();
+    EXPECT_EQ(findType(AllocationTracker::getHistograms(), "LongLived"), nullptr);
+}
@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <cstddef>
+#include <cstdint>
+
+using namespace memory;
+
+class HugePageAllocatorTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+    }
+
+    void TearDown() override
+    {
+        enableAllocationTracking(false);
+        AllocationTracker::clearAllocations();
+    }
+};
+
+TEST_F(HugePageAllocatorTest, SmallAllocationUsesHeap)
+{
+    auto ref = makeRefWithAllocator<std::byte[], HugePageAllocator<std::byte[]>>(size_t{4096});
+    ASSERT_NE(ref.get(), nullptr);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ref.get()) % 64, 0u);
+
+    auto stats = AllocationTracker::getStatistics();
+    EXPECT_EQ(stats.huge_page_allocations, 0u);
+    EXPECT_EQ(stats.huge_page_bytes, 0u);
+}
+
+TEST_F(HugePageAllocatorTest, LargeAllocationIsMappedAndReportedSeparately)
+{
+    const size_t size = 8 * HugePageConfig::hugePageSize;
+    {
+        auto ref = makeRefWithAllocator<std::byte[], HugePageAllocator<std::byte[]>>(size);
+        ASSERT_NE(ref.get(), nullptr);
+
+        for (size_t i = 0; i < size; i += 4096)
+        {
+            ref.get()[i] = std::byte{0x5a};
+        }
+        EXPECT_EQ(ref.get()[size - 4096], std::byte{0x5a});
+
+        auto stats = AllocationTracker::getStatistics();
+        EXPECT_EQ(stats.huge_page_allocations, 1u);
+        EXPECT_GE(stats.huge_page_bytes, size);
+        EXPECT_EQ(stats.huge_page_bytes % HugePageConfig::hugePageSize, 0u);
+
+        std::ostringstream oss;
+        AllocationTracker::printStatistics(&oss);
+        EXPECT_NE(oss.str().find("Huge page mappings"), std::string::npos);
+    }
+
+    auto stats = AllocationTracker::getStatistics();
+    EXPECT_EQ(stats.huge_page_allocations, 0u);
+    EXPECT_EQ(stats.huge_page_bytes, 0u);
+}
+
+TEST_F(HugePageAllocatorTest, FallsBackWithoutHugeTlb)
+{
+    const bool previous = HugePageConfig::tryHugeTlb;
+    HugePageConfig::tryHugeTlb = false;
+
+    auto* data = HugePageAllocator<uint64_t[]>::allocate(HugePageConfig::hugePageSize / sizeof(uint64_t));
+    ASSERT_NE(data, nullptr);
+    data[0] = 1;
+    data[HugePageConfig::hugePageSize / sizeof(uint64_t) - 1] = 2;
+    EXPECT_EQ(AllocationTracker::getStatistics().huge_tlb_allocations, 0u);
+    HugePageAllocator<uint64_t[]>::deallocate(data);
+
+    HugePageConfig::tryHugeTlb = previous;
+}
+
+TEST_F(HugePageAllocatorTest, NonTrivialElementsAreConstructedAndDestroyed)
+{
+    static int liveCount = 0;
+    struct Counted
+    {
+        Counted() { ++liveCount; }
+        ~Counted() { --liveCount; }
+    };
+
+    {
+        auto ref = makeRefWithAllocator<Counted[], HugePageAllocator<Counted[]>>(size_t{16});
+        EXPECT_EQ(liveCount, 16);
+    }
+    EXPECT_EQ(liveCount, 0);
+}
+
+TEST_F(HugePageAllocatorTest, SingleObject)
+{
+    struct Table
+    {
+        int entries[16];
+        explicit Table(int fill) { std::fill(std::begin(entries), std::end(entries), fill); }
+    };
+
+    auto ref = makeRefWithAllocator<Table, HugePageAllocator<Table>>(7);
+    EXPECT_EQ(ref->entries[15], 7);
+    EXPECT_EQ(AllocationTracker::getAllocationCount(), 1u);
+}
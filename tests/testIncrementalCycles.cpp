@@ -0,0 +1,314 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    struct Link
+    {
+        int id{0};
+        Ref<Link> next;
+        Ref<Link> other;
+        WeakRef<Link> parent;
+        std::vector<Ref<Link>> children;
+
+        explicit Link(int value = 0) : id(value) {}
+        Link(int value, Ref<Link> first) : id(value), next(std::move(first)) {}
+
+        void trace(RefVisitor& visit) const
+        {
+            visit(next);
+            visit(other);
+            visit(parent);
+            visit(children);
+        }
+    };
+
+    struct Pair
+    {
+        Ref<Link> first;
+        Ref<Link> second;
+    };
+
+    struct Wrapper
+    {
+        Pair pair;
+
+        void trace(RefVisitor& visit) const
+        {
+            visit(pair.first);
+            visit(pair.second);
+        }
+    };
+
+    std::mutex reportedMutex;
+    std::vector<CycleDetector::CycleInfo> reported;
+    std::atomic<int> reportCount{0};
+
+    std::vector<int> idsOf(const CycleDetector::CycleInfo& info)
+    {
+        std::vector<int> ids;
+        for (void* object : info.cycle_path)
+        {
+            ids.push_back(static_cast<Link*>(object)->id);
+        }
+        return ids;
+    }
+}
+
+class IncrementalCycleTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        reported.clear();
+        reportCount = 0;
+        CycleDetector::setCycleCallback([](const CycleDetector::CycleInfo& info) {
+            std::lock_guard<std::mutex> lock(reportedMutex);
+            reported.push_back(info);
+            reportCount.fetch_add(1);
+        });
+        CycleDetector::enableIncremental(true, CycleDetector::CycleAction::Report);
+    }
+
+    void TearDown() override
+    {
+        CycleDetector::enableIncremental(false);
+        CycleDetector::setCycleCallback(nullptr);
+    }
+};
+
+TEST_F(IncrementalCycleTest, ReportsTheAssignmentThatClosesACycle)
+{
+    auto a = makeRef<Link>(1);
+    auto b = makeRef<Link>(2);
+    a->next = b;
+    EXPECT_TRUE(reported.empty());
+
+    b->next = a;
+    ASSERT_EQ(reported.size(), 1u);
+    EXPECT_EQ(idsOf(reported[0]), (std::vector<int>{2, 1}));
+    EXPECT_EQ(reported[0].cycle_types.size(), 2u);
+    EXPECT_NE(reported[0].cycle_types[0].find("Link"), std::string::npos);
+    EXPECT_EQ(CycleDetector::getIncrementalStats().cycles, 1u);
+
+    b->next.reset();
+}
+
+TEST_F(IncrementalCycleTest, ReportsSelfReferences)
+{
+    auto a = makeRef<Link>(1);
+    a->next = a;
+    ASSERT_EQ(reported.size(), 1u);
+    EXPECT_EQ(idsOf(reported[0]), (std::vector<int>{1}));
+
+    a->next.reset();
+}
+
+TEST_F(IncrementalCycleTest, ReordersChainsBuiltAgainstTheOrder)
+{
+    std::vector<Ref<Link>> links;
+    for (int i = 0; i < 5; ++i)
+    {
+        links.push_back(makeRef<Link>(i));
+    }
+    for (int i = 0; i + 1 < 5; ++i)
+    {
+        links[i]->next = links[i + 1];
+    }
+    EXPECT_TRUE(reported.empty());
+    const auto stats = CycleDetector::getIncrementalStats();
+    EXPECT_EQ(stats.objects, 5u);
+    EXPECT_EQ(stats.references, 4u);
+    EXPECT_EQ(stats.reorders, 4u);
+    EXPECT_EQ(stats.reordered_objects, 2u + 3u + 4u + 5u);
+
+    links[4]->next = links[0];
+    ASSERT_EQ(reported.size(), 1u);
+    EXPECT_EQ(idsOf(reported[0]), (std::vector<int>{4, 0, 1, 2, 3}));
+
+    links[4]->next.reset();
+}
+
+TEST_F(IncrementalCycleTest, ListsBuiltAtTheHeadNeedNoReordering)
+{
+    auto head = makeRef<Link>(0);
+    for (int i = 1; i < 100; ++i)
+    {
+        auto link = makeRef<Link>(i);
+        link->next = std::move(head);
+        head = std::move(link);
+    }
+    const auto stats = CycleDetector::getIncrementalStats();
+    EXPECT_EQ(stats.references, 99u);
+    EXPECT_EQ(stats.reorders, 0u);
+    EXPECT_TRUE(reported.empty());
+
+    std::vector<Ref<Link>> released;
+    for (Link* link = head.get(); link && link->next; link = released.back().get())
+    {
+        released.push_back(std::move(link->next));
+    }
+    head.reset();
+    released.clear();
+}
+
+TEST_F(IncrementalCycleTest, DroppedReferencesNoLongerConstrain)
+{
+    auto a = makeRef<Link>(1);
+    auto b = makeRef<Link>(2);
+    a->next = b;
+    a->next.reset();
+    b->next = a;
+    EXPECT_TRUE(reported.empty());
+    b->next.reset();
+
+    a->other = b;
+    Ref<Link> moved = std::move(a->other);
+    b->other = a;
+    EXPECT_TRUE(reported.empty());
+    b->other.reset();
+
+    a->next = b;
+    b->next = makeRef<Link>(3);
+    a->other = b->next;
+    EXPECT_TRUE(reported.empty());
+    EXPECT_EQ(CycleDetector::getIncrementalStats().references, 3u);
+}
+
+TEST_F(IncrementalCycleTest, MovedReferencesAreTracked)
+{
+    auto a = makeRef<Link>(1);
+    auto b = makeRef<Link>(2);
+    Ref<Link> local = a;
+    b->next = std::move(local);
+    a->next = b;
+    ASSERT_EQ(reported.size(), 1u);
+    EXPECT_EQ(idsOf(reported[0]), (std::vector<int>{1, 2}));
+
+    a->next.reset();
+}
+
+TEST_F(IncrementalCycleTest, FieldsSetByTheConstructorAreEdges)
+{
+    auto b = makeRef<Link>(2);
+    auto a = makeRef<Link>(1, b);
+    EXPECT_EQ(CycleDetector::getIncrementalStats().references, 1u);
+
+    b->next = a;
+    ASSERT_EQ(reported.size(), 1u);
+    EXPECT_EQ(idsOf(reported[0]), (std::vector<int>{2, 1}));
+
+    b->next.reset();
+}
+
+TEST_F(IncrementalCycleTest, NestedMembersAreEdges)
+{
+    auto wrapper = makeRef<Wrapper>();
+    auto link = makeRef<Link>(1);
+    wrapper->pair.second = link;
+    EXPECT_EQ(CycleDetector::getIncrementalStats().references, 1u);
+
+    wrapper->pair = Pair{};
+    EXPECT_EQ(CycleDetector::getIncrementalStats().references, 0u);
+}
+
+TEST_F(IncrementalCycleTest, ContainersAndWeakReferencesAreNotEdges)
+{
+    auto a = makeRef<Link>(1);
+    auto b = makeRef<Link>(2);
+    a->children.push_back(b);
+    b->parent = a.weak();
+    b->next = a;
+    EXPECT_TRUE(reported.empty());
+    EXPECT_EQ(CycleDetector::getIncrementalStats().references, 1u);
+
+    b->next.reset();
+}
+
+TEST_F(IncrementalCycleTest, DestroyedObjectsLeaveTheGraph)
+{
+    {
+        auto a = makeRef<Link>(1);
+        a->next = makeRef<Link>(2);
+        a->next->next = makeRef<Link>(3);
+        EXPECT_EQ(CycleDetector::getIncrementalStats().objects, 3u);
+        EXPECT_EQ(CycleDetector::getIncrementalStats().references, 2u);
+    }
+    const auto stats = CycleDetector::getIncrementalStats();
+    EXPECT_EQ(stats.objects, 0u);
+    EXPECT_EQ(stats.references, 0u);
+}
+
+TEST_F(IncrementalCycleTest, ObjectsCreatedBeforeEnablingAreIgnored)
+{
+    CycleDetector::enableIncremental(false);
+    auto a = makeRef<Link>(1);
+    CycleDetector::enableIncremental(true, CycleDetector::CycleAction::Report);
+    EXPECT_TRUE(CycleDetector::isIncrementalEnabled());
+
+    a->next = a;
+    EXPECT_TRUE(reported.empty());
+    EXPECT_EQ(CycleDetector::getIncrementalStats().objects, 0u);
+
+    a->next.reset();
+}
+
+TEST_F(IncrementalCycleTest, ChecksAssignmentsFromManyThreads)
+{
+    constexpr int threads = 4;
+    constexpr int rounds = 500;
+
+    // Worker threads dereference with operator*, since operator-> records a hazard pointer per call in a
+    // thread-local vector that is not freed when the thread exits.
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([]() {
+            for (int i = 0; i < rounds; ++i)
+            {
+                auto a = makeRef<Link>(i);
+                auto b = makeRef<Link>(i);
+                (*a).next = b;
+                (*b).next = a;
+                (*b).next.reset();
+            }
+        });
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    EXPECT_EQ(reportCount.load(), threads * rounds);
+    const auto stats = CycleDetector::getIncrementalStats();
+    EXPECT_EQ(stats.objects, 0u);
+    EXPECT_EQ(stats.references, 0u);
+}
+
+TEST_F(IncrementalCycleTest, AbortsWhenAsked)
+{
+#if defined(NDEBUG)
+    EXPECT_EQ(CycleDetector::defaultCycleAction, CycleDetector::CycleAction::Report);
+#else
+    EXPECT_EQ(CycleDetector::defaultCycleAction, CycleDetector::CycleAction::Abort);
+#endif
+
+    GTEST_FLAG_SET(death_test_style, "threadsafe");
+    EXPECT_DEATH({
+        CycleDetector::enableIncremental(true, CycleDetector::CycleAction::Abort);
+        auto a = makeRef<Link>(1);
+        auto b = makeRef<Link>(2);
+        a->next = b;
+        b->next = a;
+    }, "Strong reference cycle of 2 objects created");
+}
@@ -0,0 +1,309 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    int destroyed = 0;
+
+    struct Payload
+    {
+        char bytes[256]{};
+    };
+
+    struct LeakNode
+    {
+        int id{0};
+        Ref<LeakNode> next;
+        WeakRef<LeakNode> parent;
+        std::vector<Ref<LeakNode>> children;
+        Ref<Payload> payload;
+
+        explicit LeakNode(int value = 0) : id(value) {}
+        ~LeakNode() { ++destroyed; }
+
+        void trace(RefVisitor& visit) const
+        {
+            visit(next);
+            visit(parent);
+            visit(children);
+            visit(payload);
+        }
+    };
+
+    struct Holder
+    {
+        Ref<LeakNode> node;
+
+        void trace(RefVisitor& visit) const
+        {
+            visit(node);
+        }
+    };
+
+    struct Opaque
+    {
+        Ref<LeakNode> node;
+    };
+
+    /**
+     * @brief Builds a ring of nodes and drops every outside reference to it.
+     */
+    void leakRing(int size, int firstId = 0)
+    {
+        std::vector<Ref<LeakNode>> ring;
+        for (int i = 0; i < size; ++i)
+        {
+            ring.push_back(makeRef<LeakNode>(firstId + i));
+        }
+        for (int i = 0; i < size; ++i)
+        {
+            ring[i]->next = ring[(i + 1) % size];
+        }
+    }
+
+    /**
+     * @brief Frees every leaked object of a report: all Refs are moved out before any of them is dropped.
+     */
+    void freeLeaks(const CycleDetector::LeakReport& report)
+    {
+        std::vector<Ref<LeakNode>> released;
+        for (const auto& component : report.components)
+        {
+            for (const auto& leaked : component.objects)
+            {
+                auto* node = static_cast<LeakNode*>(leaked.object);
+                released.push_back(std::move(node->next));
+                for (auto& child : node->children)
+                {
+                    released.push_back(std::move(child));
+                }
+            }
+        }
+        released.clear();
+    }
+}
+
+class LeakReportTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+        destroyed = 0;
+    }
+
+    void TearDown() override
+    {
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        enableAllocationTracking(false);
+    }
+};
+
+TEST_F(LeakReportTest, ReportsEveryLeakedCycle)
+{
+    leakRing(2, 0);
+    leakRing(3, 10);
+    auto reachable = makeRef<LeakNode>(20);
+    reachable->next = makeRef<LeakNode>(21);
+    reachable->next->next = reachable;
+
+    const auto report = CycleDetector::findLeaks();
+    EXPECT_EQ(report.objects_analyzed, 7u);
+    EXPECT_EQ(report.references_analyzed, 7u);
+    EXPECT_EQ(report.leaked_objects, 5u);
+    EXPECT_EQ(report.leaked_bytes, 5 * sizeof(LeakNode));
+    ASSERT_EQ(report.components.size(), 2u);
+
+    EXPECT_EQ(report.components[0].objects.size(), 3u);
+    EXPECT_EQ(report.components[0].bytes, 3 * sizeof(LeakNode));
+    EXPECT_EQ(report.components[1].objects.size(), 2u);
+    for (const auto& leaked : report.components[0].objects)
+    {
+        EXPECT_NE(leaked.type.find("LeakNode"), std::string::npos);
+        EXPECT_EQ(leaked.size, sizeof(LeakNode));
+        EXPECT_GE(static_cast<LeakNode*>(leaked.object)->id, 10);
+    }
+
+    freeLeaks(report);
+    EXPECT_EQ(destroyed, 5);
+    reachable->next->next.reset();
+}
+
+TEST_F(LeakReportTest, CyclesReferencedFromOutsideAreLive)
+{
+    auto owner = makeRef<Holder>();
+    {
+        auto a = makeRef<LeakNode>(1);
+        auto b = makeRef<LeakNode>(2);
+        a->next = b;
+        b->next = a;
+        owner->node = a;
+    }
+    auto opaque = makeRef<Opaque>();
+    {
+        auto c = makeRef<LeakNode>(3);
+        c->next = c;
+        opaque->node = c;
+    }
+
+    const auto report = CycleDetector::findLeaks();
+    EXPECT_EQ(report.leaked_objects, 0u);
+    EXPECT_TRUE(report.components.empty());
+
+    owner->node->next->next.reset();
+    opaque->node->next.reset();
+}
+
+TEST_F(LeakReportTest, AttributesRetainedObjectsToTheirCycle)
+{
+    {
+        auto a = makeRef<LeakNode>(1);
+        auto b = makeRef<LeakNode>(2);
+        a->next = b;
+        b->next = a;
+        auto holder = makeRef<LeakNode>(3);
+        holder->children.push_back(makeRef<LeakNode>(4));
+        holder->children.push_back(makeRef<LeakNode>(5));
+        a->children.push_back(holder);
+    }
+    leakRing(3, 10);
+
+    const auto report = CycleDetector::findLeaks();
+    EXPECT_EQ(report.leaked_objects, 8u);
+    ASSERT_EQ(report.components.size(), 2u);
+    EXPECT_EQ(report.components[0].objects.size(), 2u);
+    EXPECT_EQ(report.components[0].bytes, 2 * sizeof(LeakNode));
+    EXPECT_EQ(report.components[0].retained_objects, 5u);
+    EXPECT_EQ(report.components[0].retained_bytes, 5 * sizeof(LeakNode));
+    EXPECT_EQ(report.components[1].retained_objects, 3u);
+
+    freeLeaks(report);
+    EXPECT_EQ(destroyed, 8);
+}
+
+TEST_F(LeakReportTest, DownstreamCyclesAreReportedSeparately)
+{
+    {
+        auto a = makeRef<LeakNode>(1);
+        a->next = a;
+        auto b = makeRef<LeakNode>(2);
+        b->next = b;
+        a->children.push_back(b);
+    }
+
+    const auto report = CycleDetector::findLeaks();
+    ASSERT_EQ(report.components.size(), 2u);
+    EXPECT_EQ(report.components[0].retained_objects, 1u);
+    EXPECT_EQ(report.components[1].retained_objects, 1u);
+
+    freeLeaks(report);
+    EXPECT_EQ(destroyed, 2);
+}
+
+TEST_F(LeakReportTest, WeakCandidatesBreakTheCycle)
+{
+    leakRing(4);
+
+    const auto report = CycleDetector::findLeaks();
+    ASSERT_EQ(report.components.size(), 1u);
+    ASSERT_EQ(report.components[0].weak_candidates.size(), 1u);
+    const auto& edge = report.components[0].weak_candidates[0];
+    EXPECT_NE(edge.from_type.find("LeakNode"), std::string::npos);
+    EXPECT_NE(edge.to_type.find("LeakNode"), std::string::npos);
+
+    auto* from = static_cast<LeakNode*>(edge.from);
+    ASSERT_EQ(from->next.get(), edge.to);
+    Ref<LeakNode> broken = std::move(from->next);
+    from->parent = broken.weak();
+    broken.reset();
+    EXPECT_EQ(destroyed, 4);
+}
+
+TEST_F(LeakReportTest, SelfReferencesAreCycles)
+{
+    {
+        auto node = makeRef<LeakNode>();
+        node->next = node;
+    }
+
+    const auto report = CycleDetector::findLeaks();
+    ASSERT_EQ(report.components.size(), 1u);
+    ASSERT_EQ(report.components[0].weak_candidates.size(), 1u);
+    EXPECT_EQ(report.components[0].weak_candidates[0].from, report.components[0].weak_candidates[0].to);
+
+    freeLeaks(report);
+    EXPECT_EQ(destroyed, 1);
+}
+
+TEST_F(LeakReportTest, RetainsObjectsOfOtherTypes)
+{
+    {
+        auto node = makeRef<LeakNode>();
+        node->payload = makeRef<Payload>();
+        node->next = node;
+    }
+
+    const auto report = CycleDetector::findLeaks();
+    ASSERT_EQ(report.components.size(), 1u);
+    EXPECT_EQ(report.leaked_objects, 2u);
+    EXPECT_EQ(report.leaked_bytes, sizeof(LeakNode) + sizeof(Payload));
+    EXPECT_EQ(report.components[0].bytes, sizeof(LeakNode));
+    EXPECT_EQ(report.components[0].retained_objects, 2u);
+    EXPECT_EQ(report.components[0].retained_bytes, sizeof(LeakNode) + sizeof(Payload));
+
+    freeLeaks(report);
+    EXPECT_EQ(destroyed, 1);
+}
+
+TEST_F(LeakReportTest, FindsNothingWithoutTracking)
+{
+    enableAllocationTracking(false);
+    auto node = makeRef<LeakNode>();
+    node->next = node;
+    LeakNode* leaked = node.get();
+    node.reset();
+
+    EXPECT_EQ(CycleDetector::findLeaks().objects_analyzed, 0u);
+
+    Ref<LeakNode> last = std::move(leaked->next);
+    last.reset();
+    EXPECT_EQ(destroyed, 1);
+    enableAllocationTracking(true);
+}
+
+TEST_F(LeakReportTest, PrintsComponentsAndCandidates)
+{
+    leakRing(2);
+
+    const auto report = CycleDetector::findLeaks();
+    std::ostringstream out;
+    CycleDetector::printLeakReport(report, &out);
+    EXPECT_NE(out.str().find("2 of 2 objects leaked"), std::string::npos);
+    EXPECT_NE(out.str().find("Cycle of 2 objects"), std::string::npos);
+    EXPECT_NE(out.str().find("make weak: "), std::string::npos);
+
+    freeLeaks(report);
+}
+
+TEST_F(LeakReportTest, HandlesLongCyclesWithoutRecursion)
+{
+    constexpr int length = 200000;
+    leakRing(length);
+
+    const auto report = CycleDetector::findLeaks();
+    ASSERT_EQ(report.components.size(), 1u);
+    EXPECT_EQ(report.components[0].objects.size(), static_cast<size_t>(length));
+    EXPECT_EQ(report.components[0].weak_candidates.size(), 1u);
+
+    freeLeaks(report);
+    EXPECT_EQ(destroyed, length);
+}
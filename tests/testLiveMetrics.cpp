@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    struct MetricsWidget
+    {
+        int values[8]{};
+    };
+
+    struct MetricsGadget
+    {
+        double value{0.0};
+    };
+
+    const AllocationTracker::TypeMetrics* findType(const AllocationTracker::LiveMetrics& metrics, const std::string& name)
+    {
+        auto it = std::find_if(metrics.types.begin(), metrics.types.end(), [&name](const auto& type) {
+            return type.type.find(name) != std::string::npos;
+        });
+        return it == metrics.types.end() ? nullptr : &*it;
+    }
+}
+
+class LiveMetricsTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+        AllocationTracker::resetLiveMetrics();
+    }
+
+    void TearDown() override
+    {
+        AllocationTracker::setSamplingInterval(0);
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        enableAllocationTracking(false);
+    }
+};
+
+TEST_F(LiveMetricsTest, CountsPerType)
+{
+    std::vector<Ref<MetricsWidget>> widgets;
+    for (int i = 0; i < 10; ++i)
+    {
+        widgets.push_back(makeRef<MetricsWidget>());
+    }
+    auto gadget = makeRef<MetricsGadget>();
+
+    auto metrics = AllocationTracker::getLiveMetrics();
+    const auto* widget = findType(metrics, "MetricsWidget");
+    ASSERT_NE(widget, nullptr);
+    EXPECT_EQ(widget->live_count, 10u);
+    EXPECT_EQ(widget->live_bytes, 10 * sizeof(MetricsWidget));
+    EXPECT_EQ(widget->peak_count, 10u);
+
+    widgets.resize(6);
+    metrics = AllocationTracker::getLiveMetrics();
+    widget = findType(metrics, "MetricsWidget");
+    ASSERT_NE(widget, nullptr);
+    EXPECT_EQ(widget->live_count, 6u);
+    EXPECT_EQ(widget->total_allocations, 10u);
+    EXPECT_EQ(widget->total_frees, 4u);
+    EXPECT_EQ(widget->total_freed_bytes, 4 * sizeof(MetricsWidget));
+    EXPECT_EQ(widget->peak_count, 10u);
+    EXPECT_EQ(widget->peak_bytes, 10 * sizeof(MetricsWidget));
+
+    const auto* gadgetMetrics = findType(metrics, "MetricsGadget");
+    ASSERT_NE(gadgetMetrics, nullptr);
+    EXPECT_EQ(gadgetMetrics->live_count, 1u);
+    EXPECT_EQ(metrics.live_count, 7u);
+    EXPECT_EQ(metrics.live_bytes, 6 * sizeof(MetricsWidget) + sizeof(MetricsGadget));
+}
+
+TEST_F(LiveMetricsTest, ProcessPeakIsExactWithoutScraping)
+{
+    {
+        std::vector<Ref<MetricsWidget>> widgets;
+        for (int i = 0; i < 100; ++i)
+        {
+            widgets.push_back(makeRef<MetricsWidget>());
+        }
+    }
+
+    auto metrics = AllocationTracker::getLiveMetrics();
+    EXPECT_EQ(metrics.live_bytes, 0u);
+    EXPECT_EQ(metrics.peak_bytes, 100 * sizeof(MetricsWidget));
+    EXPECT_EQ(AllocationTracker::getLiveBytes(), 0u);
+}
+
+TEST_F(LiveMetricsTest, CountsAllocationsSkippedBySampling)
+{
+    AllocationTracker::setSamplingInterval(1 << 30);
+    std::vector<Ref<MetricsGadget>> gadgets;
+    for (int i = 0; i < 1000; ++i)
+    {
+        gadgets.push_back(makeRef<MetricsGadget>());
+    }
+
+    EXPECT_LT(AllocationTracker::getAllocationCount(), 1000u);
+    const auto metrics = AllocationTracker::getLiveMetrics();
+    const auto* gadget = findType(metrics, "MetricsGadget");
+    ASSERT_NE(gadget, nullptr);
+    EXPECT_EQ(gadget->live_count, 1000u);
+    EXPECT_EQ(AllocationTracker::getLiveBytes(), 1000 * sizeof(MetricsGadget));
+}
+
+TEST_F(LiveMetricsTest, ShardsAreSummedAcrossThreads)
+{
+    constexpr int threads = 4;
+    constexpr int perThread = 5000;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([]() {
+            for (int i = 0; i < perThread; ++i)
+            {
+                auto widget = makeRef<MetricsWidget>();
+            }
+        });
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    const auto metrics = AllocationTracker::getLiveMetrics();
+    const auto* widget = findType(metrics, "MetricsWidget");
+    ASSERT_NE(widget, nullptr);
+    EXPECT_EQ(widget->total_allocations, static_cast<size_t>(threads * perThread));
+    EXPECT_EQ(widget->total_frees, static_cast<size_t>(threads * perThread));
+    EXPECT_EQ(widget->live_count, 0u);
+}
+
+TEST_F(LiveMetricsTest, ScrapeTakesNoTrackerLock)
+{
+    auto widget = makeRef<MetricsWidget>();
+
+    // Reading while the allocation path's lock is held must not block.
+    std::lock_guard<std::mutex> lock(AllocationTracker::getMutex());
+    const auto metrics = AllocationTracker::getLiveMetrics();
+    EXPECT_EQ(metrics.live_count, 1u);
+    EXPECT_EQ(AllocationTracker::getAllocationCount(), 1u);
+    EXPECT_EQ(AllocationTracker::getTotalAllocatedBytes(), sizeof(MetricsWidget));
+}
+
+TEST_F(LiveMetricsTest, PrintLiveMetrics)
+{
+    auto gadget = makeRef<MetricsGadget>();
+    std::stringstream out;
+    AllocationTracker::printLiveMetrics(&out);
+    EXPECT_NE(out.str().find("Live Allocation Metrics"), std::string::npos);
+    EXPECT_NE(out.str().find("MetricsGadget"), std::string::npos);
+}
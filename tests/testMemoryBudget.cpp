@@ -0,0 +1,196 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <new>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    struct BudgetEntry
+    {
+        char payload[64]{};
+    };
+
+    struct BudgetOther
+    {
+        char payload[64]{};
+    };
+}
+
+class MemoryBudgetTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+        AllocationTracker::resetLiveMetrics();
+    }
+
+    void TearDown() override
+    {
+        AllocationTracker::clearBudgets();
+        AllocationTracker::setSoftLimitCallback(nullptr);
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        enableAllocationTracking(false);
+    }
+};
+
+TEST_F(MemoryBudgetTest, GlobalHardLimitRefusesAllocations)
+{
+    AllocationTracker::setGlobalBudget(0, 3 * sizeof(BudgetEntry));
+    const uint64_t rejectedBefore = AllocationTracker::getBudgetRejections();
+
+    std::vector<Ref<BudgetEntry>> entries;
+    for (int i = 0; i < 3; ++i)
+    {
+        entries.push_back(makeRef<BudgetEntry>());
+    }
+
+    try
+    {
+        auto refused = makeRef<BudgetEntry>();
+        FAIL() << "makeRef should have thrown";
+    }
+    catch (const BudgetExceeded& error)
+    {
+        EXPECT_EQ(error.event().scope, BudgetScope::Global);
+        EXPECT_EQ(error.event().limit, 3 * sizeof(BudgetEntry));
+        EXPECT_EQ(error.event().live_bytes, 3 * sizeof(BudgetEntry));
+        EXPECT_EQ(error.event().requested_bytes, sizeof(BudgetEntry));
+    }
+    EXPECT_THROW(makeRef<BudgetOther>(), std::bad_alloc);
+    EXPECT_EQ(AllocationTracker::getBudgetRejections(), rejectedBefore + 2);
+
+    entries.pop_back();
+    EXPECT_NO_THROW(entries.push_back(makeRef<BudgetEntry>()));
+}
+
+TEST_F(MemoryBudgetTest, TryMakeRefReturnsEmptyRef)
+{
+    AllocationTracker::setGlobalBudget(0, sizeof(BudgetEntry));
+
+    auto first = tryMakeRef<BudgetEntry>();
+    auto second = tryMakeRef<BudgetEntry>();
+    EXPECT_TRUE(first);
+    EXPECT_FALSE(second);
+    EXPECT_EQ(AllocationTracker::getLiveBytes(), sizeof(BudgetEntry));
+}
+
+TEST_F(MemoryBudgetTest, TypeBudgetOnlyLimitsItsType)
+{
+    auto existing = makeRef<BudgetEntry>();
+    AllocationTracker::setTypeBudget<BudgetEntry>(0, 2 * sizeof(BudgetEntry));
+
+    auto second = makeRef<BudgetEntry>();
+    EXPECT_FALSE(tryMakeRef<BudgetEntry>());
+
+    std::vector<Ref<BudgetOther>> others;
+    for (int i = 0; i < 4; ++i)
+    {
+        others.push_back(makeRef<BudgetOther>());
+    }
+
+    try
+    {
+        makeRef<BudgetEntry>();
+        FAIL() << "makeRef should have thrown";
+    }
+    catch (const BudgetExceeded& error)
+    {
+        EXPECT_EQ(error.event().scope, BudgetScope::Type);
+        EXPECT_NE(error.event().name.find("BudgetEntry"), std::string::npos);
+    }
+
+    existing.reset();
+    EXPECT_TRUE(tryMakeRef<BudgetEntry>());
+}
+
+TEST_F(MemoryBudgetTest, TagBudgetAppliesInsideTheTag)
+{
+    const uint32_t cache = AllocationTracker::registerTag("budget.cache");
+    AllocationTracker::setTagBudget(cache, 0, 2 * sizeof(BudgetEntry));
+
+    std::vector<Ref<BudgetEntry>> cached;
+    {
+        AllocationTag tag(cache);
+        cached.push_back(makeRef<BudgetEntry>());
+        cached.push_back(makeRef<BudgetEntry>());
+        try
+        {
+            makeRef<BudgetEntry>();
+            FAIL() << "makeRef should have thrown";
+        }
+        catch (const BudgetExceeded& error)
+        {
+            EXPECT_EQ(error.event().scope, BudgetScope::Tag);
+            EXPECT_EQ(error.event().name, "budget.cache");
+        }
+    }
+
+    EXPECT_TRUE(tryMakeRef<BudgetEntry>());
+}
+
+TEST_F(MemoryBudgetTest, BatchesAreCheckedAsAWhole)
+{
+    AllocationTracker::setTypeBudget<BudgetEntry>(0, 4 * sizeof(BudgetEntry));
+
+    EXPECT_THROW(makeRefBatch<BudgetEntry>(5), BudgetExceeded);
+    auto batch = makeRefBatch<BudgetEntry>(4);
+    EXPECT_EQ(batch.size(), 4u);
+}
+
+TEST_F(MemoryBudgetTest, SoftLimitCallsBackOncePerCrossing)
+{
+    std::vector<BudgetEvent> events;
+    AllocationTracker::setSoftLimitCallback([&events](const BudgetEvent& event) {
+        events.push_back(event);
+    });
+    AllocationTracker::setGlobalBudget(2 * sizeof(BudgetEntry), 0);
+
+    std::vector<Ref<BudgetEntry>> entries;
+    for (int i = 0; i < 5; ++i)
+    {
+        entries.push_back(makeRef<BudgetEntry>());
+    }
+    ASSERT_EQ(events.size(), 1u);
+    EXPECT_EQ(events[0].scope, BudgetScope::Global);
+    EXPECT_EQ(events[0].limit, 2 * sizeof(BudgetEntry));
+    EXPECT_EQ(events[0].live_bytes, 2 * sizeof(BudgetEntry));
+
+    entries.resize(1);
+    entries.push_back(makeRef<BudgetEntry>());
+    entries.push_back(makeRef<BudgetEntry>());
+    EXPECT_EQ(events.size(), 2u);
+}
+
+TEST_F(MemoryBudgetTest, SoftLimitCallbackCanEvict)
+{
+    std::vector<Ref<BudgetEntry>> cache;
+    AllocationTracker::setSoftLimitCallback([&cache](const BudgetEvent&) {
+        cache.erase(cache.begin(), cache.begin() + static_cast<std::ptrdiff_t>(cache.size() / 2));
+    });
+    AllocationTracker::setTypeBudget<BudgetEntry>(8 * sizeof(BudgetEntry), 10 * sizeof(BudgetEntry));
+
+    for (int i = 0; i < 100; ++i)
+    {
+        cache.push_back(makeRef<BudgetEntry>());
+    }
+    EXPECT_LE(AllocationTracker::getLiveBytes(), 10 * sizeof(BudgetEntry));
+}
+
+TEST_F(MemoryBudgetTest, ClearBudgetsRemovesLimits)
+{
+    AllocationTracker::setGlobalBudget(0, sizeof(BudgetEntry));
+    AllocationTracker::setTypeBudget<BudgetOther>(0, sizeof(BudgetOther));
+    auto first = makeRef<BudgetEntry>();
+    EXPECT_FALSE(tryMakeRef<BudgetOther>());
+
+    AllocationTracker::clearBudgets();
+    auto second = makeRef<BudgetEntry>();
+    auto other = makeRef<BudgetOther>();
+    EXPECT_TRUE(other);
+}
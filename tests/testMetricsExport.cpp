@@ -0,0 +1,427 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace memory;
+using memory::refCounting::MetricsWriter;
+
+struct ExportWidget
+{
+    int values[6]{};
+};
+
+struct ExportGadget
+{
+    double value{0.0};
+};
+
+namespace
+{
+    /**
+     * @brief Minimal JSON value and recursive descent parser, enough to read the exporter's output back.
+     */
+    struct JsonValue
+    {
+        enum class Kind { Null, Bool, Number, String, Array, Object } kind = Kind::Null;
+        double number = 0.0;
+        std::string string;
+        std::vector<JsonValue> array;
+        std::vector<std::pair<std::string, JsonValue>> object;
+
+        const JsonValue& at(const std::string& key) const
+        {
+            for (const auto& [name, value] : object)
+            {
+                if (name == key)
+                {
+                    return value;
+                }
+            }
+            throw std::out_of_range("missing key " + key);
+        }
+    };
+
+    class JsonParser
+    {
+    public:
+        explicit JsonParser(const std::string& text) : text_(text) {}
+
+        JsonValue parseDocument()
+        {
+            JsonValue value = parseValue();
+            skipSpace();
+            if (pos_ != text_.size())
+            {
+                throw std::runtime_error("trailing characters");
+            }
+            return value;
+        }
+
+    private:
+        const std::string& text_;
+        size_t pos_ = 0;
+
+        void skipSpace()
+        {
+            while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_])))
+            {
+                ++pos_;
+            }
+        }
+
+        void expect(char c)
+        {
+            skipSpace();
+            if (pos_ >= text_.size() || text_[pos_] != c)
+            {
+                throw std::runtime_error(std::string("expected ") + c + " at " + std::to_string(pos_));
+            }
+            ++pos_;
+        }
+
+        bool consume(char c)
+        {
+            skipSpace();
+            if (pos_ < text_.size() && text_[pos_] == c)
+            {
+                ++pos_;
+                return true;
+            }
+            return false;
+        }
+
+        std::string parseString()
+        {
+            expect('"');
+            std::string result;
+            while (pos_ < text_.size() && text_[pos_] != '"')
+            {
+                char c = text_[pos_++];
+                if (c == '\\')
+                {
+                    const char escaped = text_.at(pos_++);
+                    switch (escaped)
+                    {
+                        case 'n': c = '\n'; break;
+                        case 'u': c = static_cast<char>(std::stoi(text_.substr(pos_, 4), nullptr, 16)); pos_ += 4; break;
+                        default: c = escaped; break;
+                    }
+                }
+                result += c;
+            }
+            expect('"');
+            return result;
+        }
+
+        JsonValue parseValue()
+        {
+            skipSpace();
+            JsonValue value;
+            if (pos_ >= text_.size())
+            {
+                throw std::runtime_error("unexpected end");
+            }
+            const char c = text_[pos_];
+            if (c == '{')
+            {
+                value.kind = JsonValue::Kind::Object;
+                ++pos_;
+                if (!consume('}'))
+                {
+                    do
+                    {
+                        std::string key = parseString();
+                        expect(':');
+                        value.object.emplace_back(std::move(key), parseValue());
+                    } while (consume(','));
+                    expect('}');
+                }
+            }
+            else if (c == '[')
+            {
+                value.kind = JsonValue::Kind::Array;
+                ++pos_;
+                if (!consume(']'))
+                {
+                    do
+                    {
+                        value.array.push_back(parseValue());
+                    } while (consume(','));
+                    expect(']');
+                }
+            }
+            else if (c == '"')
+            {
+                value.kind = JsonValue::Kind::String;
+                value.string = parseString();
+            }
+            else
+            {
+                char* end = nullptr;
+                value.kind = JsonValue::Kind::Number;
+                value.number = std::strtod(text_.c_str() + pos_, &end);
+                if (end == text_.c_str() + pos_)
+                {
+                    throw std::runtime_error("bad value at " + std::to_string(pos_));
+                }
+                pos_ = static_cast<size_t>(end - text_.c_str());
+            }
+            return value;
+        }
+    };
+
+    /**
+     * @brief One sample line of an OpenMetrics exposition.
+     */
+    struct Sample
+    {
+        std::string name;
+        std::map<std::string, std::string> labels;
+        double value;
+    };
+
+    /**
+     * @brief Parses an OpenMetrics exposition, checking that every sample belongs to a declared family.
+     */
+    std::vector<Sample> parseOpenMetrics(const std::string& text)
+    {
+        std::vector<Sample> samples;
+        std::set<std::string> families;
+        std::istringstream in(text);
+        std::string line;
+        bool sawEof = false;
+        while (std::getline(in, line))
+        {
+            EXPECT_FALSE(sawEof) << "content after # EOF";
+            if (line == "# EOF")
+            {
+                sawEof = true;
+                continue;
+            }
+            if (line.rfind("# TYPE ", 0) == 0)
+            {
+                families.insert(line.substr(7, line.find(' ', 7) - 7));
+                continue;
+            }
+            if (line.rfind("# HELP ", 0) == 0)
+            {
+                continue;
+            }
+
+            Sample sample;
+            const auto brace = line.find('{');
+            const auto space = line.rfind(' ');
+            sample.name = line.substr(0, std::min(brace, space));
+            if (brace != std::string::npos)
+            {
+                size_t pos = brace + 1;
+                while (line[pos] != '}')
+                {
+                    const auto eq = line.find('=', pos);
+                    const std::string key = line.substr(pos, eq - pos);
+                    std::string value;
+                    pos = eq + 2;
+                    while (line[pos] != '"')
+                    {
+                        if (line[pos] == '\\')
+                        {
+                            ++pos;
+                        }
+                        value += line[pos++];
+                    }
+                    sample.labels[key] = value;
+                    pos += line[pos + 1] == ',' ? 2 : 1;
+                }
+            }
+            sample.value = std::stod(line.substr(space + 1));
+
+            std::string family = sample.name;
+            for (const char* suffix : {"_total", "_bucket", "_count"})
+            {
+                const std::string s(suffix);
+                if (family.size() > s.size() && family.compare(family.size() - s.size(), s.size(), s) == 0 && !families.count(family))
+                {
+                    family.resize(family.size() - s.size());
+                }
+            }
+            EXPECT_TRUE(families.count(family)) << "undeclared family " << family;
+            samples.push_back(std::move(sample));
+        }
+        EXPECT_TRUE(sawEof);
+        return samples;
+    }
+
+    double valueOf(const std::vector<Sample>& samples, const std::string& name, const std::string& typeSubstring)
+    {
+        for (const auto& sample : samples)
+        {
+            auto it = sample.labels.find("type");
+            if (sample.name == name && it != sample.labels.end() && it->second.find(typeSubstring) != std::string::npos)
+            {
+                return sample.value;
+            }
+        }
+        return -1.0;
+    }
+
+    std::string exportText(size_t (*exporter)(char*, size_t))
+    {
+        std::vector<char> buffer(1024);
+        size_t length = exporter(buffer.data(), buffer.size());
+        if (length >= buffer.size())
+        {
+            buffer.resize(length + 1);
+            length = exporter(buffer.data(), buffer.size());
+        }
+        return std::string(buffer.data(), length);
+    }
+}
+
+class MetricsExportTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+        AllocationTracker::resetLiveMetrics();
+    }
+
+    void TearDown() override
+    {
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        enableAllocationTracking(false);
+    }
+};
+
+TEST_F(MetricsExportTest, OpenMetricsMatchesLiveMetrics)
+{
+    std::vector<Ref<ExportWidget>> widgets;
+    for (int i = 0; i < 12; ++i)
+    {
+        widgets.push_back(makeRef<ExportWidget>());
+    }
+    // Per-type high-water marks are folded in at scrape time, so scrape once at the high point.
+    exportText(AllocationTracker::exportOpenMetrics);
+    widgets.resize(5);
+    auto gadget = makeRef<ExportGadget>();
+
+    const auto samples = parseOpenMetrics(exportText(AllocationTracker::exportOpenMetrics));
+    EXPECT_EQ(valueOf(samples, "mexmemory_live_objects", "ExportWidget"), 5.0);
+    EXPECT_EQ(valueOf(samples, "mexmemory_live_bytes", "ExportWidget"), 5.0 * sizeof(ExportWidget));
+    EXPECT_EQ(valueOf(samples, "mexmemory_peak_objects", "ExportWidget"), 12.0);
+    EXPECT_EQ(valueOf(samples, "mexmemory_allocations_total", "ExportWidget"), 12.0);
+    EXPECT_EQ(valueOf(samples, "mexmemory_frees_total", "ExportWidget"), 7.0);
+    EXPECT_EQ(valueOf(samples, "mexmemory_live_objects", "ExportGadget"), 1.0);
+    EXPECT_EQ(valueOf(samples, "mexmemory_allocation_size_bytes_count", "ExportWidget"), 12.0);
+    EXPECT_EQ(valueOf(samples, "mexmemory_object_lifetime_seconds_count", "ExportWidget"), 7.0);
+
+    double previous = 0.0;
+    double infinity = -1.0;
+    for (const auto& sample : samples)
+    {
+        if (sample.name == "mexmemory_allocation_size_bytes_bucket" && sample.labels.at("type").find("ExportWidget") != std::string::npos)
+        {
+            EXPECT_GE(sample.value, previous);
+            previous = sample.value;
+            if (sample.labels.at("le") == "+Inf")
+            {
+                infinity = sample.value;
+            }
+            else
+            {
+                EXPECT_GE(std::stod(sample.labels.at("le")), static_cast<double>(sizeof(ExportWidget)));
+            }
+        }
+    }
+    EXPECT_EQ(infinity, 12.0);
+}
+
+TEST_F(MetricsExportTest, JsonMatchesLiveMetrics)
+{
+    std::vector<Ref<ExportWidget>> widgets;
+    for (int i = 0; i < 4; ++i)
+    {
+        widgets.push_back(makeRef<ExportWidget>());
+    }
+    {
+        auto gadget = makeRef<ExportGadget>();
+    }
+
+    const std::string text = exportText(AllocationTracker::exportJson);
+    JsonValue document;
+    ASSERT_NO_THROW(document = JsonParser(text).parseDocument()) << text;
+
+    const auto metrics = AllocationTracker::getLiveMetrics();
+    EXPECT_EQ(document.at("live_count").number, static_cast<double>(metrics.live_count));
+    EXPECT_EQ(document.at("live_bytes").number, static_cast<double>(metrics.live_bytes));
+    EXPECT_EQ(document.at("total_allocations").number, static_cast<double>(metrics.total_allocations));
+    EXPECT_EQ(document.at("huge_pages").at("mappings").number, 0.0);
+    EXPECT_EQ(document.at("numa_nodes").kind, JsonValue::Kind::Array);
+
+    bool foundWidget = false;
+    bool foundGadget = false;
+    for (const auto& type : document.at("types").array)
+    {
+        if (type.at("type").string.find("ExportWidget") != std::string::npos)
+        {
+            foundWidget = true;
+            EXPECT_EQ(type.at("live_count").number, 4.0);
+            EXPECT_EQ(type.at("peak_bytes").number, 4.0 * sizeof(ExportWidget));
+            double sized = 0.0;
+            for (const auto& bucket : type.at("sizes").array)
+            {
+                ASSERT_EQ(bucket.array.size(), 3u);
+                EXPECT_LE(bucket.array[0].number, bucket.array[1].number);
+                sized += bucket.array[2].number;
+            }
+            EXPECT_EQ(sized, 4.0);
+            EXPECT_TRUE(type.at("lifetimes_ns").array.empty());
+        }
+        if (type.at("type").string.find("ExportGadget") != std::string::npos)
+        {
+            foundGadget = true;
+            EXPECT_EQ(type.at("live_count").number, 0.0);
+            EXPECT_EQ(type.at("total_frees").number, 1.0);
+            ASSERT_EQ(type.at("lifetimes_ns").array.size(), 1u);
+        }
+    }
+    EXPECT_TRUE(foundWidget);
+    EXPECT_TRUE(foundGadget);
+}
+
+TEST_F(MetricsExportTest, TruncatesToBufferAndReportsLength)
+{
+    auto widget = makeRef<ExportWidget>();
+    const std::string full = exportText(AllocationTracker::exportOpenMetrics);
+
+    char small[32];
+    const size_t length = AllocationTracker::exportOpenMetrics(small, sizeof(small));
+    EXPECT_EQ(length, full.size());
+    EXPECT_EQ(std::strlen(small), sizeof(small) - 1);
+    EXPECT_EQ(full.compare(0, sizeof(small) - 1, small), 0);
+
+    EXPECT_EQ(AllocationTracker::exportJson(nullptr, 0), exportText(AllocationTracker::exportJson).size());
+}
+
+TEST_F(MetricsExportTest, EscapesStrings)
+{
+    char buffer[64];
+    MetricsWriter json(buffer, sizeof(buffer));
+    json.quoted("a\"b\\c\nd\x01", MetricsWriter::Escape::Json);
+    json.finish();
+    EXPECT_STREQ(buffer, "\"a\\\"b\\\\c\\nd\\u0001\"");
+
+    MetricsWriter label(buffer, sizeof(buffer));
+    label.quoted("a\"b\\c\nd", MetricsWriter::Escape::OpenMetricsLabel).text(" ").number(int64_t{-3}).text(" ").number(0.5);
+    label.finish();
+    EXPECT_STREQ(buffer, "\"a\\\"b\\\\c\\nd\" -3 0.5");
+}
@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <cstdint>
+
+using namespace memory;
+
+class NumaAllocatorTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+    }
+
+    void TearDown() override
+    {
+        enableAllocationTracking(false);
+        AllocationTracker::clearAllocations();
+    }
+};
+
+TEST_F(NumaAllocatorTest, TopologyIsConsistent)
+{
+    const int nodes = refCounting::numa::nodeCount();
+    EXPECT_GE(nodes, 1);
+    EXPECT_LE(nodes, AllocationTracker::maxNumaNodes);
+
+    const int node = refCounting::numa::currentNode();
+    EXPECT_GE(node, 0);
+    EXPECT_LT(node, nodes);
+}
+
+TEST_F(NumaAllocatorTest, ObjectIsRecordedOnTargetNode)
+{
+    struct Record
+    {
+        uint64_t key;
+        uint64_t value;
+    };
+
+    const int node = refCounting::numa::targetNode();
+    {
+        auto ref = makeRefWithAllocator<Record, NumaAllocator<Record>>(Record{1, 2});
+        EXPECT_EQ(ref->key, 1u);
+        EXPECT_EQ(ref->value, 2u);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(ref.get()) % 64, 0u);
+
+        auto stats = AllocationTracker::getStatistics();
+        ASSERT_EQ(stats.allocations_by_node.count(node), 1u);
+        EXPECT_EQ(stats.allocations_by_node.at(node), 1u);
+        EXPECT_GE(stats.bytes_by_node.at(node), sizeof(Record));
+    }
+
+    EXPECT_TRUE(AllocationTracker::getStatistics().allocations_by_node.empty());
+}
+
+TEST_F(NumaAllocatorTest, LargeArrayOnExplicitNode)
+{
+    const int node = refCounting::numa::nodeCount() - 1;
+    const size_t count = 1 << 16;
+    {
+        NumaNodeScope scope(node);
+        auto ref = makeRefWithAllocator<uint64_t[], NumaAllocator<uint64_t[]>>(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            ref.get()[i] = i;
+        }
+        EXPECT_EQ(ref.get()[count - 1], count - 1);
+
+        auto stats = AllocationTracker::getStatistics();
+        ASSERT_EQ(stats.allocations_by_node.count(node), 1u);
+        EXPECT_GE(stats.bytes_by_node.at(node), count * sizeof(uint64_t));
+
+        std::ostringstream oss;
+        AllocationTracker::printStatistics(&oss);
+        EXPECT_NE(oss.str().find("NUMA allocations by node"), std::string::npos);
+    }
+
+    EXPECT_TRUE(AllocationTracker::getStatistics().allocations_by_node.empty());
+}
+
+TEST_F(NumaAllocatorTest, MissingNodeFallsBackToCurrentNode)
+{
+    NumaNodeScope scope(AllocationTracker::maxNumaNodes + 5);
+    EXPECT_EQ(refCounting::numa::targetNode(), refCounting::numa::currentNode());
+
+    auto* value = NumaAllocator<int>::allocate(7);
+    EXPECT_EQ(*value, 7);
+    NumaAllocator<int>::deallocate(value);
+}
+
+TEST_F(NumaAllocatorTest, ScopesNest)
+{
+    {
+        NumaNodeScope outer(0);
+        EXPECT_EQ(refCounting::numa::scopedNode, 0);
+        {
+            NumaNodeScope inner(3);
+            EXPECT_EQ(refCounting::numa::scopedNode, 3);
+        }
+        EXPECT_EQ(refCounting::numa::scopedNode, 0);
+    }
+    EXPECT_EQ(refCounting::numa::scopedNode, -1);
+}
@@ -0,0 +1,174 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace memory;
+using memory::refCounting::ObjectTimeline;
+
+class RefTraceTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        path_ = (std::filesystem::temp_directory_path() / ("mexmemory_trace_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()) + ".bin")).string();
+    }
+
+    void TearDown() override
+    {
+        RefTrace::stop();
+        std::remove(path_.c_str());
+    }
+
+    /**
+     * @brief Finds the timeline of a control block.
+     */
+    static const ObjectTimeline* findBlock(const std::vector<ObjectTimeline>& timelines, const void* block)
+    {
+        auto it = std::find_if(timelines.begin(), timelines.end(), [block](const ObjectTimeline& timeline) {
+            return timeline.block == reinterpret_cast<uintptr_t>(block);
+        });
+        return it == timelines.end() ? nullptr : &*it;
+    }
+
+    std::string path_;
+};
+
+TEST_F(RefTraceTest, RecordsLifecycleOfAnObject)
+{
+    ASSERT_TRUE(RefTrace::start(path_));
+    EXPECT_TRUE(RefTrace::isActive());
+    EXPECT_FALSE(RefTrace::start(path_));
+
+    const void* block = nullptr;
+    {
+        auto ref = makeRef<int>(7);
+        block = ref.getControlBlock();
+        auto copy = ref;
+        WeakRef<int> weak(ref);
+        ref.reset();
+        copy.reset();
+    }
+    RefTrace::stop();
+    EXPECT_FALSE(RefTrace::isActive());
+
+    const auto trace = TraceFile::load(path_);
+    EXPECT_EQ(trace.header.dropped, 0u);
+    EXPECT_EQ(trace.records.size(), RefTrace::getRecordCount());
+
+    const auto timelines = trace.timelines();
+    const ObjectTimeline* timeline = findBlock(timelines, block);
+    ASSERT_NE(timeline, nullptr);
+
+    std::vector<TraceEvent> events;
+    for (const auto& record : timeline->events)
+    {
+        events.push_back(record.event);
+    }
+    const std::vector<TraceEvent> expected = {
+        TraceEvent::Create, TraceEvent::IncrementStrong, TraceEvent::IncrementWeak,
+        TraceEvent::DecrementStrong, TraceEvent::DecrementStrong, TraceEvent::DestroyObject,
+        TraceEvent::DecrementWeak, TraceEvent::DestroyBlock
+    };
+    EXPECT_EQ(events, expected);
+    EXPECT_TRUE(timeline->objectDestroyed);
+    EXPECT_TRUE(timeline->blockDestroyed);
+    EXPECT_EQ(timeline->peakStrong, 2u);
+    EXPECT_EQ(timeline->strongAtEnd, 0u);
+
+    for (size_t i = 1; i < timeline->events.size(); ++i)
+    {
+        EXPECT_LE(trace.toNanoseconds(timeline->events[i - 1].timestamp), trace.toNanoseconds(timeline->events[i].timestamp));
+    }
+}
+
+TEST_F(RefTraceTest, FindsThreadHoldingTheLastReference)
+{
+    ASSERT_TRUE(RefTrace::start(path_));
+
+    auto ref = makeRef<int>(1);
+    const void* block = ref.getControlBlock();
+    auto held = ref;
+    auto kept = makeRef<int>(2);
+    const void* keptBlock = kept.getControlBlock();
+
+    std::thread holder([copy = ref, keptCopy = kept]() mutable {
+        copy.reset();
+        keptCopy.reset();
+    });
+    // The holder thread's lambda captures keep one extra reference each until the thread finishes.
+    holder.join();
+    ref.reset();
+    std::thread releaser([last = std::move(held)]() mutable {
+        last.reset();
+    });
+    releaser.join();
+    RefTrace::stop();
+
+    const auto trace = TraceFile::load(path_);
+    const auto timelines = trace.timelines();
+    const ObjectTimeline* released = findBlock(timelines, block);
+    ASSERT_NE(released, nullptr);
+    ASSERT_TRUE(released->objectDestroyed);
+    EXPECT_NE(released->lastReleaser, released->events.front().thread);
+
+    const ObjectTimeline* alive = findBlock(timelines, keptBlock);
+    ASSERT_NE(alive, nullptr);
+    EXPECT_FALSE(alive->objectDestroyed);
+    EXPECT_EQ(alive->strongAtEnd, 1u);
+    int64_t netHeld = 0;
+    for (const auto& [thread, count] : alive->strongByThread)
+    {
+        netHeld += count;
+    }
+    EXPECT_EQ(netHeld, 1);
+    EXPECT_GT(alive->strongByThread.at(alive->events.front().thread), 0);
+}
+
+TEST_F(RefTraceTest, RecordsNothingWhileInactive)
+{
+    ASSERT_TRUE(RefTrace::start(path_));
+    RefTrace::stop();
+    {
+        auto ref = makeRef<int>(3);
+        auto copy = ref;
+    }
+
+    EXPECT_TRUE(TraceFile::load(path_).records.empty());
+    EXPECT_EQ(RefTrace::getRecordCount(), 0u);
+}
+
+TEST_F(RefTraceTest, CountsDroppedEventsWhenRingIsFull)
+{
+    ASSERT_TRUE(RefTrace::start(path_, std::chrono::milliseconds(60000)));
+
+    auto ref = makeRef<int>(4);
+    const size_t copies = RefTrace::ringCapacity;
+    for (size_t i = 0; i < copies; ++i)
+    {
+        auto copy = ref;
+    }
+    ref.reset();
+    RefTrace::stop();
+
+    const auto trace = TraceFile::load(path_);
+    EXPECT_GT(trace.header.dropped, 0u);
+    EXPECT_EQ(trace.records.size() + trace.header.dropped, 2 * copies + 4);
+}
+
+TEST_F(RefTraceTest, RejectsFilesThatAreNotTraces)
+{
+    {
+        std::ofstream out(path_, std::ios::binary);
+        out << "not a trace file, just some text that is long enough to hold a header";
+    }
+    EXPECT_THROW(TraceFile::load(path_), std::runtime_error);
+    EXPECT_THROW(TraceFile::load(path_ + ".missing"), std::runtime_error);
+}
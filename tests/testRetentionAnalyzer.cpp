@@ -0,0 +1,331 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    struct Blob
+    {
+        char bytes[1000]{};
+    };
+
+    struct RetainNode
+    {
+        int id{0};
+        std::vector<Ref<RetainNode>> edges;
+        Ref<Blob> blob;
+
+        explicit RetainNode(int value = 0) : id(value) {}
+
+        void trace(RefVisitor& visit) const
+        {
+            visit(edges);
+            visit(blob);
+        }
+    };
+
+    constexpr size_t nodeSize = sizeof(RetainNode);
+
+    const RetentionAnalyzer::RetainedType* findType(const RetentionAnalyzer::RetentionReport& report, const std::string& name)
+    {
+        for (const auto& type : report.types)
+        {
+            if (type.type.find(name) != std::string::npos) return &type;
+        }
+        return nullptr;
+    }
+}
+
+class RetentionAnalyzerTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+    }
+
+    void TearDown() override
+    {
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        enableAllocationTracking(false);
+    }
+};
+
+TEST_F(RetentionAnalyzerTest, ChainRetainsEverythingBelow)
+{
+    auto a = makeRef<RetainNode>(1);
+    a->edges.push_back(makeRef<RetainNode>(2));
+    a->edges[0]->edges.push_back(makeRef<RetainNode>(3));
+
+    const auto graph = ObjectGraph::fromTracker();
+    const auto dominators = RetentionAnalyzer::dominatorsOf(graph);
+    ASSERT_EQ(graph.size(), 3u);
+    EXPECT_EQ(dominators.roots, 1u);
+    for (size_t i = 0; i < graph.size(); ++i)
+    {
+        const int id = static_cast<RetainNode*>(graph.nodes[i].object)->id;
+        EXPECT_EQ(dominators.retained_bytes[i], static_cast<size_t>(4 - id) * nodeSize);
+        if (id == 1)
+        {
+            EXPECT_EQ(dominators.idom[i], ObjectGraph::none);
+        }
+        else
+        {
+            EXPECT_EQ(static_cast<RetainNode*>(graph.nodes[dominators.idom[i]].object)->id, id - 1);
+        }
+    }
+}
+
+TEST_F(RetentionAnalyzerTest, SharedObjectsAreRetainedByTheirDominator)
+{
+    auto a = makeRef<RetainNode>(1);
+    auto b = makeRef<RetainNode>(2);
+    auto c = makeRef<RetainNode>(3);
+    auto d = makeRef<RetainNode>(4);
+    a->edges = {b, c};
+    b->edges = {d};
+    c->edges = {d};
+    b.reset();
+    c.reset();
+    d.reset();
+
+    const auto report = RetentionAnalyzer::analyze();
+    EXPECT_EQ(report.objects, 4u);
+    EXPECT_EQ(report.references, 4u);
+    EXPECT_EQ(report.roots, 1u);
+    EXPECT_EQ(report.total_bytes, 4 * nodeSize);
+    ASSERT_EQ(report.largest.size(), 4u);
+    EXPECT_EQ(report.largest[0].object, a.get());
+    EXPECT_EQ(report.largest[0].retained_bytes, 4 * nodeSize);
+    EXPECT_EQ(report.largest[0].dominator, nullptr);
+    for (size_t i = 1; i < report.largest.size(); ++i)
+    {
+        EXPECT_EQ(report.largest[i].retained_bytes, nodeSize);
+        EXPECT_EQ(report.largest[i].dominator, a.get());
+    }
+}
+
+TEST_F(RetentionAnalyzerTest, ObjectsHeldByTwoRootsAreRetainedByNeither)
+{
+    auto a = makeRef<RetainNode>(1);
+    auto b = makeRef<RetainNode>(2);
+    auto shared = makeRef<RetainNode>(3);
+    shared->blob = makeRef<Blob>();
+    a->edges.push_back(shared);
+    b->edges.push_back(shared);
+    shared.reset();
+
+    const auto report = RetentionAnalyzer::analyze();
+    EXPECT_EQ(report.roots, 2u);
+    ASSERT_EQ(report.largest.size(), 4u);
+    EXPECT_EQ(static_cast<RetainNode*>(report.largest[0].object)->id, 3);
+    EXPECT_EQ(report.largest[0].retained_bytes, nodeSize + sizeof(Blob));
+    EXPECT_EQ(report.largest[0].dominator, nullptr);
+    EXPECT_EQ(report.largest[1].object, a->edges[0]->blob.get());
+    EXPECT_EQ(report.largest[1].dominator, a->edges[0].get());
+    EXPECT_EQ(report.largest[2].retained_bytes, nodeSize);
+    EXPECT_EQ(report.largest[3].retained_bytes, nodeSize);
+}
+
+TEST_F(RetentionAnalyzerTest, TypesCountNestedObjectsOnce)
+{
+    auto a = makeRef<RetainNode>(1);
+    a->edges.push_back(makeRef<RetainNode>(2));
+    a->edges[0]->edges.push_back(makeRef<RetainNode>(3));
+    a->edges[0]->edges[0]->blob = makeRef<Blob>();
+    auto loose = makeRef<Blob>();
+
+    const auto report = RetentionAnalyzer::analyze();
+    const auto* nodes = findType(report, "RetainNode");
+    const auto* blobs = findType(report, "Blob");
+    ASSERT_NE(nodes, nullptr);
+    ASSERT_NE(blobs, nullptr);
+    EXPECT_EQ(nodes->count, 3u);
+    EXPECT_EQ(nodes->shallow_bytes, 3 * nodeSize);
+    EXPECT_EQ(nodes->retained_bytes, 3 * nodeSize + sizeof(Blob));
+    EXPECT_EQ(blobs->count, 2u);
+    EXPECT_EQ(blobs->shallow_bytes, 2 * sizeof(Blob));
+    EXPECT_EQ(blobs->retained_bytes, 2 * sizeof(Blob));
+    EXPECT_EQ(&report.types[0], blobs);
+}
+
+TEST_F(RetentionAnalyzerTest, LeakedCyclesAreAttributedToTheirFirstObject)
+{
+    std::vector<Ref<RetainNode>> ring;
+    for (int i = 0; i < 3; ++i)
+    {
+        ring.push_back(makeRef<RetainNode>(i));
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        ring[i]->edges.push_back(ring[(i + 1) % 3]);
+    }
+    std::vector<RetainNode*> leaked;
+    for (auto& node : ring)
+    {
+        leaked.push_back(node.get());
+    }
+    ring.clear();
+
+    const auto report = RetentionAnalyzer::analyze();
+    EXPECT_EQ(report.roots, 1u);
+    ASSERT_EQ(report.largest.size(), 3u);
+    EXPECT_EQ(report.largest[0].retained_bytes, 3 * nodeSize);
+
+    for (auto* node : leaked)
+    {
+        ring.push_back(std::move(node->edges[0]));
+    }
+    ring.clear();
+}
+
+TEST_F(RetentionAnalyzerTest, MatchesRetainedSizesByDefinition)
+{
+    constexpr int count = 120;
+    std::mt19937 random(7);
+    std::vector<Ref<RetainNode>> nodes;
+    for (int i = 0; i < count; ++i)
+    {
+        nodes.push_back(makeRef<RetainNode>(i));
+    }
+    for (int i = 1; i < count; ++i)
+    {
+        nodes[random() % static_cast<unsigned>(i)]->edges.push_back(nodes[i]);
+    }
+    for (int i = 0; i < 2 * count; ++i)
+    {
+        nodes[random() % count]->edges.push_back(nodes[random() % count]);
+    }
+    std::vector<Ref<RetainNode>> roots{nodes[0], nodes[count / 2], nodes[count - 1]};
+    std::vector<RetainNode*> all;
+    for (auto& node : nodes)
+    {
+        all.push_back(node.get());
+    }
+    nodes.clear();
+
+    const auto graph = ObjectGraph::fromTracker();
+    const auto dominators = RetentionAnalyzer::dominatorsOf(graph);
+    ASSERT_EQ(graph.size(), static_cast<size_t>(count));
+    EXPECT_EQ(dominators.roots, roots.size());
+
+    // The retained size of a node is what becomes unreachable from the roots without it.
+    for (size_t removed = 0; removed < graph.size(); ++removed)
+    {
+        std::vector<bool> reached(graph.size(), false);
+        std::vector<ObjectGraph::Index> stack;
+        for (size_t i = 0; i < graph.size(); ++i)
+        {
+            if (graph.external[i] && i != removed)
+            {
+                reached[i] = true;
+                stack.push_back(static_cast<ObjectGraph::Index>(i));
+            }
+        }
+        while (!stack.empty())
+        {
+            const auto node = stack.back();
+            stack.pop_back();
+            for (size_t e = graph.firstEdge[node]; e < graph.firstEdge[node + 1]; ++e)
+            {
+                const auto target = graph.targets[e];
+                if (target != removed && !reached[target])
+                {
+                    reached[target] = true;
+                    stack.push_back(target);
+                }
+            }
+        }
+        size_t lost = 0;
+        for (size_t i = 0; i < graph.size(); ++i)
+        {
+            lost += reached[i] ? 0 : 1;
+        }
+        EXPECT_EQ(dominators.retained_bytes[removed], lost * nodeSize) << "node " << removed;
+    }
+
+    std::vector<Ref<RetainNode>> released;
+    for (auto* node : all)
+    {
+        for (auto& edge : node->edges)
+        {
+            released.push_back(std::move(edge));
+        }
+    }
+    roots.clear();
+    released.clear();
+}
+
+TEST_F(RetentionAnalyzerTest, HandlesLongChainsWithoutRecursion)
+{
+    constexpr int length = 200000;
+    std::vector<Ref<RetainNode>> chain;
+    chain.push_back(makeRef<RetainNode>(0));
+    for (int i = 1; i < length; ++i)
+    {
+        chain.push_back(makeRef<RetainNode>(i));
+        chain[i - 1]->edges.push_back(chain[i]);
+    }
+    Ref<RetainNode> head = chain.front();
+    chain.resize(1);
+    chain.clear();
+
+    const auto report = RetentionAnalyzer::analyze(2);
+    EXPECT_EQ(report.objects, static_cast<size_t>(length));
+    ASSERT_EQ(report.largest.size(), 2u);
+    EXPECT_EQ(report.largest[0].object, head.get());
+    EXPECT_EQ(report.largest[0].retained_bytes, length * nodeSize);
+    EXPECT_EQ(report.largest[1].retained_bytes, (length - 1) * nodeSize);
+    EXPECT_EQ(report.types[0].retained_bytes, length * nodeSize);
+
+    std::vector<Ref<RetainNode>> released;
+    for (RetainNode* node = head.get(); node && !node->edges.empty(); )
+    {
+        released.push_back(std::move(node->edges[0]));
+        node = released.back().get();
+    }
+    head.reset();
+    released.clear();
+}
+
+TEST_F(RetentionAnalyzerTest, ExportsJson)
+{
+    auto a = makeRef<RetainNode>(1);
+    a->blob = makeRef<Blob>();
+
+    const auto report = RetentionAnalyzer::analyze();
+    char buffer[1024];
+    const size_t length = RetentionAnalyzer::exportJson(report, buffer, sizeof(buffer));
+    ASSERT_LT(length, sizeof(buffer));
+    const std::string json(buffer, length);
+    EXPECT_EQ(json.find("{\"objects\":2,\"references\":1,\"roots\":1,"), 0u);
+    EXPECT_NE(json.find("\"retained_bytes\":" + std::to_string(nodeSize + sizeof(Blob))), std::string::npos);
+    EXPECT_NE(json.find("\"dominator\":null"), std::string::npos);
+    EXPECT_NE(json.find("\"dominator\":" + std::to_string(reinterpret_cast<uintptr_t>(a.get()))), std::string::npos);
+    EXPECT_EQ(json.back(), '}');
+
+    char small[16];
+    EXPECT_EQ(RetentionAnalyzer::exportJson(report, small, sizeof(small)), length);
+}
+
+TEST_F(RetentionAnalyzerTest, PrintsInStatisticsFormat)
+{
+    auto a = makeRef<RetainNode>(1);
+    a->blob = makeRef<Blob>();
+
+    std::ostringstream out;
+    RetentionAnalyzer::printRetention(RetentionAnalyzer::analyze(), &out);
+    EXPECT_NE(out.str().find("=== Retained Size Analysis ==="), std::string::npos);
+    EXPECT_NE(out.str().find("Objects: 2"), std::string::npos);
+    EXPECT_NE(out.str().find("Retained by type:"), std::string::npos);
+    EXPECT_NE(out.str().find("Largest retainers:"), std::string::npos);
+}
@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <sstream>
+#include <vector>
+
+using namespace memory;
+
+struct StackCapturePayload
+{
+    int values[4]{};
+};
+
+/**
+ * @brief Allocation sites with external linkage, so their names are visible to backtrace_symbols.
+ */
+__attribute__((noinline)) Ref<StackCapturePayload> stackCaptureSiteA()
+{
+    return makeRef<StackCapturePayload>();
+}
+
+__attribute__((noinline)) Ref<StackCapturePayload> stackCaptureSiteB()
+{
+    return makeRef<StackCapturePayload>();
+}
+
+class StackCaptureTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true, false, &leakStream_);
+        AllocationTracker::clearAllocations();
+        AllocationTracker::setStackCaptureDepth(16);
+    }
+
+    void TearDown() override
+    {
+        AllocationTracker::setStackCaptureDepth(0);
+        AllocationTracker::setStackTableLimit(4096);
+        AllocationTracker::setSamplingInterval(0);
+        AllocationTracker::clearAllocations();
+        enableAllocationTracking(false);
+    }
+
+    std::stringstream leakStream_;
+};
+
+TEST_F(StackCaptureTest, IdenticalStacksAreDeduplicated)
+{
+    std::vector<Ref<StackCapturePayload>> refs;
+    for (int i = 0; i < 50; ++i)
+    {
+        refs.push_back(stackCaptureSiteA());
+    }
+    refs.push_back(stackCaptureSiteB());
+
+    EXPECT_EQ(AllocationTracker::getAllocationCount(), 51u);
+    EXPECT_EQ(AllocationTracker::getStackCount(), 2u);
+
+    auto stats = AllocationTracker::getStatistics();
+    ASSERT_EQ(stats.allocations_by_stack.size(), 2u);
+    size_t total = 0;
+    for (const auto& [id, count] : stats.allocations_by_stack)
+    {
+        EXPECT_NE(id, AllocationTracker::noStack);
+        total += count;
+    }
+    EXPECT_EQ(total, 51u);
+}
+
+TEST_F(StackCaptureTest, StacksStartAtTheCaller)
+{
+    auto ref = stackCaptureSiteA();
+    const auto& allocations = AllocationTracker::getAllocations();
+    ASSERT_EQ(allocations.size(), 1u);
+
+    const uint32_t id = allocations.begin()->second.stackId;
+    const auto symbols = AllocationTracker::getStackSymbols(id);
+    ASSERT_FALSE(symbols.empty());
+    EXPECT_EQ(symbols.front().find("memory::refCounting::"), std::string::npos);
+
+    bool foundSite = false;
+    for (const auto& symbol : symbols)
+    {
+        foundSite = foundSite || symbol.find("stackCaptureSiteA") != std::string::npos;
+    }
+    EXPECT_TRUE(foundSite);
+}
+
+TEST_F(StackCaptureTest, LeakReportIsGroupedByStack)
+{
+    std::vector<Ref<StackCapturePayload>> refs;
+    for (int i = 0; i < 2; ++i)
+    {
+        refs.push_back(stackCaptureSiteA());
+    }
+    refs.push_back(stackCaptureSiteB());
+
+    EXPECT_EQ(AllocationTracker::checkLeaks(), 3u);
+    const std::string report = leakStream_.str();
+    EXPECT_NE(report.find("Leaks by allocating stack:"), std::string::npos);
+    EXPECT_NE(report.find("2 allocations, " + std::to_string(2 * sizeof(StackCapturePayload)) + " bytes"), std::string::npos);
+    EXPECT_NE(report.find("stackCaptureSiteB"), std::string::npos);
+}
+
+TEST_F(StackCaptureTest, DisabledCaptureRecordsNoStacks)
+{
+    AllocationTracker::setStackCaptureDepth(0);
+    auto ref = stackCaptureSiteA();
+
+    EXPECT_EQ(AllocationTracker::getStackCount(), 0u);
+    EXPECT_EQ(AllocationTracker::getAllocations().begin()->second.stackId, AllocationTracker::noStack);
+    EXPECT_TRUE(AllocationTracker::getStatistics().allocations_by_stack.empty());
+}
+
+TEST_F(StackCaptureTest, StackTableLimitBoundsMemory)
+{
+    AllocationTracker::setStackTableLimit(1);
+    auto a = stackCaptureSiteA();
+    auto b = stackCaptureSiteB();
+
+    EXPECT_EQ(AllocationTracker::getAllocationCount(), 2u);
+    EXPECT_EQ(AllocationTracker::getStackCount(), 1u);
+}
+
+TEST_F(StackCaptureTest, OnlySampledAllocationsAreUnwound)
+{
+    AllocationTracker::setSamplingInterval(1 << 20);
+    std::vector<Ref<StackCapturePayload>> refs;
+    for (int i = 0; i < 1000; ++i)
+    {
+        refs.push_back(stackCaptureSiteA());
+    }
+
+    // 16 KB allocated at one sample per MiB: almost always nothing is recorded or unwound.
+    EXPECT_LE(AllocationTracker::getStackCount(), 1u);
+    EXPECT_LE(AllocationTracker::getAllocationCount(), 5u);
+}
+
+TEST_F(StackCaptureTest, PrintStatisticsListsTopStacks)
+{
+    auto ref = stackCaptureSiteB();
+    std::stringstream out;
+    AllocationTracker::printStatistics(&out);
+    EXPECT_NE(out.str().find("Top allocating stacks:"), std::string::npos);
+    EXPECT_NE(out.str().find("stackCaptureSiteB"), std::string::npos) << out.str();
+}
@@ -0,0 +1,292 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace memory;
+
+namespace
+{
+    int destroyed = 0;
+
+    struct Widget
+    {
+        int value{0};
+        Ref<Widget> next;
+
+        explicit Widget(int v = 0) : value(v) {}
+        ~Widget() { ++destroyed; }
+
+        void trace(RefVisitor& visit) const
+        {
+            visit(next);
+        }
+    };
+
+    /**
+     * @brief Checks whether two std::shared_ptrs share one control block.
+     */
+    template<typename T, typename U>
+    bool sameOwner(const std::shared_ptr<T>& a, const std::shared_ptr<U>& b)
+    {
+        return !a.owner_before(b) && !b.owner_before(a);
+    }
+
+    using refCounting::RefDeleter;
+}
+
+class StdInteropTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+        destroyed = 0;
+    }
+
+    void TearDown() override
+    {
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        enableAllocationTracking(false);
+    }
+};
+
+TEST_F(StdInteropTest, SharesTheObjectOfASharedPtr)
+{
+    auto shared = std::make_shared<Widget>(7);
+    auto ref = from_shared_ptr(shared);
+    ASSERT_TRUE(ref);
+    EXPECT_EQ(ref.get(), shared.get());
+    EXPECT_EQ(shared.use_count(), 2);
+    EXPECT_EQ(ref.getControlBlock()->strongCount(), 1u);
+
+    ref->value = 8;
+    EXPECT_EQ(shared->value, 8);
+    EXPECT_FALSE(from_shared_ptr(std::shared_ptr<Widget>()));
+}
+
+TEST_F(StdInteropTest, ObjectOutlivesBothSides)
+{
+    auto shared = std::make_shared<Widget>(1);
+    auto ref = from_shared_ptr(shared);
+    shared.reset();
+    EXPECT_EQ(destroyed, 0);
+    EXPECT_EQ(ref->value, 1);
+    ref.reset();
+    EXPECT_EQ(destroyed, 1);
+
+    shared = std::make_shared<Widget>(2);
+    ref = from_shared_ptr(shared);
+    ref.reset();
+    EXPECT_EQ(destroyed, 1);
+    EXPECT_EQ(shared.use_count(), 1);
+    shared.reset();
+    EXPECT_EQ(destroyed, 2);
+}
+
+TEST_F(StdInteropTest, RoundTripsFromRefsReuseTheControlBlock)
+{
+    auto ref = makeRef<Widget>(3);
+    auto shared = to_shared_ptr(ref);
+    EXPECT_NE(std::get_deleter<RefDeleter>(shared), nullptr);
+
+    auto back = from_shared_ptr(shared);
+    EXPECT_EQ(back.getControlBlock(), ref.getControlBlock());
+    EXPECT_EQ(back.get(), ref.get());
+    EXPECT_EQ(ref.getControlBlock()->strongCount(), 3u);
+
+    for (int i = 0; i < 10; ++i)
+    {
+        back = from_shared_ptr(to_shared_ptr(back));
+    }
+    EXPECT_EQ(back.getControlBlock(), ref.getControlBlock());
+    EXPECT_EQ(ref.getControlBlock()->strongCount(), 3u);
+}
+
+TEST_F(StdInteropTest, RoundTripsFromSharedPtrsReuseTheControlBlock)
+{
+    auto shared = std::make_shared<Widget>(4);
+    auto ref = from_shared_ptr(shared);
+    auto again = to_shared_ptr(ref);
+    EXPECT_TRUE(sameOwner(again, shared));
+    EXPECT_EQ(again.get(), shared.get());
+    EXPECT_EQ(std::get_deleter<RefDeleter>(again), nullptr);
+
+    for (int i = 0; i < 10; ++i)
+    {
+        again = to_shared_ptr(from_shared_ptr(again));
+    }
+    EXPECT_TRUE(sameOwner(again, shared));
+    EXPECT_EQ(shared.use_count(), 3);
+}
+
+TEST_F(StdInteropTest, AliasedSharedPtrsKeepTheirPointer)
+{
+    struct Pair
+    {
+        int first{1};
+        int second{2};
+    };
+    auto ref = makeRef<Pair>();
+    auto whole = to_shared_ptr(ref);
+    std::shared_ptr<int> member(whole, &whole->second);
+
+    auto intRef = from_shared_ptr(member);
+    EXPECT_EQ(intRef.get(), &ref->second);
+    EXPECT_EQ(*intRef, 2);
+    EXPECT_TRUE(sameOwner(to_shared_ptr(intRef), member));
+}
+
+TEST_F(StdInteropTest, WeakPointersFollowTheSharedPtrOwners)
+{
+    auto shared = std::make_shared<Widget>(5);
+    auto ref = from_shared_ptr(shared);
+    WeakRef<Widget> weak = ref.weak();
+
+    auto observer = to_weak_ptr(weak);
+    EXPECT_FALSE(observer.expired());
+    EXPECT_EQ(observer.lock(), shared);
+
+    ref.reset();
+    EXPECT_TRUE(weak.expired());
+    observer = to_weak_ptr(weak);
+    EXPECT_EQ(observer.lock().get(), shared.get());
+
+    shared.reset();
+    EXPECT_TRUE(observer.expired());
+    EXPECT_EQ(destroyed, 1);
+
+    auto native = makeRef<Widget>(6);
+    EXPECT_TRUE(to_weak_ptr(native.weak()).expired());
+}
+
+TEST_F(StdInteropTest, BridgedObjectsAreTracedAndTracked)
+{
+    auto shared = std::make_shared<Widget>(1);
+    auto ref = from_shared_ptr(shared);
+    ref->next = makeRef<Widget>(2);
+    EXPECT_EQ(AllocationTracker::getAllocationCount(), 2u);
+
+    std::vector<RefVisitor::Edge> edges;
+    RefVisitor visitor(edges);
+    ref.getControlBlock()->traceObject(visitor);
+    ASSERT_EQ(edges.size(), 1u);
+    EXPECT_EQ(edges[0].block, ref->next.getControlBlock());
+
+    ref.reset();
+    EXPECT_EQ(AllocationTracker::getAllocationCount(), 1u);
+    EXPECT_EQ(shared->next->value, 2);
+}
+
+TEST_F(StdInteropTest, ConstObjects)
+{
+    auto shared = std::make_shared<const Widget>(9);
+    Ref<const Widget> ref = from_shared_ptr(shared);
+    EXPECT_EQ(ref->value, 9);
+    EXPECT_TRUE(sameOwner(to_shared_ptr(ref), shared));
+}
+
+TEST_F(StdInteropTest, RepeatedConversionsShareOneSharedPtr)
+{
+    auto ref = makeRef<Widget>(10);
+    auto first = to_shared_ptr(ref);
+    auto second = to_shared_ptr(ref);
+    EXPECT_TRUE(sameOwner(first, second));
+    EXPECT_EQ(first.use_count(), 2);
+    EXPECT_EQ(ref.getControlBlock()->strongCount(), 2u);
+
+    first.reset();
+    second.reset();
+    EXPECT_EQ(ref.getControlBlock()->strongCount(), 1u);
+
+    auto third = to_shared_ptr(ref);
+    EXPECT_EQ(third.use_count(), 1);
+    EXPECT_EQ(ref.getControlBlock()->strongCount(), 2u);
+
+    ref.reset();
+    EXPECT_EQ(destroyed, 0);
+    EXPECT_EQ(third->value, 10);
+    third.reset();
+    EXPECT_EQ(destroyed, 1);
+}
+
+TEST_F(StdInteropTest, SharedPtrsOutliveTheRefBlockState)
+{
+    auto ref = makeRef<Widget>(11);
+    std::weak_ptr<Widget> observer = to_shared_ptr(ref);
+    EXPECT_TRUE(observer.expired());
+
+    ref.reset();
+    EXPECT_EQ(destroyed, 1);
+    EXPECT_TRUE(observer.expired());
+    observer.reset();
+}
+
+TEST_F(StdInteropTest, ConcurrentConversions)
+{
+    auto ref = makeRef<Widget>(12);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&ref]() {
+            for (int i = 0; i < 10000; ++i)
+            {
+                auto shared = to_shared_ptr(ref);
+                ASSERT_EQ(shared->value, 12);
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(ref.getControlBlock()->strongCount(), 1u);
+    ref.reset();
+    EXPECT_EQ(destroyed, 1);
+}
+
+TEST_F(StdInteropTest, DualRefsShareOneObject)
+{
+    {
+        auto dual = makeDualRef<Widget>(13);
+        EXPECT_EQ(AllocationTracker::getAllocationCount(), 1u);
+        EXPECT_EQ(dual.useCount(), 1u);
+
+        auto shared = dual.getSharedPtr();
+        auto ref = dual.getRef();
+        EXPECT_EQ(shared.get(), dual.get());
+        EXPECT_EQ(ref.get(), dual.get());
+        EXPECT_EQ(dual.useCount(), 3u);
+
+        auto another = dual.getSharedPtr();
+        EXPECT_TRUE(sameOwner(another, shared));
+        EXPECT_EQ(dual.useCount(), 4u);
+
+        shared->value = 14;
+        EXPECT_EQ(ref->value, 14);
+        shared.reset();
+        another.reset();
+        EXPECT_EQ(dual.useCount(), 2u);
+    }
+    EXPECT_EQ(destroyed, 1);
+}
+
+TEST_F(StdInteropTest, DualRefsReleaseTheObjectThroughEitherHandle)
+{
+    std::shared_ptr<Widget> shared;
+    {
+        auto* widget = new Widget(15);
+        DualRefObject<Widget> dual(widget);
+        EXPECT_EQ(dual.get(), widget);
+        shared = dual.getSharedPtr();
+    }
+    EXPECT_EQ(destroyed, 0);
+    EXPECT_EQ(shared->value, 15);
+    shared.reset();
+    EXPECT_EQ(destroyed, 1);
+}
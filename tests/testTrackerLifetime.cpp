@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+#include "memory/memory.h"
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#if defined(MEXMEMORY_TEST_PLUGIN)
+#include <dlfcn.h>
+#endif
+
+using namespace memory;
+
+namespace
+{
+    struct SharedWidget
+    {
+        char payload[48]{};
+    };
+
+    size_t countTypes(const AllocationTracker::LiveMetrics& metrics, const std::string& name)
+    {
+        return static_cast<size_t>(std::count_if(metrics.types.begin(), metrics.types.end(), [&name](const auto& type) {
+            return type.type == name;
+        }));
+    }
+}
+
+class TrackerLifetimeTest : public ::testing::Test
+{
+protected:
+
+    void SetUp() override
+    {
+        enableReferenceDebugging(false);
+        enableAllocationTracking(true);
+        AllocationTracker::clearAllocations();
+        AllocationTracker::resetLiveMetrics();
+    }
+
+    void TearDown() override
+    {
+        EXPECT_EQ(AllocationTracker::checkLeaks(), 0);
+        enableAllocationTracking(false);
+    }
+};
+
+TEST_F(TrackerLifetimeTest, RefsReleasedDuringStaticDestructionAreSafe)
+{
+    GTEST_FLAG_SET(death_test_style, "threadsafe");
+    EXPECT_EXIT({
+        // Released by static destruction at exit, while the tracker and the leak detector are being torn down.
+        static std::vector<Ref<SharedWidget>> survivors;
+        for (int i = 0; i < 16; ++i)
+        {
+            survivors.push_back(makeRef<SharedWidget>());
+        }
+        std::exit(0);
+    }, ::testing::ExitedWithCode(0), "");
+}
+
+TEST_F(TrackerLifetimeTest, LeakReportRunsOncePerProcess)
+{
+    GTEST_FLAG_SET(death_test_style, "threadsafe");
+    EXPECT_EXIT({
+        static Ref<SharedWidget> leaked = makeRef<SharedWidget>();
+        AllocationTracker::setLeakStream(&std::cerr);
+        std::exit(AllocationTracker::checkLeaksAtExit() == 1 && AllocationTracker::checkLeaksAtExit() == 0 ? 0 : 1);
+    }, ::testing::ExitedWithCode(0), "MEMORY LEAKS DETECTION REPORT");
+}
+
+#if defined(MEXMEMORY_TEST_PLUGIN)
+TEST_F(TrackerLifetimeTest, PluginsShareTheHostTracker)
+{
+    void* plugin = dlopen(MEXMEMORY_TEST_PLUGIN, RTLD_NOW | RTLD_LOCAL);
+    ASSERT_NE(plugin, nullptr) << dlerror();
+    auto allocate = reinterpret_cast<void (*)(size_t)>(dlsym(plugin, "pluginAllocate"));
+    auto release = reinterpret_cast<void (*)()>(dlsym(plugin, "pluginRelease"));
+    auto liveBytes = reinterpret_cast<size_t (*)()>(dlsym(plugin, "pluginLiveBytes"));
+    ASSERT_TRUE(allocate && release && liveBytes);
+
+    auto local = makeRef<SharedWidget>();
+    allocate(10);
+
+    EXPECT_EQ(AllocationTracker::getLiveBytes(), 11 * sizeof(SharedWidget));
+    EXPECT_EQ(liveBytes(), AllocationTracker::getLiveBytes());
+    EXPECT_EQ(AllocationTracker::getStatistics().total_allocations, 11u);
+
+    const auto metrics = AllocationTracker::getLiveMetrics();
+    const auto widget = std::find_if(metrics.types.begin(), metrics.types.end(), [](const auto& type) {
+        return type.type.find("SharedWidget") != std::string::npos;
+    });
+    ASSERT_NE(widget, metrics.types.end());
+    EXPECT_EQ(countTypes(metrics, widget->type), 1u);
+    EXPECT_EQ(widget->live_count, 11u);
+
+    release();
+    EXPECT_EQ(liveBytes(), sizeof(SharedWidget));
+    EXPECT_EQ(dlclose(plugin), 0);
+    EXPECT_EQ(AllocationTracker::getLiveBytes(), sizeof(SharedWidget));
+}
+#endif
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include "memory/memory.h"
+#include <vector>
 
 using namespace memory;
 
@@ -99,4 +100,22 @@ TEST_F(WeakRefTest, MoveAssignment)
 
     EXPECT_FALSE(weak1.canLock());
     EXPECT_TRUE(weak2.canLock());
-}
\ No newline at end of file
+}
+struct TreeNode
+{
+    WeakRef<TreeNode> parent;
+    std::vector<Ref<TreeNode>> children;
+};
+
+TEST_F(WeakRefTest, ChildDropsLastWeakRefToParentDuringDestruction)
+{
+    auto parent = makeRef<TreeNode>();
+    auto child = makeRef<TreeNode>();
+    child->parent = parent.weak();
+    parent->children.push_back(child);
+    child.reset();
+
+    // Destroying the parent destroys the child, which releases the last weak reference to the parent's block.
+    parent.reset();
+    EXPECT_FALSE(parent);
+}
@@ -0,0 +1,96 @@
+#include "memory/refCounting/heapGraph.h"
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace memory::refCounting;
+
+namespace
+{
+    /**
+     * @brief Prints the totals of a dump and the types with the most objects.
+     * @param graph The loaded dump.
+     */
+    void printSummary(const HeapGraph& graph)
+    {
+        size_t weak = 0;
+        size_t dangling = 0;
+        std::unordered_set<uint64_t> blocks;
+        for (const auto& node : graph.nodes)
+        {
+            blocks.insert(node.block);
+        }
+        for (const auto& edge : graph.edges)
+        {
+            weak += edge.weak ? 1 : 0;
+            dangling += blocks.count(edge.to) ? 0 : 1;
+        }
+        std::cout << graph.nodes.size() << " objects, " << graph.edges.size() - weak << " strong and " << weak << " weak references"
+                  << (graph.complete ? "" : " (dump incomplete)") << "\n";
+        std::cout << dangling << " references to objects not in the dump\n";
+
+        std::vector<size_t> counts(graph.typeNames.size(), 0);
+        std::vector<uint64_t> bytes(graph.typeNames.size(), 0);
+        for (const auto& node : graph.nodes)
+        {
+            if (node.type < counts.size())
+            {
+                ++counts[node.type];
+                bytes[node.type] += node.size;
+            }
+        }
+        std::vector<size_t> order(counts.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&counts](size_t a, size_t b) { return counts[a] > counts[b]; });
+        for (size_t i = 0; i < order.size() && i < 20; ++i)
+        {
+            std::cout << "  " << counts[order[i]] << " x " << graph.typeNames[order[i]] << " (" << bytes[order[i]] << " bytes)\n";
+        }
+    }
+}
+
+/**
+ * @brief Offline use of a HeapGraph binary dump: summarises it, or converts it to DOT or GraphML on stdout.
+ * Usage: mexMemory_heapgraph <dump file> [dot | graphml]
+ */
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <dump file> [dot | graphml]\n";
+        return 2;
+    }
+
+    HeapGraph graph;
+    try
+    {
+        graph = HeapGraph::load(argv[1]);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    if (argc < 3)
+    {
+        printSummary(graph);
+        return 0;
+    }
+
+    const std::string format = argv[2];
+    if (format != "dot" && format != "graphml")
+    {
+        std::cerr << "Unknown format " << format << ", expected dot or graphml\n";
+        return 2;
+    }
+    const auto stats = graph.write(1, format == "dot" ? GraphFormat::Dot : GraphFormat::GraphML);
+    return stats.complete ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#include "memory/refCounting/refTrace.h"
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace memory::refCounting;
+
+namespace
+{
+    /**
+     * @brief Gets a printable name for an event.
+     * @param event The event.
+     * @return The name of the event.
+     */
+    const char* eventName(TraceEvent event)
+    {
+        switch (event)
+        {
+            case TraceEvent::Create: return "create";
+            case TraceEvent::IncrementStrong: return "+strong";
+            case TraceEvent::DecrementStrong: return "-strong";
+            case TraceEvent::IncrementWeak: return "+weak";
+            case TraceEvent::DecrementWeak: return "-weak";
+            case TraceEvent::SetStrong: return "set strong";
+            case TraceEvent::DestroyObject: return "destroy object";
+            case TraceEvent::DestroyBlock: return "free block";
+        }
+        return "unknown";
+    }
+
+    /**
+     * @brief Prints the threads with a surplus of strong references on an object.
+     * @param timeline The timeline of the object.
+     */
+    void printHolders(const ObjectTimeline& timeline)
+    {
+        for (const auto& [thread, held] : timeline.strongByThread)
+        {
+            if (held > 0)
+            {
+                std::cout << "    thread " << thread << " holds " << held << "\n";
+            }
+        }
+    }
+
+    /**
+     * @brief Prints the full event history of one object.
+     * @param trace The trace the timeline comes from.
+     * @param timeline The timeline to print.
+     */
+    void printTimeline(const TraceFile& trace, const ObjectTimeline& timeline)
+    {
+        std::cout << "block 0x" << std::hex << timeline.block << std::dec << "\n";
+        for (const TraceRecord& record : timeline.events)
+        {
+            std::cout << "  " << std::fixed << std::setprecision(3) << std::setw(14) << trace.toNanoseconds(record.timestamp) / 1000.0
+                      << " us  thread " << std::setw(3) << record.thread
+                      << "  " << std::setw(14) << eventName(record.event)
+                      << "  count " << record.count << "\n";
+        }
+        if (timeline.objectDestroyed)
+        {
+            std::cout << "  last strong reference released by thread " << timeline.lastReleaser << "\n";
+        }
+        else
+        {
+            printHolders(timeline);
+        }
+    }
+}
+
+/**
+ * @brief Offline analysis of a RefTrace file: summarises the trace, lists objects still referenced when the
+ * trace ended with the threads that hold them, and prints the history of a single block on request.
+ * Usage: mexMemory_reftrace <trace file> [block address]
+ */
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <trace file> [block address]\n";
+        return 2;
+    }
+
+    TraceFile trace;
+    try
+    {
+        trace = TraceFile::load(argv[1]);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    const auto timelines = trace.timelines();
+
+    if (argc > 2)
+    {
+        const uint64_t block = std::strtoull(argv[2], nullptr, 16);
+        for (const auto& timeline : timelines)
+        {
+            if (timeline.block == block)
+            {
+                printTimeline(trace, timeline);
+            }
+        }
+        return 0;
+    }
+
+    size_t destroyed = 0;
+    std::vector<const ObjectTimeline*> alive;
+    for (const auto& timeline : timelines)
+    {
+        if (timeline.objectDestroyed)
+        {
+            ++destroyed;
+        }
+        else if (timeline.strongAtEnd > 0)
+        {
+            alive.push_back(&timeline);
+        }
+    }
+
+    std::cout << trace.records.size() << " events, " << trace.header.dropped << " dropped, "
+              << std::fixed << std::setprecision(3) << static_cast<double>(trace.header.endNs - trace.header.startNs) / 1e6 << " ms\n";
+    std::cout << timelines.size() << " objects, " << destroyed << " destroyed, " << alive.size() << " still referenced\n";
+
+    for (const ObjectTimeline* timeline : alive)
+    {
+        std::cout << "\nblock 0x" << std::hex << timeline->block << std::dec
+                  << ": " << timeline->strongAtEnd << " strong references at end, peak " << timeline->peakStrong << "\n";
+        printHolders(*timeline);
+    }
+    return 0;
+}